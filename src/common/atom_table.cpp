@@ -0,0 +1,127 @@
+#include "atom_table.hpp"
+#include <stdexcept>
+
+namespace prologcoin { namespace common {
+
+atom_table & atom_table::global()
+{
+    // Never destroyed as static heaps may still release their atoms
+    // at exit.
+    static atom_table *table = new atom_table();
+    return *table;
+}
+
+atom_table::atom_table() : next_(0)
+{
+    for (size_t i = 0; i < MAX_SEGMENTS; i++) {
+	segments_[i].store(nullptr, std::memory_order_relaxed);
+    }
+}
+
+atom_table::~atom_table()
+{
+    for (size_t i = 0; i < MAX_SEGMENTS; i++) {
+	auto *seg = segments_[i].load(std::memory_order_relaxed);
+	if (seg == nullptr) {
+	    break;
+	}
+	for (size_t j = 0; j < SEGMENT_SIZE; j++) {
+	    delete seg->entries[j].name.load(std::memory_order_relaxed);
+	}
+	delete seg;
+    }
+}
+
+atom_table::entry & atom_table::get_entry(size_t index) const
+{
+    auto *seg = segments_[index / SEGMENT_SIZE].load(std::memory_order_acquire);
+    return seg->entries[index % SEGMENT_SIZE];
+}
+
+size_t atom_table::new_index()
+{
+    if (!free_.empty()) {
+	size_t index = free_.back();
+	free_.pop_back();
+	return index;
+    }
+    size_t index = next_;
+    size_t seg_index = index / SEGMENT_SIZE;
+    if (seg_index >= MAX_SEGMENTS) {
+	throw std::runtime_error("Atom table is full");
+    }
+    if (index % SEGMENT_SIZE == 0) {
+	segments_[seg_index].store(new segment(), std::memory_order_release);
+    }
+    next_++;
+    return index;
+}
+
+size_t atom_table::intern(const std::string &name)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    auto found = name_to_index_.find(name);
+    if (found != name_to_index_.end()) {
+	get_entry(found->second).refs.fetch_add(1, std::memory_order_relaxed);
+	return found->second;
+    }
+
+    size_t index = new_index();
+    auto &e = get_entry(index);
+    e.refs.store(1, std::memory_order_relaxed);
+    e.name.store(new std::string(name), std::memory_order_release);
+    name_to_index_[name] = index;
+    stats_.interned++;
+    stats_.live++;
+    return index;
+}
+
+bool atom_table::find(const std::string &name, size_t &index) const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    auto found = name_to_index_.find(name);
+    if (found == name_to_index_.end()) {
+	return false;
+    }
+    index = found->second;
+    return true;
+}
+
+void atom_table::add_ref(size_t index)
+{
+    // The caller already holds a reference, so the atom can't
+    // disappear meanwhile.
+    get_entry(index).refs.fetch_add(1, std::memory_order_relaxed);
+}
+
+void atom_table::release(size_t index)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    auto &e = get_entry(index);
+    if (e.refs.fetch_sub(1, std::memory_order_acq_rel) != 1) {
+	return;
+    }
+    const std::string *name = e.name.load(std::memory_order_relaxed);
+    name_to_index_.erase(*name);
+    e.name.store(nullptr, std::memory_order_release);
+    delete name;
+    free_.push_back(index);
+    stats_.live--;
+    stats_.removed++;
+}
+
+size_t atom_table::ref_count(size_t index) const
+{
+    return get_entry(index).refs.load(std::memory_order_relaxed);
+}
+
+atom_table::stats atom_table::get_stats() const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return stats_;
+}
+
+}}
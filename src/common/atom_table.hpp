@@ -0,0 +1,95 @@
+#pragma once
+
+#ifndef _common_atom_table_hpp
+#define _common_atom_table_hpp
+
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <unordered_map>
+
+namespace prologcoin { namespace common {
+
+//
+// atom_table
+//
+// Atoms with names longer than 7 characters don't fit in a con_cell.
+// Such a cell holds an index into this table instead. There's one
+// table for the whole process, so the same atom has the same index
+// in every heap.
+//
+// Looking up the name of an index never locks. Entries are stored in
+// fixed size segments that are never moved or freed (only the names
+// are), so a reader only needs two (acquire) loads.
+//
+// Every heap holds a reference to each atom it has resolved and
+// releases them when it goes away, or when its garbage collector finds
+// no cells referring to them (see heap::collect_atoms.) An atom whose
+// reference count drops to zero is removed and its index is reused.
+// Thus atoms that clients keep sending don't accumulate.
+//
+class atom_table {
+public:
+    static const size_t SEGMENT_SIZE = 16384;
+    static const size_t MAX_SEGMENTS = 16384;
+
+    static atom_table & global();
+
+    atom_table();
+    ~atom_table();
+
+    // Return the index for 'name' and add a reference to it.
+    size_t intern(const std::string &name);
+
+    // Lookup 'name' without adding a reference. Only meaningful if
+    // the caller already holds a reference to the atom.
+    bool find(const std::string &name, size_t &index) const;
+
+    // Add another reference to an already referenced index.
+    void add_ref(size_t index);
+
+    // Drop a reference. The atom is removed if this was the last one.
+    void release(size_t index);
+
+    inline const std::string & name(size_t index) const {
+	auto *seg = segments_[index / SEGMENT_SIZE].load(std::memory_order_acquire);
+	return *seg->entries[index % SEGMENT_SIZE].name.load(std::memory_order_acquire);
+    }
+
+    size_t ref_count(size_t index) const;
+
+    struct stats {
+	inline stats() : live(0), interned(0), removed(0) { }
+	size_t live;      // Number of atoms in the table
+	size_t interned;  // Number of atoms ever added
+	size_t removed;   // Number of atoms removed
+    };
+
+    stats get_stats() const;
+
+private:
+    struct entry {
+	inline entry() : name(nullptr), refs(0) { }
+	std::atomic<const std::string *> name;
+	std::atomic<size_t> refs;
+    };
+
+    struct segment {
+	entry entries[SEGMENT_SIZE];
+    };
+
+    entry & get_entry(size_t index) const;
+    size_t new_index();
+
+    mutable std::mutex mutex_;
+    std::atomic<segment *> segments_[MAX_SEGMENTS];
+    std::unordered_map<std::string, size_t> name_to_index_;
+    std::vector<size_t> free_;
+    size_t next_;
+    stats stats_;
+};
+
+}}
+
+#endif
@@ -0,0 +1,466 @@
+#include "bignum.hpp"
+
+namespace prologcoin { namespace common {
+
+typedef unsigned __int128 dlimb;
+
+// The number of bits is kept in the lower half of the header cell
+// (minus the tag.)
+static const size_t MAX_BITS = (static_cast<size_t>(1) << (untagged_cell::CELL_NUM_BITS/2 - cell::TAG_SIZE_BITS)) - 1;
+
+static inline bool fits_int(__int128 v)
+{
+    return v >= int_cell::min().value() && v <= int_cell::max().value();
+}
+
+// Number of limbs after the header of a BIG with 'nbytes' bytes and
+// the number of padding bits after its least significant byte.
+static inline void big_layout(size_t nbytes, size_t &k, size_t &pad)
+{
+    k = (nbytes <= 4) ? 0 : (nbytes - 4 + sizeof(cell) - 1) / sizeof(cell);
+    pad = 32 + 64*k - 8*nbytes;
+}
+
+bignum::bignum(heap &h) : heap_(h)
+{
+}
+
+void bignum::get_limbs(big_cell big, std::vector<limb> &limbs) const
+{
+    size_t index = big.index();
+    untagged_cell::value_t hdr = heap_.untagged_at(index).raw_value();
+    size_t nbits = heap_.num_bits(big);
+    size_t nbytes = (nbits + 7) / 8;
+
+    limbs.clear();
+    if (nbytes == 0) {
+	return;
+    }
+
+    size_t k, pad;
+    big_layout(nbytes, k, pad);
+
+    // u[j] is the j:th least significant word of the cells, i.e.
+    // u[0] is the last cell and u[k] the upper half of the header.
+    auto u = [&](size_t j) -> limb {
+	return (j < k) ? heap_.untagged_at(index + k - j).raw_value()
+	               : (j == k ? hdr >> 32 : 0);
+    };
+
+    size_t n = (8*nbytes + 63) / 64;
+    limbs.resize(n);
+    for (size_t j = 0; j < n; j++) {
+	limb lo = u(j);
+	limb hi = u(j+1);
+	limbs[j] = pad == 0 ? lo : (lo >> pad) | (hi << (64 - pad));
+    }
+}
+
+big_cell bignum::new_big(const limb *limbs, size_t n)
+{
+    while (n > 0 && limbs[n-1] == 0) {
+	n--;
+    }
+    size_t nbits = (n == 0) ? 0 : 64*(n-1) + 64 - __builtin_clzll(limbs[n-1]);
+    size_t nbytes = (nbits == 0) ? 1 : (nbits + 7) / 8;
+    if (8*nbytes > MAX_BITS) {
+	throw bignum_exception("Result is too large");
+    }
+
+    big_cell big = heap_.new_big(8*nbytes);
+    size_t index = big.index();
+
+    size_t k, pad;
+    big_layout(nbytes, k, pad);
+
+    auto l = [&](size_t j) -> limb { return j < n ? limbs[j] : 0; };
+    for (size_t j = 0; j <= k; j++) {
+	limb u = l(j) << pad;
+	if (pad != 0 && j > 0) {
+	    u |= l(j-1) >> (64 - pad);
+	}
+	if (j < k) {
+	    heap_.untagged_at(index + k - j) = untagged_cell(u);
+	} else {
+	    auto &hdr = heap_.untagged_at(index);
+	    hdr = untagged_cell((hdr.raw_value() & 0xffffffff) | (u << 32));
+	}
+    }
+    return big;
+}
+
+void bignum::load(term t, number &n) const
+{
+    cell c = heap_.deref(t);
+    if (c.tag() == tag_t::INT) {
+	int64_t v = static_cast<const int_cell &>(c).value();
+	n.neg = v < 0;
+	n.mag.clear();
+	if (v != 0) {
+	    n.mag.push_back(n.neg ? static_cast<limb>(-v) : static_cast<limb>(v));
+	}
+	return;
+    }
+    if (c.tag() != tag_t::BIG) {
+	throw bignum_exception("Expected an integer; was " + c.tag().str());
+    }
+    n.neg = false;
+    get_limbs(static_cast<const big_cell &>(c), n.mag);
+    trim(n.mag);
+}
+
+term bignum::store(number &n)
+{
+    trim(n.mag);
+    if (n.mag.empty()) {
+	return int_cell(0);
+    }
+    if (n.mag.size() == 1) {
+	__int128 v = n.neg ? -static_cast<__int128>(n.mag[0])
+	                   : static_cast<__int128>(n.mag[0]);
+	if (fits_int(v)) {
+	    return int_cell(static_cast<int64_t>(v));
+	}
+    }
+    if (n.neg) {
+	throw bignum_exception("Negative result is out of range");
+    }
+    return new_big(&n.mag[0], n.mag.size());
+}
+
+void bignum::trim(std::vector<limb> &v)
+{
+    while (!v.empty() && v.back() == 0) {
+	v.pop_back();
+    }
+}
+
+int bignum::compare_mag(const std::vector<limb> &a,
+			const std::vector<limb> &b)
+{
+    if (a.size() != b.size()) {
+	return a.size() < b.size() ? -1 : 1;
+    }
+    for (size_t i = a.size(); i-- > 0;) {
+	if (a[i] != b[i]) {
+	    return a[i] < b[i] ? -1 : 1;
+	}
+    }
+    return 0;
+}
+
+void bignum::add_mag(const std::vector<limb> &a,
+		     const std::vector<limb> &b, std::vector<limb> &r)
+{
+    const std::vector<limb> &x = a.size() >= b.size() ? a : b;
+    const std::vector<limb> &y = a.size() >= b.size() ? b : a;
+    size_t n = x.size();
+    r.resize(n + 1);
+    limb carry = 0;
+    for (size_t i = 0; i < n; i++) {
+	dlimb s = static_cast<dlimb>(x[i]) + (i < y.size() ? y[i] : 0) + carry;
+	r[i] = static_cast<limb>(s);
+	carry = static_cast<limb>(s >> 64);
+    }
+    r[n] = carry;
+    trim(r);
+}
+
+void bignum::sub_mag(const std::vector<limb> &a,
+		     const std::vector<limb> &b, std::vector<limb> &r)
+{
+    size_t n = a.size();
+    r.resize(n);
+    limb borrow = 0;
+    for (size_t i = 0; i < n; i++) {
+	limb x = a[i];
+	limb y = i < b.size() ? b[i] : 0;
+	limb d = x - y;
+	limb b1 = x < y;
+	r[i] = d - borrow;
+	borrow = b1 | (d < borrow);
+    }
+    trim(r);
+}
+
+void bignum::mul_mag(const std::vector<limb> &a,
+		     const std::vector<limb> &b, std::vector<limb> &r)
+{
+    r.assign(a.size() + b.size(), 0);
+    for (size_t i = 0; i < a.size(); i++) {
+	limb carry = 0;
+	for (size_t j = 0; j < b.size(); j++) {
+	    dlimb p = static_cast<dlimb>(a[i]) * b[j] + r[i+j] + carry;
+	    r[i+j] = static_cast<limb>(p);
+	    carry = static_cast<limb>(p >> 64);
+	}
+	r[i+b.size()] = carry;
+    }
+    trim(r);
+}
+
+//
+// Knuth's algorithm D (TAOCP vol 2, 4.3.1) with 64-bit limbs.
+//
+void bignum::divmod_mag(const std::vector<limb> &a,
+			const std::vector<limb> &b,
+			std::vector<limb> &q, std::vector<limb> &r)
+{
+    if (compare_mag(a, b) < 0) {
+	q.clear();
+	r = a;
+	return;
+    }
+
+    size_t n = b.size();
+    size_t m = a.size() - n;
+
+    if (n == 1) {
+	q.resize(a.size());
+	limb rem = 0;
+	for (size_t i = a.size(); i-- > 0;) {
+	    dlimb num = (static_cast<dlimb>(rem) << 64) | a[i];
+	    q[i] = static_cast<limb>(num / b[0]);
+	    rem = static_cast<limb>(num % b[0]);
+	}
+	trim(q);
+	r.clear();
+	r.push_back(rem);
+	trim(r);
+	return;
+    }
+
+    // Normalize so that the top bit of the divisor is set
+    unsigned s = __builtin_clzll(b[n-1]);
+    vn_.resize(n);
+    for (size_t i = n - 1; i > 0; i--) {
+	vn_[i] = (b[i] << s) | (s ? b[i-1] >> (64 - s) : 0);
+    }
+    vn_[0] = b[0] << s;
+    un_.resize(a.size() + 1);
+    un_[a.size()] = s ? a[a.size()-1] >> (64 - s) : 0;
+    for (size_t i = a.size() - 1; i > 0; i--) {
+	un_[i] = (a[i] << s) | (s ? a[i-1] >> (64 - s) : 0);
+    }
+    un_[0] = a[0] << s;
+
+    q.assign(m + 1, 0);
+    const dlimb base = static_cast<dlimb>(1) << 64;
+
+    for (size_t j = m + 1; j-- > 0;) {
+	dlimb num = (static_cast<dlimb>(un_[j+n]) << 64) | un_[j+n-1];
+	dlimb qhat = num / vn_[n-1];
+	dlimb rhat = num % vn_[n-1];
+	while (qhat >= base ||
+	       qhat * vn_[n-2] > ((rhat << 64) | un_[j+n-2])) {
+	    qhat--;
+	    rhat += vn_[n-1];
+	    if (rhat >= base) {
+		break;
+	    }
+	}
+
+	// Multiply and subtract
+	limb borrow = 0, carry = 0;
+	for (size_t i = 0; i < n; i++) {
+	    dlimb p = qhat * vn_[i] + carry;
+	    carry = static_cast<limb>(p >> 64);
+	    limb x = un_[i+j];
+	    limb y = static_cast<limb>(p);
+	    limb d = x - y;
+	    limb b1 = x < y;
+	    un_[i+j] = d - borrow;
+	    borrow = b1 | (d < borrow);
+	}
+	limb x = un_[j+n];
+	limb d = x - carry;
+	limb b1 = x < carry;
+	un_[j+n] = d - borrow;
+	bool negative = b1 | (d < borrow);
+
+	// Add back (rare)
+	if (negative) {
+	    qhat--;
+	    limb c = 0;
+	    for (size_t i = 0; i < n; i++) {
+		dlimb t = static_cast<dlimb>(un_[i+j]) + vn_[i] + c;
+		un_[i+j] = static_cast<limb>(t);
+		c = static_cast<limb>(t >> 64);
+	    }
+	    un_[j+n] += c;
+	}
+	q[j] = static_cast<limb>(qhat);
+    }
+    trim(q);
+
+    // Unnormalize the remainder
+    r.resize(n);
+    for (size_t i = 0; i < n; i++) {
+	r[i] = (un_[i] >> s) | (s ? un_[i+1] << (64 - s) : 0);
+    }
+    trim(r);
+}
+
+void bignum::add_signed(bool negate_b)
+{
+    bool bneg = negate_b ? !b_.neg : b_.neg;
+    if (a_.neg == bneg) {
+	add_mag(a_.mag, b_.mag, r_.mag);
+	r_.neg = a_.neg;
+    } else if (compare_mag(a_.mag, b_.mag) >= 0) {
+	sub_mag(a_.mag, b_.mag, r_.mag);
+	r_.neg = a_.neg;
+    } else {
+	sub_mag(b_.mag, a_.mag, r_.mag);
+	r_.neg = bneg;
+    }
+}
+
+term bignum::add(term a, term b)
+{
+    cell ca = heap_.deref(a), cb = heap_.deref(b);
+    if (ca.tag() == tag_t::INT && cb.tag() == tag_t::INT) {
+	int64_t s = static_cast<const int_cell &>(ca).value() +
+	            static_cast<const int_cell &>(cb).value();
+	if (fits_int(s)) {
+	    return int_cell(s);
+	}
+    }
+    load(ca, a_);
+    load(cb, b_);
+    add_signed(false);
+    return store(r_);
+}
+
+term bignum::sub(term a, term b)
+{
+    cell ca = heap_.deref(a), cb = heap_.deref(b);
+    if (ca.tag() == tag_t::INT && cb.tag() == tag_t::INT) {
+	int64_t d = static_cast<const int_cell &>(ca).value() -
+	            static_cast<const int_cell &>(cb).value();
+	if (fits_int(d)) {
+	    return int_cell(d);
+	}
+    }
+    load(ca, a_);
+    load(cb, b_);
+    add_signed(true);
+    return store(r_);
+}
+
+term bignum::mul(term a, term b)
+{
+    cell ca = heap_.deref(a), cb = heap_.deref(b);
+    if (ca.tag() == tag_t::INT && cb.tag() == tag_t::INT) {
+	__int128 p = static_cast<__int128>(static_cast<const int_cell &>(ca).value()) *
+	             static_cast<const int_cell &>(cb).value();
+	if (fits_int(p)) {
+	    return int_cell(static_cast<int64_t>(p));
+	}
+    }
+    load(ca, a_);
+    load(cb, b_);
+    mul_mag(a_.mag, b_.mag, r_.mag);
+    r_.neg = a_.neg != b_.neg;
+    return store(r_);
+}
+
+void bignum::divmod(term a, term b, term &q, term &r)
+{
+    cell ca = heap_.deref(a), cb = heap_.deref(b);
+    if (ca.tag() == tag_t::INT && cb.tag() == tag_t::INT) {
+	int64_t x = static_cast<const int_cell &>(ca).value();
+	int64_t y = static_cast<const int_cell &>(cb).value();
+	if (y == 0) {
+	    throw bignum_exception("Division by zero");
+	}
+	if (fits_int(x / y)) {
+	    q = int_cell(x / y);
+	    r = int_cell(x % y);
+	    return;
+	}
+    }
+    load(ca, a_);
+    load(cb, b_);
+    if (b_.mag.empty()) {
+	throw bignum_exception("Division by zero");
+    }
+    divmod_mag(a_.mag, b_.mag, q_.mag, r_.mag);
+    q_.neg = a_.neg != b_.neg;
+    r_.neg = a_.neg;
+    q = store(q_);
+    r = store(r_);
+}
+
+int bignum::compare(term a, term b)
+{
+    cell ca = heap_.deref(a), cb = heap_.deref(b);
+    if (ca.tag() == tag_t::INT && cb.tag() == tag_t::INT) {
+	int64_t x = static_cast<const int_cell &>(ca).value();
+	int64_t y = static_cast<const int_cell &>(cb).value();
+	return x < y ? -1 : (x > y ? 1 : 0);
+    }
+    load(ca, a_);
+    load(cb, b_);
+    if (a_.neg != b_.neg) {
+	return a_.neg ? -1 : 1;
+    }
+    int c = compare_mag(a_.mag, b_.mag);
+    return a_.neg ? -c : c;
+}
+
+term bignum::shift_left(term a, size_t n)
+{
+    cell ca = heap_.deref(a);
+    if (ca.tag() == tag_t::INT && n < 64) {
+	__int128 v = static_cast<__int128>(static_cast<const int_cell &>(ca).value()) << n;
+	if (fits_int(v)) {
+	    return int_cell(static_cast<int64_t>(v));
+	}
+    }
+    if (n > MAX_BITS) {
+	throw bignum_exception("Result is too large");
+    }
+    load(ca, a_);
+    if (a_.mag.empty()) {
+	return int_cell(0);
+    }
+    size_t limbs = n / 64, bits = n % 64;
+    auto &v = a_.mag;
+    r_.mag.assign(v.size() + limbs + 1, 0);
+    for (size_t i = 0; i < v.size(); i++) {
+	r_.mag[i + limbs] |= v[i] << bits;
+	if (bits != 0) {
+	    r_.mag[i + limbs + 1] = v[i] >> (64 - bits);
+	}
+    }
+    r_.neg = a_.neg;
+    return store(r_);
+}
+
+term bignum::shift_right(term a, size_t n)
+{
+    cell ca = heap_.deref(a);
+    if (ca.tag() == tag_t::INT) {
+	// Arithmetic shift, i.e. rounds towards negative infinity
+	int64_t v = static_cast<const int_cell &>(ca).value();
+	return int_cell(v >> (n < 63 ? n : 63));
+    }
+    // BIGs are never negative
+    load(ca, a_);
+    size_t limbs = n / 64, bits = n % 64;
+    auto &v = a_.mag;
+    if (limbs >= v.size()) {
+	return int_cell(0);
+    }
+    r_.mag.resize(v.size() - limbs);
+    for (size_t i = 0; i < r_.mag.size(); i++) {
+	limb lo = v[i + limbs] >> bits;
+	limb hi = (bits != 0 && i + limbs + 1 < v.size()) ? v[i + limbs + 1] << (64 - bits) : 0;
+	r_.mag[i] = lo | hi;
+    }
+    r_.neg = false;
+    return store(r_);
+}
+
+}}
@@ -0,0 +1,93 @@
+#pragma once
+
+#ifndef _common_bignum_hpp
+#define _common_bignum_hpp
+
+#include "term.hpp"
+#include <vector>
+
+namespace prologcoin { namespace common {
+
+class bignum_exception : public term_exception {
+public:
+    bignum_exception(const std::string &msg)
+	: term_exception( std::string("Bignum: ") + msg) { }
+};
+
+//
+// bignum
+//
+// Integer arithmetic on INT and BIG cells that doesn't go through
+// cpp_int (and byte proxies.) A BIG is an unsigned big endian byte
+// string that starts in the upper half of its header (DAT) cell and
+// continues in the cells that follow. The operands are read from the
+// heap into 64-bit limbs (least significant first) and the result is
+// written straight into a new BIG. The limb buffers are kept between
+// operations, so once warmed up nothing but the result is allocated.
+//
+// If both operands are INT and the result fits an int_cell no limbs
+// are involved at all. Likewise any result that fits an int_cell is
+// returned as one. BIG results use as few bytes as possible, so equal
+// values get equal representations (same as the parser.)
+//
+// There are no negative BIGs. A negative result that doesn't fit an
+// int_cell raises a bignum_exception, as does division by zero.
+//
+class bignum {
+public:
+    typedef uint64_t limb;
+
+    bignum(heap &h);
+
+    term add(term a, term b);
+    term sub(term a, term b);
+    term mul(term a, term b);
+
+    // Truncating division (quotient rounds towards zero and the
+    // remainder has the sign of the dividend.)
+    void divmod(term a, term b, term &q, term &r);
+
+    // -1, 0 or 1
+    int compare(term a, term b);
+
+    term shift_left(term a, size_t n);
+    term shift_right(term a, size_t n);
+
+    // Read a BIG into limbs (least significant first.)
+    void get_limbs(big_cell big, std::vector<limb> &limbs) const;
+
+    // Create a BIG with the (normalized) value of 'n' limbs.
+    big_cell new_big(const limb *limbs, size_t n);
+
+private:
+    struct number {
+	bool neg;
+	std::vector<limb> mag;
+    };
+
+    void load(term t, number &n) const;
+    term store(number &n);
+
+    static void trim(std::vector<limb> &v);
+    static int compare_mag(const std::vector<limb> &a,
+			   const std::vector<limb> &b);
+    static void add_mag(const std::vector<limb> &a,
+			const std::vector<limb> &b, std::vector<limb> &r);
+    // Requires a >= b
+    static void sub_mag(const std::vector<limb> &a,
+			const std::vector<limb> &b, std::vector<limb> &r);
+    static void mul_mag(const std::vector<limb> &a,
+			const std::vector<limb> &b, std::vector<limb> &r);
+    void divmod_mag(const std::vector<limb> &a, const std::vector<limb> &b,
+		    std::vector<limb> &q, std::vector<limb> &r);
+
+    void add_signed(bool negate_b);
+
+    heap &heap_;
+    number a_, b_, r_, q_;
+    std::vector<limb> un_, vn_;
+};
+
+}}
+
+#endif
@@ -0,0 +1,376 @@
+#include <algorithm>
+#include <chrono>
+#include "heap_gc.hpp"
+
+namespace prologcoin { namespace common {
+
+heap_gc::heap_gc(heap &h, size_t young_start)
+    : heap_(h),
+      young_start_(std::min(young_start, h.size())),
+      young_end_(h.size()),
+      num_live_(0),
+      new_end_(h.size()),
+      old_boundary_(0),
+      track_atoms_(false)
+{
+}
+
+size_t heap_gc::collect()
+{
+    auto start_time = std::chrono::steady_clock::now();
+
+    young_end_ = heap_.size();
+    new_end_ = young_end_;
+    num_live_ = 0;
+    runs_.clear();
+    old_refs_.clear();
+    upward_refs_.clear();
+
+    if (young_start_ >= young_end_) {
+	return 0;
+    }
+
+    // Everything from here is scanned (or young.) Below it only the
+    // remembered cells.
+    old_boundary_ = std::min(heap_.remember_below(), young_start_);
+    track_atoms_ = heap_.num_unpinned_atoms() != 0;
+    seen_atoms_.clear();
+
+    // Shared ground terms in the young generation may move or die.
+    heap_.forget_hash_consed(young_start_);
+    heap_.forget_cached_hashes(young_start_);
+
+    size_t n = young_end_ - young_start_;
+    marked_.assign(n, false);
+    raw_.assign(n, false);
+
+    // Roots registered with the heap itself (see ext<T>)
+    heap_.for_each_ext([this](cell &c) { roots_.push_back(&c); });
+
+    // A root registered twice must only be relocated once.
+    std::sort(roots_.begin(), roots_.end());
+    roots_.erase(std::unique(roots_.begin(), roots_.end()), roots_.end());
+    std::sort(root_indices_.begin(), root_indices_.end());
+    root_indices_.erase(std::unique(root_indices_.begin(),
+				    root_indices_.end()),
+			root_indices_.end());
+
+    mark_all();
+    see_young_atoms();
+    compute_runs();
+    update_pointers();
+    slide();
+    update_remembered();
+    if (track_atoms_) {
+	heap_.collect_atoms(old_boundary_, seen_atoms_);
+	seen_atoms_.clear();
+    }
+
+    size_t reclaimed = young_end_ - new_end_;
+
+    uint64_t dt = std::chrono::duration_cast<std::chrono::microseconds>(
+	      std::chrono::steady_clock::now() - start_time).count();
+    auto &stats = heap_.gc_stats_;
+    stats.collections++;
+    stats.reclaimed += reclaimed;
+    stats.pause_us += dt;
+    stats.last_pause_us = dt;
+
+    marked_.clear();
+    stack_.clear();
+
+    return reclaimed;
+}
+
+bool heap_gc::relocate(size_t &index) const
+{
+    if (!is_young(index)) {
+	return true;
+    }
+    auto *r = find_run(index);
+    if (r == nullptr) {
+	return false;
+    }
+    index = r->to + (index - r->from);
+    return true;
+}
+
+bool heap_gc::relocate(cell &c) const
+{
+    if (!is_young_ptr(c)) {
+	return true;
+    }
+    auto &p = static_cast<ptr_cell &>(c);
+    size_t index = p.index();
+    if (!relocate(index)) {
+	return false;
+    }
+    p.set_index(index);
+    return true;
+}
+
+const heap_gc::run * heap_gc::find_run(size_t addr) const
+{
+    auto it = std::upper_bound(runs_.begin(), runs_.end(), addr,
+			       [](size_t a, const run &r)
+			       { return a < r.from; });
+    if (it == runs_.begin()) {
+	return nullptr;
+    }
+    --it;
+    if (addr >= it->from + it->length) {
+	return nullptr;
+    }
+    return &*it;
+}
+
+void heap_gc::mark(const cell c)
+{
+    switch (c.tag()) {
+    case tag_t::REF: {
+	size_t index = static_cast<const ptr_cell &>(c).index();
+	if (is_young(index) && !is_marked(index)) {
+	    set_marked(index);
+	    stack_.push_back(index);
+	}
+	break;
+    }
+    case tag_t::STR: {
+	size_t index = static_cast<const ptr_cell &>(c).index();
+	if (!is_young(index) || is_marked(index)) {
+	    break;
+	}
+	set_marked(index);
+	const cell f = get(index);
+	if (f.tag() != tag_t::CON) {
+	    break;
+	}
+	size_t arity = static_cast<const con_cell &>(f).arity();
+	for (size_t i = 1; i <= arity && is_young(index+i); i++) {
+	    if (!is_marked(index+i)) {
+		set_marked(index+i);
+		stack_.push_back(index+i);
+	    }
+	}
+	break;
+    }
+    case tag_t::BIG: {
+	size_t index = static_cast<const ptr_cell &>(c).index();
+	if (!is_young(index) || (is_marked(index) && is_raw(index))) {
+	    break;
+	}
+	const cell h = get(index);
+	if (h.tag() != tag_t::DAT) {
+	    break;
+	}
+	// Header and data cells are kept as is (never interpreted as
+	// references.)
+	size_t n = static_cast<const dat_cell &>(h).num_cells();
+	for (size_t i = 0; i < n && is_young(index+i); i++) {
+	    set_marked(index+i);
+	    set_raw(index+i);
+	}
+	break;
+    }
+    default:
+	break;
+    }
+}
+
+inline void heap_gc::see_atom(size_t addr, const cell c)
+{
+    if (!track_atoms_ || c.tag() != tag_t::CON) {
+	return;
+    }
+    auto &con = static_cast<const con_cell &>(c);
+    if (con.is_direct()) {
+	return;
+    }
+    auto it = seen_atoms_.find(con.atom_index());
+    if (it == seen_atoms_.end()) {
+	seen_atoms_[con.atom_index()] = addr;
+    } else if (addr < it->second) {
+	it->second = addr;
+    }
+}
+
+void heap_gc::see_young_atoms()
+{
+    if (!track_atoms_) {
+	return;
+    }
+    // The survivors end up at 'young_start' or above.
+    for (size_t i = young_start_; i < young_end_; i++) {
+	if (is_marked(i) && !is_raw(i)) {
+	    see_atom(young_start_, get(i));
+	}
+    }
+}
+
+void heap_gc::mark_all()
+{
+    for (auto *r : roots_) {
+	see_atom(heap::ATOM_UNSEEN, *r);
+	mark(*r);
+    }
+    for (auto *p : root_indices_) {
+	size_t index = *p;
+	if (is_young(index) && !is_marked(index)) {
+	    set_marked(index);
+	    stack_.push_back(index);
+	}
+    }
+
+    scan_old();
+
+    while (!stack_.empty()) {
+	size_t index = stack_.back();
+	stack_.pop_back();
+	mark(get(index));
+    }
+}
+
+void heap_gc::scan_old()
+{
+    // Remembered cells above the boundary are scanned below (or are
+    // young.) A cell may have been written many times, but it must
+    // only be relocated once.
+    auto &remembered = heap_.remembered();
+    std::sort(remembered.begin(), remembered.end());
+    remembered.erase(std::unique(remembered.begin(), remembered.end()),
+		     remembered.end());
+    for (auto addr : remembered) {
+	if (addr >= old_boundary_) {
+	    break;
+	}
+	scan_old(addr);
+    }
+
+    for (size_t i = old_boundary_; i < young_start_; i++) {
+	const cell c = get(i);
+	if (c.tag() == tag_t::DAT) {
+	    // Skip binary data of bignums
+	    i += static_cast<const dat_cell &>(c).num_cells() - 1;
+	    continue;
+	}
+	scan_old(i);
+    }
+}
+
+void heap_gc::scan_old(size_t addr)
+{
+    const cell c = get(addr);
+    see_atom(addr, c);
+    if (!is_upward_ptr(addr, c)) {
+	return;
+    }
+    upward_refs_.push_back(addr);
+    if (is_young_ptr(c)) {
+	old_refs_.push_back(addr);
+	mark(c);
+    }
+}
+
+void heap_gc::update_remembered()
+{
+    auto &remembered = heap_.remembered();
+    remembered.clear();
+    for (auto addr : upward_refs_) {
+	if (is_upward_ptr(addr, get(addr))) {
+	    remembered.push_back(addr);
+	}
+    }
+    heap_.set_remember_below(new_end_);
+    upward_refs_.clear();
+}
+
+void heap_gc::compute_runs()
+{
+    const size_t block_size = heap_block::MAX_SIZE;
+
+    size_t to = young_start_;
+    size_t i = young_start_;
+    while (i < young_end_) {
+	if (!is_marked(i)) {
+	    i++;
+	    continue;
+	}
+	size_t from = i;
+	do {
+	    i++;
+	} while (i < young_end_ && is_marked(i) && (i % block_size) != 0);
+	size_t length = i - from;
+
+	// Live cells that were allocated together stay in the same
+	// heap block.
+	size_t block_end = (to / block_size + 1) * block_size;
+	if (to + length > block_end) {
+	    to = block_end;
+	}
+	runs_.push_back(run{from, to, length});
+	to += length;
+	num_live_ += length;
+    }
+    new_end_ = to;
+}
+
+void heap_gc::update_pointers()
+{
+    for (auto &r : runs_) {
+	for (size_t i = r.from; i < r.from + r.length; i++) {
+	    if (!is_raw(i)) {
+		relocate(at(i));
+	    }
+	}
+    }
+    for (auto *r : roots_) {
+	relocate(*r);
+    }
+    for (auto *p : root_indices_) {
+	relocate(*p);
+    }
+    for (auto i : old_refs_) {
+	relocate(at(i));
+    }
+}
+
+void heap_gc::slide()
+{
+    // Destination is never above source, so copying in increasing
+    // address order is safe.
+    bool watches = heap_.has_watches();
+    for (auto &r : runs_) {
+	if (r.from == r.to) {
+	    continue;
+	}
+	for (size_t i = 0; i < r.length; i++) {
+	    size_t src = r.from + i, dst = r.to + i;
+	    at(dst) = at(src);
+	    if (watches) {
+		heap_.watch(dst, heap_.watched(src));
+	    }
+	}
+    }
+
+    // Fill holes at the end of blocks that couldn't fit the next run.
+    size_t prev_end = young_start_;
+    for (auto &r : runs_) {
+	for (size_t i = prev_end; i < r.to; i++) {
+	    at(i) = int_cell(0);
+	    if (watches) {
+		heap_.watch(i, false);
+	    }
+	}
+	prev_end = r.to + r.length;
+    }
+
+    if (watches) {
+	for (size_t i = new_end_; i < young_end_; i++) {
+	    heap_.watch(i, false);
+	}
+    }
+
+    heap_.trim(new_end_);
+}
+
+}}
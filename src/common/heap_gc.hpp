@@ -0,0 +1,157 @@
+#pragma once
+
+#ifndef _common_heap_gc_hpp
+#define _common_heap_gc_hpp
+
+#include <vector>
+#include <unordered_map>
+#include "term.hpp"
+
+namespace prologcoin { namespace common {
+
+//
+// heap_gc
+//
+// Garbage collector for the youngest part of a heap. Everything below
+// 'young_start' is the old generation, everything at or above it
+// (up to the current heap size) is the young generation.
+//
+// Old cells are never moved, but those that may refer to the young
+// generation (an old variable may have been bound to a new term) are
+// scanned: the cells in the heap's remembered set (old cells written
+// through heap::bind_barrier or heap::set_arg) and the cells between
+// the heap's remember boundary and 'young_start' (written before they
+// became old.) The rest of the old generation isn't looked at, so a
+// collection costs in proportion to the young generation and the
+// remembered set. Young cells that cannot be reached from the old
+// generation or from any of the registered roots are reclaimed.
+//
+// Afterwards the remembered set keeps the old cells that still refer
+// to younger cells (a later collection may start its young generation
+// below them) and the boundary is moved to the end of the heap.
+//
+// Thus every collection looks at all cells written since the previous
+// one (or that are live and young.) Atoms with long names found there
+// and in the roots are passed on to heap::collect_atoms, which releases
+// the unpinned atoms of the heap that nothing can refer to anymore.
+//
+// The survivors are slid down towards 'young_start' rather than being
+// copied to a separate to-space. Sliding preserves the relative
+// order of the cells which the WAM depends upon (variable age when
+// binding, heap marks in choice points and the conditional trail.)
+// Thus a collection never needs to touch anything below the heap mark
+// of the most recent choice point.
+//
+// The roots are locations outside the heap (registers, stack frames
+// and the external roots registered with the heap, see ext<T>) and
+// will be updated to reflect the new addresses. A root may
+// contain garbage (e.g. an uninitialized stack slot), which at worst
+// makes some dead cells survive.
+//
+class heap_gc {
+public:
+    heap_gc(heap &h, size_t young_start);
+
+    // A cell stored outside the heap that may point into the heap.
+    inline void add_root(cell &c)
+        { roots_.push_back(&c); }
+
+    // A heap address (e.g. a trail entry) that must be kept alive.
+    inline void add_root_index(size_t &index)
+        { root_indices_.push_back(&index); }
+
+    // Run the collection. Returns the number of reclaimed cells.
+    size_t collect();
+
+    // After collect(): Translate an address/cell to its new location.
+    // Returns false if the referenced cell was reclaimed.
+    bool relocate(size_t &index) const;
+    bool relocate(cell &c) const;
+
+    inline size_t young_start() const
+        { return young_start_; }
+
+    inline size_t young_end() const
+        { return young_end_; }
+
+    inline size_t num_live() const
+        { return num_live_; }
+
+private:
+    struct run {
+	size_t from;
+	size_t to;
+	size_t length;
+    };
+
+    inline cell & at(size_t addr)
+        { return heap_.find_block(addr)[addr]; }
+
+    // Reading doesn't copy blocks shared with another heap (see
+    // heap::fork.) Only young cells and relocated old ones are written.
+    inline const cell & get(size_t addr) const
+        { return static_cast<const heap &>(heap_).find_block(addr)[addr]; }
+
+    inline bool is_young(size_t addr) const
+        { return addr >= young_start_ && addr < young_end_; }
+
+    inline bool is_marked(size_t addr) const
+        { return marked_[addr - young_start_]; }
+
+    inline void set_marked(size_t addr)
+        { marked_[addr - young_start_] = true; }
+
+    inline bool is_raw(size_t addr) const
+        { return raw_[addr - young_start_]; }
+
+    inline void set_raw(size_t addr)
+        { raw_[addr - young_start_] = true; }
+
+    static inline bool is_ptr(const cell c)
+        { auto t = c.tag();
+          return t == tag_t::REF || t == tag_t::STR || t == tag_t::BIG; }
+
+    inline bool is_young_ptr(const cell c) const
+        { return is_ptr(c) &&
+	         is_young(static_cast<const ptr_cell &>(c).index()); }
+
+    // A cell at 'addr' that refers to a younger cell
+    static inline bool is_upward_ptr(size_t addr, const cell c)
+        { return is_ptr(c) &&
+	         static_cast<const ptr_cell &>(c).index() > addr; }
+
+    void see_atom(size_t addr, const cell c);
+    void see_young_atoms();
+    void mark(const cell c);
+    void mark_all();
+    void scan_old();
+    void scan_old(size_t addr);
+    void update_remembered();
+    void compute_runs();
+    void update_pointers();
+    void slide();
+
+    const run * find_run(size_t addr) const;
+
+    heap &heap_;
+    size_t young_start_;
+    size_t young_end_;
+    size_t num_live_;
+    size_t new_end_;
+    size_t old_boundary_;
+    bool track_atoms_;
+
+    std::vector<cell *> roots_;
+    std::vector<size_t *> root_indices_;
+    std::vector<size_t> old_refs_;
+    std::vector<size_t> upward_refs_;
+    std::vector<size_t> stack_;
+    std::vector<bool> marked_;
+    std::vector<bool> raw_;
+    std::vector<run> runs_;
+    std::unordered_map<size_t, size_t> seen_atoms_;
+};
+
+}}
+
+#endif
@@ -4,6 +4,7 @@
 #define _common_merkle_trie_hpp
 
 #include <bitset>
+#include <cstring>
 #include <iostream>
 #include "blake2.hpp"
 
@@ -579,7 +580,7 @@ private:
         auto node = spine.back().node;
 	while (!spine.empty() && node->mask_ == 0) {
 	    spine.pop_back();
-	    node = spine.back().node;
+	    if (!spine.empty()) node = spine.back().node;
 	}
 	if (spine.empty()) {
 	    return;
@@ -600,7 +601,7 @@ private:
         auto node = spine.back().node;
 	while (!spine.empty() && node->mask_ == 0) {
 	    spine.pop_back();
-	    node = spine.back().node;
+	    if (!spine.empty()) node = spine.back().node;
 	}
 	if (spine.empty()) {
 	    return;
@@ -1,15 +1,16 @@
 #include <iomanip>
 #include <algorithm>
 #include <boost/algorithm/string.hpp>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
 #include "term.hpp"
 #include "term_ops.hpp"
 
 namespace prologcoin { namespace common {
 
-#ifdef DEBUG_TERM
-size_t heap::id_counter_ = 0;
-#endif
-
 // extern "C" { void DebugBreak(); }
     
 coin_security_exception::coin_security_exception() 
@@ -258,8 +259,17 @@ std::string dat_cell::inner_str() const
 
 heap::heap() 
   : size_(0),
+    num_watches_(0),
+    remember_below_(0),
+    paged_(false),
+    page_fd_(-1),
+    max_resident_(0),
+    page_clock_(0),
     coin_security_enabled_(true),
-    external_ptrs_max_(0)
+    max_size_(0),
+    hash_consed_top_(0),
+    hash_cache_top_(0),
+    num_unpinned_atoms_(0)
 {
     new_block(0);
 }
@@ -267,16 +277,135 @@ heap::heap()
 heap::~heap()
 {
 #ifdef DEBUG_TERM
-    if (external_ptrs_.size() > 0) {
+    if (ext_stats_.live > 0) {
 	std::cerr << "Warning: Heap destroyed while external pointers exist.\n";
-	for (auto p : external_ptrs_) {
-	    std::cout << "  " << p.first << " id=" << p.second << "\n";
+	for (size_t i = 0; i < ext_slots_.size(); i++) {
+	    if (ext_slots_[i].ptr != nullptr) {
+		std::cout << "  " << ext_slots_[i].ptr << " slot=" << i << "\n";
+	    }
 	}
-	assert(external_ptrs_.size() == 0);
+	assert(ext_stats_.live == 0);
     }
 #endif
     for (auto *b : blocks_) {
-	delete b;
+	release_block(b);
+    }
+    release_atoms();
+    if (page_fd_ != -1) {
+	close(page_fd_);
+    }
+}
+
+static const size_t BLOCK_BYTES = heap_block::MAX_SIZE * sizeof(cell);
+
+void heap_block::map_cells(int fd)
+{
+    void *p = mmap(nullptr, BLOCK_BYTES, PROT_READ | PROT_WRITE, MAP_SHARED,
+		   fd, static_cast<off_t>(index_ * BLOCK_BYTES));
+    if (p == MAP_FAILED) {
+	throw heap_paging_exception(std::string("Failed to map block: ")
+				    + strerror(errno));
+    }
+    cell *mapped_cells = reinterpret_cast<cell *>(p);
+    std::copy(cells_, cells_ + size_, mapped_cells);
+    free_cells();
+    cells_ = mapped_cells;
+    mapped_ = true;
+}
+
+void heap_block::unmap_cells()
+{
+    munmap(cells_, BLOCK_BYTES);
+}
+
+void heap_block::evict()
+{
+    // The pages of a shared file mapping are written back by the
+    // kernel, so dropping them is all that is needed.
+    madvise(cells_, BLOCK_BYTES, MADV_DONTNEED);
+    resident_ = false;
+}
+
+void heap::set_paging(const std::string &file, size_t max_resident)
+{
+    if (paged_) {
+	throw heap_paging_exception("Already enabled");
+    }
+    int fd = open(file.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0600);
+    if (fd == -1) {
+	throw heap_paging_exception("Cannot open '" + file + "': "
+				    + strerror(errno));
+    }
+    // Nobody else needs the file. It's gone once we close it.
+    unlink(file.c_str());
+    if (ftruncate(fd, blocks_.size() * BLOCK_BYTES) != 0) {
+	close(fd);
+	throw heap_paging_exception(std::string("Cannot resize backing file: ")
+				    + strerror(errno));
+    }
+    page_fd_ = fd;
+    for (auto *b : blocks_) {
+	b->map_cells(page_fd_);
+	b->set_last_used(++page_clock_);
+    }
+    paging_stats_.resident = blocks_.size();
+    paged_ = true;
+    set_max_resident_blocks(max_resident);
+}
+
+void heap::set_max_resident_blocks(size_t max_resident)
+{
+    max_resident_ = max_resident < MIN_RESIDENT_BLOCKS
+	          ? static_cast<size_t>(MIN_RESIDENT_BLOCKS) : max_resident;
+    if (paged_) {
+	evict_blocks();
+    }
+}
+
+void heap::page_new_block(heap_block &block)
+{
+    if (ftruncate(page_fd_, (block.index() + 1) * BLOCK_BYTES) != 0) {
+	throw heap_paging_exception(std::string("Cannot resize backing file: ")
+				    + strerror(errno));
+    }
+    block.map_cells(page_fd_);
+    block.set_last_used(++page_clock_);
+    paging_stats_.resident++;
+    evict_blocks();
+}
+
+void heap::page_in(heap_block &block) const
+{
+    // The kernel reads the pages back on access. We just need to
+    // account for the block (and perhaps evict another one.)
+    block.set_resident(true);
+    paging_stats_.resident++;
+    paging_stats_.faults++;
+    evict_blocks();
+}
+
+void heap::evict_blocks() const
+{
+    // The head block (where we allocate) is never evicted. Neither
+    // is the most recently used one, as the caller may still hold a
+    // reference to one of its cells (we need a minimum number of
+    // resident blocks for that reason.)
+    while (paging_stats_.resident > max_resident_) {
+	heap_block *lru = nullptr;
+	for (auto *b : blocks_) {
+	    if (b == head_block_ || !b->is_resident()) {
+		continue;
+	    }
+	    if (lru == nullptr || b->last_used() < lru->last_used()) {
+		lru = b;
+	    }
+	}
+	if (lru == nullptr) {
+	    break;
+	}
+	lru->evict();
+	paging_stats_.resident--;
+	paging_stats_.evictions++;
     }
 }
 
@@ -285,8 +414,123 @@ const con_cell heap::DOTTED_PAIR = con_cell(".",2);
 const con_cell heap::COMMA = con_cell(",",2);
 const con_cell heap::COIN = con_cell("$coin",2);
 
+heap_block * heap_block::clone() const
+{
+    auto *copy = new heap_block(index_, offset_);
+    std::copy(cells_, cells_ + size_, copy->cells_);
+    copy->size_ = size_;
+    copy->watch_ = watch_;
+    return copy;
+}
+
+void heap::release_block(heap_block *block)
+{
+    if (block->release()) {
+	delete block;
+    }
+}
+
+heap_block * heap::unshare_block(size_t index)
+{
+    heap_block *block = blocks_[index];
+    heap_block *copy = block->clone();
+    blocks_[index] = copy;
+    if (head_block_ == block) {
+	head_block_ = copy;
+    }
+    release_block(block);
+    return copy;
+}
+
+void heap::fork(const heap &src)
+{
+    if (paged_ || src.paged_) {
+	throw heap_paging_exception("Cannot fork a paged heap");
+    }
+    for (auto *b : blocks_) {
+	release_block(b);
+    }
+    blocks_ = src.blocks_;
+    for (auto *b : blocks_) {
+	b->add_ref();
+    }
+    head_block_ = blocks_.back();
+    size_ = src.size_;
+    watched_ = src.watched_;
+    num_watches_ = src.num_watches_;
+    remembered_ = src.remembered_;
+    remember_below_ = src.remember_below_;
+    hash_cons_table_ = src.hash_cons_table_;
+    hash_consed_ = src.hash_consed_;
+    hash_consed_top_ = src.hash_consed_top_;
+    hash_cache_ = src.hash_cache_;
+    hash_cache_top_ = src.hash_cache_top_;
+    release_atoms();
+    atoms_ = src.atoms_;
+    num_unpinned_atoms_ = src.num_unpinned_atoms_;
+    for (auto &a : atoms_) {
+	atom_table::global().add_ref(a.first);
+    }
+}
+
+size_t heap::num_shared_blocks() const
+{
+    size_t n = 0;
+    for (auto *b : blocks_) {
+	if (b->is_shared()) n++;
+    }
+    return n;
+}
+
+void heap::add_hash_consed(uint64_t h, size_t index)
+{
+    hash_cons_table_.insert(std::make_pair(h, index));
+    hash_consed_.insert(index);
+    if (index >= hash_consed_top_) {
+	hash_consed_top_ = index + 1;
+    }
+}
+
+void heap::forget_hash_consed(size_t from)
+{
+    if (from >= hash_consed_top_) {
+	return;
+    }
+    for (auto it = hash_cons_table_.begin(); it != hash_cons_table_.end();) {
+	if (it->second >= from) {
+	    hash_consed_.erase(it->second);
+	    it = hash_cons_table_.erase(it);
+	} else {
+	    ++it;
+	}
+    }
+    hash_consed_top_ = from;
+}
+
+void heap::forget_cached_hashes(size_t from)
+{
+    if (from >= hash_cache_top_) {
+	return;
+    }
+    for (auto it = hash_cache_.begin(); it != hash_cache_.end();) {
+	if (it->first >= from) {
+	    it = hash_cache_.erase(it);
+	} else {
+	    ++it;
+	}
+    }
+    hash_cache_top_ = from;
+}
+
 void heap::trim(size_t new_size)
 {
+    forget_hash_consed(new_size);
+    forget_cached_hashes(new_size);
+    // Cells from here on are new (whatever was remembered for them is
+    // ignored, see heap_gc::scan_old.)
+    if (new_size < remember_below_) {
+	remember_below_ = new_size;
+    }
     size_t heap_end = new_size > 0 ? new_size - 1 : 0;
     size_t block_index = find_block_index(heap_end);
     auto &block = find_block(heap_end);
@@ -294,10 +538,17 @@ void heap::trim(size_t new_size)
     size_ = new_size;
     if (block_index+1 < blocks_.size()) {
 	for (size_t i = block_index+1; i < blocks_.size(); i++) {
-	    delete blocks_[i];
+	    if (paged_ && blocks_[i]->is_resident()) {
+		paging_stats_.resident--;
+	    }
+	    release_block(blocks_[i]);
 	}
 	blocks_.resize(block_index+1);
 	head_block_ = &block;
+	if (paged_) {
+	    // Failing to shrink the backing file is harmless.
+	    if (ftruncate(page_fd_, blocks_.size() * BLOCK_BYTES) != 0) { }
+	}
     }
 }
 
@@ -342,17 +593,83 @@ bool heap::check_functor(const cell c) const
     return true;
 }
 
-size_t heap::resolve_atom_index(const std::string &name) const
+size_t heap::resolve_atom_index(const std::string &name, bool pin) const
+{
+    auto &table = atom_table::global();
+
+    size_t index;
+    if (table.find(name, index)) {
+	auto found = atoms_.find(index);
+	if (found != atoms_.end()) {
+	    if (pin && found->second != ATOM_PINNED) {
+		found->second = ATOM_PINNED;
+		num_unpinned_atoms_--;
+	    }
+	    return index;
+	}
+    }
+
+    // Not referenced by this heap yet.
+    index = table.intern(name);
+    atoms_[index] = pin ? ATOM_PINNED : ATOM_UNSEEN;
+    if (!pin) {
+	num_unpinned_atoms_++;
+    }
+    return index;
+}
+
+void heap::pin_atom(con_cell c)
+{
+    if (c.is_direct()) {
+	return;
+    }
+    size_t index = c.atom_index();
+    auto found = atoms_.find(index);
+    if (found == atoms_.end()) {
+	// Resolved by another heap (which still holds it.)
+	atom_table::global().add_ref(index);
+	atoms_[index] = ATOM_PINNED;
+    } else if (found->second != ATOM_PINNED) {
+	found->second = ATOM_PINNED;
+	num_unpinned_atoms_--;
+    }
+}
+
+void heap::collect_atoms(size_t boundary,
+			 const std::unordered_map<size_t, size_t> &seen)
+{
+    // A cell below 'boundary' that was written before the previous
+    // collection hasn't been looked at. If the atom was found below
+    // 'boundary' at some earlier collection it may still be there.
+    for (auto it = atoms_.begin(); it != atoms_.end();) {
+	size_t &lowest = it->second;
+	if (lowest == ATOM_PINNED) {
+	    ++it;
+	    continue;
+	}
+	auto s = seen.find(it->first);
+	if (s != seen.end()) {
+	    if (lowest >= boundary || s->second < lowest) {
+		lowest = s->second;
+	    }
+	    ++it;
+	} else if (lowest < boundary) {
+	    ++it;
+	} else {
+	    atom_table::global().release(it->first);
+	    num_unpinned_atoms_--;
+	    it = atoms_.erase(it);
+	}
+    }
+}
+
+void heap::release_atoms()
 {
-    auto found = atom_name_to_index_table_.find(name);
-    if (found == atom_name_to_index_table_.end()) {
-        // Not found. Create a new entry.
-        size_t index = atom_index_to_name_table_.size();
-        atom_index_to_name_table_.push_back(name);
-	atom_name_to_index_table_[name] = index;
-	return index;
+    for (auto &a : atoms_) {
+	atom_table::global().release(a.first);
     }
-    return found->second;
+    atoms_.clear();
+    num_unpinned_atoms_ = 0;
 }
 
 bool heap::is_name(con_cell c, const std::string &name) const
@@ -495,7 +812,7 @@ void heap::set_big(cell big, const boost::multiprecision::cpp_int &i)
     if (i != 0) {
 	// It needs to be in the right most position of the bignum
 	// (the bignum is in big endian form)
-	auto nbytes = (nbits - ((msb(i) + 7) / 8)*8) / 8;
+	auto nbytes = (nbits - ((msb(i) + 8) / 8)*8) / 8;
 	while (nbytes) {
 	    ++bi;
 	    nbytes--;
@@ -573,7 +890,11 @@ void heap::print(std::ostream &out, size_t from, size_t to) const
 
 void heap::print_status(std::ostream &out) const
 {
-    out << "Heap status: Size: " << size_ << " External refs: " << external_ptr_count() << " (at most it was " << external_ptrs_max_ << ")\n";
+    out << "Heap status: Size: " << size_ << " External refs: " << ext_stats_.live << " (at most it was " << ext_stats_.max << ", " << ext_stats_.registrations << " registered in total) Atoms: " << atoms_.size() << "\n";
+    out << "GC status: Collections: " << gc_stats_.collections << " Reclaimed cells: " << gc_stats_.reclaimed << " Pause: " << gc_stats_.pause_us << " us (last was " << gc_stats_.last_pause_us << " us)\n";
+    if (paged_) {
+	out << "Paging status: Blocks: " << blocks_.size() << " Resident: " << paging_stats_.resident << " (at most " << max_resident_ << ") Faults: " << paging_stats_.faults << " Evictions: " << paging_stats_.evictions << "\n";
+    }
 }
 
 
@@ -10,12 +10,14 @@
 #include <memory>
 #include <unordered_set>
 #include <unordered_map>
+#include <atomic>
 #include <boost/lexical_cast.hpp>
 #include <bitset>
 
 #include <boost/noncopyable.hpp>
 #include <iostream>
 #include <boost/multiprecision/cpp_int.hpp>
+#include "atom_table.hpp"
 
 // #define DEBUG_TERM
 
@@ -313,6 +315,18 @@ public:
       : term_exception( std::string("Expected STR cell; was " + c.tag().str())) { }
 };
 
+class heap_paging_exception : public term_exception {
+public:
+    heap_paging_exception(const std::string &msg)
+	: term_exception( std::string("Heap paging: ") + msg) { }
+};
+
+class quota_exception : public term_exception {
+public:
+    quota_exception(const std::string &resource, size_t limit)
+	: term_exception( std::string("Exceeded ") + resource + " quota of " + boost::lexical_cast<std::string>(limit)) { }
+};
+
 class coin_security_exception : public term_exception {
 public:
     coin_security_exception();
@@ -704,17 +718,27 @@ private:
 // heap_block
 //
 // We don't want to keep _all_ heap blocks in memory. We can
-// cache those that are frequent.
+// cache those that are frequent. If the heap is paged (see
+// heap::set_paging) the cells of a block are a shared mapping of a
+// slice of the backing file. A cold block is then evicted by
+// dropping its pages; the mapping (and thus every pointer into it)
+// stays valid and the pages are read back from the file on access.
+//
+// Blocks can also be shared between heaps (see heap::fork). A shared
+// block is read-only and gets copied by the first heap writing to it.
 //
 class heap_block : private boost::noncopyable {
 public:
     static const size_t MAX_SIZE = 1024*128;
 
     inline heap_block() : index_(0), offset_(0),
-			  size_(0), cells_(nullptr) { init_cells(); }
+			  size_(0), cells_(nullptr), mapped_(false),
+			  resident_(true), last_used_(0), refs_(1)
+        { init_cells(); }
     inline heap_block(size_t index, size_t offset)
         : index_(index), offset_(offset),
-	  size_(0), cells_(nullptr) { init_cells(); }
+	  size_(0), cells_(nullptr), mapped_(false),
+	  resident_(true), last_used_(0), refs_(1) { init_cells(); }
     inline ~heap_block() { free_cells(); }
 
     inline void init_cells() {
@@ -722,9 +746,36 @@ public:
     }
 
     inline void free_cells() {
-	delete reinterpret_cast<uint64_t *>(cells_);
+	if (mapped_) {
+	    unmap_cells();
+	} else {
+	    delete [] reinterpret_cast<uint64_t *>(cells_);
+	}
     }
 
+    // Paging (see heap::set_paging)
+    void map_cells(int fd);
+    void unmap_cells();
+    void evict();
+    inline bool is_mapped() const { return mapped_; }
+    inline bool is_resident() const { return resident_; }
+    inline void set_resident(bool r) { resident_ = r; }
+    inline uint64_t last_used() const { return last_used_; }
+    inline void set_last_used(uint64_t t) { last_used_ = t; }
+
+    // Sharing (see heap::fork)
+    inline bool is_shared() const {
+	return refs_.load(std::memory_order_relaxed) > 1;
+    }
+    inline void add_ref() {
+	refs_.fetch_add(1, std::memory_order_relaxed);
+    }
+    // Returns true if this was the last reference
+    inline bool release() {
+	return refs_.fetch_sub(1, std::memory_order_acq_rel) == 1;
+    }
+    heap_block * clone() const;
+
     inline size_t index() const { return index_; }
     inline size_t offset() const { return offset_; }
 
@@ -740,6 +791,11 @@ public:
 	return size_ + n < MAX_SIZE;
     }
 
+    // Largest n for which can_allocate(n) holds
+    inline size_t available() const {
+	return size_ + 1 < MAX_SIZE ? MAX_SIZE - size_ - 1 : 0;
+    }
+
     inline size_t allocate(size_t n) {
 	size_t addr = offset_ + size_;
 	size_ += n;
@@ -751,6 +807,11 @@ public:
     }
 
     inline void fill() {
+	// Unused cells at the end are set to something harmless so that
+	// the heap always can be scanned linearly (see heap_gc.)
+	for (size_t i = size_; i < MAX_SIZE; i++) {
+	    cells_[i] = int_cell(0);
+	}
 	size_ = MAX_SIZE;
     }
 
@@ -767,6 +828,10 @@ private:
     size_t offset_;
     size_t size_;
     cell *cells_;
+    bool mapped_;
+    bool resident_;
+    uint64_t last_used_;
+    std::atomic<size_t> refs_;
     std::bitset<MAX_SIZE> watch_; // Flag if a particular cell is accessed
 };
 
@@ -778,69 +843,55 @@ class heap; // Forward
 // We keep track of which heap the cell comes from. Also the heap
 // gets notified so that whenever a heap GC happens the address can be
 // updated.
-// 
+//
+
+//
+// A registered external root. The slot is reused once unregistered,
+// so the handle also carries the generation of the slot at the time
+// of registration (to catch stale handles.)
+//
+struct ext_handle {
+    inline ext_handle() : slot(0), generation(0) { }
+    inline ext_handle(uint32_t s, uint32_t g) : slot(s), generation(g) { }
+    uint32_t slot;
+    uint32_t generation;
+};
 
-#if 0
 template<typename T> class ext {
 public:
-    inline ext() : heap_(nullptr), ptr_()
+    inline ext() : heap_(nullptr), ptr_() { }
+    inline ext(const heap &h, T ptr) : heap_(&h), ptr_(ptr)
     {
-#ifdef DEBUG_TERM
-	id_ = 0;
-#endif
+	handle_ = ext_register(h, &ptr_);
     }
-    inline ext(const heap &h, cell ptr) : heap_(&h), ptr_(ptr)
-    {
-#ifdef DEBUG_TERM
-	id_ = ext_register(h, &ptr_); 
-#else
-	ext_register(h, &ptr_);
-#endif
-    }
-    inline ~ext() { if (heap_ != nullptr) ext_unregister(*heap_, &ptr_); }
+    inline ~ext() { if (heap_ != nullptr) ext_unregister(*heap_, handle_); }
 
-    inline ext(const ext<T> &other)
+    inline ext(const ext<T> &other) : heap_(other.heap_), ptr_(other.ptr_)
     {
-	if (other.heap_ != nullptr) {
-	    heap_ = other.heap_;
-	    ptr_ = other.ptr_;
-#ifdef DEBUG_TERM
-            id_ = ext_register(*heap_, &ptr_);
-#else
-            ext_register(*heap_, &ptr_);
-#endif
-	} else {
-	    heap_ = nullptr;
+	if (heap_ != nullptr) {
+	    handle_ = ext_register(*heap_, &ptr_);
 	}
     }
 
     inline void operator = (const ext<T> &other)
     {
-	if (other.heap_ != nullptr) {
-	    bool was_null = heap_ == nullptr;
-	    heap_ = other.heap_;
-	    ptr_ = other.ptr_;
-	    if (was_null) {
-#ifdef DEBUG_TERM
-   	        id_ = ext_register(*heap_, &ptr_);
-#else
-	        ext_register(*heap_, &ptr_);
-#endif
-            }
-	} else {
-	    if (heap_ != nullptr) {
-		ext_unregister(*heap_, &ptr_);
-		heap_ = nullptr;
-	    }
+	if (heap_ != nullptr) {
+	    ext_unregister(*heap_, handle_);
+	}
+	heap_ = other.heap_;
+	ptr_ = other.ptr_;
+	if (heap_ != nullptr) {
+	    handle_ = ext_register(*heap_, &ptr_);
 	}
     }
 
-    inline operator T ();
-    inline operator const T & () const;
-    inline T operator * () const;
+    inline operator T () const
+        { return static_cast<const T &>(ptr_); }
+    inline T operator * () const
+        { return static_cast<const T &>(ptr_); }
+    inline const T * operator -> () const
+        { return &static_cast<const T &>(ptr_); }
     inline T deref() const;
-    inline const T * operator -> () const;
-    inline T * operator -> ();
 
     inline bool operator == (const ext<T> &other) const {
 	return heap_ == other.heap_ && ptr_ == other.ptr_;
@@ -851,20 +902,13 @@ public:
     }
 
 private:
-#ifdef DEBUG_TERM
-    inline size_t ext_register(const heap &h, cell *p);
-#else
-    inline void ext_register(const heap &h, cell *p);
-#endif
-    inline void ext_unregister(const heap &h, cell *p);
+    inline ext_handle ext_register(const heap &h, cell *p);
+    inline void ext_unregister(const heap &h, ext_handle handle);
 
     const heap *heap_;
     mutable cell ptr_;
-#ifdef DEBUG_TERM
-    mutable size_t id_;
-#endif
+    ext_handle handle_;
 };
-#endif
 
 //
 // heap
@@ -877,6 +921,52 @@ public:
     heap();
     ~heap();
 
+    // Statistics updated by the garbage collector (see heap_gc.)
+    struct gc_stats {
+	inline gc_stats() : collections(0), reclaimed(0),
+			    pause_us(0), last_pause_us(0) { }
+	size_t collections;      // Number of collections
+	size_t reclaimed;        // Total number of reclaimed cells
+	uint64_t pause_us;       // Total time spent collecting
+	uint64_t last_pause_us;  // Time spent in the most recent collection
+    };
+
+    inline const gc_stats & get_gc_stats() const { return gc_stats_; }
+
+    // Paging. Heap blocks are backed by 'file' (which is removed as
+    // soon as it has been opened) and at most 'max_resident' blocks
+    // are kept in memory; the least recently used ones are evicted.
+    static const size_t MIN_RESIDENT_BLOCKS = 4;
+
+    // Copy-on-write snapshot. This heap (which loses its own content)
+    // becomes a copy of 'src' in O(number of blocks) time. The blocks
+    // are shared until either heap writes to them. Paged heaps cannot
+    // be forked. Not thread safe w.r.t. 'src' being modified.
+    void fork(const heap &src);
+
+    inline size_t num_blocks() const { return blocks_.size(); }
+    size_t num_shared_blocks() const;
+
+    void set_paging(const std::string &file, size_t max_resident);
+    inline bool is_paged() const { return paged_; }
+    inline size_t max_resident_blocks() const { return max_resident_; }
+    void set_max_resident_blocks(size_t max_resident);
+
+    struct paging_stats {
+	inline paging_stats() : resident(0), faults(0), evictions(0) { }
+	size_t resident;         // Number of blocks in memory
+	size_t faults;           // Number of blocks read back in
+	size_t evictions;        // Number of blocks evicted
+    };
+
+    inline const paging_stats & get_paging_stats() const { return paging_stats_; }
+
+    // Quota on the number of cells (0 = unlimited.) It is checked
+    // when a new block is needed, so the heap may fill up the block
+    // that reaches the quota but no new one is started.
+    inline void set_max_size(size_t cells) { max_size_ = cells; }
+    inline size_t max_size() const { return max_size_; }
+
     inline heap & get_heap() { return *this; }
     inline const heap & get_heap() const { return *this; }
 
@@ -916,13 +1006,11 @@ public:
 	}
     }
 
+    // For writing: a block shared with another heap (see fork) is
+    // copied first. Reads should go through the const version.
     inline cell & operator [] (size_t addr)
     {
-	auto &block = find_block(addr);
-	if (block.watched(addr)) {
-  	    watched_.push_back(addr);
-	}
-	return block[addr];
+	return find_block(addr)[addr];
     }
 
     inline const cell & operator [] (size_t addr) const
@@ -940,10 +1028,14 @@ public:
 
     size_t list_length(const cell lst) const;
 
-    inline con_cell atom(const std::string &name) const
+    // Atoms and functors with long names are pinned unless 'pin' is
+    // false, in which case they're only kept as long as a cell of this
+    // heap refers to them (see collect_atoms.) Names that end up
+    // anywhere else (e.g. as keys of a C++ map) must be pinned.
+    inline con_cell atom(const std::string &name, bool pin = true) const
     {
         if (name.length() > 7) {
-	    return con_cell(resolve_atom_index(name), 0);
+	    return con_cell(resolve_atom_index(name, pin), 0);
 	}
 	return con_cell(name, 0);
     }
@@ -953,7 +1045,7 @@ public:
         if (cell.is_direct()) {
 	    return cell.name();
         } else {
-  	    return atom_index_to_name_table_[cell.atom_index()];
+  	    return atom_table::global().name(cell.atom_index());
 	}
     }
 
@@ -1023,10 +1115,11 @@ public:
 
     bool is_name(con_cell cell, const std::string &name) const;
 
-    inline con_cell functor(const std::string &name, size_t arity)
+    inline con_cell functor(const std::string &name, size_t arity,
+			    bool pin = true)
     {
         if (name.length() > 7) {
-   	    return con_cell(resolve_atom_index(name), arity);
+   	    return con_cell(resolve_atom_index(name, pin), arity);
 	}
 	
         return con_cell(name, arity);
@@ -1059,7 +1152,22 @@ public:
 	}
     }
 
-    size_t resolve_atom_index(const std::string &name) const;
+    size_t resolve_atom_index(const std::string &name, bool pin = true) const;
+    void pin_atom(con_cell c);
+    inline size_t num_atoms() const { return atoms_.size(); }
+    inline size_t num_unpinned_atoms() const { return num_unpinned_atoms_; }
+
+    // After a garbage collection (see heap_gc): 'seen' has the atoms
+    // found in cells at or above 'boundary', in the roots and in the
+    // cells written since the previous collection, with the lowest
+    // address each one was found at. Unpinned atoms that can't be
+    // referenced anymore are released.
+    void collect_atoms(size_t boundary,
+		       const std::unordered_map<size_t, size_t> &seen);
+
+    // Unpinned atom not known to be referred to by any cell
+    static const size_t ATOM_UNSEEN = static_cast<size_t>(-2);
+    static const size_t ATOM_PINNED = static_cast<size_t>(-1);
 
     inline con_cell functor(const term s) const
     {
@@ -1136,6 +1244,7 @@ public:
         str_cell &s = static_cast<str_cell &>(dc);
 	size_t i = s.index() + index + 1;
 	(*this)[i] = c;
+	remember(i);
     }
 
     inline term new_str(con_cell con)
@@ -1299,6 +1408,39 @@ public:
 	return t;
     }
 
+    // A list of n elements (ending with 'tail') built in bulk. The
+    // pairs are laid out back to back (3 cells each, no STR cells in
+    // between), one allocation per heap block.
+    inline term new_list(const term *elems, size_t n, term tail)
+    {
+	if (n == 0) {
+	    return tail;
+	}
+	term first;
+	size_t last_cdr = 0;
+	for (size_t i = 0; i < n;) {
+	    ensure_allocate(3);
+	    size_t k = std::min(n - i, head_block_->available() / 3);
+	    cell *p;
+	    size_t index;
+	    std::tie(p, index) = allocate(tag_t::CON, 3*k);
+	    for (size_t j = 0; j < k; j++) {
+		p[3*j] = DOTTED_PAIR;
+		p[3*j+1] = elems[i+j];
+		p[3*j+2] = str_cell(index+3*j+3);
+	    }
+	    if (i == 0) {
+		first = str_cell(index);
+	    } else {
+		(*this)[last_cdr] = str_cell(index);
+	    }
+	    last_cdr = index + 3*k - 1;
+	    i += k;
+	}
+	(*this)[last_cdr] = tail;
+	return first;
+    }
+
     inline term new_ref()
     {
 	size_t index;
@@ -1313,14 +1455,36 @@ public:
 	size_t index;
 	cell *p;
 	std::tie(p, index) = allocate(tag_t::REF, cnt);
+	// Only the first cell gets a tag by allocate (the others may
+	// hold anything left behind by a trim.)
 	for (size_t i = 0; i < cnt; i++) {
-	    static_cast<ref_cell &>(p[i]).set_index(index+i);
+	    p[i] = ref_cell(index+i);
 	}
     }
 
     inline size_t external_ptr_count() const
     {
-	return external_ptrs_.size();
+	return ext_stats_.live;
+    }
+
+    struct ext_stats {
+	inline ext_stats() : live(0), max(0), registrations(0) { }
+	size_t live;          // Number of registered external roots
+	size_t max;           // Most roots registered at the same time
+	size_t registrations; // Total number of registrations
+    };
+
+    inline const ext_stats & get_ext_stats() const { return ext_stats_; }
+
+    // Visit every registered external root (e.g. for a garbage
+    // collector that needs to update them.)
+    template<typename F> inline void for_each_ext(F f) const
+    {
+	for (auto &slot : ext_slots_) {
+	    if (slot.ptr != nullptr) {
+		f(*slot.ptr);
+	    }
+	}
     }
 
     void print_status(std::ostream &out) const;
@@ -1337,7 +1501,47 @@ public:
     }
 
     inline void watch(size_t addr, bool b) {
-        find_block(addr).watch(addr, b);
+        auto &block = find_block(addr);
+	if (block.watched(addr) != b) {
+	    block.watch(addr, b);
+	    if (b) num_watches_++; else num_watches_--;
+	}
+    }
+
+    inline bool has_watches() const {
+        return num_watches_ != 0;
+    }
+
+    // Write barrier for variable bindings. Unless some cell is watched
+    // (e.g. a frozen variable) or old (see remember) this is a couple
+    // of compares.
+    inline void bind_barrier(size_t addr) {
+        remember(addr);
+        if (num_watches_ != 0 && find_block(addr).watched(addr)) {
+	    watched_.push_back(addr);
+	}
+    }
+
+    // Remembered set (see heap_gc.) Cells below 'remember_below' that
+    // are bound or set are recorded, so a collection only needs to
+    // scan those (and the cells between this boundary and the young
+    // generation) instead of the whole old generation.
+    inline void remember(size_t addr) {
+        if (addr < remember_below_) {
+	    remembered_.push_back(addr);
+	}
+    }
+
+    inline size_t remember_below() const {
+        return remember_below_;
+    }
+
+    inline void set_remember_below(size_t addr) {
+        remember_below_ = addr;
+    }
+
+    inline std::vector<size_t> & remembered() {
+        return remembered_;
     }
 
     inline const std::vector<size_t> & watched() const {
@@ -1347,15 +1551,70 @@ public:
     inline bool watched(size_t addr) const {
         return find_block(addr).watched(addr);
     }  
+
+    // Hash-consing (see term_utils::hash_cons.) Ground STR terms
+    // registered here are stored once; equal ground terms refer to
+    // the same cells and can therefore be compared by address.
+    typedef std::unordered_multimap<uint64_t, size_t> hash_cons_map;
+
+    inline bool has_hash_consed() const {
+        return !hash_consed_.empty();
+    }
+
+    inline bool is_hash_consed(const cell c) const {
+        return c.tag() == tag_t::STR && !hash_consed_.empty() &&
+	  hash_consed_.count(static_cast<const str_cell &>(c).index()) != 0;
+    }
+
+    inline const hash_cons_map & hash_cons_table() const {
+        return hash_cons_table_;
+    }
+
+    void add_hash_consed(uint64_t h, size_t index);
+
+    // Cached structural hashes (see term_utils::hash) of ground STR
+    // terms, keyed by their address.
+    inline bool find_cached_hash(size_t index, uint64_t &h) const {
+        if (hash_cache_.empty()) {
+	    return false;
+	}
+	auto it = hash_cache_.find(index);
+	if (it == hash_cache_.end()) {
+	    return false;
+	}
+	h = it->second;
+	return true;
+    }
+
+    inline void cache_hash(size_t index, uint64_t h) {
+        hash_cache_[index] = h;
+	if (index >= hash_cache_top_) {
+	    hash_cache_top_ = index + 1;
+	}
+    }
+
+    inline size_t hash_cache_size() const {
+        return hash_cache_.size();
+    }
+
+    void forget_cached_hashes(size_t from);
+
+    // Forget the registered terms at or above 'from' (they are about
+    // to be moved or discarded.)
+    void forget_hash_consed(size_t from);
   
 private:
     friend class term_emitter;
+    friend class heap_gc;
 
     inline size_t new_block()
     {
 	heap_block *last_block = blocks_.back();
 	size_t last_offset = last_block->offset();
 	size_t new_offset = last_offset + heap_block::MAX_SIZE;
+	if (max_size_ != 0 && new_offset >= max_size_) {
+	    throw quota_exception("heap", max_size_);
+	}
 	new_block(new_offset);
 	last_block->fill();
 	size_ = new_offset;
@@ -1367,6 +1626,9 @@ private:
 	heap_block *block = new heap_block(blocks_.size(), offset);
 	head_block_ = block;
 	blocks_.push_back(block);
+	if (paged_) {
+	    page_new_block(*block);
+	}
     }
 
     inline size_t find_block_index(size_t addr) const
@@ -1376,20 +1638,51 @@ private:
 
     inline heap_block & find_block(size_t addr)
     {
-	return *blocks_[find_block_index(addr)];
+	size_t index = find_block_index(addr);
+	heap_block *block = blocks_[index];
+	if (paged_) {
+	    touch(*block);
+	}
+	if (block->is_shared()) {
+	    block = unshare_block(index);
+	}
+	return *block;
     }
 
     inline const heap_block & find_block(size_t addr) const
     {
-	return *blocks_[find_block_index(addr)];
+	heap_block *block = blocks_[find_block_index(addr)];
+	if (paged_) {
+	    touch(*block);
+	}
+	return *block;
+    }
+
+    inline void touch(heap_block &block) const
+    {
+	block.set_last_used(++page_clock_);
+	if (!block.is_resident()) {
+	    page_in(block);
+	}
     }
 
+    heap_block * unshare_block(size_t index);
+    void release_block(heap_block *block);
+    void release_atoms();
+
+    void page_new_block(heap_block &block);
+    void page_in(heap_block &block) const;
+    void evict_blocks() const;
+
     inline const bool in_range(size_t addr) const
     {
 	return addr < size();
     }
 
     inline void ensure_allocate(size_t n) {
+	if (head_block_->is_shared()) {
+	    unshare_block(head_block_->index());
+	}
 	if (!head_block_->can_allocate(n)) {
 	    new_block();
 	}
@@ -1418,31 +1711,34 @@ private:
 	return get(s.index() + index + 1);
     }
 
-#ifdef DEBUG_TERM
-    inline size_t register_ext(cell *p) const
-#else
-    inline void register_ext(cell *p) const
-#endif
+    // O(1): slots are taken from (and returned to) a free list.
+    inline ext_handle register_ext(cell *p) const
     {
-	if (external_ptrs_.size() > external_ptrs_max_) {
-	    external_ptrs_max_ = external_ptrs_.size();
+	uint32_t slot;
+	if (ext_free_.empty()) {
+	    slot = static_cast<uint32_t>(ext_slots_.size());
+	    ext_slots_.push_back(ext_slot());
+	} else {
+	    slot = ext_free_.back();
+	    ext_free_.pop_back();
 	}
-#ifdef DEBUG_TERM
-	size_t id = id_counter_++;
-        external_ptrs_.insert(std::make_pair(p, id));
-	return id;
-#else
-        external_ptrs_.insert(p);
-#endif
+	auto &s = ext_slots_[slot];
+	s.ptr = p;
+	ext_stats_.registrations++;
+	if (++ext_stats_.live > ext_stats_.max) {
+	    ext_stats_.max = ext_stats_.live;
+	}
+	return ext_handle(slot, s.generation);
     }
 
-    inline void unregister_ext(cell *p) const
+    inline void unregister_ext(ext_handle handle) const
     {
-#ifdef DEBUG_TERM
-	assert(external_ptrs_.erase(p) == 1);
-#else
-        external_ptrs_.erase(p);
-#endif
+	auto &s = ext_slots_[handle.slot];
+	assert(s.ptr != nullptr && s.generation == handle.generation);
+	s.ptr = nullptr;
+	s.generation++;
+	ext_free_.push_back(handle.slot);
+	ext_stats_.live--;
     }
 
     bool check_functor(const cell c) const;
@@ -1451,19 +1747,43 @@ private:
     std::vector<heap_block *> blocks_;
     heap_block * head_block_;
     std::vector<size_t> watched_;
+    size_t num_watches_; // Number of cells with the watch bit set
+    std::vector<size_t> remembered_;
+    size_t remember_below_;
+
+    bool paged_;
+    int page_fd_;
+    size_t max_resident_;
+    mutable uint64_t page_clock_;
+    mutable paging_stats paging_stats_;
 
     bool coin_security_enabled_;
+    size_t max_size_;
 
-#ifdef DEBUG_TERM
-    mutable std::unordered_map<cell *, size_t> external_ptrs_;
-    static size_t id_counter_;
-#else
-    mutable std::unordered_set<cell *> external_ptrs_;
-#endif
-    mutable size_t external_ptrs_max_;
+    gc_stats gc_stats_;
+
+    struct ext_slot {
+	inline ext_slot() : ptr(nullptr), generation(0) { }
+	cell *ptr;
+	uint32_t generation;
+    };
+
+    mutable std::vector<ext_slot> ext_slots_;
+    mutable std::vector<uint32_t> ext_free_;
+    mutable ext_stats ext_stats_;
+
+    hash_cons_map hash_cons_table_;
+    std::unordered_set<size_t> hash_consed_;
+    size_t hash_consed_top_;
+    std::unordered_map<size_t, uint64_t> hash_cache_;
+    size_t hash_cache_top_;
 
-    mutable std::vector<std::string> atom_index_to_name_table_;
-    mutable std::unordered_map<std::string, size_t> atom_name_to_index_table_;
+    // Atoms (in the process wide atom_table) this heap holds a
+    // reference to: atom index -> ATOM_PINNED, or the lowest address
+    // of a cell referring to it when it was last seen by the garbage
+    // collector (ATOM_UNSEEN if it hasn't been seen yet.)
+    mutable std::unordered_map<size_t, size_t> atoms_;
+    mutable size_t num_unpinned_atoms_;
 
 public:
     static const con_cell EMPTY_LIST;
@@ -1530,61 +1850,23 @@ inline big_inserter::big_inserter(heap &h, big_cell big) :
 //  register and unregister for ref.
 //
 
-#if 0
-
-#ifdef DEBUG_TERM
-template<typename T> size_t ext<T>::ext_register(const heap &h, cell *p)
+template<typename T> ext_handle ext<T>::ext_register(const heap &h, cell *p)
 {
     return h.register_ext(p);
 }
-#else
-template<typename T> void ext<T>::ext_register(const heap &h, cell *p)
-{
-    h.register_ext(p);
-}
-#endif
 
-template<typename T> void ext<T>::ext_unregister(const heap &h, cell *p)
+template<typename T> void ext<T>::ext_unregister(const heap &h, ext_handle handle)
 {
-    h.unregister_ext(p);
+    h.unregister_ext(handle);
 }
 
 template<typename T> T ext<T>::deref() const
 {
     cell c = heap_->deref(ptr_);
     ptr_ = c;
-    return ext<T>(*heap_, c);
-}
-
-template<typename T> T ext<T>::operator * () const
-{
-    return deref();
-}
-
-template<typename T> const T * ext<T>::operator -> () const
-{
-    deref();
-    return &ptr_;
-}
-
-template<typename T> T * ext<T>::operator -> ()
-{
-    deref();
-    return &ptr_;
+    return static_cast<const T &>(ptr_);
 }
 
-template<typename T> ext<T>::operator T ()
-{
-    return ptr_;
-}
-
-template<typename T> ext<T>::operator const T & () const
-{
-    return ptr_;
-}
-
-#endif
-
 } }
 
 namespace boost {
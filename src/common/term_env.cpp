@@ -91,6 +91,13 @@ bool term_utils::equal(term a, term b, uint64_t &cost)
 	    return false;
 	}
 
+	// Two different shared ground terms are never equal
+	if (get_heap().is_hash_consed(a) && get_heap().is_hash_consed(b)) {
+	    trim_stack(d);
+	    cost = cost_tmp;
+	    return false;
+	}
+
 	con_cell fa = functor(a);
 	con_cell fb = functor(b);
 
@@ -116,36 +123,189 @@ bool term_utils::equal(term a, term b, uint64_t &cost)
     return true;
 }
 
+// Finalizer of MurmurHash3 (64-bit.)
+static inline uint64_t hash_mix(uint64_t h)
+{
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+    return h;
+}
+
+// Order dependent combination.
+static inline uint64_t hash_combine(uint64_t h, uint64_t v)
+{
+    return hash_mix(h ^ (hash_mix(v) + 0x9e3779b97f4a7c15ULL + (h << 6) + (h >> 2)));
+}
+
 uint64_t term_utils::hash(term t)
 {
-    size_t d = stack_size();
+    // Post order traversal so that the hash of every compound
+    // subterm is available. Those of ground terms are cached on the
+    // heap (the hash of a term with variables changes once they are
+    // bound.) A subterm reached through a (bound) variable doesn't
+    // count as ground either, as the binding may be undone.
+    //
+    // A variable inside a structure is bound in place, so a term may
+    // look ground while backtracking can still reset one of its cells.
+    // Hence only terms that can't change are cached: hash consed terms
+    // and terms above HB (those go away on backtracking, and so does
+    // their cache entry when the heap is trimmed.)
+    std::vector<std::pair<term, bool> > work;
+    std::vector<std::pair<uint64_t, bool> > results;
+
+    auto &h = get_heap();
+
+    work.push_back(std::make_pair(t, false));
+
+    while (!work.empty()) {
+	auto w = work.back();
+	work.pop_back();
+	bool via_ref = w.first.tag() == tag_t::REF;
+	term c = deref(w.first);
+
+	switch (c.tag()) {
+	case tag_t::CON:
+	case tag_t::INT:
+	    results.push_back(std::make_pair(hash_mix(c.raw_value()), !via_ref));
+	    break;
+	case tag_t::REF:
+	    results.push_back(std::make_pair(hash_mix(c.raw_value()), false));
+	    break;
+	case tag_t::BIG: {
+	    auto &big = static_cast<big_cell &>(c);
+	    uint64_t hb = hash_mix(h.num_bits(big));
+	    for (auto it = h.begin(big), it_end = h.end(big); it != it_end; ++it) {
+		hb = hash_combine(hb, *it);
+	    }
+	    results.push_back(std::make_pair(hb, !via_ref));
+	    break;
+	    }
+	case tag_t::STR: {
+	    size_t index = static_cast<str_cell &>(c).index();
+	    uint64_t hc;
+	    if (!w.second && h.find_cached_hash(index, hc)) {
+		results.push_back(std::make_pair(hc, !via_ref));
+		break;
+	    }
+	    con_cell f = functor(c);
+	    size_t n = f.arity();
+	    if (!w.second) {
+		work.push_back(std::make_pair(w.first, true));
+		for (size_t i = 0; i < n; i++) {
+		    work.push_back(std::make_pair(arg(c, i), false));
+		}
+		break;
+	    }
+	    hc = hash_mix(f.raw_value());
+	    bool ground = true;
+	    for (size_t i = 0; i < n; i++) {
+		auto r = results.back();
+		results.pop_back();
+		hc = hash_combine(hc, r.first);
+		ground = ground && r.second;
+	    }
+	    if (ground && (index >= get_register_hb() || h.is_hash_consed(c))) {
+		h.cache_hash(index, hc);
+	    }
+	    results.push_back(std::make_pair(hc, ground && !via_ref));
+	    break;
+	    }
+	default:
+	    results.push_back(std::make_pair(hash_mix(c.raw_value()), false));
+	    break;
+	}
+    }
 
-    push(t);
+    return results.back().first;
+}
 
-    uint64_t h = 0;
+term term_utils::hash_cons(term t)
+{
+    // Post order traversal. Every (sub)term results in its shared
+    // replacement and whether it is ground. Arguments that are
+    // variables (even bound ones; the binding may be undone) make
+    // the term non-ground.
+    std::vector<std::pair<term, bool> > work;
+    std::vector<std::pair<term, bool> > results;
 
-    while (stack_size() > d) {
-	t = deref(pop());
+    auto &h = get_heap();
 
-	switch (t.tag()) {
+    work.push_back(std::make_pair(deref(t), false));
+
+    while (!work.empty()) {
+	auto w = work.back();
+	work.pop_back();
+	term c = w.first;
+
+	switch (c.tag()) {
 	case tag_t::CON:
 	case tag_t::INT:
-	case tag_t::REF:
-	    h += t.raw_value();
+	    results.push_back(std::make_pair(c, true));
 	    break;
-        case tag_t::STR: {
-	    con_cell f = functor(t);
-	    h += f.raw_value();
+	case tag_t::STR: {
+	    if (h.is_hash_consed(c)) {
+		results.push_back(std::make_pair(c, true));
+		break;
+	    }
+	    con_cell f = functor(c);
 	    size_t n = f.arity();
+	    if (!w.second) {
+		work.push_back(std::make_pair(c, true));
+		for (size_t i = 0; i < n; i++) {
+		    work.push_back(std::make_pair(arg(c, i), false));
+		}
+		break;
+	    }
+	    bool ground = true;
+	    uint64_t hc = f.raw_value();
 	    for (size_t i = 0; i < n; i++) {
-	        push(arg(t, i));
+		auto r = results.back();
+		results.pop_back();
+		ground = ground && r.second;
+		term a = arg(c, i);
+		if (a.tag() == tag_t::STR && a != r.first) {
+		    set_arg(c, i, r.first);
+		}
+		hc = (hc ^ r.first.raw_value()) * 0x100000001b3;
 	    }
-	  }
-	  break;
+	    if (!ground) {
+		results.push_back(std::make_pair(c, false));
+		break;
+	    }
+	    // The arguments are shared already, so comparing the cells
+	    // of the arguments is enough.
+	    term shared = c;
+	    auto range = h.hash_cons_table().equal_range(hc);
+	    for (auto it = range.first; it != range.second; ++it) {
+		term other = str_cell(it->second);
+		if (functor(other) != f) {
+		    continue;
+		}
+		bool eq = true;
+		for (size_t i = 0; i < n && eq; i++) {
+		    eq = arg(other, i) == arg(c, i);
+		}
+		if (eq) {
+		    shared = other;
+		    break;
+		}
+	    }
+	    if (shared == c) {
+		h.add_hash_consed(hc, static_cast<str_cell &>(c).index());
+	    }
+	    results.push_back(std::make_pair(shared, true));
+	    break;
+	    }
+	default:
+	    results.push_back(std::make_pair(c, false));
+	    break;
 	}
     }
 
-    return h;
+    return results.back().first;
 }
 
 uint64_t term_utils::cost(term t)
@@ -212,7 +372,8 @@ bool term_utils::unify(term a, term b, uint64_t &cost)
 void term_utils::restore_cells_after_unify() {
   while(temp_trail_size() > 0) {
     auto index = temp_trail_pop();
-    heap_set(index, heap_get(static_cast<fwd_cell &>(heap_get(index))));
+    auto c = heap_get(index);
+    heap_set(index, heap_get(static_cast<fwd_cell &>(c).index()));
   }
 }
 
@@ -313,6 +474,13 @@ bool term_utils::unify_helper(term a, term b, uint64_t &cost)
 	    continue;
           }
 
+	  // Two different shared ground terms are never equal
+	  if (get_heap().is_hash_consed(a) && get_heap().is_hash_consed(b)) {
+	    cost = cost_tmp;
+	    restore_cells_after_unify();
+	    return false;
+	  }
+
 	  con_cell f = static_cast<con_cell &>(adest);
           if (f != static_cast<con_cell &>(bdest)) {
 	    cost = cost_tmp;
@@ -349,11 +517,8 @@ bool term_utils::unify_helper(term a, term b, uint64_t &cost)
 	      restore_cells_after_unify();
 	      return false;
 	  }
-	  size_t numbits = 0;
-	  boost::multiprecision::cpp_int ai, bi;
-	  get_big(abig, ai, numbits);
-	  get_big(bbig, bi, numbits);
-	  if (ai != bi) {
+	  uint64_t big_cost = 0;
+	  if (!get_heap().big_equal(abig, bbig, big_cost)) {
 	      cost = cost_tmp;
 	      restore_cells_after_unify();
 	      return false;
@@ -428,8 +593,18 @@ int term_utils::standard_order(term a, term b, uint64_t &cost)
 	    cost = cost_tmp;
 	    return cmp;
 	  }
-	case tag_t::REF:
 	case tag_t::INT:
+	  {
+	    trim_stack(d);
+	    cost = cost_tmp;
+	    if (static_cast<const int_cell &>(a).value() <
+		static_cast<const int_cell &>(b).value()) {
+	        return -1;
+	    } else {
+  	        return 1;
+	    }
+	  }
+	case tag_t::REF:
 	  {
 	    trim_stack(d);
 	    if (a.value() < b.value()) {
@@ -474,9 +649,17 @@ int term_utils::standard_order(term a, term b, uint64_t &cost)
 }
 
 term term_utils::copy(term c, naming_map &names,
-		      heap &src, naming_map &src_names, uint64_t &cost)
+		      heap &src, naming_map &src_names, uint64_t &cost,
+		      bool share_ground)
 {
     std::unordered_map<term, term> term_map;
+    return copy(c, names, src, src_names, cost, share_ground, term_map);
+}
+
+term term_utils::copy(term c, naming_map &names,
+		      heap &src, naming_map &src_names, uint64_t &cost,
+		      bool share_ground, std::unordered_map<term, term> &term_map)
+{
     std::unordered_map<con_cell, con_cell> con_map;
     std::vector<std::pair<term, size_t> >cyclic_args;
     std::unordered_set<term> current_path;
@@ -502,6 +685,13 @@ term term_utils::copy(term c, naming_map &names,
 	    continue;
 	}
 
+	// Shared ground terms (see hash_cons) need no copying
+	if (share_ground && &src == &get_heap() && src.is_hash_consed(c)) {
+	    temp_push(c);
+	    temp_push(int_cell(0));
+	    continue;
+	}
+
         // We know this is a cyclic reference that needs to be patched.
         // Can a sentinel value be pushed on the stack, so we know to patch that argument?
         if (c.tag() == tag_t::STR && !processed && current_path.count(c) > 0) {
@@ -537,7 +727,7 @@ term term_utils::copy(term c, naming_map &names,
 		  auto search = con_map.find(cc);
 		  con_cell dst_cc;
 		  if (search == con_map.end()) {
-		      dst_cc = functor(src.atom_name(cc), cc.arity());
+		      dst_cc = functor(src.atom_name(cc), cc.arity(), false);
 		      con_map[cc] = dst_cc;
 		  } else {
 		      dst_cc = search->second;
@@ -560,7 +750,7 @@ term term_utils::copy(term c, naming_map &names,
 	    auto search_f = con_map.find(f);
 	    con_cell dst_f;
             if (search_f == con_map.end()) {
-		dst_f = functor(src.atom_name(f), f.arity());
+		dst_f = functor(src.atom_name(f), f.arity(), false);
 		con_map[f] = dst_f;
 	    } else {
 		dst_f = search_f->second;
@@ -633,6 +823,103 @@ term term_utils::copy(term c, naming_map &names,
     return temp_pop();
 }
 
+bool term_utils::unify_instance(term pattern, term t, naming_map &names,
+				std::unordered_map<term, term> &var_map,
+				uint64_t &cost)
+{
+    return unify_instance(pattern, t, names, get_heap(), var_map, cost);
+}
+
+bool term_utils::unify_instance(term pattern, term t, naming_map &names,
+				heap &src,
+				std::unordered_map<term, term> &var_map,
+				uint64_t &cost)
+{
+    bool same_heap = &src == &get_heap();
+
+    size_t start_trail = trail_size();
+    size_t start_stack = stack_size();
+    size_t old_register_hb = get_register_hb();
+
+    // Record all bindings so we can undo them in case
+    // unification fails.
+    set_register_hb(heap_size());
+
+    uint64_t cost_tmp = 0;
+    bool r = true;
+
+    push(t);
+    push(pattern);
+
+    while (r && stack_size() > start_stack) {
+	term p = pop();
+	uint64_t cost_deref = 0;
+	term a = deref_with_cost(pop(), cost_deref);
+	cost_tmp += cost_deref + 1;
+
+	if (p.tag() == tag_t::REF) {
+	    auto it = var_map.find(p);
+	    if (it == var_map.end()) {
+		// First occurrence; the instance variable would
+		// have been bound to 'a' anyway.
+		var_map[p] = a;
+	    } else {
+		uint64_t cost_unify = 0;
+		r = unify_helper(it->second, a, cost_unify);
+		cost_tmp += cost_unify;
+	    }
+	    continue;
+	}
+
+	if (a.tag() == tag_t::REF) {
+	    // This part of the pattern is needed, so instantiate it.
+	    uint64_t cost_copy = 0;
+	    term inst = copy(p, names, src, names, cost_copy, true,
+			     var_map);
+	    cost_tmp += cost_copy;
+	    bind(static_cast<ref_cell &>(a), inst);
+	    continue;
+	}
+
+	if (!same_heap && p.tag() == tag_t::BIG) {
+	    uint64_t cost_copy = 0;
+	    p = copy(p, names, src, names, cost_copy, true, var_map);
+	    cost_tmp += cost_copy;
+	}
+
+	if (p.tag() != tag_t::STR ||
+	    (same_heap && get_heap().is_hash_consed(p))) {
+	    // No pattern variables in here
+	    uint64_t cost_unify = 0;
+	    r = unify_helper(p, a, cost_unify);
+	    cost_tmp += cost_unify;
+	    continue;
+	}
+
+	if (a.tag() != tag_t::STR || src.functor(p) != functor(a)) {
+	    r = false;
+	    continue;
+	}
+
+	size_t num_args = functor(a).arity();
+	for (size_t i = 0; i < num_args; i++) {
+	    push(arg(a, num_args-i-1));
+	    push(src.arg(p, num_args-i-1));
+	}
+    }
+
+    cost = cost_tmp;
+
+    if (!r) {
+	unwind_trail(start_trail, trail_size());
+	trim_trail(start_trail);
+	trim_stack(start_stack);
+    }
+
+    set_register_hb(old_register_hb);
+    return r;
+}
+
 std::string term_utils::list_to_string(const term t, heap &src)
 {
     term lst = t;
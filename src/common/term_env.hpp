@@ -6,6 +6,7 @@
 #include <iterator>
 #include <map>
 #include "term.hpp"
+#include "heap_gc.hpp"
 #include "term_emitter.hpp"
 #include "term_parser.hpp"
 #include "term_tokenizer.hpp"
@@ -143,9 +144,11 @@ public:
     // Heap management
     inline void heap_set(size_t index, term t)
         { T::get_heap()[index] = t; }
-    inline term heap_get(size_t index)
+    // Reads go through the const path so that blocks shared with
+    // another heap (see heap::fork) aren't copied.
+    inline term heap_get(size_t index) const
         { return T::get_heap()[index]; }
-    inline untagged_cell heap_get_untagged(size_t index)
+    inline untagged_cell heap_get_untagged(size_t index) const
         { return T::get_heap().untagged_at(index); }
 
     // Term management
@@ -189,8 +192,9 @@ public:
         { return T::get_heap().size(); }
 
     // Term creation
-    inline con_cell functor(const std::string &name, size_t arity)
-        { return T::get_heap().functor(name, arity); }
+    inline con_cell functor(const std::string &name, size_t arity,
+			    bool pin = true)
+        { return T::get_heap().functor(name, arity, pin); }
     inline term new_term(con_cell functor)
         { return T::get_heap().new_str(functor); }
     inline term new_term_con(con_cell functor)
@@ -224,6 +228,8 @@ public:
         { return T::get_heap().new_dotted_pair(); }
     inline term new_dotted_pair(term a, term b)
         { return T::get_heap().new_dotted_pair(a,b); }
+    inline term new_list(const std::vector<term> &elems, term tail)
+        { return T::get_heap().new_list(elems.data(), elems.size(), tail); }
     inline con_cell to_atom(con_cell functor)
         { return T::get_heap().to_atom(functor); }
     inline con_cell to_functor(con_cell atom, size_t arity)
@@ -254,6 +260,8 @@ public:
        { return T::get_heap().watched(addr); }  
     inline void heap_clear_watched()
        { T::get_heap().clear_watched(); }
+    inline void heap_bind_barrier(size_t addr)
+       { T::get_heap().bind_barrier(addr); }
 
     // Disable coin security
     inline typename heap::disabled_coin_security disable_coin_security()
@@ -280,6 +288,8 @@ public:
 
 class stacks {
 public:
+    inline stacks() : register_hb_(0), max_trail_(0), trail_check_(0) { }
+
     inline stacks & get_stacks() { return *this; }
     inline const stacks & get_stacks() const { return *this; }
     inline std::vector<term> & get_stack() { return stack_; }
@@ -293,12 +303,35 @@ public:
     inline size_t get_register_hb() const { return register_hb_; }
     inline void set_register_hb(size_t hb) { register_hb_ = hb; }
 
+    // Quota on the number of trail entries (0 = unlimited.) It is
+    // only checked when the trail reaches 'trail_check', which is
+    // where it needs to grow (or the quota if that comes first.)
+    inline size_t max_trail() const { return max_trail_; }
+    inline void set_max_trail(size_t n) { max_trail_ = n; trail_check_ = 0; }
+    inline size_t trail_check() const { return trail_check_; }
+
+    inline void grow_trail()
+    {
+	if (max_trail_ != 0 && trail_.size() >= max_trail_) {
+	    throw quota_exception("trail", max_trail_);
+	}
+	if (trail_.size() == trail_.capacity()) {
+	    trail_.reserve(trail_.capacity() < 1024 ? 1024 : 2*trail_.capacity());
+	}
+	trail_check_ = trail_.capacity();
+	if (max_trail_ != 0 && max_trail_ < trail_check_) {
+	    trail_check_ = max_trail_;
+	}
+    }
+
 private:
     std::vector<term> stack_;
     std::vector<size_t> trail_;
     std::vector<term> temp_;
     std::vector<size_t> temp_trail_;
     size_t register_hb_;
+    size_t max_trail_;
+    size_t trail_check_;
 };
 
 template<typename T> class stacks_dock : public T {
@@ -331,7 +364,12 @@ public:
       { T::get_stack().resize(new_size); }
 
   inline void push_trail(size_t i)
-      { T::get_trail().push_back(i); }
+      { auto &tr = T::get_trail();
+	if (tr.size() >= get_stacks().trail_check()) {
+	    get_stacks().grow_trail();
+	}
+	tr.push_back(i);
+      }
   inline size_t pop_trail()
       { auto p = T::get_trail().back(); T::get_trail().pop_back(); return p; }
   inline size_t trail_size() const
@@ -430,12 +468,41 @@ public:
 
     bool unify(term a, term b, uint64_t &cost);
     term copy(const term t, naming_map &names, uint64_t &cost);
+    // If 'share_ground' is true, then ground terms that are shared (see
+    // hash_cons) are not copied; the caller must not modify the copy.
     term copy(const term t, naming_map &names,
-	      heap &src, naming_map &src_names, uint64_t &cost);
+	      heap &src, naming_map &src_names, uint64_t &cost,
+	      bool share_ground = false);
+    // Same, but the variables of 't' found in 'var_map' are replaced
+    // with what they map to. New variables are added to the map.
+    term copy(const term t, naming_map &names,
+	      heap &src, naming_map &src_names, uint64_t &cost,
+	      bool share_ground, std::unordered_map<term, term> &var_map);
+
+    // Unify 't' with an instance of 'pattern' (as if it was created by
+    // copy(pattern, ..., share_ground=true)) without creating the
+    // instance. The variables of 'pattern' are left untouched; what
+    // they become is recorded in 'var_map' instead. Only the parts of
+    // 'pattern' that get bound to variables of 't' are copied. The rest
+    // of an instance (e.g. a clause body) is then created with copy
+    // using the same 'var_map'. 'pattern' may be on another heap
+    // ('src'); nothing is then shared with it.
+    bool unify_instance(term pattern, term t, naming_map &names,
+			std::unordered_map<term, term> &var_map,
+			uint64_t &cost);
+    bool unify_instance(term pattern, term t, naming_map &names,
+			heap &src, std::unordered_map<term, term> &var_map,
+			uint64_t &cost);
     bool equal(term a, term b, uint64_t &cost);
     uint64_t hash(term t);
     uint64_t cost(term t);
 
+    // Share the ground subterms of 't' with equal ground terms already
+    // registered on the heap (and register the new ones.) The term is
+    // updated in place; the returned term is 't' or its replacement
+    // (if 't' itself is ground and already known.)
+    term hash_cons(term t);
+
     // Return -1, 0 or 1 when comparing standard order for 'a' and 'b'
     int standard_order(const term a, const term b, uint64_t &cost);
 
@@ -462,6 +529,7 @@ private:
     {
         size_t index = a.index();
         heap_set(index, b);
+        heap_bind_barrier(index);
         trail(index);
     }
 
@@ -566,6 +634,62 @@ public:
 			var_naming(), cost);
   }
 
+  // Terms in 'term_map' are replaced with what they map to
+  inline term copy(term t, std::unordered_map<term, term> &term_map,
+		   uint64_t &cost)
+  {
+      term_utils utils(heap_dock<HT>::get_heap(), stacks_dock<ST>::get_stacks(), ops_dock<OT>::get_ops());
+      return utils.copy(t, var_naming(), heap_dock<HT>::get_heap(),
+			var_naming(), cost, false, term_map);
+  }
+
+  // Instantiate a term that won't be modified (see term_utils::copy)
+  inline term copy_shared(term t, uint64_t &cost)
+  {
+      term_utils utils(heap_dock<HT>::get_heap(), stacks_dock<ST>::get_stacks(), ops_dock<OT>::get_ops());
+      return utils.copy(t, var_naming(), heap_dock<HT>::get_heap(),
+			var_naming(), cost, true);
+  }
+
+  inline term copy_shared(term t, std::unordered_map<term, term> &var_map,
+			  uint64_t &cost)
+  {
+      term_utils utils(heap_dock<HT>::get_heap(), stacks_dock<ST>::get_stacks(), ops_dock<OT>::get_ops());
+      return utils.copy(t, var_naming(), heap_dock<HT>::get_heap(),
+			var_naming(), cost, true, var_map);
+  }
+
+  // Unify with an instance of a term that won't be modified
+  // (see term_utils::unify_instance)
+  inline bool unify_instance(term pattern, term t,
+			     std::unordered_map<term, term> &var_map,
+			     uint64_t &cost)
+  {
+      term_utils utils(heap_dock<HT>::get_heap(), stacks_dock<ST>::get_stacks(), ops_dock<OT>::get_ops());
+      return utils.unify_instance(pattern, t, var_naming(), var_map, cost);
+  }
+
+  // Same, but 'pattern' is a term of 'src'
+  inline bool unify_instance(term pattern, term t,
+			     term_env_dock<HT,ST,OT> &src,
+			     std::unordered_map<term, term> &var_map,
+			     uint64_t &cost)
+  {
+      term_utils utils(heap_dock<HT>::get_heap(), stacks_dock<ST>::get_stacks(), ops_dock<OT>::get_ops());
+      return utils.unify_instance(pattern, t, var_naming(), src.get_heap(),
+				  var_map, cost);
+  }
+
+  // Instantiate a term of 'src' (see unify_instance)
+  inline term copy_shared(term t, term_env_dock<HT,ST,OT> &src,
+			  std::unordered_map<term, term> &var_map,
+			  uint64_t &cost)
+  {
+      term_utils utils(heap_dock<HT>::get_heap(), stacks_dock<ST>::get_stacks(), ops_dock<OT>::get_ops());
+      return utils.copy(t, var_naming(), src.get_heap(), src.var_naming(),
+			cost, true, var_map);
+  }
+
   inline term copy(term t, term_env_dock<HT,ST,OT> &src, uint64_t &cost)
   {
       term_utils utils(heap_dock<HT>::get_heap(), stacks_dock<ST>::get_stacks(), ops_dock<OT>::get_ops());
@@ -601,6 +725,12 @@ public:
       return utils.hash(t);
   }
 
+  inline term hash_cons(term t)
+  {
+      term_utils utils(heap_dock<HT>::get_heap(), stacks_dock<ST>::get_stacks(), ops_dock<OT>::get_ops());
+      return utils.hash_cons(t);
+  }
+
   inline uint64_t cost(const term t)
   {
       term_utils utils(heap_dock<HT>::get_heap(), stacks_dock<ST>::get_stacks(), ops_dock<OT>::get_ops());
@@ -617,9 +747,32 @@ public:
   {
       size_t index = a.index();
       heap_dock<HT>::heap_set(index, b);
+      heap_dock<HT>::heap_bind_barrier(index);
       stacks_dock<ST>::trail(index);
   }
 
+  // Run a heap collection. Trailed cells are kept alive (the trail
+  // entries are updated) and variable names follow their variables.
+  inline size_t collect_garbage(heap_gc &gc)
+  {
+      auto &tr = stacks_dock<ST>::get_trail();
+      for (auto &index : tr) {
+	  gc.add_root_index(index);
+      }
+      size_t reclaimed = gc.collect();
+
+      naming_map names;
+      for (auto &v : var_naming_) {
+	  term t = v.first;
+	  if (gc.relocate(t)) {
+	      names[t] = v.second;
+	  }
+      }
+      var_naming_.swap(names);
+
+      return reclaimed;
+  }
+
   inline int standard_order(const term a, const term b, uint64_t &cost)
   {
       term_utils utils(heap_dock<HT>::get_heap(), stacks_dock<ST>::get_stacks(), ops_dock<OT>::get_ops());
@@ -569,7 +569,7 @@ protected:
     auto fname = args[0].token().lexeme();
     auto farity = num_args;
 
-    con_cell f = heap_.functor(fname, farity);
+    con_cell f = heap_.functor(fname, farity, false);
     term fstr = heap_.new_str(f);
     term fstr_pos;
 
@@ -917,7 +917,7 @@ protected:
 	// Round up to nearest byte
 	size_t nbits = 8;
 	if (val != 0) {
-	    nbits = ((msb(val) + 7) / 8) * 8;
+	    nbits = ((msb(val) + 8) / 8) * 8;
 	}
 
 	big_cell big = heap_.new_big(val, nbits);
@@ -942,7 +942,7 @@ protected:
   {
     if (check_mode_) return sym();
 
-    con_cell con = heap_.atom(args[0].token().lexeme());
+    con_cell con = heap_.atom(args[0].token().lexeme(), false);
     if (track_positions()) {
         return sym(con, make_pos(args[0].token().pos(), 0), args[0].leftmost_pos());
     } else {
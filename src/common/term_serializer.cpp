@@ -317,7 +317,7 @@ void term_serializer::read_index(const buffer_t &bytes, size_t &offset, cell c)
 
     switch (c.tag()) {
     case tag_t::CON:
-	index_term(c, env_.resolve_atom_index(name));
+	index_term(c, env_.resolve_atom_index(name, false));
 	break;
     case tag_t::REF: {
 	auto t = env_.new_ref();
@@ -0,0 +1,150 @@
+#include <iostream>
+#include <iomanip>
+#include <thread>
+#include <assert.h>
+#include <common/term_env.hpp>
+#include <common/atom_table.hpp>
+#include <common/heap_gc.hpp>
+
+using namespace prologcoin::common;
+
+static void header( const std::string &str )
+{
+    std::cout << "\n";
+    std::cout << "--- [" + str + "] " + std::string(60 - str.length(), '-') << "\n";
+    std::cout << "\n";
+}
+
+static void test_shared_atoms()
+{
+    header( "test_shared_atoms()" );
+
+    auto &table = atom_table::global();
+    size_t live_before = table.get_stats().live;
+
+    con_cell a1, a2;
+    {
+	term_env env1, env2;
+	a1 = env1.functor("a_long_atom_name", 2);
+	a2 = env2.functor("a_long_atom_name", 2);
+
+	// Same atom has the same cell in every heap
+	assert(a1 == a2);
+	assert(env2.atom_name(a1) == "a_long_atom_name");
+	assert(table.ref_count(a1.atom_index()) == 2);
+
+	// Resolving again in the same heap doesn't add references
+	env1.functor("a_long_atom_name", 0);
+	assert(table.ref_count(a1.atom_index()) == 2);
+
+	assert(table.get_stats().live == live_before + 1);
+    }
+
+    // Gone with the heaps referencing it
+    assert(table.get_stats().live == live_before);
+    std::cout << "Removed: " << table.get_stats().removed << "\n";
+
+    // A new atom reuses the index
+    term_env env3;
+    con_cell a3 = env3.functor("another_long_atom", 0);
+    assert(a3.atom_index() == a1.atom_index());
+    assert(env3.atom_name(a3) == "another_long_atom");
+}
+
+static void test_concurrent_atoms()
+{
+    header( "test_concurrent_atoms()" );
+
+    auto &table = atom_table::global();
+    size_t live_before = table.get_stats().live;
+
+    const size_t NUM_THREADS = 4;
+    const size_t NUM_ATOMS = 20000;
+
+    std::vector<std::thread> threads;
+    for (size_t t = 0; t < NUM_THREADS; t++) {
+	threads.push_back(std::thread([=] {
+	    term_env env;
+	    for (size_t i = 0; i < NUM_ATOMS; i++) {
+		// Half of the atoms are shared with other threads
+		std::string name = (i % 2 == 0)
+		    ? "shared_atom_" + boost::lexical_cast<std::string>(i)
+		    : "thread_" + boost::lexical_cast<std::string>(t) + "_atom_" + boost::lexical_cast<std::string>(i);
+		con_cell c = env.functor(name, 0);
+		assert(env.atom_name(c) == name);
+	    }
+	}));
+    }
+    for (auto &th : threads) {
+	th.join();
+    }
+
+    auto stats = table.get_stats();
+    std::cout << "Interned: " << stats.interned << " Live: " << stats.live << " Removed: " << stats.removed << "\n";
+    assert(stats.live == live_before);
+}
+
+static void test_atom_gc()
+{
+    header( "test_atom_gc()" );
+
+    auto &table = atom_table::global();
+    size_t live_before = table.get_stats().live;
+
+    term_env env;
+    auto &h = env.get_heap();
+
+    // Pinned: never released by a collection
+    con_cell pinned = env.functor("a_pinned_atom", 0);
+
+    term old = env.parse("old(X, Y, an_old_atom_name).");
+    size_t young_start = env.heap_size();
+    size_t first_young_start = young_start;
+    for (size_t i = 0; i < 100; i++) {
+	env.parse("foo(a_garbage_atom_" + boost::lexical_cast<std::string>(i) + ").");
+    }
+    term kept = env.parse("bar(a_kept_atom_name).");
+    assert(h.num_unpinned_atoms() == 102);
+    assert(table.get_stats().live == live_before + 103);
+
+    {
+	heap_gc gc(h, young_start);
+	gc.add_root(kept);
+	env.collect_garbage(gc);
+    }
+    assert(h.num_unpinned_atoms() == 2);
+    assert(table.get_stats().live == live_before + 3);
+    assert(env.to_string(kept) == "bar(a_kept_atom_name)");
+    assert(env.to_string(old) == "old(X, Y, an_old_atom_name)");
+
+    // An atom only referred to by an old cell written after the
+    // collection is kept.
+    young_start = env.heap_size();
+    term x = env.arg(old, 0);
+    env.bind(static_cast<ref_cell &>(x), env.parse("a_bound_atom_name."));
+    env.parse("baz(another_garbage_atom).");
+    {
+	heap_gc gc(h, young_start);
+	gc.add_root(kept);
+	env.collect_garbage(gc);
+    }
+    assert(table.get_stats().live == live_before + 4);
+    assert(env.to_string(old) == "old(a_bound_atom_name, Y, an_old_atom_name)");
+
+    // Once nothing refers to it, it's gone.
+    {
+	heap_gc gc(h, first_young_start);
+	env.collect_garbage(gc);
+    }
+    assert(table.get_stats().live == live_before + 3);
+    assert(env.atom_name(pinned) == "a_pinned_atom");
+    std::cout << "Atoms: " << h.num_atoms() << " (" << h.num_unpinned_atoms() << " unpinned)\n";
+}
+
+int main(int argc, char *argv[])
+{
+    test_shared_atoms();
+    test_concurrent_atoms();
+    test_atom_gc();
+    return 0;
+}
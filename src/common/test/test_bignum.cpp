@@ -0,0 +1,184 @@
+#include <iostream>
+#include <iomanip>
+#include <random>
+#include <assert.h>
+#include <boost/multiprecision/cpp_int.hpp>
+#include <common/term_env.hpp>
+#include <common/bignum.hpp>
+
+using namespace prologcoin::common;
+using namespace boost::multiprecision;
+
+static void header( const std::string &str )
+{
+    std::cout << "\n";
+    std::cout << "--- [" + str + "] " + std::string(60 - str.length(), '-') << "\n";
+    std::cout << "\n";
+}
+
+static const cpp_int INT_MIN_VALUE = cpp_int(int_cell::min().value());
+static const cpp_int INT_MAX_VALUE = cpp_int(int_cell::max().value());
+
+static term make(heap &h, const cpp_int &v)
+{
+    if (v >= INT_MIN_VALUE && v <= INT_MAX_VALUE) {
+	return int_cell(static_cast<int64_t>(v));
+    }
+    assert(v > 0);
+    return h.new_big(v, 0);
+}
+
+static cpp_int value(heap &h, term t)
+{
+    if (t.tag() == tag_t::INT) {
+	return cpp_int(static_cast<const int_cell &>(t).value());
+    }
+    assert(t.tag() == tag_t::BIG);
+    cpp_int v;
+    size_t nbits = 0;
+    h.get_big(t, v, nbits);
+
+    // Results are normalized: only values that don't fit an int_cell
+    // become BIGs and they use as few bytes as possible.
+    assert(v > INT_MAX_VALUE);
+    assert(nbits == ((msb(v) + 8) / 8) * 8);
+    return v;
+}
+
+static cpp_int random_value(std::mt19937_64 &rnd, bool allow_negative)
+{
+    size_t limbs = rnd() % 5;
+    cpp_int v = 0;
+    for (size_t i = 0; i < limbs; i++) {
+	v <<= 64;
+	v += rnd();
+    }
+    // Sometimes drop bits to get all kinds of lengths
+    if (limbs > 0) {
+	v >>= rnd() % 64;
+    }
+    if (rnd() % 4 == 0) {
+	v = rnd() % 1000;
+    }
+    if (allow_negative && v <= INT_MAX_VALUE && rnd() % 2 == 0) {
+	v = -v;
+    }
+    return v;
+}
+
+static void test_bignum_layout()
+{
+    header( "test_bignum_layout()" );
+
+    heap h;
+    bignum b(h);
+
+    // Every length between 1 and 40 bytes survives a round trip
+    for (size_t nbytes = 1; nbytes <= 40; nbytes++) {
+	cpp_int v = 0;
+	for (size_t i = 0; i < nbytes; i++) {
+	    v = (v << 8) + (0x80 | i);
+	}
+	big_cell big = h.new_big(v, 0);
+	std::vector<bignum::limb> limbs;
+	b.get_limbs(big, limbs);
+	cpp_int w = 0;
+	for (size_t i = limbs.size(); i-- > 0;) {
+	    w = (w << 64) + limbs[i];
+	}
+	assert(v == w);
+
+	big_cell big2 = b.new_big(&limbs[0], limbs.size());
+	uint64_t cost = 0;
+	assert(h.big_equal(big, big2, cost));
+    }
+}
+
+static void test_bignum_ops()
+{
+    header( "test_bignum_ops()" );
+
+    heap h;
+    bignum b(h);
+    std::mt19937_64 rnd(4711);
+
+    const size_t N = 20000;
+    size_t num_big = 0;
+    for (size_t i = 0; i < N; i++) {
+	cpp_int x = random_value(rnd, true);
+	cpp_int y = random_value(rnd, true);
+	term tx = make(h, x), ty = make(h, y);
+
+	if (x + y >= INT_MIN_VALUE) {
+	    term s = b.add(tx, ty);
+	    num_big += s.tag() == tag_t::BIG;
+	    assert(value(h, s) == x + y);
+	}
+	if (x - y >= INT_MIN_VALUE) {
+	    assert(value(h, b.sub(tx, ty)) == x - y);
+	}
+	if (x * y >= INT_MIN_VALUE) {
+	    assert(value(h, b.mul(tx, ty)) == x * y);
+	}
+	if (y != 0 && x / y >= INT_MIN_VALUE) {
+	    term q, r;
+	    b.divmod(tx, ty, q, r);
+	    assert(value(h, q) == x / y);
+	    assert(value(h, r) == x % y);
+	}
+	int c = b.compare(tx, ty);
+	assert(c == (x < y ? -1 : (x > y ? 1 : 0)));
+
+	size_t n = rnd() % 200;
+	if (x >= 0) {
+	    assert(value(h, b.shift_left(tx, n)) == (x << n));
+	    assert(value(h, b.shift_right(tx, n)) == (x >> n));
+	}
+    }
+    std::cout << "Checked " << N << " operand pairs; " << num_big << " sums were BIGs\n";
+    assert(num_big > 0);
+}
+
+static void test_bignum_errors()
+{
+    header( "test_bignum_errors()" );
+
+    heap h;
+    bignum b(h);
+
+    cpp_int big = cpp_int(1) << 100;
+    term t = make(h, big);
+
+    // There are no negative BIGs
+    bool thrown = false;
+    try {
+	b.sub(int_cell(0), t);
+    } catch (bignum_exception &ex) {
+	std::cout << "Expected: " << ex.what() << "\n";
+	thrown = true;
+    }
+    assert(thrown);
+
+    thrown = false;
+    term q, r;
+    try {
+	b.divmod(t, int_cell(0), q, r);
+    } catch (bignum_exception &ex) {
+	std::cout << "Expected: " << ex.what() << "\n";
+	thrown = true;
+    }
+    assert(thrown);
+
+    // Falls back to an int_cell once the result fits
+    term d = b.sub(t, b.sub(t, int_cell(42)));
+    assert(d.tag() == tag_t::INT);
+    assert(static_cast<const int_cell &>(d).value() == 42);
+}
+
+int main(int argc, char *argv[])
+{
+    test_bignum_layout();
+    test_bignum_ops();
+    test_bignum_errors();
+    return 0;
+}
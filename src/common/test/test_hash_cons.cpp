@@ -0,0 +1,68 @@
+#include <iostream>
+#include <iomanip>
+#include <assert.h>
+#include <common/term_env.hpp>
+
+using namespace prologcoin::common;
+
+static void header( const std::string &str )
+{
+    std::cout << "\n";
+    std::cout << "--- [" + str + "] " + std::string(60 - str.length(), '-') << "\n";
+    std::cout << "\n";
+}
+
+static void test_hash_cons()
+{
+    header( "test_hash_cons()" );
+
+    term_env env;
+
+    term t1 = env.hash_cons(env.parse("foo(X, [a,b,c], bar(1, [a,b,c])).") );
+    term t2 = env.hash_cons(env.parse("baz([a,b,c], bar(1, [a,b,c]), Y).") );
+
+    std::cout << env.to_string(t1) << "\n";
+    std::cout << env.to_string(t2) << "\n";
+
+    // Equal ground subterms are the same cells
+    assert(env.arg(t1, 1) == env.arg(t2, 0));
+    assert(env.arg(t1, 2) == env.arg(t2, 1));
+    assert(env.arg(env.arg(t1, 2), 1) == env.arg(t1, 1));
+    assert(env.get_heap().is_hash_consed(env.arg(t1, 1)));
+
+    // Non-ground terms are not shared
+    assert(!env.get_heap().is_hash_consed(t1));
+    assert(env.to_string(t1) == "foo(X, [a,b,c], bar(1, [a,b,c]))");
+    assert(env.to_string(t2) == "baz([a,b,c], bar(1, [a,b,c]), Y)");
+
+    // A ground term already known is replaced altogether
+    term t3 = env.hash_cons(env.parse("bar(1, [a,b,c])."));
+    assert(t3 == env.arg(t1, 2));
+
+    // Different shared terms don't unify
+    term t4 = env.hash_cons(env.parse("bar(1, [a,b,d])."));
+    uint64_t cost = 0;
+    assert(!env.unify(t3, t4, cost));
+    assert(!env.equal(t3, t4, cost));
+    assert(env.unify(t3, env.parse("bar(1, [A,b,c])."), cost));
+
+    // Shared terms aren't copied by copy_shared
+    term c = env.copy_shared(t1, cost);
+    assert(c != t1);
+    assert(env.arg(c, 2) == env.arg(t1, 2));
+    term c2 = env.copy(t1, cost);
+    assert(env.arg(c2, 2) != env.arg(t1, 2));
+
+    // Trimming the heap forgets the terms above
+    size_t sz = env.heap_size();
+    term t5 = env.hash_cons(env.parse("qux(1,2,3)."));
+    assert(env.get_heap().is_hash_consed(t5));
+    env.trim_heap(sz);
+    assert(!env.get_heap().is_hash_consed(t5));
+}
+
+int main(int argc, char *argv[])
+{
+    test_hash_cons();
+    return 0;
+}
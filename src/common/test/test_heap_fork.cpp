@@ -0,0 +1,77 @@
+#include <iostream>
+#include <iomanip>
+#include <assert.h>
+#include <common/term_env.hpp>
+
+using namespace prologcoin::common;
+
+static void header( const std::string &str )
+{
+    std::cout << "\n";
+    std::cout << "--- [" + str + "] " + std::string(60 - str.length(), '-') << "\n";
+    std::cout << "\n";
+}
+
+static term new_list(term_env &env, size_t n)
+{
+    term lst = env.EMPTY_LIST;
+    for (size_t i = 0; i < n; i++) {
+	lst = env.new_dotted_pair(int_cell(static_cast<int64_t>(n-i-1)), lst);
+    }
+    return lst;
+}
+
+static void test_fork()
+{
+    header( "test_fork()" );
+
+    term_env tmpl;
+
+    term t = tmpl.parse("template(X, a_long_atom_name, [1,2,3]).");
+    term lst = new_list(tmpl, heap_block::MAX_SIZE);
+    std::string t_str = tmpl.to_string(t);
+    size_t tmpl_size = tmpl.heap_size();
+
+    term_env session1, session2;
+    session1.get_heap().fork(tmpl.get_heap());
+    session2.get_heap().fork(tmpl.get_heap());
+
+    size_t n = tmpl.get_heap().num_blocks();
+    std::cout << "Blocks: " << n << " shared: "
+	      << session1.get_heap().num_shared_blocks() << "\n";
+    assert(session1.get_heap().num_shared_blocks() == n);
+    assert(session1.heap_size() == tmpl_size);
+
+    // Writes in one session are not visible elsewhere
+    uint64_t cost = 0;
+    assert(session1.unify(t, session1.parse("template(one, _, _)."), cost));
+    assert(session2.unify(t, session2.parse("template(two, _, _)."), cost));
+
+    std::cout << "Template: " << tmpl.to_string(t) << "\n";
+    std::cout << "Session1: " << session1.to_string(t) << "\n";
+    std::cout << "Session2: " << session2.to_string(t) << "\n";
+
+    assert(tmpl.to_string(t) == t_str);
+    assert(session1.to_string(t) == "template(one, a_long_atom_name, [1,2,3])");
+    assert(session2.to_string(t) == "template(two, a_long_atom_name, [1,2,3])");
+
+    // Only the blocks written to were copied
+    assert(session1.get_heap().num_shared_blocks() > 0);
+    assert(session1.get_heap().num_shared_blocks() < n);
+
+    // Unmodified blocks are still readable from all heaps
+    assert(session2.list_length(lst) == heap_block::MAX_SIZE);
+    assert(tmpl.list_length(lst) == heap_block::MAX_SIZE);
+
+    // Allocation after the fork doesn't clobber the template
+    term s1 = session1.parse("foo(bar).");
+    term s2 = tmpl.parse("baz(qux).");
+    assert(session1.to_string(s1) == "foo(bar)");
+    assert(tmpl.to_string(s2) == "baz(qux)");
+}
+
+int main(int argc, char *argv[])
+{
+    test_fork();
+    return 0;
+}
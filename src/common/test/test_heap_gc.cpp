@@ -0,0 +1,276 @@
+#include <iostream>
+#include <iomanip>
+#include <algorithm>
+#include <assert.h>
+#include <common/term_env.hpp>
+#include <common/heap_gc.hpp>
+
+using namespace prologcoin::common;
+
+static void header( const std::string &str )
+{
+    std::cout << "\n";
+    std::cout << "--- [" + str + "] " + std::string(60 - str.length(), '-') << "\n";
+    std::cout << "\n";
+}
+
+// Create a list [0,...,n-1] interleaved with some garbage
+static term new_list_with_garbage(term_env &env, size_t n)
+{
+    term lst = env.EMPTY_LIST;
+    for (size_t i = 0; i < n; i++) {
+	env.new_term(env.functor("garbage", 3));
+	lst = env.new_dotted_pair(int_cell(static_cast<int64_t>(n-i-1)), lst);
+    }
+    return lst;
+}
+
+static void test_simple_collect()
+{
+    header( "test_simple_collect()" );
+
+    term_env env;
+
+    term old = env.parse("foo(X, bar(Y), X).");
+    size_t young_start = env.heap_size();
+
+    // Garbage
+    for (size_t i = 0; i < 100; i++) {
+	env.parse("some(garbage, [1,2,3], Z).");
+    }
+    term t = env.parse("baz(A, [1,2,3|B], qux(A)).");
+    for (size_t i = 0; i < 100; i++) {
+	env.parse("some(more, garbage).");
+    }
+
+    std::string before_old = env.to_string(old);
+    std::string before = env.to_string(t);
+    size_t size_before = env.heap_size();
+
+    heap_gc gc(env.get_heap(), young_start);
+    gc.add_root(t);
+    size_t reclaimed = env.collect_garbage(gc);
+
+    std::cout << "Heap size before: " << size_before << "\n";
+    std::cout << "Heap size after : " << env.heap_size() << "\n";
+    std::cout << "Reclaimed       : " << reclaimed << "\n";
+
+    assert(reclaimed > 0);
+    assert(env.heap_size() == size_before - reclaimed);
+    assert(env.to_string(t) == before);
+    assert(env.to_string(old) == before_old);
+
+    // Variables must still be shared
+    uint64_t cost = 0;
+    term pattern = env.parse("baz(hello, _, qux(W)).");
+    assert(env.unify(t, pattern, cost));
+    std::cout << "After unify: " << env.to_string(t) << "\n";
+    assert(env.to_string(t) == "baz(hello, [1,2,3|B], qux(hello))");
+
+    auto &stats = env.get_heap().get_gc_stats();
+    assert(stats.collections == 1);
+    assert(stats.reclaimed == reclaimed);
+}
+
+static void test_old_to_young()
+{
+    header( "test_old_to_young()" );
+
+    term_env env;
+
+    term old = env.parse("foo(X, Y).");
+    size_t young_start = env.heap_size();
+
+    for (size_t i = 0; i < 1000; i++) {
+	env.new_term(env.functor("garbage", 2));
+    }
+    term young = env.parse("young(1, [a,b,c], Z).");
+
+    // Bind X (old) to a term on the young side. No root refers to
+    // the young term, so it must be found by scanning the old side.
+    term x = env.arg(old, 0);
+    env.bind(static_cast<ref_cell &>(x), young);
+    young = term();
+
+    std::string before = env.to_string(old);
+    std::cout << "Before: " << before << "\n";
+
+    heap_gc gc(env.get_heap(), young_start);
+    size_t reclaimed = env.collect_garbage(gc);
+
+    std::cout << "After : " << env.to_string(old) << "\n";
+    std::cout << "Reclaimed: " << reclaimed << "\n";
+    assert(reclaimed >= 1000*3);
+    assert(env.to_string(old) == before);
+}
+
+static void test_bignum_and_blocks()
+{
+    header( "test_bignum_and_blocks()" );
+
+    term_env env;
+
+    size_t young_start = env.heap_size();
+
+    // Enough cells to span several heap blocks.
+    const size_t n = heap_block::MAX_SIZE / 2;
+    term lst = new_list_with_garbage(env, n);
+
+    term big = env.parse("16'102030405060708090A0B0C0D0E0f0.");
+    std::string big_str = env.to_string(big);
+    env.new_term(env.functor("garbage", 5));
+    term pair = env.new_term(env.functor("pair", 2), {lst, big});
+
+    size_t size_before = env.heap_size();
+
+    heap_gc gc(env.get_heap(), young_start);
+    gc.add_root(pair);
+    size_t reclaimed = env.collect_garbage(gc);
+
+    std::cout << "Heap size before: " << size_before << "\n";
+    std::cout << "Heap size after : " << env.heap_size() << "\n";
+    std::cout << "Live cells      : " << gc.num_live() << "\n";
+
+    assert(reclaimed > 0);
+    assert(env.heap_size() < size_before);
+
+    // Check list
+    term l = env.arg(pair, 0);
+    size_t i = 0;
+    while (env.is_dotted_pair(l)) {
+	term h = env.arg(l, 0);
+	assert(h == int_cell(static_cast<int64_t>(i)));
+	l = env.arg(l, 1);
+	i++;
+    }
+    assert(i == n);
+
+    // Check bignum
+    std::cout << "Bignum: " << env.to_string(env.arg(pair, 1)) << "\n";
+    assert(env.to_string(env.arg(pair, 1)) == big_str);
+
+    // Heap must still be usable
+    term more = new_list_with_garbage(env, 1000);
+    assert(env.list_length(more) == 1000);
+}
+
+static void test_ext_roots()
+{
+    header( "test_ext_roots()" );
+
+    term_env env;
+    auto &h = env.get_heap();
+
+    size_t young_start = env.heap_size();
+    for (size_t i = 0; i < 100; i++) {
+	env.parse("some(garbage, [1,2,3], Z).");
+    }
+    ext<term> t(h, env.parse("foo(bar, [4,5,6])."));
+    std::string before = env.to_string(*t);
+
+    {
+	// Temporary handles reuse their slots
+	for (size_t i = 0; i < 10; i++) {
+	    ext<term> tmp(h, *t);
+	    ext<term> tmp2(tmp);
+	}
+	auto &stats = h.get_ext_stats();
+	std::cout << "Live: " << stats.live << " Max: " << stats.max
+		  << " Registrations: " << stats.registrations << "\n";
+	assert(stats.live == 1);
+	assert(stats.max == 3);
+	assert(stats.registrations == 21);
+    }
+
+    ext<term> dead;
+    {
+	ext<term> gone(h, env.parse("gone(forever)."));
+	dead = gone;
+    }
+    dead = ext<term>();
+    assert(h.external_ptr_count() == 1);
+
+    for (size_t i = 0; i < 100; i++) {
+	env.parse("some(more, garbage).");
+    }
+
+    // The GC finds (and relocates) registered roots by itself
+    heap_gc gc(h, young_start);
+    size_t reclaimed = env.collect_garbage(gc);
+    std::cout << "Reclaimed: " << reclaimed << "\n";
+    assert(reclaimed > 0);
+    assert(env.to_string(*t) == before);
+    term moved = *t;
+    assert(static_cast<ptr_cell &>(moved).index() < young_start + 20);
+}
+
+static void test_remembered_set()
+{
+    header( "test_remembered_set()" );
+
+    term_env env;
+    auto &h = env.get_heap();
+
+    term old = env.parse("foo(X, Y).");
+    size_t young_start = env.heap_size();
+    for (size_t i = 0; i < 1000; i++) {
+	env.parse("some(garbage, [1,2,3], Z).");
+    }
+
+    // Everything below the end of the heap is old after a collection,
+    // and written old cells are remembered from then on.
+    {
+	heap_gc gc(h, young_start);
+	env.collect_garbage(gc);
+    }
+    assert(h.remember_below() == env.heap_size());
+    size_t num_remembered = h.remembered().size();
+
+    young_start = env.heap_size();
+    for (size_t i = 0; i < 1000; i++) {
+	env.new_term(env.functor("garbage", 2));
+    }
+    term young = env.parse("young(1, [a,b,c], Z).");
+    term x = env.arg(old, 0);
+    size_t x_addr = static_cast<ref_cell &>(x).index();
+    env.bind(static_cast<ref_cell &>(x), young);
+    young = term();
+    assert(h.remembered().size() == num_remembered + 1);
+    assert(h.remembered().back() == x_addr);
+
+    std::string before = env.to_string(old);
+    {
+	heap_gc gc(h, young_start);
+	size_t reclaimed = env.collect_garbage(gc);
+	std::cout << "Reclaimed: " << reclaimed << "\n";
+	assert(reclaimed >= 1000*3);
+	assert(env.to_string(old) == before);
+    }
+
+    // X still refers to a younger cell, so it's kept for a collection
+    // whose young generation starts below that cell.
+    auto &r = h.remembered();
+    assert(std::find(r.begin(), r.end(), x_addr) != r.end());
+    size_t live_end = env.heap_size();
+    for (size_t i = 0; i < 100; i++) {
+	env.new_term(env.functor("garbage", 2));
+    }
+    size_t garbage = env.heap_size() - live_end;
+    {
+	heap_gc gc(h, young_start);
+	size_t reclaimed = env.collect_garbage(gc);
+	assert(reclaimed == garbage);
+	assert(env.to_string(old) == before);
+    }
+}
+
+int main( int argc, char *argv[] )
+{
+    test_simple_collect();
+    test_old_to_young();
+    test_bignum_and_blocks();
+    test_ext_roots();
+    test_remembered_set();
+
+    return 0;
+}
@@ -0,0 +1,93 @@
+#include <iostream>
+#include <iomanip>
+#include <assert.h>
+#include <unistd.h>
+#include <common/term_env.hpp>
+
+using namespace prologcoin::common;
+
+static void header( const std::string &str )
+{
+    std::cout << "\n";
+    std::cout << "--- [" + str + "] " + std::string(60 - str.length(), '-') << "\n";
+    std::cout << "\n";
+}
+
+static std::string backing_file()
+{
+    return "/tmp/test_heap_paging_" + boost::lexical_cast<std::string>(getpid()) + ".dat";
+}
+
+static term new_list(term_env &env, size_t n)
+{
+    term lst = env.EMPTY_LIST;
+    for (size_t i = 0; i < n; i++) {
+	lst = env.new_dotted_pair(int_cell(static_cast<int64_t>(n-i-1)), lst);
+    }
+    return lst;
+}
+
+static bool check_list(term_env &env, term lst, size_t n)
+{
+    for (size_t i = 0; i < n; i++) {
+	if (!env.is_dotted_pair(lst)) {
+	    return false;
+	}
+	term x = env.arg(lst, 0);
+	if (x != int_cell(static_cast<int64_t>(i))) {
+	    return false;
+	}
+	lst = env.arg(lst, 1);
+    }
+    return lst == env.EMPTY_LIST;
+}
+
+static void test_paged_heap()
+{
+    header( "test_paged_heap()" );
+
+    term_env env;
+    auto &h = env.get_heap();
+
+    term first = env.parse("foo(X, bar(Y), X).");
+    std::string first_str = env.to_string(first);
+
+    h.set_paging(backing_file(), 4);
+    assert(h.is_paged());
+    assert(access(backing_file().c_str(), F_OK) != 0);
+
+    // Large enough to span many more blocks than can be resident
+    const size_t n = 4 * heap_block::MAX_SIZE;
+    term lst = new_list(env, n);
+
+    h.print_status(std::cout);
+
+    auto &stats = h.get_paging_stats();
+    assert(stats.resident <= 4);
+    assert(stats.evictions > 0);
+
+    // Walking the list faults the blocks back in
+    assert(check_list(env, lst, n));
+    assert(env.to_string(first) == first_str);
+    h.print_status(std::cout);
+    assert(stats.faults > 0);
+    assert(stats.resident <= 4);
+
+    // Bindings in evicted blocks survive
+    uint64_t cost = 0;
+    assert(env.unify(first, env.parse("foo(hello, _, _)."), cost));
+    new_list(env, n);
+    assert(env.to_string(first) == "foo(hello, bar(Y), hello)");
+
+    // Shrinking the heap releases blocks
+    env.trim_heap(heap_block::MAX_SIZE + 10);
+    h.print_status(std::cout);
+    assert(stats.resident <= 2);
+    assert(env.to_string(first) == "foo(hello, bar(Y), hello)");
+}
+
+int main(int argc, char *argv[])
+{
+    test_paged_heap();
+    return 0;
+}
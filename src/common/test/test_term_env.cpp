@@ -321,6 +321,86 @@ static void test_list_string()
     assert(back == str);
 }
 
+static void test_unify_instance()
+{
+    header( "test_unify_instance()" );
+
+    term_env env;
+
+    term pattern = env.parse("foo(X, bar(X, Y), Y, baz(Z)).");
+    term goal = env.parse("foo(1, B, 2, C).");
+
+    std::unordered_map<term, term> var_map;
+    uint64_t cost = 0;
+    assert(env.unify_instance(pattern, goal, var_map, cost));
+
+    std::cout << "Pattern: " << env.to_string(pattern) << "\n";
+    std::cout << "Goal   : " << env.to_string(goal) << "\n";
+
+    // The pattern itself is never bound
+    assert(env.to_string(pattern) == "foo(X, bar(X, Y), Y, baz(Z))");
+    assert(env.to_string(goal) == "foo(1, bar(1, 2), 2, baz(Z))");
+
+    // Copying with the same map completes the instance
+    term inst = env.copy_shared(pattern, var_map, cost);
+    assert(env.equal(inst, goal, cost));
+
+    // A failed match leaves no bindings behind
+    term goal2 = env.parse("foo(1, bar(2, D), E, F).");
+    size_t tr = env.trail_size();
+    var_map.clear();
+    assert(!env.unify_instance(pattern, goal2, var_map, cost));
+    assert(env.trail_size() == tr);
+    assert(env.to_string(goal2) == "foo(1, bar(2, D), E, F)");
+    assert(env.to_string(pattern) == "foo(X, bar(X, Y), Y, baz(Z))");
+}
+
+static void test_quotas()
+{
+    header( "test_quotas()" );
+
+    term_env env;
+
+    // The heap is only checked when a new block is needed
+    size_t quota = env.heap_size() + heap_block::MAX_SIZE / 2;
+    env.get_heap().set_max_size(quota);
+    bool thrown = false;
+    size_t n = 0;
+    try {
+	while (n < 2*heap_block::MAX_SIZE) {
+	    env.new_term(env.functor("f", 3));
+	    n++;
+	}
+    } catch (quota_exception &ex) {
+	std::cout << "Expected: " << ex.what() << " (after " << n << " terms)\n";
+	thrown = true;
+    }
+    assert(thrown);
+    assert(env.heap_size() >= quota);
+    assert(env.heap_size() < quota + heap_block::MAX_SIZE);
+
+    // The trail
+    env.set_max_trail(100);
+    thrown = false;
+    n = 0;
+    try {
+	while (n < 1000) {
+	    env.push_trail(n);
+	    n++;
+	}
+    } catch (quota_exception &ex) {
+	std::cout << "Expected: " << ex.what() << "\n";
+	thrown = true;
+    }
+    assert(thrown);
+    assert(n == 100);
+
+    // Removing the quota
+    env.set_max_trail(0);
+    env.push_trail(n);
+    assert(env.trail_size() == 101);
+}
+
 int main( int argc, char *argv[] )
 {
     test_simple_env();
@@ -333,6 +413,8 @@ int main( int argc, char *argv[] )
     test_dfs_iterator();
     test_copy_term_heaps();
     test_list_string();
+    test_unify_instance();
+    test_quotas();
 
     return 0;
 }
@@ -0,0 +1,118 @@
+#include <iostream>
+#include <iomanip>
+#include <unordered_set>
+#include <assert.h>
+#include <common/term_env.hpp>
+
+using namespace prologcoin::common;
+
+static void header( const std::string &str )
+{
+    std::cout << "\n";
+    std::cout << "--- [" + str + "] " + std::string(60 - str.length(), '-') << "\n";
+    std::cout << "\n";
+}
+
+static void test_hash_equal_terms()
+{
+    header( "test_hash_equal_terms()" );
+
+    term_env env;
+
+    term t1 = env.parse("foo(bar(1, [a,b,c]), \"text\", 123456789012345678901234567890).");
+    term t2 = env.parse("foo(bar(1, [a,b,c]), \"text\", 123456789012345678901234567890).");
+    assert(t1 != t2);
+    assert(env.hash(t1) == env.hash(t2));
+
+    // Bound variables hash as their values
+    term t3 = env.parse("foo(X, \"text\", 123456789012345678901234567890).");
+    uint64_t cost = 0;
+    assert(env.unify(env.arg(t3, 0), env.parse("bar(1, [a,b,c])."), cost));
+    assert(env.hash(t3) == env.hash(t1));
+}
+
+static void test_hash_collisions()
+{
+    header( "test_hash_collisions()" );
+
+    term_env env;
+
+    // Argument order matters (the sum of cells didn't.)
+    assert(env.hash(env.parse("f(1,2).")) != env.hash(env.parse("f(2,1).")));
+    assert(env.hash(env.parse("f(g(a),b).")) != env.hash(env.parse("f(a,g(b)).")));
+
+    std::unordered_set<uint64_t> hashes;
+    size_t n = 0;
+    for (int64_t i = 0; i < 100; i++) {
+	for (int64_t j = 0; j < 100; j++) {
+	    term t = env.new_term(env.functor("f", 2));
+	    env.set_arg(t, 0, int_cell(i));
+	    env.set_arg(t, 1, int_cell(j));
+	    hashes.insert(env.hash(t));
+	    n++;
+	}
+    }
+    std::cout << "Terms: " << n << " Distinct hashes: " << hashes.size() << "\n";
+    assert(hashes.size() == n);
+}
+
+static size_t index_of(term t)
+{
+    return static_cast<const str_cell &>(t).index();
+}
+
+static void test_hash_cache()
+{
+    header( "test_hash_cache()" );
+
+    term_env env;
+    auto &h = env.get_heap();
+
+    term t = env.parse("foo(bar(1,2), baz([x,y]), Z).");
+    size_t before = h.hash_cache_size();
+    uint64_t h1 = env.hash(t);
+
+    // The ground subterms are cached, but not the term with a variable
+    std::cout << "Cached: " << h.hash_cache_size() - before << "\n";
+    assert(h.hash_cache_size() > before);
+    uint64_t hc;
+    assert(h.find_cached_hash(index_of(env.arg(t, 0)), hc));
+    assert(!h.find_cached_hash(index_of(t), hc));
+
+    // Binding the variable changes the hash. With a choice point
+    // (HB above the term) the binding may be undone, so the now
+    // ground looking term isn't cached.
+    size_t tr = env.trail_size();
+    env.set_register_hb(env.heap_size());
+    uint64_t cost = 0;
+    assert(env.unify(env.arg(t, 2), int_cell(42), cost));
+    uint64_t h2 = env.hash(t);
+    assert(h1 != h2);
+    assert(!h.find_cached_hash(index_of(t), hc));
+    env.unwind_trail(tr, env.trail_size());
+    assert(env.hash(t) == h1);
+    env.set_register_hb(0);
+
+    // Hash consed terms never change, so they are always cached
+    term g = env.hash_cons(env.parse("g(h(1), k(2))."));
+    env.set_register_hb(env.heap_size());
+    env.hash(g);
+    assert(h.find_cached_hash(index_of(g), hc));
+    env.set_register_hb(0);
+
+    // Trimming invalidates the cache
+    size_t sz = env.heap_size();
+    term u = env.parse("qux(1,2,3).");
+    env.hash(u);
+    assert(h.find_cached_hash(index_of(u), hc));
+    env.trim_heap(sz);
+    assert(!h.find_cached_hash(index_of(u), hc));
+}
+
+int main(int argc, char *argv[])
+{
+    test_hash_equal_terms();
+    test_hash_collisions();
+    test_hash_cache();
+    return 0;
+}
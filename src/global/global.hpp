@@ -49,6 +49,14 @@ public:
     inline global_interpreter & interp() {
         return interp_;
     }
+
+    // The global state can be larger than available memory. Keep at
+    // most 'max_resident_blocks' heap blocks in memory; the rest live
+    // in 'file'.
+    inline void set_heap_paging(const std::string &file,
+				size_t max_resident_blocks) {
+        interp_.get_heap().set_paging(file, max_resident_blocks);
+    }
   
 private:
     global_interpreter interp_;
@@ -6,26 +6,75 @@ namespace prologcoin { namespace interp {
 
     using namespace prologcoin::common;
 
-    int_cell arithmetics_fn::get_int(const term &t)
+    bignum & arithmetics_fn::big(interpreter_base &interp)
     {
+	return interp.arith().big();
+    }
+
+    int64_t arithmetics_fn::get_shift(interpreter_base &interp, const term &t)
+    {
+	if (t.tag() != tag_t::INT) {
+	    interp.abort(interpreter_exception_wrong_arg_type(
+			     "Shift amount is not a small integer: " +
+			     interp.safe_to_string(t)));
+	}
 	cell c = t;
-	const int_cell &ic = static_cast<const int_cell &>(c);
-	return ic;
+	return static_cast<const int_cell &>(c).value();
     }
 
     term arithmetics_fn::plus_2(interpreter_base &interp, term *args)
     {
-	return get_int(args[0]) + get_int(args[1]);
+	return big(interp).add(args[0], args[1]);
     }
 
     term arithmetics_fn::minus_2(interpreter_base &interp, term *args)
     {
-	return get_int(args[0]) - get_int(args[1]);
+	return big(interp).sub(args[0], args[1]);
     }
 
     term arithmetics_fn::times_2(interpreter_base &interp, term *args)
     {
-	return get_int(args[0]) * get_int(args[1]);
+	return big(interp).mul(args[0], args[1]);
+    }
+
+    term arithmetics_fn::int_div_2(interpreter_base &interp, term *args)
+    {
+	term q, r;
+	big(interp).divmod(args[0], args[1], q, r);
+	return q;
+    }
+
+    term arithmetics_fn::mod_2(interpreter_base &interp, term *args)
+    {
+	// Unlike rem, the result has the sign of the divisor
+	term q, r;
+	auto &b = big(interp);
+	b.divmod(args[0], args[1], q, r);
+	int_cell zero(0);
+	if (b.compare(r, zero) != 0 &&
+	    (b.compare(r, zero) < 0) != (b.compare(args[1], zero) < 0)) {
+	    r = b.add(r, args[1]);
+	}
+	return r;
+    }
+
+    term arithmetics_fn::shift_left_2(interpreter_base &interp, term *args)
+    {
+	int64_t n = get_shift(interp, args[1]);
+	return n >= 0 ? big(interp).shift_left(args[0], n)
+	              : big(interp).shift_right(args[0], -n);
+    }
+
+    term arithmetics_fn::shift_right_2(interpreter_base &interp, term *args)
+    {
+	int64_t n = get_shift(interp, args[1]);
+	return n >= 0 ? big(interp).shift_right(args[0], n)
+	              : big(interp).shift_left(args[0], -n);
+    }
+
+    arithmetics::arithmetics(interpreter_base &interp)
+	: interp_(interp), big_(interp.get_heap()), debug_(false)
+    {
     }
 
     void arithmetics::load_fn(const std::string &name, size_t arity, arithmetics::fn fn)
@@ -42,6 +91,10 @@ namespace prologcoin { namespace interp {
         load_fn("+", 2, &arithmetics_fn::plus_2);
         load_fn("-", 2, &arithmetics_fn::minus_2);
         load_fn("*", 2, &arithmetics_fn::times_2);
+        load_fn("//", 2, &arithmetics_fn::int_div_2);
+        load_fn("mod", 2, &arithmetics_fn::mod_2);
+        load_fn("<<", 2, &arithmetics_fn::shift_left_2);
+        load_fn(">>", 2, &arithmetics_fn::shift_right_2);
     }
 
     void arithmetics::unload()
@@ -93,7 +146,12 @@ namespace prologcoin { namespace interp {
 		    }
 		    std::cout << ")\n";
 		}
-		result = fn_call(interp_, &args_[off]);
+		try {
+		    result = fn_call(interp_, &args_[off]);
+		} catch (bignum_exception &ex) {
+		    interp_.abort(interpreter_exception_evaluation(
+				      context + ": " + ex.what()));
+		}
 		args_.resize(off);
 		interp_.push(result);
 		interp_.push(int_cell(1));
@@ -131,6 +189,30 @@ namespace prologcoin { namespace interp {
 	return result;
     }
 
+    int arithmetics::compare(term &lhs, term &rhs,
+			     const std::string &context)
+    {
+	term a = eval(lhs, context);
+	term b = eval(rhs, context);
+	return big_.compare(a, b);
+    }
+
+    term arithmetics::apply(con_cell f, term *args,
+			    const std::string &context)
+    {
+	load_fns();
+
+	auto fn_call = lookup(f);
+	assert(fn_call != nullptr);
+	try {
+	    return fn_call(interp_, args);
+	} catch (bignum_exception &ex) {
+	    interp_.abort(interpreter_exception_evaluation(
+			      context + ": " + ex.what()));
+	    return args[0];
+	}
+    }
+
     //
     // Simple
     //
@@ -4,6 +4,7 @@
 #define _interp_arithmetics_hpp
 
 #include "../common/term.hpp"
+#include "../common/bignum.hpp"
 
 namespace prologcoin { namespace interp {
     class interpreter_base;
@@ -13,8 +14,13 @@ namespace prologcoin { namespace interp {
 	static common::term plus_2(interpreter_base &interp, common::term *args);
 	static common::term minus_2(interpreter_base &interp, common::term *args);
 	static common::term times_2(interpreter_base &interp, common::term *args);
+	static common::term int_div_2(interpreter_base &interp, common::term *args);
+	static common::term mod_2(interpreter_base &interp, common::term *args);
+	static common::term shift_left_2(interpreter_base &interp, common::term *args);
+	static common::term shift_right_2(interpreter_base &interp, common::term *args);
     private:
-	static common::int_cell get_int(const common::term &t);
+	static common::bignum & big(interpreter_base &interp);
+	static int64_t get_shift(interpreter_base &interp, const common::term &t);
     };
 
 
@@ -23,15 +29,25 @@ namespace prologcoin { namespace interp {
 				            common::term *args)> fn;
 
     public:
-        arithmetics(interpreter_base &interp) : interp_(interp), debug_(false)
- 	   { }
+        arithmetics(interpreter_base &interp);
 
 	inline void set_debug(bool dbg) { debug_ = dbg; }
 
+	inline common::bignum & big() { return big_; }
+
 	void unload();
 
 	common::term eval(common::term &expr, const std::string &context);
 
+	// Evaluate both sides and compare them (-1, 0 or 1)
+	int compare(common::term &lhs, common::term &rhs,
+		    const std::string &context);
+
+	// Apply a function to evaluated arguments (used by compiled
+	// arithmetics when it can't stay with small integers.)
+	common::term apply(common::con_cell f, common::term *args,
+			   const std::string &context);
+
     private:
 	void load_fn(const std::string &name, size_t arity, fn f);
 	void load_fns();
@@ -44,6 +60,7 @@ namespace prologcoin { namespace interp {
 					  const std::string &context);
 
 	interpreter_base &interp_;
+	common::bignum big_;
 	std::vector<common::term> args_;
 
 	std::unordered_map<common::con_cell, fn> fn_map_;
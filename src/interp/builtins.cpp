@@ -1,8 +1,10 @@
 #include "builtins.hpp"
 #include "interpreter_base.hpp"
 #include "wam_interpreter.hpp"
+#include "sorter.hpp"
 #include <stdarg.h>
 #include <boost/algorithm/string.hpp>
+#include <fstream>
 #include <memory>
 #include <set>
 
@@ -20,6 +22,139 @@ namespace prologcoin { namespace interp {
 	return true;
     }
 
+    //
+    // profile_on/0 starts counting calls, redos, exits and fails per
+    // predicate. profile_sample/1 also samples the stacks every given
+    // number of microseconds (of CPU time.) Only one interpreter at a
+    // time can sample, so it's loaded with the file I/O builtins.
+    //
+    bool builtins::profile_on_0(interpreter_base &interp, size_t arity, common::term args[])
+    {
+	interp.get_profiler().start(0);
+	return true;
+    }
+
+    bool builtins::profile_sample_1(interpreter_base &interp, size_t arity, common::term args[])
+    {
+	term t = args[0];
+	if (t.tag() != tag_t::INT || reinterpret_cast<int_cell &>(t).value() <= 0) {
+	    interp.abort(interpreter_exception_wrong_arg_type("profile_sample/1: Argument must be a positive integer (microseconds); found " + interp.to_string(t)));
+	}
+	auto interval = static_cast<size_t>(reinterpret_cast<int_cell &>(t).value());
+	if (interp.get_profiler().is_timer_taken()) {
+	    interp.abort(interpreter_exception_resource("profile_sample/1: Another interpreter is already sampling"));
+	}
+	if (!interp.get_profiler().start(interval)) {
+	    interp.abort(interpreter_exception_unsupported("profile_sample/1: Sampling is not supported on this platform"));
+	}
+	return true;
+    }
+
+    bool builtins::profile_off_0(interpreter_base &interp, size_t arity, common::term args[])
+    {
+	interp.get_profiler().stop();
+	return true;
+    }
+
+    bool builtins::profile_reset_0(interpreter_base &interp, size_t arity, common::term args[])
+    {
+	interp.get_profiler().reset();
+	return true;
+    }
+
+    //
+    // profile_data(Name/Arity, [calls-C,redos-R,exits-E,fails-F,self-S,total-T])
+    // (times in milliseconds)
+    //
+    bool builtins::profile_data_2(interpreter_base &interp, size_t arity, common::term args[])
+    {
+	static const con_cell SLASH("/", 2);
+	static const con_cell MINUS("-", 2);
+
+	term pi = args[0];
+	if (pi.tag() != tag_t::STR || interp.functor(pi) != SLASH ||
+	    interp.arg(pi, 1).tag() != tag_t::INT ||
+	    !interp.is_atom(interp.arg(pi, 0))) {
+	    interp.abort(interpreter_exception_wrong_arg_type("profile_data/2: First argument must be a predicate indicator Name/Arity; found " + interp.to_string(pi)));
+	}
+	term name = interp.arg(pi, 0);
+	term ar = interp.arg(pi, 1);
+	auto f = interp.functor(interp.atom_name(name), static_cast<size_t>(reinterpret_cast<int_cell &>(ar).value()));
+
+	profiler::counters none;
+	auto &prof = interp.get_profiler();
+	auto *c = prof.get_counters(f);
+	if (c == nullptr) c = &none;
+
+	std::pair<const char *, uint64_t> data[] = {
+	    { "calls", c->calls }, { "redos", c->redos },
+	    { "exits", c->exits }, { "fails", c->fails() },
+	    { "self", prof.to_ms(c->self_samples) },
+	    { "total", prof.to_ms(c->total_samples) } };
+
+	term lst = interpreter_base::EMPTY_LIST;
+	for (size_t i = sizeof(data)/sizeof(data[0]); i > 0; i--) {
+	    auto &d = data[i-1];
+	    term kv = interp.new_term(MINUS, {interp.atom(d.first), int_cell(static_cast<int64_t>(d.second))});
+	    lst = interp.new_dotted_pair(kv, lst);
+	}
+	return interp.unify(args[1], lst);
+    }
+
+    //
+    // profile_flamegraph(File) writes the sampled stacks in the
+    // collapsed format (for flamegraph.pl.)
+    //
+    bool builtins::profile_flamegraph_1(interpreter_base &interp, size_t arity, common::term args[])
+    {
+	term file = args[0];
+	if (!interp.is_atom(file)) {
+	    interp.abort(interpreter_exception_wrong_arg_type("profile_flamegraph/1: Argument must be an atom; found " + interp.to_string(file)));
+	}
+	std::string path = interp.get_full_path(interp.atom_name(file));
+	std::ofstream out(path);
+	if (!out) {
+	    interp.abort(interpreter_exception_file_not_found("profile_flamegraph/1: Could not open '" + path + "'"));
+	}
+	interp.get_profiler().print_collapsed(out);
+	return true;
+    }
+
+    //
+    // statistics(Key, Value) for Key in runtime/walltime ([Total,SinceLast]
+    // in milliseconds), inferences, heap (cells) and trail (entries.)
+    //
+    bool builtins::statistics_2(interpreter_base &interp, size_t arity, common::term args[])
+    {
+	term key = args[0];
+	if (!interp.is_atom(key)) {
+	    interp.abort(interpreter_exception_wrong_arg_type("statistics/2: First argument must be an atom; found " + interp.to_string(key)));
+	}
+	std::string name = interp.atom_name(key);
+	auto &prof = interp.get_profiler();
+	uint64_t total, since_last;
+	term value;
+	if (name == "runtime" || name == "walltime") {
+	    if (name == "runtime") {
+		prof.runtime(total, since_last);
+	    } else {
+		prof.walltime(total, since_last);
+	    }
+	    value = interp.new_dotted_pair(int_cell(static_cast<int64_t>(total)),
+		      interp.new_dotted_pair(int_cell(static_cast<int64_t>(since_last)),
+					     interpreter_base::EMPTY_LIST));
+	} else if (name == "inferences") {
+	    value = int_cell(static_cast<int64_t>(interp.num_inferences()));
+	} else if (name == "heap") {
+	    value = int_cell(static_cast<int64_t>(interp.heap_size()));
+	} else if (name == "trail") {
+	    value = int_cell(static_cast<int64_t>(interp.trail_size()));
+	} else {
+	    interp.abort(interpreter_exception_wrong_arg_type("statistics/2: Unknown key " + name));
+	}
+	return interp.unify(args[1], value);
+    }
+
     //
     // debug_on/0
     //
@@ -38,6 +173,17 @@ namespace prologcoin { namespace interp {
 	return true;
     }	
 
+    //
+    // Memory
+    //
+
+    // A major collection takes place at the next safe point.
+    bool builtins::garbage_collect_0(interpreter_base &interp, size_t arity, common::term args[])
+    {
+	interp.request_gc();
+	return true;
+    }
+
     //
     // Simple
     //
@@ -324,7 +470,7 @@ namespace prologcoin { namespace interp {
 	 }
        }
        boost::to_upper(s);
-       term r = interp.atom(s);
+       term r = interp.atom(s, false);
        bool ok = interp.unify(to, r);
        return ok;
    }
@@ -502,6 +648,36 @@ namespace prologcoin { namespace interp {
 	return ok;
     }	
 
+    bool builtins::operator_less_than(interpreter_base &interp, size_t arity, common::term args[])
+    {
+	return interp.arith().compare(args[0], args[1], "</2") < 0;
+    }
+
+    bool builtins::operator_equals_less_than(interpreter_base &interp, size_t arity, common::term args[])
+    {
+	return interp.arith().compare(args[0], args[1], "=</2") <= 0;
+    }
+
+    bool builtins::operator_greater_than(interpreter_base &interp, size_t arity, common::term args[])
+    {
+	return interp.arith().compare(args[0], args[1], ">/2") > 0;
+    }
+
+    bool builtins::operator_greater_than_equals(interpreter_base &interp, size_t arity, common::term args[])
+    {
+	return interp.arith().compare(args[0], args[1], ">=/2") >= 0;
+    }
+
+    bool builtins::operator_arith_equals(interpreter_base &interp, size_t arity, common::term args[])
+    {
+	return interp.arith().compare(args[0], args[1], "=:=/2") == 0;
+    }
+
+    bool builtins::operator_arith_not_equals(interpreter_base &interp, size_t arity, common::term args[])
+    {
+	return interp.arith().compare(args[0], args[1], "=\\=/2") != 0;
+    }
+
     //
     // Analyzing & constructing terms
     //
@@ -516,8 +692,11 @@ namespace prologcoin { namespace interp {
 	}
     }
 
+    // The cells stored just before allocating the choice point are
+    // found below its heap mark (the heap may have grown beyond it
+    // when asserting clauses.)
     void builtins::restore_p_from_heap_if_wam(interpreter_base &interp) {
-	auto c = interp.get_heap()[interp.heap_size()-1];
+	auto c = interp.heap_get(interp.b()->h-1);
 	if (c.tag() == tag_t::INT) {
 	    wam_interpreter &wami = reinterpret_cast<wam_interpreter &>(interp);
 	    auto ic = static_cast<int_cell &>(c).value();
@@ -528,7 +707,7 @@ namespace prologcoin { namespace interp {
 
     bool builtins::arg_3_cp(interpreter_base &interp, size_t arity, common::term args[])
     {
-	auto arg_index_term = interp.get_heap()[interp.heap_size()-2];
+	auto arg_index_term = interp.heap_get(interp.b()->h-2);
 	auto arg_index = static_cast<int_cell &>(arg_index_term).value();
 	term t = args[1];
 	size_t n = interp.functor(t).arity();
@@ -537,7 +716,7 @@ namespace prologcoin { namespace interp {
 	    interp.b()->bp = code_point::fail();
 	    return false;
 	}
-	interp.get_heap()[interp.heap_size()-2] = int_cell(arg_index);
+	interp.get_heap()[interp.b()->h-2] = int_cell(arg_index);
 	restore_p_from_heap_if_wam(interp);
 	interp.unify(args[0], int_cell(arg_index+1));
 	term val = interp.arg(t, arg_index);
@@ -741,49 +920,97 @@ namespace prologcoin { namespace interp {
 	return interp.unify(rhs, lst);
     }
 
-    bool builtins::sort_2(interpreter_base &interp, size_t arity, term args[])
+    bool builtins::sort_list(interpreter_base &interp, term args[],
+			     const std::string &context, size_t key,
+			     bool descending, bool dedup)
     {
-        term arg0 = args[0];
-	term arg1 = args[1];
+	term lst = args[0];
 
-	if (arg0.tag() == tag_t::REF) {
-            interp.abort(interpreter_exception_not_sufficiently_instantiated("sort/2: Arguments are not sufficiently instantiated"));
-	}
+	sorter s(interp);
+	std::vector<term> elems;
+	s.get_elements(lst, elems, context);
 
-	if (!interp.is_list(arg0)) {
-            interp.abort(interpreter_exception_not_sufficiently_instantiated("sort/2: First argument is not a list; found " + interp.to_string(arg0)));
-	}
+	interp.add_accumulated_cost(interp.cost(lst));
 
-	interp.add_accumulated_cost(interp.cost(arg0));
+	if (key != 0) {
+	    for (auto &el : elems) {
+		term t = interp.deref(el);
+		if (t.tag() != tag_t::STR || interp.functor(t).arity() < key) {
+		    interp.abort(interpreter_exception_wrong_arg_type(context + ": Element has no argument " + boost::lexical_cast<std::string>(key) + "; found " + interp.to_string(t)));
+		}
+	    }
+	}
 
-	size_t n = interp.list_length(arg0);
+	s.sort(elems, key, descending, dedup);
 
-	std::vector<term> vec(n);
+	term r = interp.new_list(elems, interpreter_base::EMPTY_LIST);
+	return interp.unify(args[1], r);
+    }
 
-	for (size_t i = 0; i < n; i++) {
-	    term el = interp.arg(arg0, 0);
-	    vec[i] = el;
-	    arg0 = interp.arg(arg0, 1);
-	}
+    bool builtins::sort_2(interpreter_base &interp, size_t arity, term args[])
+    {
+	return sort_list(interp, args, "sort/2", 0, false, true);
+    }
 
-	std::stable_sort(vec.begin(), vec.end(),
-			 [&](const term &t1, const term &t2)
-			 { return interp.standard_order(t1,t2) < 0; } );
+    bool builtins::msort_2(interpreter_base &interp, size_t arity, term args[])
+    {
+	return sort_list(interp, args, "msort/2", 0, false, false);
+    }
 
-	vec.erase( std::unique(vec.begin(), vec.end()), vec.end());
-	n = vec.size();
+    bool builtins::keysort_2(interpreter_base &interp, size_t arity, term args[])
+    {
+	static const con_cell minus("-", 2);
 
-	// Build list from vector
+	term lst = interp.deref(args[0]);
+	while (interp.is_dotted_pair(lst)) {
+	    term el = interp.deref(interp.arg(lst, 0));
+	    if (el.tag() == tag_t::REF) {
+		interp.abort(interpreter_exception_not_sufficiently_instantiated("keysort/2: Arguments are not sufficiently instantiated"));
+	    }
+	    if (el.tag() != tag_t::STR || interp.functor(el) != minus) {
+		interp.abort(interpreter_exception_wrong_arg_type("keysort/2: Element is not a pair Key-Value; found " + interp.to_string(el)));
+	    }
+	    lst = interp.deref(interp.arg(lst, 1));
+	}
+	return sort_list(interp, args, "keysort/2", 1, false, false);
+    }
 
-	term r = interpreter_base::EMPTY_LIST;
-	
-	for (size_t i = 0; i < n; i++) {
-	    term el = vec[n-i-1];
-	    r = interp.new_dotted_pair(el, r);
+    bool builtins::sort_4(interpreter_base &interp, size_t arity, term args[])
+    {
+	static const con_cell less_than("@<", 2);
+	static const con_cell less_than_equals("@=<", 2);
+	static const con_cell greater_than("@>", 2);
+	static const con_cell greater_than_equals("@>=", 2);
+
+	term key = interp.deref(args[0]);
+	term order = interp.deref(args[1]);
+	if (key.tag() == tag_t::REF || order.tag() == tag_t::REF) {
+	    interp.abort(interpreter_exception_not_sufficiently_instantiated("sort/4: Arguments are not sufficiently instantiated"));
+	}
+	if (key.tag() != tag_t::INT ||
+	    reinterpret_cast<int_cell &>(key).value() < 0) {
+	    interp.abort(interpreter_exception_wrong_arg_type("sort/4: First argument must be a non-negative integer; found " + interp.to_string(key)));
+	}
+	size_t k = static_cast<size_t>(reinterpret_cast<int_cell &>(key).value());
+
+	con_cell ord = order.tag() == tag_t::CON
+	    ? interp.to_functor(reinterpret_cast<con_cell &>(order), 2)
+	    : con_cell("", 0);
+	bool descending, dedup;
+	if (ord == less_than) {
+	    descending = false; dedup = true;
+	} else if (ord == less_than_equals) {
+	    descending = false; dedup = false;
+	} else if (ord == greater_than) {
+	    descending = true; dedup = true;
+	} else if (ord == greater_than_equals) {
+	    descending = true; dedup = false;
+	} else {
+	    interp.abort(interpreter_exception_wrong_arg_type("sort/4: Second argument must be one of @<, @=<, @> or @>=; found " + interp.to_string(order)));
+	    return false;
 	}
 
-	bool ok = interp.unify(arg1, r);
-	return ok;
+	return sort_list(interp, &args[2], "sort/4", k, descending, dedup);
     }
 
     //
@@ -52,10 +52,23 @@ namespace prologcoin { namespace interp {
 	//
 
         static bool profile_0(interpreter_base &interp, size_t arity, common::term args []);
+        static bool profile_on_0(interpreter_base &interp, size_t arity, common::term args []);
+        static bool profile_sample_1(interpreter_base &interp, size_t arity, common::term args []);
+        static bool profile_off_0(interpreter_base &interp, size_t arity, common::term args []);
+        static bool profile_reset_0(interpreter_base &interp, size_t arity, common::term args []);
+        static bool profile_data_2(interpreter_base &interp, size_t arity, common::term args []);
+        static bool profile_flamegraph_1(interpreter_base &interp, size_t arity, common::term args []);
+        static bool statistics_2(interpreter_base &interp, size_t arity, common::term args []);
 
 	static bool debug_on_0(interpreter_base &interp, size_t arity, common::term args []);
 	static bool debug_check_0(interpreter_base &interp, size_t arity, common::term args[]);
 
+	//
+	// Memory
+	//
+
+	static bool garbage_collect_0(interpreter_base &interp, size_t arity, common::term args[]);
+
 	//
 	// Simple
 	//
@@ -157,6 +170,12 @@ namespace prologcoin { namespace interp {
 	//
 
 	static bool is_2(interpreter_base &interp, size_t arity, common::term args[]);
+	static bool operator_less_than(interpreter_base &interp, size_t arity, common::term args[]);
+	static bool operator_equals_less_than(interpreter_base &interp, size_t arity, common::term args[]);
+	static bool operator_greater_than(interpreter_base &interp, size_t arity, common::term args[]);
+	static bool operator_greater_than_equals(interpreter_base &interp, size_t arity, common::term args[]);
+	static bool operator_arith_equals(interpreter_base &interp, size_t arity, common::term args[]);
+	static bool operator_arith_not_equals(interpreter_base &interp, size_t arity, common::term args[]);
 
 	//
 	// Analyzing & constructing terms
@@ -170,7 +189,13 @@ namespace prologcoin { namespace interp {
 	static bool same_term_2(interpreter_base &interp, size_t arity, common::term args[]);
 	static bool operator_deconstruct(interpreter_base &interp, size_t arity, common::term args[]);
         static bool sort_2(interpreter_base &interp, size_t arity, common::term args[]);
+        static bool msort_2(interpreter_base &interp, size_t arity, common::term args[]);
+        static bool keysort_2(interpreter_base &interp, size_t arity, common::term args[]);
+        static bool sort_4(interpreter_base &interp, size_t arity, common::term args[]);
     private:
+	static bool sort_list(interpreter_base &interp, common::term args[],
+			      const std::string &context, size_t key,
+			      bool descending, bool dedup);
 	static common::term deconstruct_write_list(interpreter_base &interp,
 						   common::term &t,
 						   size_t index);
@@ -1,15 +1,32 @@
 #include "interpreter.hpp"
 #include "wam_compiler.hpp"
+#include "wam_code_cache.hpp"
+#include <limits>
 #include <boost/range/adaptor/reversed.hpp>
 
 namespace prologcoin { namespace interp {
 
+std::string interpreter::default_code_cache_;
+
 interpreter::interpreter() 
 {
     id_to_predicate_.push_back(predicate()); // Reserve index 0
     wam_enabled_ = true;
+    code_cache_ = default_code_cache_;
+    auto_compile_threshold_ = DEFAULT_AUTO_COMPILE_THRESHOLD;
     query_vars_ = nullptr;
     num_instances_ = 0;
+    num_table_answers_ = 0;
+    set_gc_fn(gc);
+    set_clauses_loaded_fn(clauses_loaded);
+
+    load_builtin(con_cell("assert",1), &interpreter::assert_1);
+    load_builtin(con_cell("asserta",1), &interpreter::asserta_1);
+    load_builtin(con_cell("assertz",1), &interpreter::assertz_1);
+    load_builtin(con_cell("retract",1), &interpreter::retract_1);
+    load_builtin(con_cell("dynamic",1), &interpreter::dynamic_1);
+    load_builtin(con_cell("table",1), &interpreter::table_1);
+    load_builtin(functor("abolish_all_tables",0), &interpreter::abolish_all_tables_0);
 
     set_debug_check_fn(
        [&] {
@@ -62,12 +79,63 @@ append([], Zs, Zs).
 append([X|Xs], Ys, [X|Zs]) :-
     append(Xs, Ys, Zs).
 
+%
+% predsort/3 (merge sort; P(O, A, B) gives O as <, > or =, and
+% elements that are = to an earlier one are dropped.) P is called
+% through findall/3 as the compiler can't call a variable goal.
+%
+
+predsort(P, L, Sorted) :-
+    '$predsort'(L, P, Sorted).
+
+'$predsort'([], _, []) :- !.
+'$predsort'([X], _, [X]) :- !.
+'$predsort'(L, P, Sorted) :-
+    '$predsplit'(L, L1, L2),
+    '$predsort'(L1, P, S1),
+    '$predsort'(L2, P, S2),
+    '$predmerge'(S1, S2, P, Sorted).
+
+'$predsplit'([], [], []).
+'$predsplit'([X|Xs], [X|Ys], Zs) :-
+    '$predsplit'(Xs, Zs, Ys).
+
+'$predmerge'([], Ys, _, Ys) :- !.
+'$predmerge'(Xs, [], _, Xs) :- !.
+'$predmerge'([X|Xs], [Y|Ys], P, Zs) :-
+    G =.. [P, O, X, Y],
+    findall(O, G, [O|_]),
+    '$predmerge'(O, X, Xs, Y, Ys, P, Zs).
+
+'$predmerge'('<', X, Xs, Y, Ys, P, [X|Zs]) :-
+    '$predmerge'(Xs, [Y|Ys], P, Zs).
+'$predmerge'('>', X, Xs, Y, Ys, P, [Y|Zs]) :-
+    '$predmerge'([X|Xs], Ys, P, Zs).
+'$predmerge'('=', X, Xs, _, Ys, P, [X|Zs]) :-
+    '$predmerge'(Xs, Ys, P, Zs).
+
 )PROG";
 
     load_program(lib);
+
+    // On a hit we only compile what the file doesn't have
+    if (!code_cache_.empty()) {
+	wam_code_cache cache(*this);
+	auto key = cache.source_key(get_predicates());
+	if (!cache.load(code_cache_, key)) {
+	    compile();
+	    cache.save(code_cache_, key, get_predicates());
+	    return;
+	}
+    }
     compile();
 }
 
+void interpreter::set_default_code_cache(const std::string &path)
+{
+    default_code_cache_ = path;
+}
+
 // Save everything so interpreter state can be restored.
 struct new_instance_context : public meta_context {
     new_instance_context(interpreter_base &i, meta_fn fn)
@@ -131,6 +199,23 @@ bool interpreter::execute(const term query)
 
     bool new_inst = false;
 
+    // Removed code can only be freed between outermost queries. A
+    // nested execute (an instance, e.g. for format's ~@) runs while
+    // the code of the outer query is still in its continuation,
+    // environments, choice points and on the C stack.
+    if (num_instances() == 0 && b() == nullptr) {
+	reclaim_code();
+    }
+
+    // No choice points at all, so no call is iterating over
+    // the cached clause lists (and no table is being evaluated.)
+    // If the stack is empty too, what it has grown is given back.
+    if (b() == nullptr) {
+	compact_index();
+	reset_tables();
+	shrink_stack();
+    }
+
     if (has_more()) {
 	new_instance();
 	new_inst = true;
@@ -179,7 +264,8 @@ bool interpreter::execute(const term query)
 bool interpreter::cont()
 {
     set_complete(false);
-    while (!is_complete()) {
+    try {
+      while (!is_complete()) {
         while (!is_complete()) {
 	    if (p().has_wam_code()) {
 	        bool ok = cont_wam();
@@ -199,6 +285,12 @@ bool interpreter::cont()
 		fail();
 	    }
         }
+      }
+    } catch (const common::quota_exception &ex) {
+	// Heap and trail quotas are checked by the term layer
+	abort_resource(interpreter_exception_resource(ex.what()));
+    } catch (const interpreter_exception_resource &ex) {
+	abort_resource(ex);
     }
 
     bool r = !is_top_fail();
@@ -227,6 +319,32 @@ void interpreter::delete_instance()
     }
 }
 
+// Running out of a resource leaves the stacks (close to) full, so
+// nothing of the aborted instance is kept: its choice points, meta
+// contexts and environments are dropped. Outer instances (and the
+// terms they refer to) are left as they were.
+void interpreter::abort_resource(const interpreter_exception_resource &ex)
+{
+    for (;;) {
+	while (b() != top_b()) {
+	    reset_to_choice_point(b());
+	    set_b(b()->b);
+	}
+	if (!has_meta_context()) {
+	    set_e(nullptr, ENV_NAIVE);
+	    set_top_e();
+	    break;
+	}
+	meta_fn fn = get_current_meta_context()->fn;
+	fn(*this, meta_reason_t::META_DELETE);
+	if (fn == interpreter::new_instance_meta) {
+	    num_instances_--;
+	    break;
+	}
+    }
+    abort(ex);
+}
+
 bool interpreter::next()
 {
     term old_qr = qr();
@@ -292,22 +410,27 @@ void interpreter::fail()
 	    } else if (bp.term_code().tag() != common::tag_t::INT) {
 	        // Direct query
 	        static managed_clauses empty_clauses;
-	        ok = select_clause(bp, 0, empty_clauses, 0);
+	        ok = select_clause(bp, 0, empty_clauses, 0, ch->gen);
 	    } else {
 		auto bpterm = bp.term_code();
 		size_t bpval = static_cast<const int_cell &>(bpterm).value();
 		// Is there another clause to backtrack to?
 		if (bpval != 0) {
-		    size_t index_id = bpval >> 8;
+		    size_t index_id = bpval >> 32;
 		    
 		    if (is_debug()) {
 			std::string redo_str = to_string(qr());
 			std::cout << "interpreter::fail(): redo " << redo_str << std::endl;
 		    }
 		    auto &clauses = get_predicate_by_id(index_id);
-		    size_t from_clause = bpval & 0xff;
+		    size_t from_clause = bpval & 0xffffffff;
+
+		    if (get_profiler().is_enabled()) {
+			get_profiler().redo(pr(), ch->exits);
+		    }
 		    
-		    ok = select_clause(qr(), index_id, clauses, from_clause);
+		    ok = select_clause(qr(), index_id, clauses, from_clause,
+				       ch->gen);
 		}
 	    }
 	    if (!ok) {
@@ -318,16 +441,135 @@ void interpreter::fail()
     }
 }
 
-bool interpreter::unify_args(term head, const code_point &p)
+void interpreter::gc(interpreter_base *interp)
+{
+    reinterpret_cast<interpreter *>(interp)->collect_garbage();
+}
+
+void interpreter::collect_garbage()
+{
+    bool major = gc_is_major();
+
+    // Frozen closures and watched cells are keyed by heap address and
+    // meta contexts keep their own copies of the registers. Wait until
+    // they are gone.
+    bool can_collect = heap_watched().empty() &&
+	               frozen_closures.begin() == frozen_closures.end() &&
+	               (m() == nullptr ||
+			(m()->fn == interpreter::new_instance_meta &&
+			 m()->old_m == nullptr));
+
+    common::heap_gc gc(get_heap(), gc_young_start(major));
+
+    if (can_collect) {
+	// After a cut HB may be above the most recent choice point and
+	// bindings that never need to be undone are then trailed. These
+	// would otherwise keep dead cells alive.
+	set_register_hb(gc_heap_mark());
+	tidy_trail();
+
+	can_collect = add_gc_roots(gc);
+    }
+
+    if (!can_collect) {
+	// Try again later
+	gc_done(false);
+	return;
+    }
+
+    size_t reclaimed = common::term_env::collect_garbage(gc);
+
+    if (is_debug()) {
+	std::cout << "interpreter::collect_garbage(): "
+		  << (major ? "major" : "minor")
+		  << " reclaimed=" << reclaimed << " heap=" << heap_size()
+		  << "\n";
+    }
+
+    gc_done(major);
+}
+
+bool interpreter::add_gc_roots(common::heap_gc &gc)
+{
+    for (size_t i = 0; i < num_of_args(); i++) {
+	gc.add_root(a(i));
+    }
+    gc.add_root(p().term_code());
+    gc.add_root(cp().term_code());
+    gc.add_root(qr());
+
+    if (!add_gc_roots(gc, save_e(), cp())) {
+	return false;
+    }
+
+    for (auto *ch = b(); ch != top_b() && ch != nullptr; ch = ch->b) {
+	for (size_t i = 0; i < ch->arity; i++) {
+	    gc.add_root(ch->ai[i]);
+	}
+	gc.add_root(ch->qr);
+	gc.add_root(ch->cp.term_code());
+	gc.add_root(ch->bp.term_code());
+	if (!add_gc_roots(gc, ch->ce, ch->cp)) {
+	    return false;
+	}
+    }
+
+    return true;
+}
+
+// Walk the environment chain starting at 'ce' where 'cont' is where
+// execution continues within that environment.
+bool interpreter::add_gc_roots(common::heap_gc &gc, environment_saved_t ce,
+			       code_point &cont)
+{
+    code_point *c = &cont;
+    for (auto *e = ce.ce0(); e != top_e() && e != nullptr;) {
+	switch (ce.kind()) {
+	case ENV_NAIVE: {
+	    auto *ee = reinterpret_cast<environment_naive_t *>(e);
+	    gc.add_root(ee->qr);
+	    break;
+	    }
+	case ENV_WAM: {
+	    // The number of live Y variables is only known from
+	    // the call instruction preceding the continuation.
+	    if (!c->has_wam_code()) {
+		return false;
+	    }
+	    auto *we = reinterpret_cast<environment_t *>(e);
+	    size_t n = num_y_at_continuation(*c);
+	    for (size_t i = 0; i < n; i++) {
+		gc.add_root(we->yn[i]);
+	    }
+	    break;
+	    }
+	case ENV_FROZEN:
+	    return false;
+	}
+	gc.add_root(e->cp.term_code());
+	c = &e->cp;
+	ce = e->ce;
+	e = ce.ce0();
+    }
+    return true;
+}
+
+// Unify the (stored) clause head with the goal. The clause isn't
+// copied; the bindings of its variables end up in clause_vars_.
+// The clause is a term of 'env' (see clause_env.)
+bool interpreter::unify_head(common::term_env &env, term head,
+			     const code_point &p)
 {
     static const common::con_cell colon(":",2);
-    
+
+    clause_vars_.clear();
+
     if (p.term_code().tag() == common::tag_t::STR) {
         term goal = p.term_code();
 	if (functor(goal) == colon) {
 	    goal = arg(goal, 1);
 	}
-	return unify(head, goal);
+	return unify_instance(head, goal, env, clause_vars_);
     } else {
 	// Otherwise this is an already disected call with
 	// args. So unify with arguments.
@@ -343,11 +585,11 @@ bool interpreter::unify_args(term head, const code_point &p)
 	size_t n = num_of_args();
 	bool fail = false;
 	if (head == colon) {
-	    head = arg(head, 1);
+	    head = env.arg(head, 1);
 	}
 	for (size_t i = 0; i < n; i++) {
-	    auto arg_i = arg(head, i);
-	    if (!unify(arg_i, a(i))) {
+	    auto arg_i = env.arg(head, i);
+	    if (!unify_instance(arg_i, a(i), env, clause_vars_)) {
 		fail = true;
 		break;
 	    }
@@ -368,7 +610,8 @@ bool interpreter::unify_args(term head, const code_point &p)
 bool interpreter::select_clause(const code_point &instruction,
 				size_t index_id,
 				managed_clauses &clauses,
-				size_t from_clause)
+				size_t from_clause,
+				size_t gen)
 {
     if (is_debug()) {
         std::cout << "select clause\n";
@@ -393,27 +636,37 @@ bool interpreter::select_clause(const code_point &instruction,
     for (size_t i = from_clause; i < num_clauses; i++) {
         auto &m_clause = clauses[i];
 
+	// Added or erased after the call started?
+	if (!m_clause.is_visible(gen)) {
+	    continue;
+	}
+
 	size_t current_heap = heap_size();
-	auto copy_clause = copy(m_clause.clause()); // Instantiate it
+	term clause = m_clause.clause();
+	auto &env = clause_env(m_clause);
 
-	term copy_head = clause_head(copy_clause);
-	term copy_body = clause_body(copy_clause);
+	// Only the body is instantiated (and only if the head matches.)
+	if (unify_head(env, clause_head(env, clause), instruction)) {
+	    term copy_body = copy_shared(clause_body(env, clause), env,
+					 clause_vars_);
 
-	if (unify_args(copy_head, instruction.term_code())) { // Heads match?
 	    // Update choice point (where to continue on fail...)
 	    if (has_choices) {
 	        auto choice_point = b();
 		if (i == num_clauses - 1) {
 	  	    choice_point->bp = code_point::fail();
 		} else {
-		    choice_point->bp = code_point(int_cell((index_id << 8) + (i+1)));
+		    choice_point->bp = code_point(int_cell((index_id << 32) + (i+1)));
 		}
 	    }
 
 	    allocate_environment<ENV_NAIVE>();
+	    if (get_profiler().is_enabled()) {
+		ee()->pe = env.functor(clause_head(env, clause));
+	    }
 	    set_cp(interpreter_base::EMPTY_LIST);
 	    set_p(copy_body);
-	    set_qr(copy_head);
+	    set_qr(instruction.term_code());
 
 	    // We've found a clause to execute. At this point we'll
 	    // add the cost of the clause. Note that unification above
@@ -425,7 +678,7 @@ bool interpreter::select_clause(const code_point &instruction,
 	                    // frozen closures (so these are run first.)
 	    return true;
 	} else {
-    	    // Discard garbage created on heap (due to copying clause)
+    	    // Discard what got instantiated of the head
 	    trim_heap(current_heap);
 	}
     }
@@ -446,6 +699,10 @@ void interpreter::dispatch()
 
     if (f == interpreter_base::EMPTY_LIST) {
         // Return
+	if (get_profiler().is_enabled() && e0() != top_e() &&
+	    e_kind() == ENV_NAIVE && ee()->pe != interpreter_base::EMPTY_LIST) {
+	    get_profiler().exit(ee()->pe);
+	}
 	deallocate_and_proceed();
 	if (is_debug()) {
 	    std::cout << "interpreter::dispatch(): pop: e=" << e0() << std::endl;
@@ -474,18 +731,10 @@ void interpreter::dispatch()
         std::cout << "interpreter::dispatch(): call " << to_string_cp(p()) << " cp=" << to_string_cp(cp()) << "\n";
     }
 
-#if PROFILER
-    struct scope_exit {
-	scope_exit(interpreter_base &interp, con_cell f) : interp_(interp), f_(f) { }
-	~scope_exit() {
-	    auto dt = cpu_.elapsed().system;
-	    interp_.profiling_[f_] += dt;
-	}
-	interpreter_base &interp_;
-	con_cell f_;
-	boost::timer::cpu_timer cpu_;
-    } sc(*this, f);
-#endif
+    count_inference();
+    if (get_profiler().is_enabled() && get_profiler().has_pending_samples()) {
+	profile_samples();
+    }
 
     size_t arity = f.arity();
 
@@ -518,6 +767,10 @@ void interpreter::dispatch()
 	break;
     }
 
+    // Safe point: all live terms are reachable from registers,
+    // environments and choice points.
+    check_gc();
+
     // Is instruction already a built-in (can happen for native backtracking)
     if (p().is_builtin()) {
 	if (!(p().bn())(*this, arity, args())) {
@@ -545,14 +798,40 @@ void interpreter::dispatch()
 	return;
     }
 
+    // Tabled predicates are answered from their tables (the clauses
+    // are only run when a table is evaluated.)
+    if (is_tabled(qn)) {
+	if (p().term_code() == table_goal_) {
+	    table_goal_ = term();
+	} else {
+	    set_p(cp());
+	    set_cp(interpreter_base::EMPTY_LIST);
+	    if (!call_tabled(f)) {
+		fail();
+	    }
+	    check_frozen();
+	    return;
+	}
+    }
+
+    if (get_profiler().is_enabled()) {
+	get_profiler().call(f);
+    }
+
+    // Hot predicates get compiled
+    if (is_wam_enabled() && !code.has_wam_code() &&
+	auto_compile_threshold_ != 0 &&
+	++call_counts_[qn] == auto_compile_threshold_) {
+	auto_compile(qn);
+    }
+
     if (is_wam_enabled() && code.has_wam_code()) {
         dispatch_wam(code.wam_code());
 	return;
     }
 
-    auto first_arg = get_first_arg();
-
-    size_t predicate_id = matched_predicate_id(module, f, first_arg);
+    size_t gen = generation();
+    size_t predicate_id = matched_predicate_id(module, f, args());
     predicate  &pred = get_predicate_by_id(predicate_id);
 
     set_pr(f);
@@ -562,7 +841,7 @@ void interpreter::dispatch()
 
     if (clauses.empty()) {
         clauses = get_predicate(module, f);
-	if (clauses.empty()) {
+	if (clauses.empty() && !is_dynamic(qn)) {
 	    std::stringstream msg;
 	    msg << "Undefined predicate ";
 	    if (!is_empty_list(module)) {
@@ -586,12 +865,12 @@ void interpreter::dispatch()
 
     // More than one clause that matches? We need a choice point.
     if (has_choices) {
-	int_cell index_id_int(index_id << 8);
+	int_cell index_id_int(index_id << 32);
 	code_point ch(index_id_int);
 	allocate_choice_point(ch);
     }
 
-    if (!select_clause(p().term_code(), index_id, clauses, 0)) {
+    if (!select_clause(p().term_code(), index_id, clauses, 0, gen)) {
 	fail();
     }
 }
@@ -601,19 +880,149 @@ void interpreter::dispatch_wam(wam_instruction_base *instruction)
     set_p(instruction);
 }
 
+void interpreter::auto_compile(const qname &qn)
+{
+    if (get_predicate(qn.first, qn.second).empty() || is_compiled(qn)) {
+	return;
+    }
+    // Code never moves, so this is fine while code is running.
+    compile(qn);
+}
+
+//
+// Clauses are indexed on demand. Any argument can be used for this, as
+// well as the arguments of a compound argument (if all the clauses
+// that have it instantiated agree on its functor.) The positions are
+// ranked when a predicate is first called (see index_positions) and a
+// call is then indexed on the best position it has instantiated. The
+// clauses that match are cached per position and key.
+//
+// A position is 'i' for argument i and (i+1)*MAX_ARGS+j for argument
+// j of argument i.
+//
+
+common::cell interpreter::index_key(const term t)
+{
+    switch (t.tag()) {
+    case common::tag_t::STR: return functor(t);
+    case common::tag_t::CON: case common::tag_t::INT: return t;
+    default: return term(); // We don't index on variables or BIGs
+    }
+}
+
+common::term interpreter::index_sub_arg(common::term_env &env, const term t,
+					size_t pos)
+{
+    if (pos < MAX_ARGS) {
+	return t;
+    }
+    size_t j = pos % MAX_ARGS;
+    if (t.tag() != common::tag_t::STR || env.functor(t).arity() <= j) {
+	return term();
+    }
+    return env.deref(env.arg(t, j));
+}
+
+common::term interpreter::index_arg(const managed_clause &m_clause,
+				    size_t pos)
+{
+    auto &env = clause_env(m_clause);
+    term head = clause_head(env, m_clause.clause());
+    size_t i = (pos < MAX_ARGS) ? pos : pos / MAX_ARGS - 1;
+    return index_sub_arg(env, env.deref(env.arg(head, i)), pos);
+}
+
+common::term interpreter::index_goal_arg(const term args[], size_t pos)
+{
+    size_t i = (pos < MAX_ARGS) ? pos : pos / MAX_ARGS - 1;
+    return index_sub_arg(*this, interpreter_base::deref(args[i]), pos);
+}
+
+const std::vector<size_t> & interpreter::index_positions(const qname &qn)
+{
+    auto it = index_positions_.find(qn);
+    if (it != index_positions_.end()) {
+	return it->second;
+    }
+
+    auto &m_clauses = get_predicate(qn.first, qn.second);
+    if (m_clauses.empty()) {
+	// Not defined (yet)
+	static const std::vector<size_t> none;
+	return none;
+    }
+    size_t arity = qn.second.arity();
+
+    std::vector<size_t> candidates;
+    for (size_t i = 0; i < arity; i++) {
+	candidates.push_back(i);
+	con_cell f;
+	bool same_functor = true;
+	for (auto &m_clause : m_clauses) {
+	    auto &env = clause_env(m_clause);
+	    term head = clause_head(env, m_clause.clause());
+	    term arg_i = env.deref(env.arg(head, i));
+	    if (arg_i.tag() == common::tag_t::REF) {
+		continue;
+	    }
+	    if (arg_i.tag() != common::tag_t::STR ||
+		(f != con_cell() && env.functor(arg_i) != f)) {
+		same_functor = false;
+		break;
+	    }
+	    f = env.functor(arg_i);
+	}
+	if (same_functor && f != con_cell()) {
+	    for (size_t j = 0; j < f.arity(); j++) {
+		candidates.push_back((i+1)*MAX_ARGS + j);
+	    }
+	}
+    }
+
+    // Rank them on the expected number of clauses to try
+    size_t n = m_clauses.size();
+    index_caches_[qn].num_clauses = n;
+    std::vector<std::pair<double, size_t> > ranked;
+    for (auto pos : candidates) {
+	size_t num_vars = 0;
+	std::unordered_set<term> keys;
+	for (auto &m_clause : m_clauses) {
+	    auto key = index_key(index_arg(m_clause, pos));
+	    if (key == term()) {
+		num_vars++;
+	    } else {
+		keys.insert(key);
+	    }
+	}
+	if (keys.empty()) {
+	    continue;
+	}
+	double expected = num_vars + static_cast<double>(n - num_vars) / keys.size();
+	ranked.push_back(std::make_pair(expected, pos));
+    }
+    std::stable_sort(ranked.begin(), ranked.end(),
+		     [](const std::pair<double, size_t> &p1,
+			const std::pair<double, size_t> &p2)
+		     { return p1.first < p2.first; });
+
+    auto &positions = index_positions_[qn];
+    for (auto &r : ranked) {
+	positions.push_back(r.second);
+    }
+    return positions;
+}
+
 void interpreter::compute_matched_predicate(con_cell module,
 					    con_cell func,
-					    const term first_arg,
+					    size_t pos,
+					    const common::cell key,
 					    predicate &matched)
 {
     auto &m_clauses = get_predicate(module, func);
     for (auto &m_clause : m_clauses) {
-	// Extract head
-	auto head = clause_head(m_clause.clause());
-	auto head_functor = functor(head);
-	if (head_functor.arity() > 0) {
-	    auto head_first_arg = arg(head, 0);
-	    if (definitely_inequal(head_first_arg, first_arg)) {
+	if (key != term()) {
+	    auto head_key = index_key(index_arg(m_clause, pos));
+	    if (head_key != term() && head_key != key) {
 		continue;
 	    }
 	}
@@ -621,38 +1030,785 @@ void interpreter::compute_matched_predicate(con_cell module,
     }
 }
 
-size_t interpreter::matched_predicate_id(con_cell module,
-					 con_cell func, const term first_arg)
+size_t interpreter::matched_predicate_id(con_cell module, con_cell func,
+					 const term args[])
 {
     using namespace prologcoin::common;
 
-    term index_arg = first_arg;
-    switch (first_arg.tag()) {
-    case tag_t::STR:
-	index_arg = functor(first_arg); break;
-    case tag_t::CON:
-    case tag_t::INT:
-	break;
-    case tag_t::REF:
-	index_arg = term();
-	break;
+    auto qn = std::make_pair(module, func);
+
+    // Use the best position that is instantiated
+    size_t pos = 0;
+    common::cell key = term();
+    for (auto p : index_positions(qn)) {
+	key = index_key(index_goal_arg(args, p));
+	if (key != term()) {
+	    pos = p;
+	    break;
+	}
     }
 
-    functor_index findex(std::make_pair(module,func), index_arg);
+    functor_index findex(qn, arg_index(pos, key));
     auto it = predicate_id_.find(findex);
     size_t id;
     if (it == predicate_id_.end()) {
-	id = id_to_predicate_.size();
-	id_to_predicate_.push_back( predicate() );
+	id = new_predicate_id();
 	predicate_id_[findex] = id;
+	index_caches_[qn].keys[pos].push_back(key);
 	auto &pred = id_to_predicate_[id];
-	compute_matched_predicate(module, func, first_arg, pred);
+	compute_matched_predicate(module, func, pos, key, pred);
     } else {
 	id = it->second;
     }
     return id;
 }
 
+size_t interpreter::new_predicate_id()
+{
+    if (!free_ids_.empty()) {
+	size_t id = free_ids_.back();
+	free_ids_.pop_back();
+	return id;
+    }
+    size_t id = id_to_predicate_.size();
+    id_to_predicate_.push_back( predicate() );
+    return id;
+}
+
+//
+// Asserted clauses are added to the cached lists they match, so the
+// indexing is kept up to date at the cost of a lookup per position.
+// (A clause with a variable at a position is added to all the lists
+// of that position.) The positions are ranked again when the number
+// of clauses has doubled.
+//
+
+void interpreter::index_clause(const qname &qn, const managed_clause &m_clause,
+			       bool at_end)
+{
+    auto it = index_caches_.find(qn);
+    if (it == index_caches_.end()) {
+	return;
+    }
+    auto &cache = it->second;
+    if (cache.num_clauses != 0 &&
+	get_predicate(qn.first, qn.second).size() > 2*cache.num_clauses) {
+	reindex(qn);
+	return;
+    }
+
+    for (auto &entry : cache.keys) {
+	size_t pos = entry.first;
+	auto key = index_key(index_arg(m_clause, pos));
+	if (key == term()) {
+	    for (auto &k : entry.second) {
+		index_clause(functor_index(qn, arg_index(pos, k)),
+			     m_clause, at_end);
+	    }
+	} else {
+	    index_clause(functor_index(qn, arg_index(pos, key)),
+			 m_clause, at_end);
+	    index_clause(functor_index(qn, arg_index(pos, term())),
+			 m_clause, at_end);
+	}
+    }
+}
+
+void interpreter::index_clause(const functor_index &findex,
+			       const managed_clause &m_clause, bool at_end)
+{
+    auto it = predicate_id_.find(findex);
+    if (it == predicate_id_.end()) {
+	return;
+    }
+    if (at_end) {
+	id_to_predicate_[it->second].push_back(m_clause);
+	return;
+    }
+
+    // Running calls may iterate over the list, so it is replaced.
+    size_t id = new_predicate_id();
+    auto &clauses = id_to_predicate_[id];
+    auto &old_clauses = id_to_predicate_[it->second];
+    clauses.push_back(m_clause);
+    clauses.insert(clauses.end(), old_clauses.begin(), old_clauses.end());
+    orphaned_ids_.push_back(it->second);
+    it->second = id;
+}
+
+// Drop the cached lists (they're built again on demand.)
+void interpreter::reindex(const qname &qn)
+{
+    auto it = index_caches_.find(qn);
+    if (it != index_caches_.end()) {
+	for (auto &entry : it->second.keys) {
+	    for (auto &key : entry.second) {
+		functor_index findex(qn, arg_index(entry.first, key));
+		auto found = predicate_id_.find(findex);
+		if (found != predicate_id_.end()) {
+		    orphaned_ids_.push_back(found->second);
+		    predicate_id_.erase(found);
+		}
+	    }
+	}
+	index_caches_.erase(it);
+    }
+    index_positions_.erase(qn);
+}
+
+// A consult doesn't go through add_clause (and may replace the clauses.)
+void interpreter::clauses_loaded(interpreter_base *interp, const qname &qn)
+{
+    reinterpret_cast<interpreter *>(interp)->reindex(qn);
+}
+
+// Only called when nothing is running.
+void interpreter::compact_index()
+{
+    for (auto &entry : index_caches_) {
+	auto &qn = entry.first;
+	auto &cache = entry.second;
+	if (cache.num_erased == 0) {
+	    continue;
+	}
+	for (auto &keys : cache.keys) {
+	    for (auto &key : keys.second) {
+		functor_index findex(qn, arg_index(keys.first, key));
+		auto &clauses = id_to_predicate_[predicate_id_[findex]];
+		clauses.erase(std::remove_if(clauses.begin(), clauses.end(),
+					     [](const managed_clause &m_clause)
+					     { return m_clause.is_erased(); }),
+			      clauses.end());
+	    }
+	}
+	cache.num_erased = 0;
+    }
+
+    for (auto id : orphaned_ids_) {
+	predicate().swap(id_to_predicate_[id]);
+	free_ids_.push_back(id);
+    }
+    orphaned_ids_.clear();
+}
+
+//
+// Dynamic database (assert/retract)
+//
+// Updates start a new generation and calls only see the clauses of
+// the generation they started in (the logical update view.) Compiled
+// code of an updated predicate is unlinked, so it's run on the term
+// interpreter until it gets hot again (and is compiled anew.)
+//
+
+bool interpreter::assert_1(interpreter_base &interp0, size_t arity, common::term args[])
+{
+    return assertz_1(interp0, arity, args);
+}
+
+bool interpreter::asserta_1(interpreter_base &interp0, size_t arity, common::term args[])
+{
+    auto &interp = reinterpret_cast<interpreter &>(interp0);
+    interp.add_clause(args[0], false);
+    return true;
+}
+
+bool interpreter::assertz_1(interpreter_base &interp0, size_t arity, common::term args[])
+{
+    auto &interp = reinterpret_cast<interpreter &>(interp0);
+    interp.add_clause(args[0], true);
+    return true;
+}
+
+void interpreter::add_clause(const term t0, bool at_end)
+{
+    term t = interpreter_base::deref(t0);
+    if (t.tag() == common::tag_t::REF) {
+	abort(interpreter_exception_not_sufficiently_instantiated("assert/1: Clause is not sufficiently instantiated"));
+    }
+    auto m_clause = assert_clause(t, at_end);
+    auto qn = std::make_pair(interpreter_base::EMPTY_LIST,
+			     functor(clause_head(t)));
+    make_dynamic(qn);
+    index_clause(qn, m_clause, at_end);
+    database_updated(qn);
+
+    // Retracted clauses are freed here (the clause heap only grows
+    // by asserting.)
+    if (is_clause_heap_full()) {
+	compact_clauses(id_to_predicate_, oldest_visible_generation());
+    }
+}
+
+// Only the choice points of calls that go through the clauses of
+// dynamic predicates matter (compiled code runs copies of them.)
+size_t interpreter::oldest_visible_generation()
+{
+    size_t gen = generation();
+    for (auto *ch = b(); ch != nullptr; ch = ch->b) {
+	auto &bp = ch->bp;
+	bool is_clauses;
+	if (bp.is_builtin()) {
+	    is_clauses = bp.bn() == retract_1_cp;
+	} else {
+	    is_clauses = !bp.has_wam_code() &&
+		bp.term_code().tag() == common::tag_t::INT &&
+		is_dynamic(qname(interpreter_base::EMPTY_LIST, ch->pr));
+	}
+	if (is_clauses && ch->gen < gen) {
+	    gen = ch->gen;
+	}
+    }
+    return gen;
+}
+
+// The state (the cached list, the next clause to try and P) is kept
+// on the heap just before the choice point, as for arg/3.
+bool interpreter::retract_1(interpreter_base &interp0, size_t arity, common::term args[])
+{
+    auto &interp = reinterpret_cast<interpreter &>(interp0);
+
+    term t = interp.interpreter_base::deref(args[0]);
+    term head = t.tag() == common::tag_t::REF ? t : interp.interpreter_base::deref(interp.clause_head(t));
+    if (head.tag() == common::tag_t::REF) {
+	interp.abort(interpreter_exception_not_sufficiently_instantiated("retract/1: Clause is not sufficiently instantiated"));
+    }
+    if (head.tag() != common::tag_t::STR && head.tag() != common::tag_t::CON) {
+	interp.abort(interpreter_exception_wrong_arg_type("retract/1: Head of clause is not callable; was " + interp.to_string(head)));
+    }
+
+    auto f = interp.functor(head);
+    auto qn = std::make_pair(interpreter_base::EMPTY_LIST, f);
+    if (interp.get_predicate(qn.first, qn.second).empty()) {
+	return false;
+    }
+    interp.make_dynamic(qn);
+
+    std::vector<term> head_args(f.arity());
+    for (size_t i = 0; i < f.arity(); i++) {
+	head_args[i] = interp.arg(head, i);
+    }
+    size_t index_id = interp.matched_predicate_id(qn.first, qn.second,
+						  head_args.data());
+
+    interp.new_cell0(int_cell(index_id));
+    interp.new_cell0(int_cell(0));
+    builtins::store_p_on_heap_if_wam(interp);
+    interp.allocate_choice_point(code_point(interpreter_base::EMPTY_LIST, retract_1_cp, false));
+
+    return interp.retract_clause(t, index_id, 0, interp.b()->gen);
+}
+
+bool interpreter::retract_1_cp(interpreter_base &interp0, size_t arity, common::term args[])
+{
+    auto &interp = reinterpret_cast<interpreter &>(interp0);
+    size_t h = interp.b()->h;
+    const common::heap &heap = interp.get_heap();
+    auto index_id = static_cast<const int_cell &>(heap[h-3]).value();
+    auto from_clause = static_cast<const int_cell &>(heap[h-2]).value();
+    builtins::restore_p_from_heap_if_wam(interp);
+    return interp.retract_clause(interp.interpreter_base::deref(args[0]), index_id, from_clause,
+				 interp.b()->gen);
+}
+
+bool interpreter::retract_clause(term t, size_t index_id, size_t from_clause,
+				 size_t gen)
+{
+    static const con_cell true_0("true", 0);
+
+    term head = clause_head(t);
+    term body = true_0;
+    if (functor(t) == IMPLIED_BY) {
+	body = arg(t, 1);
+    }
+
+    auto &clauses = get_predicate_by_id(index_id);
+    for (size_t i = from_clause; i < clauses.size(); i++) {
+	if (!clauses[i].is_visible(gen) || clauses[i].is_erased()) {
+	    continue;
+	}
+	size_t current_trail = trail_size();
+	size_t current_heap = heap_size();
+	term clause = clauses[i].clause();
+	auto &env = clause_env(clauses[i]);
+	term clause_body0 = clause_body(env, clause);
+	clause_vars_.clear();
+	bool matched = unify_instance(clause_head(env, clause), head, env,
+				      clause_vars_);
+	if (matched) {
+	    term clause_body1 = true_0;
+	    if (!env.is_empty_list(clause_body0)) {
+		clause_body1 = copy_shared(clause_body0, env, clause_vars_);
+	    }
+	    matched = unify(body, clause_body1);
+	}
+	if (matched) {
+	    get_heap()[b()->h-2] = int_cell(i+1);
+	    auto m_clause = clauses[i];
+	    auto qn = std::make_pair(interpreter_base::EMPTY_LIST,
+				     functor(head));
+	    erase_clause(qn, m_clause);
+	    auto &cache = index_caches_[qn];
+	    cache.num_erased++;
+	    if (cache.num_erased > get_predicate(qn.first, qn.second).size()) {
+		reindex(qn);
+	    }
+	    database_updated(qn);
+	    return true;
+	}
+	interpreter_base::unwind_trail(current_trail, trail_size());
+	trim_trail(current_trail);
+	trim_heap(current_heap);
+    }
+
+    b()->bp = code_point::fail();
+    return false;
+}
+
+bool interpreter::dynamic_1(interpreter_base &interp0, size_t arity, common::term args[])
+{
+    auto &interp = reinterpret_cast<interpreter &>(interp0);
+    interp.declare_predicates(args[0], "dynamic/1",
+			      [&](const qname &qn) { interp.make_dynamic(qn); });
+    return true;
+}
+
+// Name/Arity, a conjunction or a list of those.
+void interpreter::declare_predicates(term spec, const std::string &name,
+				     const std::function<void (const qname &)> &fn)
+{
+    static const con_cell slash("/", 2);
+
+    spec = interpreter_base::deref(spec);
+    if (is_empty_list(spec)) {
+	return;
+    }
+    if (is_list(spec)) {
+	for (auto s : iterate_over(spec)) {
+	    declare_predicates(s, name, fn);
+	}
+	return;
+    }
+    if (spec.tag() == common::tag_t::STR && functor(spec) == COMMA) {
+	declare_predicates(arg(spec, 0), name, fn);
+	declare_predicates(arg(spec, 1), name, fn);
+	return;
+    }
+    term pname = spec.tag() == common::tag_t::STR && functor(spec) == slash
+	? interpreter_base::deref(arg(spec, 0)) : term();
+    term arity = spec.tag() == common::tag_t::STR && functor(spec) == slash
+	? interpreter_base::deref(arg(spec, 1)) : term();
+    if (pname.tag() != common::tag_t::CON || arity.tag() != common::tag_t::INT) {
+	abort(interpreter_exception_wrong_arg_type(name + ": Expected Name/Arity; was " + to_string(spec)));
+    }
+    auto f = functor(atom_name(static_cast<con_cell &>(pname)),
+		     static_cast<int_cell &>(arity).value());
+    fn(std::make_pair(interpreter_base::EMPTY_LIST, f));
+}
+
+// The cached lists have copies of the clauses, which have to be
+// erasable as well.
+void interpreter::make_dynamic(const qname &qn)
+{
+    if (!is_dynamic(qn)) {
+	set_dynamic(qn);
+	reindex(qn);
+    }
+}
+
+void interpreter::database_updated(const qname &qn)
+{
+    if (is_compiled(qn)) {
+	remove_compiled(qn);
+	set_code(qn, code_point());
+    }
+    call_counts_.erase(qn);
+}
+
+//
+// Tabling
+//
+// A call to a tabled predicate is answered from the table of its
+// variant. If there's no such table (or it's incomplete) the clauses
+// are run to collect all answers first, and only then are the answers
+// returned. A call of a table that is still being evaluated (a
+// recursive variant) gets the answers found so far. The evaluation of
+// the table it called is then iterated (along with all the tables
+// evaluated in between) until no more answers are found. The tables
+// in between are completed with it (they're its SCC.)
+//
+
+static const size_t NO_LEADER = std::numeric_limits<size_t>::max();
+
+struct meta_context_table : public meta_context {
+    inline meta_context_table(interpreter_base &interp, meta_fn fn)
+	: meta_context(interp, fn) { }
+    size_t table_id_;
+    size_t num_answers_;     // All answers when this iteration started
+    size_t incomplete_mark_;
+    common::term call_;      // The call (with the arguments of the caller)
+    common::term goal_;      // Runs the clauses
+};
+
+bool interpreter::table_1(interpreter_base &interp0, size_t arity, common::term args[])
+{
+    auto &interp = reinterpret_cast<interpreter &>(interp0);
+    interp.declare_predicates(args[0], "table/1",
+			      [&](const qname &qn) { interp.make_tabled(qn); });
+    return true;
+}
+
+bool interpreter::abolish_all_tables_0(interpreter_base &interp0, size_t arity, common::term args[])
+{
+    auto &interp = reinterpret_cast<interpreter &>(interp0);
+    if (!interp.table_stack_.empty()) {
+	interp.abort(interpreter_exception_wrong_arg_type("abolish_all_tables/0: Tables are being evaluated"));
+    }
+    interp.tables_.clear();
+    interp.table_index_.clear();
+    interp.incomplete_.clear();
+    interp.tables_env_.trim_heap(0);
+    return true;
+}
+
+void interpreter::make_tabled(const qname &qn)
+{
+    if (!is_tabled(qn)) {
+	set_tabled(qn);
+	// Compiled code would bypass the tables
+	database_updated(qn);
+    }
+}
+
+bool interpreter::call_tabled(con_cell f)
+{
+    size_t arity = f.arity();
+    term call = f;
+    if (arity > 0) {
+	call = new_str(f);
+	for (size_t i = 0; i < arity; i++) {
+	    set_arg(call, i, a(i));
+	}
+    }
+
+    size_t id = find_table(call);
+    auto &table = tables_[id];
+    switch (table.state) {
+    case TABLE_COMPLETE:
+	return return_answers(id, table.answers.size());
+    case TABLE_EVALUATING:
+	// All the tables evaluated since then depend on this one
+	for (size_t i = table.depth; i < table_stack_.size(); i++) {
+	    auto &other = tables_[table_stack_[i]];
+	    other.leader = std::min(other.leader, table.depth);
+	}
+	return return_answers(id, table.answers.size());
+    case TABLE_INCOMPLETE:
+	evaluate_table(id, call);
+	return true;
+    }
+    return false;
+}
+
+size_t interpreter::find_table(const term call)
+{
+    auto &ids = table_index_[variant_hash(*this, call)];
+    for (auto id : ids) {
+	if (is_variant(*this, call, tables_env_, tables_[id].call)) {
+	    return id;
+	}
+    }
+    uint64_t cost = 0;
+    size_t id = tables_.size();
+    tables_.push_back(call_table(tables_env_.copy(call, *this, cost)));
+    add_accumulated_cost(cost);
+    ids.push_back(id);
+    return id;
+}
+
+// Run the clauses (as findall/3 does) and add every solution to the
+// table (see table_meta.)
+void interpreter::evaluate_table(size_t id, const term call)
+{
+    term goal = copy(tables_[id].call, tables_env_);
+
+    auto &table = tables_[id];
+    table.state = TABLE_EVALUATING;
+    table.depth = table_stack_.size();
+    table.leader = NO_LEADER;
+    table_stack_.push_back(id);
+
+    auto *context = new_meta_context<meta_context_table>(&table_meta);
+    context->table_id_ = id;
+    context->num_answers_ = num_table_answers_;
+    context->incomplete_mark_ = incomplete_.size();
+    context->call_ = call;
+    context->goal_ = goal;
+
+    set_top_e();
+    allocate_choice_point(code_point::fail());
+    set_top_b(b());
+    table_goal_ = goal;
+    set_p(code_point(goal));
+    set_cp(interpreter_base::EMPTY_LIST);
+}
+
+bool interpreter::table_meta(interpreter_base &interp0, const meta_reason_t &reason)
+{
+    auto &interp = reinterpret_cast<interpreter &>(interp0);
+    auto *context = interp.get_current_meta_context<meta_context_table>();
+    size_t id = context->table_id_;
+
+    if (reason == meta_reason_t::META_DELETE) {
+	// Aborted. It's evaluated again when called.
+	interp.table_stack_.resize(interp.tables_[id].depth);
+	interp.tables_[id].state = TABLE_INCOMPLETE;
+	interp.release_last_meta_context();
+	return true;
+    }
+
+    interp.set_complete(false);
+
+    if (!interp.is_top_fail()) {
+	interp.add_answer(id, context->goal_);
+	interp.set_p(common::con_cell("fail",0));
+	interp.set_cp(interpreter_base::EMPTY_LIST);
+	return true;
+    }
+
+    interp.unwind_to_top_choice_point();
+
+    auto &table = interp.tables_[id];
+    if (table.leader == table.depth &&
+	interp.num_table_answers_ != context->num_answers_) {
+	// Iterate as the tables it depends on got new answers
+	table.leader = NO_LEADER;
+	context->num_answers_ = interp.num_table_answers_;
+	interp.set_top_fail(false);
+	interp.set_complete(false);
+	interp.table_goal_ = context->goal_;
+	interp.set_p(code_point(context->goal_));
+	interp.set_cp(interpreter_base::EMPTY_LIST);
+	return true;
+    }
+
+    interp.table_stack_.pop_back();
+    if (table.leader < table.depth) {
+	// Completed by its leader
+	table.state = TABLE_INCOMPLETE;
+	interp.incomplete_.push_back(id);
+    } else {
+	interp.complete_tables(context->incomplete_mark_);
+	table.state = TABLE_COMPLETE;
+    }
+
+    term call = context->call_;
+    interp.release_last_meta_context();
+    interp.set_top_fail(false);
+    interp.set_complete(false);
+
+    size_t arity = interp.functor(call).arity();
+    for (size_t i = 0; i < arity; i++) {
+	interp.a(i) = interp.arg(call, i);
+    }
+    interp.set_num_of_args(arity);
+
+    return interp.return_answers(id, table.answers.size());
+}
+
+void interpreter::complete_tables(size_t from)
+{
+    for (size_t i = from; i < incomplete_.size(); i++) {
+	tables_[incomplete_[i]].state = TABLE_COMPLETE;
+    }
+    incomplete_.resize(from);
+}
+
+// Tables whose evaluation never finished are evaluated again.
+void interpreter::reset_tables()
+{
+    for (auto id : table_stack_) {
+	tables_[id].state = TABLE_INCOMPLETE;
+    }
+    table_stack_.clear();
+    incomplete_.clear();
+}
+
+bool interpreter::add_answer(size_t id, const term answer)
+{
+    auto &table = tables_[id];
+    auto &ids = table.answer_index[variant_hash(*this, answer)];
+    for (auto i : ids) {
+	if (is_variant(*this, answer, tables_env_, table.answers[i])) {
+	    return false;
+	}
+    }
+    uint64_t cost = 0;
+    ids.push_back(table.answers.size());
+    table.answers.push_back(tables_env_.copy(answer, *this, cost));
+    add_accumulated_cost(cost);
+    num_table_answers_++;
+    return true;
+}
+
+// The state (the table, the next answer, the number of answers and P)
+// is kept on the heap just before the choice point, as for arg/3.
+bool interpreter::return_answers(size_t id, size_t num_answers)
+{
+    if (num_answers == 0) {
+	return false;
+    }
+    if (num_answers > 1) {
+	new_cell0(int_cell(id));
+	new_cell0(int_cell(1));
+	new_cell0(int_cell(num_answers));
+	builtins::store_p_on_heap_if_wam(*this);
+	allocate_choice_point(code_point(interpreter_base::EMPTY_LIST, table_answer_cp, false));
+    }
+    return unify_answer(id, 0);
+}
+
+bool interpreter::table_answer_cp(interpreter_base &interp0, size_t arity, common::term args[])
+{
+    auto &interp = reinterpret_cast<interpreter &>(interp0);
+    size_t h = interp.b()->h;
+    const common::heap &heap = interp.get_heap();
+    auto id = static_cast<const int_cell &>(heap[h-4]).value();
+    auto index = static_cast<const int_cell &>(heap[h-3]).value();
+    auto n = static_cast<const int_cell &>(heap[h-2]).value();
+    builtins::restore_p_from_heap_if_wam(interp);
+    if (index + 1 == n) {
+	interp.b()->bp = code_point::fail();
+    } else {
+	interp.get_heap()[h-3] = int_cell(index+1);
+    }
+    return interp.unify_answer(id, index);
+}
+
+bool interpreter::unify_answer(size_t id, size_t index)
+{
+    term answer = copy(tables_[id].answers[index], tables_env_);
+    size_t arity = functor(answer).arity();
+    for (size_t i = 0; i < arity; i++) {
+	if (!unify(a(i), arg(answer, i))) {
+	    return false;
+	}
+    }
+    return true;
+}
+
+// Variables are numbered by first occurrence, so all variants of a
+// term get the same hash.
+uint64_t interpreter::variant_hash(common::term_env &env, const term t)
+{
+    std::unordered_map<term, uint64_t> vars;
+    std::vector<term> work;
+    uint64_t h = 0xcbf29ce484222325ULL;
+
+    work.push_back(t);
+    while (!work.empty()) {
+	term c = env.deref(work.back());
+	work.pop_back();
+	uint64_t v;
+	switch (c.tag()) {
+	case common::tag_t::REF: {
+	    auto it = vars.find(c);
+	    if (it == vars.end()) {
+		v = vars.size();
+		vars[c] = v;
+	    } else {
+		v = it->second;
+	    }
+	    v = ~v;
+	    break;
+	    }
+	case common::tag_t::STR: {
+	    auto f = env.functor(c);
+	    v = f.raw_value();
+	    for (size_t i = f.arity(); i > 0; i--) {
+		work.push_back(env.arg(c, i-1));
+	    }
+	    break;
+	    }
+	case common::tag_t::BIG:
+	    v = env.hash(c);
+	    break;
+	default:
+	    v = c.raw_value();
+	    break;
+	}
+	h = (h ^ v) * 0x100000001b3ULL;
+    }
+    return h;
+}
+
+// Equal up to renaming of variables. The terms may live on different
+// heaps.
+bool interpreter::is_variant(common::term_env &env_a, const term a,
+			     common::term_env &env_b, const term b)
+{
+    std::unordered_map<term, term> a_to_b, b_to_a;
+    std::vector<std::pair<term, term> > work;
+
+    work.push_back(std::make_pair(a, b));
+    while (!work.empty()) {
+	term ca = env_a.deref(work.back().first);
+	term cb = env_b.deref(work.back().second);
+	work.pop_back();
+	if (ca.tag() != cb.tag()) {
+	    return false;
+	}
+	switch (ca.tag()) {
+	case common::tag_t::REF: {
+	    auto it = a_to_b.find(ca);
+	    if (it != a_to_b.end()) {
+		if (it->second != cb) {
+		    return false;
+		}
+	    } else if (b_to_a.count(cb)) {
+		return false;
+	    } else {
+		a_to_b[ca] = cb;
+		b_to_a[cb] = ca;
+	    }
+	    break;
+	    }
+	case common::tag_t::STR: {
+	    auto f = env_a.functor(ca);
+	    if (f != env_b.functor(cb)) {
+		return false;
+	    }
+	    for (size_t i = 0; i < f.arity(); i++) {
+		work.push_back(std::make_pair(env_a.arg(ca, i), env_b.arg(cb, i)));
+	    }
+	    break;
+	    }
+	case common::tag_t::BIG: {
+	    auto &big_a = static_cast<common::big_cell &>(ca);
+	    auto &big_b = static_cast<common::big_cell &>(cb);
+	    const common::heap &heap_a = env_a.get_heap();
+	    const common::heap &heap_b = env_b.get_heap();
+	    if (heap_a.num_bits(big_a) != heap_b.num_bits(big_b)) {
+		return false;
+	    }
+	    auto it_b = heap_b.begin(big_b);
+	    for (auto it_a = heap_a.begin(big_a), it_a_end = heap_a.end(big_a);
+		 it_a != it_a_end; ++it_a, ++it_b) {
+		if (*it_a != *it_b) {
+		    return false;
+		}
+	    }
+	    break;
+	    }
+	default:
+	    if (ca != cb) {
+		return false;
+	    }
+	    break;
+	}
+    }
+    return true;
+}
+
 std::string interpreter::get_result(bool newlines) const
 {
     using namespace prologcoin::common;
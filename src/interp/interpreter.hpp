@@ -18,6 +18,18 @@ public:
 
     void setup_standard_lib();
 
+    // The compiled standard library is loaded from this file, or
+    // saved to it if it doesn't match (see wam_code_cache.hpp.) No
+    // file if it's empty.
+    inline void set_code_cache(const std::string &path)
+    { code_cache_ = path; }
+
+    inline const std::string & code_cache() const
+    { return code_cache_; }
+
+    // The code cache of new interpreters
+    static void set_default_code_cache(const std::string &path);
+
     void new_instance();
     size_t num_instances() const { return num_instances_; }
     void delete_instance();
@@ -64,6 +76,16 @@ public:
     inline bool is_wam_enabled() const
     { return wam_enabled_; }
 
+    // Predicates that are called this many times on the term
+    // interpreter are compiled to WAM code (0 disables this.)
+    static const size_t DEFAULT_AUTO_COMPILE_THRESHOLD = 100;
+
+    inline void set_auto_compile_threshold(size_t n)
+    { auto_compile_threshold_ = n; }
+
+    inline size_t auto_compile_threshold() const
+    { return auto_compile_threshold_; }
+
     std::string get_result(bool newlines = true) const;
     term get_result_term(const std::string &varname) const;
     term get_result_term() const;
@@ -79,13 +101,65 @@ public:
 private:
     static bool new_instance_meta(interpreter_base &interp, const meta_reason_t &reason);
 
+    //
+    // Dynamic database
+    //
+
+    static bool assert_1(interpreter_base &interp, size_t arity, common::term args[]);
+    static bool asserta_1(interpreter_base &interp, size_t arity, common::term args[]);
+    static bool assertz_1(interpreter_base &interp, size_t arity, common::term args[]);
+    static bool retract_1(interpreter_base &interp, size_t arity, common::term args[]);
+    static bool retract_1_cp(interpreter_base &interp, size_t arity, common::term args[]);
+    static bool dynamic_1(interpreter_base &interp, size_t arity, common::term args[]);
+
+    void add_clause(const term t, bool at_end);
+    bool retract_clause(term t, size_t index_id, size_t from_clause, size_t gen);
+    void declare_predicates(term spec, const std::string &name,
+			    const std::function<void (const qname &)> &fn);
+    void make_dynamic(const qname &qn);
+    void database_updated(const qname &qn);
+    size_t oldest_visible_generation();
+
+    //
+    // Tabling
+    //
+
+    static bool table_1(interpreter_base &interp, size_t arity, common::term args[]);
+    static bool abolish_all_tables_0(interpreter_base &interp, size_t arity, common::term args[]);
+    static bool table_meta(interpreter_base &interp, const meta_reason_t &reason);
+    static bool table_answer_cp(interpreter_base &interp, size_t arity, common::term args[]);
+
+    void make_tabled(const qname &qn);
+    bool call_tabled(con_cell f);
+    size_t find_table(const term call);
+    void evaluate_table(size_t id, const term call);
+    bool add_answer(size_t id, const term answer);
+    bool return_answers(size_t id, size_t num_answers);
+    bool unify_answer(size_t id, size_t index);
+    void complete_tables(size_t from);
+    void reset_tables();
+
+    static uint64_t variant_hash(common::term_env &env, const term t);
+    static bool is_variant(common::term_env &env_a, const term a,
+			   common::term_env &env_b, const term b);
+
+    static void gc(interpreter_base *interp);
+    static void clauses_loaded(interpreter_base *interp, const qname &qn);
+    void collect_garbage();
+    bool add_gc_roots(common::heap_gc &gc);
+    bool add_gc_roots(common::heap_gc &gc, environment_saved_t ce,
+		      code_point &cont);
+
     void dispatch();
     void dispatch_wam(wam_instruction_base *instruction);
-    bool unify_args(term clause_head, const code_point &p);
+    void auto_compile(const qname &qn);
+    bool unify_head(common::term_env &env, term clause_head,
+		    const code_point &p);
     bool select_clause(const code_point &instruction,
 		       size_t index_id,
 		       managed_clauses &clauses,
-		       size_t from_clause);
+		       size_t from_clause,
+		       size_t gen);
 
     const predicate & get_predicate(con_cell module, con_cell f)
     {
@@ -97,15 +171,79 @@ private:
 	return id_to_predicate_[id];
     }
 
+    common::cell index_key(const term t);
+    term index_sub_arg(common::term_env &env, const term t, size_t pos);
+    term index_arg(const managed_clause &m_clause, size_t pos);
+    term index_goal_arg(const term args[], size_t pos);
+    const std::vector<size_t> & index_positions(const qname &qn);
+
     void compute_matched_predicate(con_cell module, con_cell functor,
-				   const term first_arg,
+				   size_t pos, const common::cell key,
 				   predicate &matched);
-    size_t matched_predicate_id(con_cell module,
-				con_cell functor, const term first_arg);
+    size_t matched_predicate_id(con_cell module, con_cell functor,
+				const term args[]);
+    size_t new_predicate_id();
 
+    void index_clause(const qname &qn, const managed_clause &m_clause,
+		      bool at_end);
+    void index_clause(const functor_index &findex,
+		      const managed_clause &m_clause, bool at_end);
+    void reindex(const qname &qn);
+    void compact_index();
 
     std::unordered_map<functor_index, size_t> predicate_id_;
     std::vector<predicate> id_to_predicate_;
+    std::unordered_map<qname, std::vector<size_t> > index_positions_;
+
+    // What is cached for a predicate, so the cached clause lists can
+    // be updated when clauses are added (or dropped when they need to
+    // be ranked again.)
+    struct index_cache {
+	index_cache() : num_clauses(0), num_erased(0) { }
+	size_t num_clauses; // When the positions were ranked
+	size_t num_erased;  // Erased clauses still in the lists
+	std::unordered_map<size_t, std::vector<common::cell> > keys;
+    };
+
+    std::unordered_map<qname, index_cache> index_caches_;
+
+    // Lists that have been replaced may still be used by running
+    // calls. They are released when nothing is running.
+    std::vector<size_t> orphaned_ids_;
+    std::vector<size_t> free_ids_;
+
+    // A table holds the answers of a call (and all its variants.)
+    // It's complete when all the answers have been found. Calls of
+    // tables that are still being evaluated get the answers found so
+    // far, so evaluation is iterated until no more answers are found.
+    enum table_state_t {
+	TABLE_EVALUATING,
+	TABLE_INCOMPLETE,
+	TABLE_COMPLETE
+    };
+
+    struct call_table {
+	call_table(const term c)
+	    : call(c), state(TABLE_INCOMPLETE), depth(0), leader(0) { }
+	term call;            // In tables_env_
+	table_state_t state;
+	size_t depth;         // On table_stack_ (when evaluating)
+	size_t leader;        // Lowest depth of the tables it called
+	std::vector<term> answers;  // In tables_env_
+	std::unordered_map<uint64_t, std::vector<size_t> > answer_index;
+    };
+
+    // Tables live on a heap of their own so they survive backtracking
+    // (and are shared by all the queries of a session.)
+    common::term_env tables_env_;
+    std::vector<call_table> tables_;
+    std::unordered_map<uint64_t, std::vector<size_t> > table_index_;
+    std::vector<size_t> table_stack_;  // Tables being evaluated
+    std::vector<size_t> incomplete_;   // Waiting for their leader
+    size_t num_table_answers_;
+    term table_goal_;  // Runs the clauses (not the table)
+
+    void abort_resource(const interpreter_exception_resource &ex);
 
     inline std::vector<binding> & query_vars()
         { return *query_vars_; }
@@ -117,7 +255,12 @@ private:
         { query_vars_ = qv; }
 
     bool wam_enabled_;
+    std::string code_cache_;
+    static std::string default_code_cache_;
+    size_t auto_compile_threshold_;
+    std::unordered_map<qname, size_t> call_counts_;
     std::vector<binding> *query_vars_;
+    std::unordered_map<term, term> clause_vars_;
     size_t num_instances_;
 
     friend struct new_instance_context;
@@ -3,10 +3,12 @@
 #include "builtins_fileio.hpp"
 #include "wam_interpreter.hpp"
 #include <boost/filesystem.hpp>
-#include <boost/timer/timer.hpp>
 #include <boost/range/adaptor/reversed.hpp>
-
-#define PROFILER 0
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#endif
 
 namespace prologcoin { namespace interp {
 
@@ -33,7 +35,7 @@ meta_context::meta_context(interpreter_base &i, meta_fn mfn)
     old_hb = i.get_register_hb();
 }
 
-interpreter_base::interpreter_base() : register_pr_("", 0), arith_(*this), locale_(*this)
+interpreter_base::interpreter_base() : register_pr_("", 0), arith_(*this), inferences_(0), locale_(*this), profiler_(*this)
 {
     init();
 
@@ -66,13 +68,26 @@ void interpreter_base::init()
 {
     debug_ = false;
     track_cost_ = false;
+    hash_consing_ = false;
     file_id_count_ = 3;
     num_of_args_= 0;
     memset(register_ai_, 0, sizeof(register_ai_));
-    stack_ = reinterpret_cast<word_t *>(new char[MAX_STACK_SIZE]);
+    stack_ = reserve_stack(MAX_STACK_SIZE);
+    stack_limit_words_ = MAX_STACK_SIZE_WORDS;
+    stack_committed_words_ = 0;
+    grow_stack(0);
     num_y_fn_ = &num_y;
     save_state_fn_ = &save_state;
     restore_state_fn_ = &restore_state;
+    gc_fn_ = nullptr;
+    clauses_loaded_fn_ = nullptr;
+    gc_threshold_ = DEFAULT_GC_THRESHOLD;
+    gc_requested_ = false;
+    gc_minor_count_ = 0;
+    heap_floor_ = 0;
+    generation_ = 0;
+    clauses_env_ = new common::term_env();
+    clauses_limit_ = MIN_CLAUSE_HEAP;
     standard_output_ = nullptr;
     prepare_execution();
 }
@@ -91,9 +106,91 @@ interpreter_base::~interpreter_base()
     syntax_check_stack_.clear();
     builtins_.clear();
     program_db_.clear();
+    delete clauses_env_;
     module_db_.clear();
     module_db_set_.clear();
     program_predicates_.clear();
+    release_stack(stack_, MAX_STACK_SIZE);
+}
+
+//
+// The stack is reserved once and committed in chunks (doubling) as
+// it grows. Pages not committed aren't accessible, so running past
+// the committed part faults instead of overwriting something else.
+//
+
+word_t * interpreter_base::reserve_stack(size_t bytes)
+{
+#ifdef _WIN32
+    void *p = VirtualAlloc(nullptr, bytes, MEM_RESERVE, PAGE_NOACCESS);
+    if (p == nullptr) {
+	throw std::bad_alloc();
+    }
+#else
+    void *p = mmap(nullptr, bytes, PROT_NONE,
+		   MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (p == MAP_FAILED) {
+	throw std::bad_alloc();
+    }
+#endif
+    return reinterpret_cast<word_t *>(p);
+}
+
+void interpreter_base::release_stack(word_t *stack, size_t bytes)
+{
+#ifdef _WIN32
+    VirtualFree(stack, 0, MEM_RELEASE);
+#else
+    munmap(stack, bytes);
+#endif
+}
+
+void interpreter_base::grow_stack(size_t words)
+{
+    if (words >= stack_limit_words_) {
+	if (stack_limit_words_ < MAX_STACK_SIZE_WORDS) {
+	    throw interpreter_exception_resource(common::quota_exception("stack", quotas_.stack_words).what());
+	}
+	throw interpreter_exception_stack_overflow("Exceeded maximum stack size (" + boost::lexical_cast<std::string>(MAX_STACK_SIZE) + " bytes.)");
+    }
+    if (words < stack_committed_words_) {
+	return;
+    }
+    size_t new_words = std::max(stack_committed_words_, INITIAL_STACK_SIZE_WORDS);
+    while (new_words <= words) {
+	new_words *= 2;
+    }
+    new_words = std::min(new_words, MAX_STACK_SIZE_WORDS);
+
+    word_t *from = stack_ + stack_committed_words_;
+    size_t bytes = (new_words - stack_committed_words_) * sizeof(word_t);
+#ifdef _WIN32
+    bool ok = VirtualAlloc(from, bytes, MEM_COMMIT, PAGE_READWRITE) != nullptr;
+#else
+    bool ok = mprotect(from, bytes, PROT_READ | PROT_WRITE) == 0;
+#endif
+    if (!ok) {
+	throw interpreter_exception_stack_overflow("Could not grow stack to " + boost::lexical_cast<std::string>(new_words * sizeof(word_t)) + " bytes.");
+    }
+    stack_committed_words_ = new_words;
+}
+
+void interpreter_base::shrink_stack()
+{
+    if (e0() != nullptr || b() != nullptr || m() != nullptr ||
+	stack_committed_words_ <= INITIAL_STACK_SIZE_WORDS) {
+	return;
+    }
+    word_t *from = stack_ + INITIAL_STACK_SIZE_WORDS;
+    size_t bytes = (stack_committed_words_ - INITIAL_STACK_SIZE_WORDS) * sizeof(word_t);
+#ifdef _WIN32
+    VirtualFree(from, bytes, MEM_DECOMMIT);
+#else
+    // Replacing the mapping drops the pages.
+    mmap(from, bytes, PROT_NONE,
+	 MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_FIXED, -1, 0);
+#endif
+    stack_committed_words_ = INITIAL_STACK_SIZE_WORDS;
 }
 
 void interpreter_base::reset()
@@ -132,6 +229,29 @@ void interpreter_base::close_all_files()
     open_files_.clear();
 }
 
+void interpreter_base::set_quotas(const quotas &q)
+{
+    quotas_ = q;
+    set_max_size(q.heap_cells);
+    clauses_env_->get_heap().set_max_size(q.heap_cells);
+    set_max_trail(q.trail_entries);
+    if (q.stack_words != 0 && q.stack_words < MAX_STACK_SIZE_WORDS) {
+	stack_limit_words_ = q.stack_words;
+    } else {
+	stack_limit_words_ = MAX_STACK_SIZE_WORDS;
+    }
+}
+
+interpreter_base::quotas interpreter_base::get_usage()
+{
+    quotas u;
+    u.heap_cells = heap_size();
+    u.trail_entries = trail_size();
+    u.stack_words = to_stack_relative_addr(stack_top(false));
+    u.open_files = open_files_.size();
+    return u;
+}
+
 void interpreter_base::reset_files()
 {
     close_all_files();
@@ -145,6 +265,9 @@ bool interpreter_base::is_file_id(size_t id) const
 
 file_stream & interpreter_base::new_file_stream(const std::string &path)
 {
+    if (quotas_.open_files != 0 && open_files_.size() >= quotas_.open_files) {
+	throw interpreter_exception_resource(common::quota_exception("open files", quotas_.open_files).what());
+    }
     size_t new_id = file_id_count_;
     file_stream *fs = new file_stream(*this, file_id_count_, path);
     file_id_count_++;
@@ -344,6 +467,9 @@ void interpreter_base::load_clause(const term t, bool as_program)
     // the most common case.
     preprocess_freeze(t);
 
+    // Large constant data in clauses is only stored once.
+    term clause = is_hash_consing() ? hash_cons(t) : t;
+
     con_cell module = EMPTY_LIST;
 
     // This is a valid clause. Let's lookup the functor of its head.
@@ -356,6 +482,7 @@ void interpreter_base::load_clause(const term t, bool as_program)
 
     auto found = program_db_.find(qn);
     if (found == program_db_.end()) {
+	pin_name(qn);
         program_db_[qn] = managed_clauses();
 	program_predicates_.push_back(qn);
     } else {
@@ -368,12 +495,171 @@ void interpreter_base::load_clause(const term t, bool as_program)
 	}
     }
     updated_predicates_.insert(qn);
-    program_db_[qn].push_back(managed_clause(t, cost(t)));
+    program_db_[qn].push_back(managed_clause(clause, cost(clause)));
+    gc_pin_heap();
+    if (clauses_loaded_fn_ != nullptr) {
+	clauses_loaded_fn_(this, qn);
+    }
+
+    if (module_db_set_[module].count(qn) == 0) {
+        module_db_set_[module].insert(qn);
+	module_db_[module].push_back(qn);
+    }
+}
+
+void interpreter_base::fork_program(const interpreter_base &tmpl)
+{
+    assert(heap_size() == 0);
+
+    get_heap().fork(tmpl.get_heap());
+    clauses_env_->get_heap().fork(tmpl.clauses_env_->get_heap());
+    clauses_limit_ = tmpl.clauses_limit_;
+
+    program_db_ = tmpl.program_db_;
+    for (auto &p : program_db_) {
+	for (auto &m_clause : p.second) {
+	    m_clause.unshare();
+	}
+    }
+    program_predicates_ = tmpl.program_predicates_;
+    dynamic_predicates_ = tmpl.dynamic_predicates_;
+    tabled_predicates_ = tmpl.tabled_predicates_;
+    generation_ = tmpl.generation_;
+
+    // Builtins are already there
+    for (auto &qn : program_predicates_) {
+	if (module_db_set_[qn.first].insert(qn).second) {
+	    module_db_[qn.first].push_back(qn);
+	}
+    }
+
+    protect_heap();
+}
+
+void interpreter_base::set_dynamic(const qname &qn)
+{
+    if (dynamic_predicates_.insert(qn).second) {
+	pin_name(qn);
+	for (auto &m_clause : program_db_[qn]) {
+	    m_clause.make_erasable();
+	}
+    }
+}
+
+// The clause is copied to the clause heap (so it isn't undone by
+// backtracking.)
+managed_clause interpreter_base::assert_clause(const term t, bool at_end)
+{
+    syntax_check_stack_.push_back(
+		  std::bind(&interpreter_base::syntax_check_clause, this,
+			    t));
+    syntax_check();
+
+    uint64_t copy_cost = 0;
+    term clause = clauses_env_->copy(t, *this, copy_cost);
+    add_accumulated_cost(copy_cost);
+
+    con_cell module = EMPTY_LIST;
+    auto qn = std::make_pair(module, functor(clause_head(t)));
+
+    if (program_db_.find(qn) == program_db_.end()) {
+	pin_name(qn);
+        program_db_[qn] = managed_clauses();
+	program_predicates_.push_back(qn);
+    }
+
+    managed_clause m_clause(clause, cost(t), ++generation_);
+    auto &clauses = program_db_[qn];
+    if (at_end) {
+	clauses.push_back(m_clause);
+    } else {
+	clauses.insert(clauses.begin(), m_clause);
+    }
 
     if (module_db_set_[module].count(qn) == 0) {
         module_db_set_[module].insert(qn);
 	module_db_[module].push_back(qn);
     }
+
+    return m_clause;
+}
+
+void interpreter_base::erase_clause(const qname &qn, managed_clause &m_clause)
+{
+    m_clause.erase(++generation_);
+    auto &clauses = program_db_[qn];
+    auto it = std::find_if(clauses.begin(), clauses.end(),
+			   [&](const managed_clause &other)
+			   { return other.clause() == m_clause.clause(); });
+    if (it != clauses.end()) {
+	clauses.erase(it);
+    }
+}
+
+void interpreter_base::compact_clauses(std::vector<predicate> &lists,
+				       size_t gen)
+{
+    auto *fresh = new common::term_env();
+    fresh->get_heap().set_max_size(clauses_env_->get_heap().max_size());
+    std::unordered_map<term, term> moved;
+    auto relocate = [&](managed_clause &m_clause) {
+	if (!m_clause.is_asserted() || m_clause.clause() == term()) {
+	    return;
+	}
+	if (m_clause.is_dead(gen)) {
+	    m_clause.relocate(term());
+	    return;
+	}
+	auto it = moved.find(m_clause.clause());
+	if (it == moved.end()) {
+	    uint64_t cost = 0;
+	    term cl = fresh->copy(m_clause.clause(), *clauses_env_, cost);
+	    it = moved.insert(std::make_pair(m_clause.clause(), cl)).first;
+	}
+	m_clause.relocate(it->second);
+    };
+
+    for (auto &qn : dynamic_predicates_) {
+	for (auto &m_clause : program_db_[qn]) {
+	    relocate(m_clause);
+	}
+    }
+    for (auto &clauses : lists) {
+	for (auto &m_clause : clauses) {
+	    relocate(m_clause);
+	}
+    }
+
+    delete clauses_env_;
+    clauses_env_ = fresh;
+    clauses_limit_ = 2*clauses_env_->heap_size();
+    if (clauses_limit_ < MIN_CLAUSE_HEAP) {
+	clauses_limit_ = MIN_CLAUSE_HEAP;
+    }
+}
+
+bool interpreter_base::has_asserted_big(const qname &qn)
+{
+    for (auto &m_clause : get_predicate(qn)) {
+	if (!m_clause.is_asserted()) {
+	    continue;
+	}
+	std::vector<term> todo{m_clause.clause()};
+	while (!todo.empty()) {
+	    term t = clauses_env_->deref(todo.back());
+	    todo.pop_back();
+	    if (t.tag() == common::tag_t::BIG) {
+		return true;
+	    }
+	    if (t.tag() == common::tag_t::STR) {
+		size_t n = clauses_env_->functor(t).arity();
+		for (size_t i = 0; i < n; i++) {
+		    todo.push_back(clauses_env_->arg(t, i));
+		}
+	    }
+	}
+    }
+    return false;
 }
 
 void interpreter_base::load_builtin(const qname &qn, builtin b)
@@ -396,6 +682,14 @@ void interpreter_base::load_builtins()
 {
     // Profiling
     load_builtin(con_cell("profile", 0), &builtins::profile_0);
+    load_builtin(functor("profile_on", 0), &builtins::profile_on_0);
+    load_builtin(functor("profile_off", 0), &builtins::profile_off_0);
+    load_builtin(functor("profile_reset", 0), &builtins::profile_reset_0);
+    load_builtin(functor("profile_data", 2), &builtins::profile_data_2);
+    load_builtin(functor("statistics", 2), &builtins::statistics_2);
+
+    // Memory
+    load_builtin(functor("garbage_collect", 0), &builtins::garbage_collect_0);
 
     // Simple
     load_builtin(con_cell("true",0), &builtins::true_0);
@@ -440,6 +734,12 @@ void interpreter_base::load_builtins()
 
     // Arithmetics
     load_builtin(con_cell("is",2), &builtins::is_2);
+    load_builtin(con_cell("<",2), &builtins::operator_less_than);
+    load_builtin(con_cell("=<",2), &builtins::operator_equals_less_than);
+    load_builtin(con_cell(">",2), &builtins::operator_greater_than);
+    load_builtin(con_cell(">=",2), &builtins::operator_greater_than_equals);
+    load_builtin(con_cell("=:=",2), &builtins::operator_arith_equals);
+    load_builtin(con_cell("=\\=",2), &builtins::operator_arith_not_equals);
 
     // Analyzing & constructing terms
     load_builtin(con_cell("arg",3), &builtins::arg_3);
@@ -448,6 +748,9 @@ void interpreter_base::load_builtins()
     load_builtin(functor("copy_term",2), &builtins::copy_term_2);
     load_builtin(con_cell("=..", 2), &builtins::operator_deconstruct);
     load_builtin(con_cell("sort", 2), &builtins::sort_2);
+    load_builtin(con_cell("msort", 2), &builtins::msort_2);
+    load_builtin(con_cell("keysort", 2), &builtins::keysort_2);
+    load_builtin(con_cell("sort", 4), &builtins::sort_4);
 
     // Meta
     load_builtin(con_cell("\\+", 1), builtin(&builtins::operator_disprove,true));
@@ -497,6 +800,11 @@ void interpreter_base::load_builtins_file_io()
     load_builtin(con_cell("told",0), &builtins_fileio::told_0);
     load_builtin(con_cell("format",2), builtin(&builtins_fileio::format_2,true));
     load_builtin(con_cell("sformat",3), builtin(&builtins_fileio::sformat_3,true));
+
+    // Profiling (the sampling timer is shared by the whole process and
+    // the flamegraph is written to a file)
+    load_builtin(functor("profile_sample", 1), &builtins::profile_sample_1);
+    load_builtin(functor("profile_flamegraph", 1), &builtins::profile_flamegraph_1);
 }
 
 void interpreter_base::load_program(const term t)
@@ -697,7 +1005,9 @@ void interpreter_base::print_db(std::ostream &out) const
 	    if (!is_empty_list(qn.first)) {
 	        mod = to_string(qn.first)+":";
 	    }
-	    auto str = mod+to_string(m_clause.clause(), opt);
+	    auto str = mod+(m_clause.is_asserted()
+			    ? clauses_env_->to_string(m_clause.clause(), opt)
+			    : to_string(m_clause.clause(), opt));
 	    out << str;
 	    do_nl = true;
 	}
@@ -713,39 +1023,7 @@ void interpreter_base::print_profile() const
 
 void interpreter_base::print_profile(std::ostream &out) const
 {
-    struct entry {
-	con_cell f;
-	uint64_t t;
-
-	bool operator < (const entry &e) const {
-	    if (t < e.t) {
-		return true;
-	    } else if (t > e.t) {
-		return false;
-	    } else {
-		return f.value() < e.f.value();
-	    }
-	}
-
-	bool operator == (const entry &e) const {
-	    return t == e.t && f == e.f;
-	}
-    };
-
-    std::vector<entry> all;
-
-    for (auto prof : profiling_) {
-	auto f = prof.first;
-	auto t = prof.second;
-	all.push_back(entry{f,t});
-    }
-    std::sort(all.begin(), all.end());
-    for (auto p : all) {
-	auto f = p.f;
-	auto t = p.t;
-	std::cout << to_string(f) << ": " << t << "\n";
-    }
-
+    profiler_.print(out);
 }
 
 void interpreter_base::abort(const interpreter_exception &ex)
@@ -764,6 +1042,9 @@ void interpreter_base::prepare_execution()
     register_top_e_ = register_e_;
     set_register_hb(heap_size());
     register_p_.reset();
+    gc_query_start_ = heap_size();
+    gc_promoted_ = 0;
+    reset_gc_limit();
 }
 
 
@@ -815,19 +1096,29 @@ common::cell interpreter_base::first_arg_index(const term t)
 
 term interpreter_base::clause_head(const term clause)
 {
-    auto f = functor(clause);
+    return clause_head(*this, clause);
+}
+
+term interpreter_base::clause_body(const term clause)
+{
+    return clause_body(*this, clause);
+}
+
+term interpreter_base::clause_head(common::term_env &env, const term clause)
+{
+    auto f = env.functor(clause);
     if (f == IMPLIED_BY) {
-	return arg(clause, 0);
+	return env.arg(clause, 0);
     } else {
 	return clause;
     }
 }
 
-term interpreter_base::clause_body(const term clause)
+term interpreter_base::clause_body(common::term_env &env, const term clause)
 {
-    auto f = functor(clause);
+    auto f = env.functor(clause);
     if (f == IMPLIED_BY) {
-        return arg(clause, 1);
+        return env.arg(clause, 1);
     } else {
         return EMPTY_LIST;
     }
@@ -875,6 +1166,7 @@ choice_point_t * interpreter_base::reset_to_choice_point(choice_point_t *b)
     for (size_t i = 0; i < n; i++) {
 	a(i) = ch->ai[i];
     }
+    num_of_args_ = n;
 
     return ch;
 }
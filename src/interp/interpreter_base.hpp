@@ -8,44 +8,112 @@
 #include <stack>
 #include <tuple>
 #include <map>
+#include <memory>
 #include "../common/term_env.hpp"
 #include "../common/merkle_trie.hpp"
 #include "builtins.hpp"
 #include "file_stream.hpp"
 #include "arithmetics.hpp"
 #include "locale.hpp"
+#include "profiler.hpp"
 
 namespace prologcoin { namespace interp {
-// This pair represents functor with first argument. If first argument
-// is a STR tag, then we dereference it to a CON cell.
+// This pair represents functor with an indexed argument (see
+// interpreter::index_positions.) If the argument is a STR tag, then
+// we dereference it to a CON cell.
 //
-// FUNCTOR_INDEX = pair( QNAME, ARG_TYPE)
+// FUNCTOR_INDEX = pair( QNAME, pair( ARG_POSITION, ARG_TYPE ) )
 // QNAME = pair( MODULE, FUNCTOR )
 //
 typedef std::pair<common::con_cell, common::con_cell> qname;
-typedef std::pair<qname, common::cell> functor_index;
+typedef std::pair<size_t, common::cell> arg_index;
+typedef std::pair<qname, arg_index> functor_index;
 
+//
+// Clauses of dynamic predicates are stamped with the generation they
+// were added (born) and erased (died) in. A call only sees the clauses
+// that were alive in the generation it started (the logical update
+// view.) All copies of a clause share its erase stamp.
+//
+// Asserted clauses are stored on the clause heap (see
+// interpreter_base::clause_env) and not on the heap of the query.
+//
 class managed_clause {
 public:
     inline managed_clause()
-	: clause_(), cost_(0) { }
+	: clause_(), cost_(0), born_(0), asserted_(false) { }
     inline managed_clause(common::term cl, uint64_t cost)
-        : clause_(cl), cost_(cost) { }
+        : clause_(cl), cost_(cost), born_(0), asserted_(false) { }
+    inline managed_clause(common::term cl, uint64_t cost, size_t born)
+        : clause_(cl), cost_(cost), born_(born),
+	  died_(std::make_shared<size_t>(0)), asserted_(true) { }
 
     inline managed_clause(const managed_clause &other)
-	: clause_(other.clause_), cost_(other.cost_) { }
+	: clause_(other.clause_), cost_(other.cost_), born_(other.born_),
+	  died_(other.died_), asserted_(other.asserted_) { }
+
+    inline managed_clause & operator = (const managed_clause &other) = default;
 
     inline common::term clause() const {
 	return clause_;
     }
 
+    inline bool is_asserted() const {
+	return asserted_;
+    }
+
+    // When the clause heap is compacted
+    inline void relocate(common::term cl) {
+	clause_ = cl;
+    }
+
     inline uint64_t cost() const {
 	return cost_;
     }
 
+    inline bool is_erasable() const {
+	return died_ != nullptr;
+    }
+
+    inline bool is_erased() const {
+	return died_ != nullptr && *died_ != 0;
+    }
+
+    inline bool is_visible(size_t gen) const {
+	return born_ <= gen && (died_ == nullptr || *died_ == 0 || *died_ > gen);
+    }
+
+    // Erased before 'gen', i.e. calls started in 'gen' (or later)
+    // can't see it.
+    inline bool is_dead(size_t gen) const {
+	return died_ != nullptr && *died_ != 0 && *died_ <= gen;
+    }
+
+    inline void erase(size_t gen) {
+	*died_ = gen;
+    }
+
+    // Turn a static clause into one that can be erased.
+    inline void make_erasable() {
+	if (died_ == nullptr) {
+	    died_ = std::make_shared<size_t>(0);
+	}
+    }
+
+    // Copies share whether the clause is erased. After this call
+    // this one is erased independently of the others.
+    inline void unshare() {
+	if (died_ != nullptr) {
+	    died_ = std::make_shared<size_t>(*died_);
+	}
+    }
+
 private:
     common::term clause_;
     size_t cost_;
+    size_t born_;
+    std::shared_ptr<size_t> died_;
+    bool asserted_;
 };
 
 typedef std::vector<managed_clause> managed_clauses;
@@ -64,7 +132,8 @@ namespace std {
 	size_t operator()(const prologcoin::interp::functor_index &k) const {
 	    return k.first.first.raw_value() + 
 	   	   17*k.first.second.raw_value() +
-	           131*k.second.raw_value();
+	           131*k.second.second.raw_value() +
+	           1031*k.second.first;
 	}
     };
 }
@@ -138,6 +207,13 @@ public:
 	: interpreter_exception(msg) { }
 };
 
+class interpreter_exception_resource : public interpreter_exception
+{
+public:
+    interpreter_exception_resource(const std::string &msg)
+	: interpreter_exception(msg) { }
+};
+
 class interpreter_exception_undefined_predicate : public interpreter_exception
 {
 public:
@@ -201,6 +277,13 @@ public:
 	: interpreter_exception(msg) { }
 };
 
+class interpreter_exception_evaluation : public interpreter_exception
+{
+public:
+    interpreter_exception_evaluation(const std::string &msg)
+	: interpreter_exception(msg) { }
+};
+
 class interpreter_exception_undefined_function : public interpreter_exception
 {
 public:
@@ -273,6 +356,7 @@ public:
     inline builtin_fn bn() const { return bn_; }
     inline const common::con_cell & module() const { return module_; }
     inline const common::cell & term_code() const { return term_code_; }
+    inline common::cell & term_code() { return term_code_; }
     inline const common::int_cell & label() const { return static_cast<const common::int_cell &>(term_code_); }
     inline const common::con_cell & name() const { return static_cast<const common::con_cell &>(term_code_); }
 
@@ -356,6 +440,8 @@ struct choice_point_t {
     choice_point_t       *b0;
     common::term          qr; // Only used for naive interpreter (for now)
     common::con_cell      pr; // Only used for naive interpreter (for now)
+    size_t                gen; // Only used for naive interpreter (for now)
+    uint64_t              exits; // For counting redos when profiling
     size_t                arity;
     common::term          ai[];
 };
@@ -365,6 +451,7 @@ struct environment_naive_t : public environment_base_t {
     choice_point_t       *b0;
     common::term          qr;
     common::con_cell      pr;
+    common::con_cell      pe; // Predicate of clause (for profiling exits)
 };
 
 struct environment_frozen_t : public environment_naive_t {
@@ -457,6 +544,8 @@ class interpreter_base : public common::term_env {
     friend class builtins_opt;
     friend class builtins_fileio;
     friend class arithmetics;
+    friend class arithmetics_fn;
+    friend class sorter;
     friend struct meta_context;
     friend class interpreter;
     friend struct new_instance_context;
@@ -475,6 +564,12 @@ public:
     inline const locale & current_locale() const { return locale_; }
     inline locale & current_locale() { return locale_; }
 
+    inline const profiler & get_profiler() const { return profiler_; }
+    inline profiler & get_profiler() { return profiler_; }
+
+    inline uint64_t num_inferences() const { return inferences_; }
+    inline void count_inference() { inferences_++; }
+
     inline bool is_debug() const { return debug_; }
     inline void set_debug(bool dbg) { debug_ = dbg; arith_.set_debug(dbg); }
     inline void debug_check() { debug_check_fn_(); }
@@ -502,6 +597,10 @@ public:
     bool is_track_cost() const { return track_cost_; }
     void set_track_cost(bool b) { track_cost_ = b; }
 
+    // Share ground subterms of loaded clauses (see term_utils::hash_cons)
+    bool is_hash_consing() const { return hash_consing_; }
+    void set_hash_consing(bool b) { hash_consing_ = b; }
+
     void enable_file_io();
     const std::string & get_current_directory() const;
     void set_current_directory(const std::string &dir);
@@ -543,10 +642,27 @@ public:
     term clause_body(const term clause);
     common::con_cell clause_predicate(const term clause);
 
+    // Same for a clause of 'env'
+    static term clause_head(common::term_env &env, const term clause);
+    static term clause_body(common::term_env &env, const term clause);
+
     void load_program(const std::string &str);
     void load_program(std::istream &is);
     void load_program(const term clauses);
 
+    // Start from the program of 'tmpl' (instead of loading it again.)
+    // The heap is forked, i.e. its blocks are shared until this
+    // interpreter writes to them, and the program database is copied.
+    // This interpreter must not have anything on its heap yet. Code
+    // compiled by 'tmpl' isn't shared; the predicates are interpreted
+    // until they get compiled here. 'tmpl' must not change meanwhile.
+    void fork_program(const interpreter_base &tmpl);
+
+    // Names of predicates outlive the terms they came from (see
+    // heap::pin_atom.)
+    inline void pin_name(const qname &qn)
+        { pin_atom(qn.first); pin_atom(qn.second); }
+
     inline const predicate & get_predicate(con_cell module, con_cell f)
         { return get_predicate(std::make_pair(module, f)); }
 
@@ -570,6 +686,51 @@ public:
     inline void clear_updated_predicates()
         { updated_predicates_.clear(); }
 
+    inline void clear_updated_predicate(const qname &pn)
+        { updated_predicates_.erase(pn); }
+
+    // The dynamic database (assert/retract.) Each update starts a new
+    // generation.
+    inline size_t generation() const
+        { return generation_; }
+
+    inline bool is_dynamic(const qname &pn) const
+        { return dynamic_predicates_.find(pn) != dynamic_predicates_.end(); }
+
+    void set_dynamic(const qname &pn);
+    managed_clause assert_clause(const term t, bool at_end);
+    void erase_clause(const qname &pn, managed_clause &m_clause);
+
+    // Asserted clauses live on a heap of their own, so they don't pin
+    // the heap of the query (and backtracking doesn't undo them.)
+    inline common::term_env & clause_env(const managed_clause &m_clause)
+        { return m_clause.is_asserted() ? *clauses_env_ : *this; }
+
+    inline common::term_env & clauses_env()
+        { return *clauses_env_; }
+
+    // The clause heap has grown enough to be worth compacting (it's
+    // done when it has doubled since the last time.)
+    static const size_t MIN_CLAUSE_HEAP = 4096;
+    inline bool is_clause_heap_full() const
+        { return clauses_env_->heap_size() >= clauses_limit_; }
+
+    // Move the asserted clauses that can still be seen to a new
+    // clause heap. The ones erased before 'gen' (the oldest generation
+    // a running call can see) are dropped. 'lists' hold other copies
+    // of the clauses.
+    void compact_clauses(std::vector<predicate> &lists, size_t gen);
+
+    bool has_asserted_big(const qname &qn);
+
+    // Calls to tabled predicates are answered from tables (they're
+    // never compiled.)
+    inline bool is_tabled(const qname &pn) const
+        { return tabled_predicates_.find(pn) != tabled_predicates_.end(); }
+
+    inline void set_tabled(const qname &pn)
+        { pin_name(pn); tabled_predicates_.insert(pn); }
+
     std::string to_string_cp(const code_point &cp)
         { return cp.to_string(*this); }
 
@@ -619,6 +780,9 @@ public:
 	}
     }
 
+    inline const std::unordered_map<qname, builtin> & get_builtins() const
+        { return builtins_; }
+
     inline bool is_builtin(const qname &qn) const
         { return is_builtin(qn.first, qn.second); }
 
@@ -630,6 +794,43 @@ public:
 
     inline void set_maximum_cost(uint64_t cost) { maximum_cost_ = cost; }
 
+    // Resource quotas (0 = unlimited) that protect a node from queries
+    // that would exhaust its memory. They are checked where memory is
+    // allocated in bulk (a new heap block, growing the trail) or where
+    // there already is a check (stack frames, opening a file), so
+    // there is no per cell cost. Exceeding a quota raises an
+    // interpreter_exception_resource.
+    struct quotas {
+	inline quotas() : heap_cells(0), trail_entries(0),
+			  stack_words(0), open_files(0) { }
+	size_t heap_cells;
+	size_t trail_entries;
+	size_t stack_words;
+	size_t open_files;
+    };
+
+    void set_quotas(const quotas &q);
+    inline const quotas & get_quotas() const { return quotas_; }
+
+    // Current usage (in the same units as the quotas.)
+    quotas get_usage();
+
+    // Heap garbage collection. A collection is only done at a safe
+    // point (the naive interpreter dispatching a goal or the WAM calling
+    // a predicate) where all live terms are known. A minor collection
+    // takes place when 'gc_threshold' cells have been allocated since
+    // the last collection. A threshold of 0 disables the collector.
+    static const size_t DEFAULT_GC_THRESHOLD = 1024*1024;
+    static const size_t GC_MINOR_PER_MAJOR = 8;
+
+    inline size_t gc_threshold() const { return gc_threshold_; }
+    inline void set_gc_threshold(size_t cells)
+        { gc_threshold_ = cells; reset_gc_limit(); }
+
+    // Force a major collection at the next safe point.
+    inline void request_gc()
+        { gc_requested_ = true; gc_limit_ = 0; }
+
     inline bool unify(term a, term b)
        { uint64_t cost = 0;
 	 bool ok = common::term_env::unify(a, b, cost);
@@ -658,6 +859,55 @@ public:
 	 return c;
        }
 
+    inline term copy(term t, std::unordered_map<term, term> &term_map)
+       { uint64_t cost = 0;
+         term c = common::term_env::copy(t, term_map, cost);
+	 add_accumulated_cost(cost);
+	 return c;
+       }
+
+    // The copy may share ground terms with 't' and must not be modified
+    inline term copy_shared(term t)
+       { uint64_t cost = 0;
+         term c = common::term_env::copy_shared(t, cost);
+	 add_accumulated_cost(cost);
+	 return c;
+       }
+
+    inline term copy_shared(term t, std::unordered_map<term, term> &var_map)
+       { uint64_t cost = 0;
+         term c = common::term_env::copy_shared(t, var_map, cost);
+	 add_accumulated_cost(cost);
+	 return c;
+       }
+
+    inline bool unify_instance(term pattern, term t,
+			       std::unordered_map<term, term> &var_map)
+       { uint64_t cost = 0;
+         bool r = common::term_env::unify_instance(pattern, t, var_map, cost);
+	 add_accumulated_cost(cost);
+	 return r;
+       }
+
+    // Same, but 'pattern' is a term of 'src' (e.g. a clause on the
+    // clause heap)
+    inline term copy_shared(term t, term_env &src,
+			    std::unordered_map<term, term> &var_map)
+       { uint64_t cost = 0;
+         term c = common::term_env::copy_shared(t, src, var_map, cost);
+	 add_accumulated_cost(cost);
+	 return c;
+       }
+
+    inline bool unify_instance(term pattern, term t, term_env &src,
+			       std::unordered_map<term, term> &var_map)
+       { uint64_t cost = 0;
+         bool r = common::term_env::unify_instance(pattern, t, src, var_map,
+						   cost);
+	 add_accumulated_cost(cost);
+	 return r;
+       }
+
     inline managed_data * get_managed_data(common::con_cell key)
        { auto it = managed_data_.find(key);
 	 if (it == managed_data_.end()) {
@@ -668,7 +918,7 @@ public:
        }
 
   inline void set_managed_data(common::con_cell key, managed_data *data)
-       { managed_data_[key] = data; }
+       { pin_atom(key); managed_data_[key] = data; }
 
 protected:
     friend class wam_interpreter;
@@ -711,6 +961,9 @@ protected:
     typedef size_t (*num_y_fn_t)(interpreter_base *interp, bool use_previous);
     typedef void (*save_state_fn_t)(interpreter_base *interp);
     typedef void (*restore_state_fn_t)(interpreter_base *interp);
+    typedef void (*gc_fn_t)(interpreter_base *interp);
+    typedef void (*clauses_loaded_fn_t)(interpreter_base *interp,
+					const qname &qn);
 
     inline num_y_fn_t num_y_fn()
     {
@@ -738,6 +991,83 @@ protected:
 	restore_state_fn_ = rfn;
     }
 
+    inline void set_gc_fn(gc_fn_t gfn)
+    {
+        gc_fn_ = gfn;
+    }
+
+    // Called when a consult has added (or replaced) clauses of a
+    // predicate (assert has its own bookkeeping.)
+    inline void set_clauses_loaded_fn(clauses_loaded_fn_t lfn)
+    {
+        clauses_loaded_fn_ = lfn;
+    }
+
+    // Only to be called at a safe point.
+    inline void check_gc()
+    {
+        if (heap_size() >= gc_limit_ && gc_fn_ != nullptr) {
+	    gc_fn_(this);
+	}
+    }
+
+    inline void reset_gc_limit()
+    {
+        if (gc_requested_) {
+	    gc_limit_ = 0;
+	} else if (gc_threshold_ == 0) {
+	    gc_limit_ = std::numeric_limits<size_t>::max();
+	} else {
+	    gc_limit_ = heap_size() + gc_threshold_;
+	}
+    }
+
+    inline bool gc_is_major() const
+    {
+        return gc_requested_ || gc_minor_count_ + 1 >= GC_MINOR_PER_MAJOR;
+    }
+
+    // Bindings of cells below this address may have to be undone
+    // (by backtracking or when the query is done.)
+    inline size_t gc_heap_mark() const
+    {
+        return b() != nullptr ? b()->h : gc_query_start_;
+    }
+
+    // Cells below this address are never moved by the next collection.
+    inline size_t gc_young_start(bool major) const
+    {
+        size_t start = gc_query_start_;
+	if (gc_heap_mark() > start) start = gc_heap_mark();
+	if (!major && gc_promoted_ > start) start = gc_promoted_;
+	return start;
+    }
+
+    inline void gc_done(bool major)
+    {
+        gc_minor_count_ = major ? 0 : gc_minor_count_ + 1;
+	gc_promoted_ = heap_size();
+	gc_requested_ = false;
+	reset_gc_limit();
+    }
+
+    // Everything currently on the heap must stay where it is (e.g.
+    // clauses added to the program database.)
+    inline void gc_pin_heap()
+    {
+        if (heap_size() > gc_query_start_) {
+	    gc_query_start_ = heap_size();
+	}
+    }
+
+    // Everything currently on the heap survives backtracking as well.
+    inline void protect_heap()
+    {
+        heap_floor_ = heap_size();
+	set_register_hb(heap_size());
+	gc_pin_heap();
+    }
+
     inline term & a(size_t i)
     {
         return register_ai_[i];    
@@ -978,6 +1308,27 @@ protected:
     // Allocate on stack so that we don't overwrite any data of a previous
     // stack frame.
     inline word_t * allocate_stack(bool use_previous)
+    {
+	word_t *new_s = stack_top(use_previous);
+
+	size_t top = to_stack_relative_addr(new_s) + MAX_STACK_FRAME_WORDS;
+	if (top >= stack_committed_words_ || top >= stack_limit_words_) {
+	    grow_stack(top);
+	}
+
+	return new_s;
+    }
+
+    static word_t * reserve_stack(size_t bytes);
+    static void release_stack(word_t *stack, size_t bytes);
+
+    // Commit more of the reserved stack (or throw if over the limit.)
+    void grow_stack(size_t words);
+
+    // Give back what the stack has grown (only when it's empty.)
+    void shrink_stack();
+
+    inline word_t * stack_top(bool use_previous)
     {
 	word_t *new_s;
 
@@ -994,12 +1345,6 @@ protected:
 	        new_s = base(b()) + words<term>()*b()->arity + words<choice_point_t>();
 	    }
 	}
-
-	if (to_stack_relative_addr(new_s) + MAX_STACK_FRAME_WORDS
-	    >= MAX_STACK_SIZE_WORDS) {
-	    throw interpreter_exception_stack_overflow("Exceeded maximum stack size (" + boost::lexical_cast<std::string>(MAX_STACK_SIZE) + " bytes.)");
-	}
-
 	return new_s;
     }
   
@@ -1058,6 +1403,8 @@ protected:
 	new_b->b0 = register_b0_;
 	new_b->qr = register_qr_;
 	new_b->pr = register_pr_;
+	new_b->gen = generation_;
+	new_b->exits = profiler_.num_exits();
 	register_b_ = new_b;
 	set_register_hb(heap_size());
 
@@ -1110,9 +1457,14 @@ protected:
     inline const term qr() const
         { return register_qr_; }
 
+    inline term & qr()
+        { return register_qr_; }
+
     inline void set_qr(term qr)
         { register_qr_ = qr; }
 
+    inline common::con_cell pr() const
+        { return register_pr_; }
     inline void set_pr(common::con_cell pr)
         { register_pr_ = pr; }
 
@@ -1230,6 +1582,7 @@ private:
 
     bool debug_;
     bool track_cost_;
+    bool hash_consing_;
     std::vector<std::function<void ()> > syntax_check_stack_;
 
     std::unordered_map<qname, code_point> code_db_;
@@ -1239,15 +1592,26 @@ private:
     std::unordered_map<con_cell, std::unordered_set<qname> > module_db_set_;
     std::vector<qname> program_predicates_;
     std::unordered_set<qname> updated_predicates_;
+    std::unordered_set<qname> dynamic_predicates_;
+    std::unordered_set<qname> tabled_predicates_;
+    size_t generation_;
+    common::term_env *clauses_env_;
+    size_t clauses_limit_;  // Clause heap size that triggers compaction
 
     // Stack is emulated at heap offset >= 2^59 (3 bits for tag, remember!)
     // (This conforms to the WAM standard where addr(stack) > addr(heap))
     const size_t STACK_BASE = 0x80000000000000;
-    const size_t MAX_STACK_SIZE = 1024*1024;
+
+    // The full stack is reserved address space (so frames never move)
+    // but only what has been reached is committed.
+    const size_t MAX_STACK_SIZE = 256*1024*1024;
     const size_t MAX_STACK_SIZE_WORDS = MAX_STACK_SIZE / sizeof(word_t);
+    const size_t INITIAL_STACK_SIZE_WORDS = 64*1024 / sizeof(word_t);
     const size_t MAX_STACK_FRAME_WORDS = 4096 / sizeof(word_t);
 
     word_t    *stack_;
+    size_t    stack_limit_words_;
+    size_t    stack_committed_words_;
 
     bool top_fail_;
     bool complete_;
@@ -1274,6 +1638,16 @@ private:
     num_y_fn_t num_y_fn_;
     save_state_fn_t save_state_fn_;
     restore_state_fn_t restore_state_fn_;
+    gc_fn_t gc_fn_;
+    clauses_loaded_fn_t clauses_loaded_fn_;
+
+    size_t gc_threshold_;   // Young generation size that triggers a GC
+    size_t gc_limit_;       // Heap size that triggers the next GC
+    bool gc_requested_;     // Next collection is a major one
+    size_t gc_query_start_; // Heap size when the current query started
+    size_t gc_promoted_;    // Survivors of the last minor collection
+    size_t gc_minor_count_; // Minor collections since last major
+    size_t heap_floor_;     // The heap is never trimmed below this
 
     term register_qr_;     // Current query 
     con_cell register_pr_; // Current predicate (for profiling)
@@ -1293,7 +1667,8 @@ private:
 
     arithmetics arith_;
 
-    std::unordered_map<common::con_cell, uint64_t> profiling_;
+    // Calls (incl. built-ins) made since the interpreter was created
+    uint64_t inferences_;
 
     std::function<void ()> debug_check_fn_;
 
@@ -1303,9 +1678,13 @@ private:
     // Maximum cost allowed
     uint64_t maximum_cost_;
 
+    quotas quotas_;
+
     // Locale
     locale locale_;
 
+    profiler profiler_;
+
     common::merkle_trie<term,60> frozen_closures;
 
     std::unordered_map<common::con_cell, managed_data *> managed_data_;
@@ -1345,14 +1724,21 @@ protected:
     }
   
     inline void trim_heap(size_t new_size) {
-        term_env::trim_heap(new_size);
-	// And we need to remove any pending frozen closures
+        if (new_size < heap_floor_) {
+	    new_size = heap_floor_;
+	}
+	// Remove any pending frozen closures first (while their
+	// heap blocks still exist.)
 	for (auto it = frozen_closures.begin(new_size);
 	     it != frozen_closures.end();) {
    	     size_t addr = it->key();
 	     it = frozen_closures.erase(it);
 	     heap_watch(addr, false);
 	}
+        term_env::trim_heap(new_size);
+	if (new_size < gc_promoted_) {
+	    gc_promoted_ = new_size;
+	}
     }
 
     void check_frozen();
@@ -1368,6 +1754,7 @@ template<> inline environment_naive_t * interpreter_base::allocate_environment<E
     new_ee->b0 = b0();
     new_ee->qr = register_qr_;
     new_ee->pr = register_pr_;
+    new_ee->pe = EMPTY_LIST;
     
     set_ee(new_ee);
     return new_ee;
@@ -1390,6 +1777,7 @@ template<> inline environment_frozen_t * interpreter_base::allocate_environment<
     new_ef->b0 = b0();
     new_ef->qr = register_qr_;
     new_ef->pr = register_pr_;
+    new_ef->pe = EMPTY_LIST;
     new_ef->p = p();
     
     set_e(new_ef, ENV_FROZEN);
@@ -0,0 +1,191 @@
+#include "interpreter_base.hpp"
+#include "profiler.hpp"
+#include <algorithm>
+#include <cstring>
+#include <iomanip>
+#include <unordered_set>
+#ifndef _WIN32
+#include <sys/time.h>
+#endif
+
+namespace prologcoin { namespace interp {
+
+volatile sig_atomic_t profiler::pending_samples_ = 0;
+profiler * profiler::owner_ = nullptr;
+
+profiler::profiler(interpreter_base &interp)
+    : interp_(interp), enabled_(false), interval_(0), last_interval_(0),
+      num_samples_(0), num_exits_(0), last_runtime_(0), last_walltime_(0)
+{
+    started_ = std::chrono::steady_clock::now();
+}
+
+profiler::~profiler()
+{
+    stop();
+}
+
+void profiler::on_signal(int)
+{
+    pending_samples_ = pending_samples_ + 1;
+}
+
+bool profiler::start(size_t interval)
+{
+    stop();
+    enabled_ = true;
+    if (interval == 0) {
+	return true;
+    }
+#ifdef _WIN32
+    return false;
+#else
+    // Only one interpreter (per process) can own the timer.
+    if (is_timer_taken()) {
+	return false;
+    }
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = &profiler::on_signal;
+    sa.sa_flags = SA_RESTART;
+    sigemptyset(&sa.sa_mask);
+    if (sigaction(SIGPROF, &sa, nullptr) != 0) {
+	return false;
+    }
+    struct itimerval timer;
+    timer.it_interval.tv_sec = interval / 1000000;
+    timer.it_interval.tv_usec = interval % 1000000;
+    timer.it_value = timer.it_interval;
+    pending_samples_ = 0;
+    if (setitimer(ITIMER_PROF, &timer, nullptr) != 0) {
+	return false;
+    }
+    owner_ = this;
+    interval_ = interval;
+    last_interval_ = interval;
+    return true;
+#endif
+}
+
+void profiler::stop()
+{
+    enabled_ = false;
+    if (owner_ != this) {
+	return;
+    }
+#ifndef _WIN32
+    struct itimerval timer;
+    memset(&timer, 0, sizeof(timer));
+    setitimer(ITIMER_PROF, &timer, nullptr);
+    signal(SIGPROF, SIG_IGN);
+#endif
+    owner_ = nullptr;
+    interval_ = 0;
+    pending_samples_ = 0;
+}
+
+void profiler::reset()
+{
+    counters_.clear();
+    stacks_.clear();
+    num_samples_ = 0;
+}
+
+void profiler::add_samples(const std::vector<con_cell> &stack)
+{
+    uint64_t n = static_cast<uint64_t>(pending_samples_);
+    pending_samples_ = 0;
+    if (n == 0 || stack.empty()) {
+	return;
+    }
+    num_samples_ += n;
+
+    counters_[stack.front()].self_samples += n;
+
+    // A recursive predicate gets its total time once per sample.
+    std::unordered_set<con_cell> seen;
+    std::string collapsed;
+    for (auto it = stack.rbegin(); it != stack.rend(); ++it) {
+	auto f = *it;
+	if (seen.insert(f).second) {
+	    counters_[f].total_samples += n;
+	}
+	if (!collapsed.empty()) {
+	    collapsed += ";";
+	}
+	collapsed += predicate_name(f);
+    }
+    stacks_[collapsed] += n;
+}
+
+std::string profiler::predicate_name(con_cell f) const
+{
+    return interp_.to_string(f) + "/" + boost::lexical_cast<std::string>(f.arity());
+}
+
+void profiler::print(std::ostream &out) const
+{
+    struct entry {
+	con_cell f;
+	const counters *c;
+    };
+
+    std::vector<entry> all;
+    for (auto &prof : counters_) {
+	all.push_back(entry{prof.first, &prof.second});
+    }
+
+    // Most time first, then most calls.
+    std::sort(all.begin(), all.end(),
+	      [](const entry &a, const entry &b) {
+		  if (a.c->total_samples != b.c->total_samples) {
+		      return a.c->total_samples > b.c->total_samples;
+		  }
+		  if (a.c->calls != b.c->calls) {
+		      return a.c->calls > b.c->calls;
+		  }
+		  return a.f.value() < b.f.value();
+	      });
+
+    out << "Inferences: " << interp_.num_inferences();
+    if (num_samples_ != 0) {
+	out << "  Samples: " << num_samples_ << " (" << to_ms(num_samples_) << " ms)";
+    }
+    out << "\n";
+    out << std::left << std::setw(30) << "Predicate" << std::right
+	<< std::setw(10) << "Calls" << std::setw(10) << "Redos"
+	<< std::setw(10) << "Exits" << std::setw(10) << "Fails"
+	<< std::setw(10) << "Self(ms)" << std::setw(10) << "Total(ms)"
+	<< "\n";
+    for (auto &e : all) {
+	out << std::left << std::setw(30) << predicate_name(e.f) << std::right
+	    << std::setw(10) << e.c->calls << std::setw(10) << e.c->redos
+	    << std::setw(10) << e.c->exits << std::setw(10) << e.c->fails()
+	    << std::setw(10) << to_ms(e.c->self_samples)
+	    << std::setw(10) << to_ms(e.c->total_samples) << "\n";
+    }
+}
+
+void profiler::print_collapsed(std::ostream &out) const
+{
+    for (auto &stack : stacks_) {
+	out << stack.first << " " << stack.second << "\n";
+    }
+}
+
+void profiler::runtime(uint64_t &total, uint64_t &since_last)
+{
+    total = static_cast<uint64_t>(std::clock()) * 1000 / CLOCKS_PER_SEC;
+    since_last = total - last_runtime_;
+    last_runtime_ = total;
+}
+
+void profiler::walltime(uint64_t &total, uint64_t &since_last)
+{
+    auto dt = std::chrono::steady_clock::now() - started_;
+    total = std::chrono::duration_cast<std::chrono::milliseconds>(dt).count();
+    since_last = total - last_walltime_;
+    last_walltime_ = total;
+}
+
+}}
@@ -0,0 +1,131 @@
+#pragma once
+
+#ifndef _interp_profiler_hpp
+#define _interp_profiler_hpp
+
+#include "../common/term_env.hpp"
+#include <signal.h>
+#include <chrono>
+#include <ctime>
+#include <map>
+#include <unordered_map>
+#include <vector>
+
+namespace prologcoin { namespace interp {
+
+class interpreter_base;
+
+//
+// Per predicate counters for the ports of the box model (call, redo,
+// exit and fail) and, when sampling, self and total time. The counting
+// is toggled at runtime and costs a flag test when it is off. Fails
+// aren't observed directly, they are the calls and redos that didn't
+// exit.
+//
+// Samples are driven by SIGPROF (in CPU time.) The handler only bumps a
+// counter; the interpreter takes the samples at its next safe point by
+// walking the environments (see wam_interpreter::profile_samples.)
+// Without last call optimization the stacks are complete, with it the
+// frames that have been replaced are missing.
+//
+// This class should not be used in consensus rules.
+//
+class profiler {
+    using con_cell = prologcoin::common::con_cell;
+
+public:
+    profiler(interpreter_base &interp);
+    ~profiler();
+
+    struct counters {
+	uint64_t calls = 0;
+	uint64_t redos = 0;
+	uint64_t exits = 0;
+	uint64_t self_samples = 0;
+	uint64_t total_samples = 0;
+
+	// Every call or redo leaves through exit or fail.
+	inline uint64_t fails() const
+	    { return calls + redos > exits ? calls + redos - exits : 0; }
+    };
+
+    inline bool is_enabled() const { return enabled_; }
+    inline bool is_sampling() const { return interval_ != 0; }
+
+    // Start counting and, if interval (in microseconds) is non-zero,
+    // sampling. Returns false if sampling isn't available.
+    bool start(size_t interval);
+    void stop();
+    void reset();
+
+    inline void call(con_cell f) { counters_[f].calls++; }
+    inline void exit(con_cell f) { counters_[f].exits++; num_exits_++; }
+
+    // A choice point being resumed is a redo only if some goal has
+    // exited since it was created (or last resumed); otherwise it's
+    // just the next clause being tried after a head that didn't match.
+    inline void redo(con_cell f, uint64_t &exits_at) {
+	if (exits_at != num_exits_) {
+	    counters_[f].redos++;
+	    exits_at = num_exits_;
+	}
+    }
+
+    inline uint64_t num_exits() const { return num_exits_; }
+
+    // Another interpreter is sampling
+    inline bool is_timer_taken() const
+        { return owner_ != nullptr && owner_ != this; }
+
+    inline bool has_pending_samples() const
+        { return pending_samples_ != 0 && owner_ == this; }
+
+    // Record the pending samples for a stack (innermost frame first.)
+    void add_samples(const std::vector<con_cell> &stack);
+
+    inline const counters * get_counters(con_cell f) const {
+	auto it = counters_.find(f);
+	return it == counters_.end() ? nullptr : &it->second;
+    }
+
+    // Samples to milliseconds
+    inline uint64_t to_ms(uint64_t samples) const
+        { return samples * last_interval_ / 1000; }
+
+    inline uint64_t num_samples() const { return num_samples_; }
+
+    void print(std::ostream &out) const;
+
+    // One line per stack: "outer;...;inner <samples>" (as expected by
+    // flamegraph.pl.)
+    void print_collapsed(std::ostream &out) const;
+
+    //
+    // For statistics/2 (total and since last asked, in milliseconds)
+    //
+    void runtime(uint64_t &total, uint64_t &since_last);
+    void walltime(uint64_t &total, uint64_t &since_last);
+
+private:
+    std::string predicate_name(con_cell f) const;
+
+    static void on_signal(int sig);
+    static volatile sig_atomic_t pending_samples_;
+    static profiler *owner_;
+
+    interpreter_base &interp_;
+    bool enabled_;
+    size_t interval_;
+    size_t last_interval_;
+    uint64_t num_samples_;
+    uint64_t num_exits_;
+    std::unordered_map<con_cell, counters> counters_;
+    std::map<std::string, uint64_t> stacks_;
+    std::chrono::steady_clock::time_point started_;
+    uint64_t last_runtime_;
+    uint64_t last_walltime_;
+};
+
+}}
+
+#endif
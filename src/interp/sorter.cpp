@@ -0,0 +1,353 @@
+#include "interpreter_base.hpp"
+#include "sorter.hpp"
+#include <algorithm>
+#include <memory>
+#include <thread>
+
+namespace prologcoin { namespace interp {
+
+using namespace prologcoin::common;
+
+sorter::sorter(interpreter_base &interp)
+    : interp_(interp), ctx_(interp.get_heap())
+{
+}
+
+void sorter::get_elements(term lst, std::vector<term> &elems,
+			  const std::string &context)
+{
+    if (lst.tag() == tag_t::REF) {
+	interp_.abort(interpreter_exception_not_sufficiently_instantiated(context + ": Arguments are not sufficiently instantiated"));
+    }
+    if (!interp_.is_list(lst)) {
+	interp_.abort(interpreter_exception_not_list(context + ": First argument is not a list; found " + interp_.to_string(lst)));
+    }
+    size_t n = interp_.list_length(lst);
+    elems.resize(n);
+    for (size_t i = 0; i < n; i++) {
+	elems[i] = interp_.arg(lst, 0);
+	lst = interp_.arg(lst, 1);
+    }
+}
+
+void sorter::sort(std::vector<term> &elems, size_t key, bool descending,
+		  bool dedup)
+{
+    const heap &h = interp_.get_heap();
+    size_t n = elems.size();
+
+    std::vector<term> keys(n);
+    for (size_t i = 0; i < n; i++) {
+	keys[i] = key == 0 ? h.deref(elems[i]) : h.arg(elems[i], key - 1);
+    }
+
+    std::vector<size_t> order;
+    if (all_tag(keys, tag_t::INT)) {
+	sort_ints(keys, descending, order);
+    } else if (all_atoms(keys)) {
+	sort_atoms(keys, descending, order);
+    } else {
+	sort_terms(keys, descending, order);
+    }
+
+    std::vector<term> sorted;
+    sorted.reserve(n);
+    size_t last = n;
+    for (auto i : order) {
+	if (dedup && last != n && compare(keys[last], keys[i]) == 0) {
+	    continue;
+	}
+	sorted.push_back(elems[i]);
+	last = i;
+    }
+    elems.swap(sorted);
+}
+
+int sorter::compare(term a, term b)
+{
+    return compare(a, b, ctx_);
+}
+
+//
+// Same order as term_utils::standard_order, but small integers are
+// compared by their (signed) values and BIGs by magnitude.
+//
+int sorter::compare(term a, term b, context &ctx) const
+{
+    const heap &h = interp_.get_heap();
+    auto &stack = ctx.stack;
+
+    stack.clear();
+    stack.push_back(std::make_pair(a, b));
+    while (!stack.empty()) {
+	a = h.deref(stack.back().first);
+	b = h.deref(stack.back().second);
+	stack.pop_back();
+
+	if (a == b) {
+	    continue;
+	}
+	if (a.tag() != b.tag()) {
+	    return a.tag() < b.tag() ? -1 : 1;
+	}
+
+	int c = 0;
+	switch (a.tag()) {
+	case tag_t::REF:
+	    c = a.value() < b.value() ? -1 : 1;
+	    break;
+	case tag_t::INT: {
+	    auto x = static_cast<const int_cell &>(a).value();
+	    auto y = static_cast<const int_cell &>(b).value();
+	    c = x < y ? -1 : (x > y ? 1 : 0);
+	    break;
+	    }
+	case tag_t::BIG:
+	    c = compare_big(a, b, ctx);
+	    break;
+	case tag_t::CON:
+	    c = functor_order(h, static_cast<const con_cell &>(a),
+			      static_cast<const con_cell &>(b));
+	    break;
+	case tag_t::STR: {
+	    con_cell fa = h.functor(a);
+	    con_cell fb = h.functor(b);
+	    if (fa != fb) {
+		c = functor_order(h, fa, fb);
+		break;
+	    }
+	    size_t n = fa.arity();
+	    for (size_t i = 0; i < n; i++) {
+		stack.push_back(std::make_pair(h.arg(a, n - i - 1),
+					       h.arg(b, n - i - 1)));
+	    }
+	    break;
+	    }
+	default:
+	    break;
+	}
+	if (c != 0) {
+	    stack.clear();
+	    return c;
+	}
+    }
+    return 0;
+}
+
+int sorter::functor_order(const heap &h, con_cell a, con_cell b)
+{
+    if (a.arity() != b.arity()) {
+	return a.arity() < b.arity() ? -1 : 1;
+    }
+    return h.atom_name(a).compare(h.atom_name(b));
+}
+
+int sorter::compare_big(term a, term b, context &ctx) const
+{
+    auto &la = ctx.limbs_a;
+    auto &lb = ctx.limbs_b;
+    ctx.big.get_limbs(static_cast<const big_cell &>(a), la);
+    ctx.big.get_limbs(static_cast<const big_cell &>(b), lb);
+    while (!la.empty() && la.back() == 0) la.pop_back();
+    while (!lb.empty() && lb.back() == 0) lb.pop_back();
+    if (la.size() != lb.size()) {
+	return la.size() < lb.size() ? -1 : 1;
+    }
+    for (size_t i = la.size(); i > 0; i--) {
+	if (la[i-1] != lb[i-1]) {
+	    return la[i-1] < lb[i-1] ? -1 : 1;
+	}
+    }
+    return 0;
+}
+
+bool sorter::all_tag(const std::vector<term> &keys, tag_t::kind_t tag)
+{
+    for (auto &k : keys) {
+	if (k.tag() != tag) {
+	    return false;
+	}
+    }
+    return true;
+}
+
+bool sorter::all_atoms(const std::vector<term> &keys)
+{
+    for (auto &k : keys) {
+	if (k.tag() != tag_t::CON ||
+	    static_cast<const con_cell &>(k).arity() != 0) {
+	    return false;
+	}
+    }
+    return true;
+}
+
+void sorter::sort_ints(const std::vector<term> &keys, bool descending,
+		       std::vector<size_t> &order)
+{
+    static const uint64_t SIGN = static_cast<uint64_t>(1) << 63;
+
+    size_t n = keys.size();
+    std::vector<std::pair<uint64_t, size_t> > items(n);
+    for (size_t i = 0; i < n; i++) {
+	auto v = static_cast<const int_cell &>(keys[i]).value();
+	uint64_t k = static_cast<uint64_t>(v) ^ SIGN;
+	items[i] = std::make_pair(descending ? ~k : k, i);
+    }
+    radix_sort(items);
+    order.resize(n);
+    for (size_t i = 0; i < n; i++) {
+	order[i] = items[i].second;
+    }
+}
+
+void sorter::sort_atoms(const std::vector<term> &keys, bool descending,
+			std::vector<size_t> &order)
+{
+    const heap &h = interp_.get_heap();
+    size_t n = keys.size();
+    std::vector<std::string> names(n);
+    std::vector<std::pair<uint64_t, size_t> > items(n);
+    for (size_t i = 0; i < n; i++) {
+	names[i] = h.atom_name(static_cast<const con_cell &>(keys[i]));
+	uint64_t k = 0;
+	for (size_t j = 0; j < 8; j++) {
+	    uint8_t ch = j < names[i].size() ? static_cast<uint8_t>(names[i][j]) : 0;
+	    k = (k << 8) | ch;
+	}
+	items[i] = std::make_pair(descending ? ~k : k, i);
+    }
+    radix_sort(items);
+
+    // Names that share the first 8 bytes
+    for (size_t i = 0; i < n;) {
+	size_t j = i + 1;
+	while (j < n && items[j].first == items[i].first) {
+	    j++;
+	}
+	if (j - i > 1 && names[items[i].second].size() >= 8) {
+	    std::stable_sort(items.begin() + i, items.begin() + j,
+		     [&](const std::pair<uint64_t, size_t> &a,
+			 const std::pair<uint64_t, size_t> &b) {
+			 int c = names[a.second].compare(names[b.second]);
+			 return descending ? c > 0 : c < 0; });
+	}
+	i = j;
+    }
+
+    order.resize(n);
+    for (size_t i = 0; i < n; i++) {
+	order[i] = items[i].second;
+    }
+}
+
+void sorter::sort_terms(const std::vector<term> &keys, bool descending,
+			std::vector<size_t> &order)
+{
+    static const size_t MAX_THREADS = 8;
+
+    size_t n = keys.size();
+    order.resize(n);
+    for (size_t i = 0; i < n; i++) {
+	order[i] = i;
+    }
+
+    auto less = [&](context &ctx) {
+	return [&](size_t i, size_t j) {
+	    int c = compare(keys[i], keys[j], ctx);
+	    return descending ? c > 0 : c < 0;
+	};
+    };
+
+    // The comparisons only read the heap, but reading a paged or a
+    // shared heap may change it.
+    auto &h = interp_.get_heap();
+    size_t num_threads = std::min(static_cast<size_t>(std::thread::hardware_concurrency()), MAX_THREADS);
+    if (n < PARALLEL_THRESHOLD || num_threads < 2 || h.is_paged() ||
+	h.num_shared_blocks() != 0) {
+	std::stable_sort(order.begin(), order.end(), less(ctx_));
+	return;
+    }
+
+    std::vector<std::unique_ptr<context> > ctxs;
+    std::vector<size_t> bounds(num_threads + 1);
+    for (size_t t = 0; t <= num_threads; t++) {
+	bounds[t] = n * t / num_threads;
+	if (t < num_threads) {
+	    ctxs.emplace_back(new context(h));
+	}
+    }
+
+    std::vector<std::thread> threads;
+    for (size_t t = 0; t < num_threads; t++) {
+	threads.emplace_back([&, t] {
+		std::stable_sort(order.begin() + bounds[t],
+				 order.begin() + bounds[t+1],
+				 less(*ctxs[t])); });
+    }
+    for (auto &th : threads) {
+	th.join();
+    }
+
+    // Merge the sorted runs pairwise (std::merge is stable.)
+    std::vector<size_t> merged(n);
+    for (size_t width = 1; width < num_threads; width *= 2) {
+	threads.clear();
+	for (size_t t = 0; t < num_threads; t += 2*width) {
+	    size_t lo = bounds[t];
+	    size_t mid = bounds[std::min(t + width, num_threads)];
+	    size_t hi = bounds[std::min(t + 2*width, num_threads)];
+	    threads.emplace_back([&, t, lo, mid, hi] {
+		    std::merge(order.begin() + lo, order.begin() + mid,
+			       order.begin() + mid, order.begin() + hi,
+			       merged.begin() + lo, less(*ctxs[t])); });
+	}
+	for (auto &th : threads) {
+	    th.join();
+	}
+	order.swap(merged);
+    }
+}
+
+//
+// LSD radix sort (stable) on 16 bits at a time. Passes where all keys
+// have the same digit are skipped.
+//
+void sorter::radix_sort(std::vector<std::pair<uint64_t, size_t> > &items)
+{
+    static const size_t BITS = 16;
+    static const size_t BUCKETS = static_cast<size_t>(1) << BITS;
+
+    size_t n = items.size();
+    if (n < 256) {
+	std::stable_sort(items.begin(), items.end(),
+			 [](const std::pair<uint64_t, size_t> &a,
+			    const std::pair<uint64_t, size_t> &b) {
+			     return a.first < b.first; });
+	return;
+    }
+
+    std::vector<std::pair<uint64_t, size_t> > tmp(n);
+    std::vector<size_t> count(BUCKETS);
+    for (size_t shift = 0; shift < 64; shift += BITS) {
+	std::fill(count.begin(), count.end(), 0);
+	for (auto &item : items) {
+	    count[(item.first >> shift) & (BUCKETS - 1)]++;
+	}
+	if (count[(items[0].first >> shift) & (BUCKETS - 1)] == n) {
+	    continue;
+	}
+	size_t sum = 0;
+	for (auto &c : count) {
+	    size_t k = c;
+	    c = sum;
+	    sum += k;
+	}
+	for (auto &item : items) {
+	    tmp[count[(item.first >> shift) & (BUCKETS - 1)]++] = item;
+	}
+	items.swap(tmp);
+    }
+}
+
+}}
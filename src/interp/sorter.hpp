@@ -0,0 +1,79 @@
+#pragma once
+
+#ifndef _interp_sorter_hpp
+#define _interp_sorter_hpp
+
+#include "../common/term_env.hpp"
+#include "../common/bignum.hpp"
+#include <vector>
+
+namespace prologcoin { namespace interp {
+
+class interpreter_base;
+
+//
+// Sorting for sort/2, msort/2, keysort/2 and sort/4. All sorts are
+// stable and in standard order of terms.
+//
+// The sort keys are picked out (and dereferenced) once. If they are
+// all small integers or all atoms they are sorted by radix on 64-bit
+// keys (for atoms, the first 8 bytes of the name, and ties sorted by
+// name afterwards.) Other keys are merge sorted, in parallel if the
+// list is large. The comparison used then doesn't touch the
+// interpreter (it has its own stack), so it can run on several
+// threads as long as the heap is only read, i.e. isn't paged or
+// shared.
+//
+class sorter {
+    using term = prologcoin::common::term;
+
+public:
+    sorter(interpreter_base &interp);
+
+    // Elements of a proper list; aborts if it's partial or not a list.
+    void get_elements(term lst, std::vector<term> &elems,
+		      const std::string &context);
+
+    // Sort on the key'th argument of the elements (0 = the element
+    // itself.) If dedup then only the first of elements with equal
+    // keys is kept.
+    void sort(std::vector<term> &elems, size_t key, bool descending,
+	      bool dedup);
+
+    // Standard order (-1, 0 or 1)
+    int compare(term a, term b);
+
+    static const size_t PARALLEL_THRESHOLD = 1 << 16;
+
+private:
+    struct context {
+	context(common::heap &h) : big(h) { }
+	std::vector<std::pair<term, term> > stack;
+	common::bignum big;
+	std::vector<common::bignum::limb> limbs_a, limbs_b;
+    };
+
+    int compare(term a, term b, context &ctx) const;
+    static int functor_order(const common::heap &h, common::con_cell a,
+			     common::con_cell b);
+    int compare_big(term a, term b, context &ctx) const;
+
+    bool all_tag(const std::vector<term> &keys, common::tag_t::kind_t tag);
+    bool all_atoms(const std::vector<term> &keys);
+
+    void sort_ints(const std::vector<term> &keys, bool descending,
+		   std::vector<size_t> &order);
+    void sort_atoms(const std::vector<term> &keys, bool descending,
+		    std::vector<size_t> &order);
+    void sort_terms(const std::vector<term> &keys, bool descending,
+		    std::vector<size_t> &order);
+
+    static void radix_sort(std::vector<std::pair<uint64_t, size_t> > &items);
+
+    interpreter_base &interp_;
+    context ctx_;
+};
+
+}}
+
+#endif
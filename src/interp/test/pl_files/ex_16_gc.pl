@@ -0,0 +1,62 @@
+% Meta: gc threshold 256
+
+%
+% Heap garbage collection. A small threshold forces many
+% collections while the terms below are being built.
+%
+
+garbage(0) :- !.
+garbage(N) :-
+    _ = foo(N, [a,b,c], bar(N)),
+    N1 is N - 1,
+    garbage(N1).
+
+numlist(N, N, [N]) :- !.
+numlist(I, N, [I|Xs]) :-
+    I1 is I + 1,
+    numlist(I1, N, Xs).
+
+sum([], 0).
+sum([X|Xs], S) :-
+    garbage(10),
+    sum(Xs, S0),
+    S is S0 + X.
+
+?- numlist(1000, 1019, Xs), garbage(500), sum(Xs, Q1).
+% Expect: Xs = [1000,1001,1002,1003,1004,1005,1006,1007,1008,1009,1010,1011,1012,1013,1014,1015,1016,1017,1018,1019], Q1 = 20190
+% Expect: end
+
+%
+% Variables shared between live terms must survive a collection.
+%
+
+pairs(0, _, []) :- !.
+pairs(N, V, [P|Ps]) :-
+    P = p(N, V),
+    garbage(5),
+    N1 is N - 1,
+    pairs(N1, V, Ps).
+
+?- pairs(3, V, Ps), garbage(300), V = hello, Q2 = Ps.
+% Expect: V = hello, Ps = [p(3,hello),p(2,hello),p(1,hello)], Q2 = [p(3,hello),p(2,hello),p(1,hello)]
+% Expect: end
+
+%
+% Alternatives left on the stack (choice points) keep their terms.
+%
+
+pick(X) :- garbage(300), X = first(f(1)).
+pick(X) :- garbage(300), X = second(g([1,2,3])).
+
+?- pick(Q3).
+% Expect: Q3 = first(f(1))
+% Expect: Q3 = second(g([1,2,3]))
+% Expect: end
+
+%
+% garbage_collect/0 requests a major collection.
+%
+
+?- numlist(1000, 1004, L), garbage_collect, garbage(10), Q4 = L.
+% Expect: L = [1000,1001,1002,1003,1004], Q4 = [1000,1001,1002,1003,1004]
+% Expect: end
@@ -0,0 +1,42 @@
+% Meta: hash consing on
+
+%
+% Ground subterms of loaded clauses are stored once (hash-consed.)
+%
+
+keys(alice, [key(1000,abcdefgh), key(1001,bcdefghi), key(1002,cdefghij)]).
+keys(bob, [key(1000,abcdefgh), key(1001,bcdefghi), key(1002,cdefghij)]).
+keys(carol, [key(1000,abcdefgh), key(2001,other)]).
+
+address(alice, addr(street(main, 1000), city(springfield))).
+address(bob, addr(street(main, 1000), city(springfield))).
+address(carol, addr(street(elm, 1001), city(springfield))).
+
+?- keys(alice, K1), keys(bob, K2), K1 == K2.
+% Expect: K1 = [key(1000,abcdefgh),key(1001,bcdefghi),key(1002,cdefghij)], K2 = [key(1000,abcdefgh),key(1001,bcdefghi),key(1002,cdefghij)]
+% Expect: end
+
+?- keys(alice, K1), keys(carol, K2), K1 == K2.
+% Expect: fail
+
+?- address(alice, A), address(carol, A).
+% Expect: fail
+
+?- address(P, addr(street(main, 1000), city(C))).
+% Expect: P = alice, C = springfield
+% Expect: P = bob, C = springfield
+% Expect: end
+
+%
+% Clauses mixing variables and ground data
+%
+
+entry(X, pair(X, [key(1000,abcdefgh), key(1001,bcdefghi)])).
+
+?- entry(hello, E), keys(alice, [K1,K2|Ks]), E = pair(X, [K1,K2]).
+% Expect: E = pair(hello,[key(1000,abcdefgh),key(1001,bcdefghi)]), K1 = key(1000,abcdefgh), K2 = key(1001,bcdefghi), Ks = [key(1002,cdefghij)], X = hello
+% Expect: end
+
+?- entry(X, pair(Y, [key(1000,Z)|Zs])).
+% Expect: Y = X, Z = abcdefgh, Zs = [key(1001,bcdefghi)]
+% Expect: end
@@ -0,0 +1,27 @@
+%
+% Integers that overflow become bignums and return to small
+% integers when they fit again.
+%
+
+?- X is 1152921504606846975 + 1, Y is X - 1, Q1 = Y.
+% Expect: X = 1152921504606846976, Y = 1152921504606846975, Q1 = 1152921504606846975
+% Expect: end
+
+?- X is 4294967296 * 4294967295, Q2 is X // 4294967295.
+% Expect: X = 18446744069414584320, Q2 = 4294967296
+% Expect: end
+
+%
+% Beyond 64 bits.
+%
+
+pow2(0, 1) :- !.
+pow2(N, X) :- N1 is N - 1, pow2(N1, X1), X is X1 * 2.
+
+?- pow2(200, X), Y is X >> 190, Z is (X + 12345) mod 1000000, W is (1 << 200) - X, Q3 = Y.
+% Expect: X = 58'12n1XR4oJkmBdJMxhBGQGb96gQ88xUzxLFyH, Y = 1024, Z = 313721, W = 0, Q3 = 1024
+% Expect: end
+
+?- X is 340282366920938463463374607431768211456 // 1208925819614629174706176, Q4 is -7 mod 3.
+% Expect: X = 281474976710656, Q4 = 2
+% Expect: end
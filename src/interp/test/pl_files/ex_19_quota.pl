@@ -0,0 +1,24 @@
+%
+% Resource quotas. Queries that would use too much memory are
+% stopped with a resource error.
+%
+
+% Meta: quota stack 20000
+mklist(0, []) :- !.
+mklist(N, [X|Xs]) :- N1 is N - 1, mklist(N1, Xs).
+
+walk([]).
+walk([X|Xs]) :- walk(Xs), atom(a).
+
+deep(N) :- mklist(N, L), walk(L).
+
+?- deep(100).
+% Expect: true
+% Expect: end
+
+?- deep(100000).
+% Expect: Exceeded stack quota of 20000
+
+?- deep(200).
+% Expect: true
+% Expect: end
@@ -0,0 +1,23 @@
+%
+% Trail quota. Bindings of older variables (while there are alternatives left)
+% are recorded on the trail.
+%
+
+% Meta: quota trail 1000
+
+bindall([]).
+bindall([X|Xs]) :- pick(X), bindall(Xs).
+
+pick(1).
+pick(2).
+
+mklist(0, []) :- !.
+mklist(N, [X|Xs]) :- N1 is N - 1, mklist(N1, Xs).
+
+first(N, Q) :- mklist(N, L), bindall(L), L = [Q|Rest].
+
+?- first(100, Q1).
+% Expect: Q1 = 1
+
+?- first(2000, Q2).
+% Expect: Exceeded trail quota of 1000
@@ -0,0 +1,22 @@
+%
+% Hot predicates get compiled to WAM code while they run. Those
+% not compiled explicitly below start out on the term interpreter.
+%
+
+% Meta: auto compile 5
+% Meta: dont-compile count/2
+% Meta: dont-compile big/1
+
+k(1).
+k(2).
+
+big(123456789012345678901234567890).
+
+count(0, []) :- !.
+count(N, [B|Bs]) :- big(B), N1 is N - 1, count(N1, Bs).
+
+% The first solution compiles count/2 and big/1 and then backtracks
+% into code that was compiled after the choice point was created.
+?- k(K), count(8, L), K = 2, L = [X,X,X,X,X,X,X,X].
+% Expect: K = 2, L = [58'18XcTm1rhDaaCfzETs, 58'18XcTm1rhDaaCfzETs, 58'18XcTm1rhDaaCfzETs, 58'18XcTm1rhDaaCfzETs, 58'18XcTm1rhDaaCfzETs, 58'18XcTm1rhDaaCfzETs, 58'18XcTm1rhDaaCfzETs, 58'18XcTm1rhDaaCfzETs], X = 58'18XcTm1rhDaaCfzETs
+% Expect: end
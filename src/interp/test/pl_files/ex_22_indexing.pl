@@ -0,0 +1,63 @@
+%
+% Clauses are indexed on whatever argument the call has instantiated,
+% and on the arguments of compound arguments.
+%
+
+addr(wallet, alice, 100).
+addr(wallet, bob, 200).
+addr(wallet, carol, 300).
+addr(contract, dave, 400).
+addr(wallet, X, 0) :- X = nobody.
+addr(contract, erin, 500).
+
+?- addr(T, bob, V).
+% Expect: T = wallet, V = 200
+% Expect: end
+
+?- addr(T, N, 500).
+% Expect: T = contract, N = erin
+% Expect: end
+
+?- addr(wallet, N, 0).
+% Expect: N = nobody
+% Expect: end
+
+?- addr(contract, N, V).
+% Expect: N = dave, V = 400
+% Expect: N = erin, V = 500
+% Expect: end
+
+?- addr(T, frank, V).
+% Expect: fail
+
+coin(c(1, alice), 10).
+coin(c(2, bob), 20).
+coin(c(3, alice), 30).
+coin(c(4, carol), 40).
+
+?- coin(c(I, alice), A).
+% Expect: I = 1, A = 10
+% Expect: I = 3, A = 30
+% Expect: end
+
+?- coin(c(2, O), A).
+% Expect: O = bob, A = 20
+% Expect: end
+
+?- coin(C, 40).
+% Expect: C = c(4, carol)
+% Expect: end
+
+edge([a|_], 1, x).
+edge([a|_], 2, y).
+edge([b|_], 3, z).
+edge([], 4, w).
+
+?- edge(L, 2, E).
+% Expect: L = [a|_], E = y
+% Expect: end
+
+?- edge([a], N, E).
+% Expect: N = 1, E = x
+% Expect: N = 2, E = y
+% Expect: end
@@ -0,0 +1,56 @@
+%
+% Dynamic database. A call only sees the clauses that were there
+% when it started (the logical update view.) Every query leaves the
+% database as it found it (as it is run twice.)
+%
+
+?- dynamic(log/1), log(X).
+% Expect: fail
+
+?- nolog(X).
+% Expect: Undefined predicate nolog/1
+
+%
+% Clauses added while iterating are not seen.
+%
+
+?- assertz(q(1)), assertz(q(2)), findall(X, (q(X), Y is X + 10, assertz(q(Y))), L), findall(X, retract(q(X)), L2).
+% Expect: L = [1,2], L2 = [1,2,11,12]
+% Expect: end
+
+%
+% Clauses erased while iterating are still seen (but can't be
+% retracted twice.)
+%
+
+?- assertz(r(1)), assertz(r(2)), assertz(r(3)), findall(X, (r(X), retract(r(3))), L), findall(X, retract(r(X)), L2).
+% Expect: L = [1], L2 = [1,2]
+% Expect: end
+
+?- asserta(s(1)), asserta(s(2)), assertz((s(X) :- X = 3)), findall(X, s(X), L), retract((s(Z) :- Z = 3)), findall(X, retract(s(X)), L2).
+% Expect: L = [2,1,3], L2 = [2,1]
+% Expect: end
+
+%
+% Compiled predicates become dynamic when updated.
+%
+
+color(red).
+color(green).
+
+?- assertz(color(blue)), findall(C, color(C), L), retract(color(blue)), findall(C, color(C), L2).
+% Expect: L = [red,green,blue], L2 = [red,green]
+% Expect: end
+
+%
+% Many clauses, indexed on the second argument.
+%
+
+fill(0) :- !.
+fill(N) :- assertz(t(N, N)), N1 is N - 1, fill(N1).
+
+drain(A, B) :- findall(X, retract(t(X, _)), [A,B|_]).
+
+?- fill(300), t(K, 150), t(X, Y), X == 1, drain(A, B).
+% Expect: K = 150, X = 1, Y = 1, A = 300, B = 299
+% Expect: end
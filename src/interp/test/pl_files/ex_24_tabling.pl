@@ -0,0 +1,83 @@
+%
+% Tabling. Calls to tabled predicates are answered from tables, so
+% left recursion terminates and common subgoals are evaluated once.
+%
+
+?- table(path/2), table((fib/2, reach/2)).
+% Expect: true
+
+%
+% Left recursion over a cyclic graph.
+%
+
+edge(a,b).
+edge(b,c).
+edge(c,a).
+edge(c,d).
+
+path(X,Y) :- path(X,Z), edge(Z,Y).
+path(X,Y) :- edge(X,Y).
+
+?- findall(Y, path(a,Y), L), sort(L, S).
+% Expect: L = [b,c,a,d], S = [a,b,c,d]
+
+?- path(d,Y).
+% Expect: fail
+
+%
+% Called from compiled code (evaluated anew.)
+%
+
+from_a(Y) :- path(a, Y), Y \== a.
+
+?- abolish_all_tables, from_a(Y).
+% Expect: Y = b
+% Expect: Y = c
+% Expect: Y = d
+% Expect: end
+
+?- findall(X-Y, path(X,Y), L), sort(L, S).
+% Expect: L = [a-b,b-c,c-a,c-d,a-c,b-a,b-d,c-b,a-a,a-d,b-b,c-c], S = [a-a,a-b,a-c,a-d,b-a,b-b,b-c,b-d,c-a,c-b,c-c,c-d]
+
+%
+% Right recursion where the variants call each other (the tables
+% are completed together.)
+%
+
+link(1,2).
+link(2,3).
+link(3,1).
+link(3,4).
+
+reach(X,Y) :- link(X,Y).
+reach(X,Y) :- link(X,Z), reach(Z,Y).
+
+?- findall(Y, reach(2,Y), L), sort(L, S).
+% Expect: L = [3,1,4,2], S = [1,2,3,4]
+
+?- findall(Y, reach(4,Y), L).
+% Expect: L = []
+
+%
+% Exponential without tabling.
+%
+
+fib(0, 0).
+fib(1, 1).
+fib(N, F) :-
+    N \== 0, N \== 1,
+    N1 is N - 1, N2 is N - 2,
+    fib(N1, F1), fib(N2, F2),
+    F is F1 + F2.
+
+?- fib(60, F).
+% Expect: F = 1548008755920
+% Expect: end
+
+%
+% Tables can be dropped.
+%
+
+?- abolish_all_tables, fib(10, F).
+% Expect: F = 55
+% Expect: end
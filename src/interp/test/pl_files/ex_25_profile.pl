@@ -0,0 +1,47 @@
+%
+% The profiler counts the ports of each predicate (the same for the
+% term interpreter and compiled code.)
+%
+
+p(1).
+p(2).
+p(3).
+
+q(X) :- p(X), X \== 2.
+
+ports(PI, [C,R,E,F]) :-
+    profile_data(PI, [calls-C,redos-R,exits-E,fails-F|_]).
+
+?- profile_reset, profile_on, findall(X, q(X), L), profile_off,
+   ports(p/1, P), ports(q/1, Q).
+% Expect: L = [1,3], P = [1,2,3,0], Q = [1,0,2,0]
+
+?- profile_data(r/1, D).
+% Expect: D = [calls-0,redos-0,exits-0,fails-0,self-0,total-0]
+
+%
+% Sampling (the samples themselves vary from run to run.)
+%
+
+% Meta: fileio on
+
+count(0) :- !.
+count(N) :- N1 is N - 1, count(N1).
+
+?- profile_reset, profile_sample(100), count(5000), profile_off,
+   ports(count/1, P).
+% Expect: P = [5001,0,5001,0]
+
+%
+% Statistics
+%
+
+stats_ok :-
+    statistics(runtime, [T,S]), integer(T), integer(S),
+    statistics(walltime, [_,_]),
+    statistics(inferences, I), integer(I),
+    statistics(heap, H), integer(H),
+    statistics(trail, R), integer(R).
+
+?- stats_ok.
+% Expect: true
@@ -0,0 +1,21 @@
+%
+% The stack grows on demand, so deep recursion (without last call
+% optimization in the term interpreter) doesn't run out of it.
+%
+
+count(0) :- !.
+count(N) :- N1 is N - 1, count(N1).
+
+?- count(50000).
+% Expect: true
+
+len([], 0).
+len([_|Xs], N) :- len(Xs, N0), N is N0 + 1.
+
+mklist(0, []) :- !.
+mklist(N, [N|Xs]) :- N1 is N - 1, mklist(N1, Xs).
+
+mklen(N, Len) :- mklist(N, L), len(L, Len).
+
+?- mklen(30000, N).
+% Expect: N = 30000
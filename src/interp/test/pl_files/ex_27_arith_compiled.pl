@@ -0,0 +1,75 @@
+%
+% Arithmetic comparisons, and is/2 and comparisons compiled into
+% arithmetic instructions (small integers with overflow into bignums.)
+%
+
+cmp(X, Y, [A,B,C,D,E,F]) :-
+    (X < Y -> A = t ; A = f),
+    (X > Y -> B = t ; B = f),
+    (X =< Y -> C = t ; C = f),
+    (X >= Y -> D = t ; D = f),
+    (X =:= Y -> E = t ; E = f),
+    (X =\= Y -> F = t ; F = f).
+
+?- cmp(1, 2, L1), cmp(2, 2, L2), cmp(3, 2, L3).
+% Expect: L1 = [t,f,t,f,f,t], L2 = [f,f,t,t,t,f], L3 = [f,t,f,t,f,t]
+
+?- cmp(1+1, 4 // 2, L), cmp(-5, 1 << 70, M).
+% Expect: L = [f,f,t,t,t,f], M = [t,f,t,f,f,t]
+
+%
+% Tight loops
+%
+
+sum(N, S) :- sum(N, 0, S).
+sum(0, S, S) :- !.
+sum(N, S0, S) :- S1 is S0 + N * N, N1 is N - 1, sum(N1, S1, S).
+
+?- sum(1000, S).
+% Expect: S = 333833500
+% Expect: end
+
+count_down(N, N) :- N =< 0, !.
+count_down(N, M) :- N > 0, N1 is N - 3, count_down(N1, M).
+
+?- count_down(100, M).
+% Expect: M = -2
+% Expect: end
+
+%
+% Overflow to bignums and back
+%
+
+grow(X, 0, X) :- !.
+grow(X, N, Y) :- X1 is X * 1000 + N mod 7, N1 is N - 1, grow(X1, N1, Y).
+
+?- grow(1, 8, X), Y is X // 1000000000000000000, Z is X - Y * 1000000000000000000.
+% Expect: X = 58'CuiQMVcdbbaH6g, Y = 1001000, Z = 6005004003002001
+% Expect: end
+
+?- X is 1152921504606846975 + 1, Y is X - 1, W is (1 << 62) >> 61.
+% Expect: X = 1152921504606846976, Y = 1152921504606846975, W = 2
+
+limits(A, B, C, D) :-
+    A is 1152921504606846975 * 2,
+    B is (-1152921504606846975 - 1) // -1,
+    C is -7 mod 3 + 7 mod -3,
+    D is -1 >> 100.
+
+?- limits(A, B, C, D).
+% Expect: A = 2305843009213693950, B = 1152921504606846976, C = 0, D = -1
+
+%
+% Expressions bound at runtime
+%
+
+late(E, X) :- Y = E, X is Y * 2 + 1.
+
+?- late(3 + 4, X).
+% Expect: X = 15
+
+?- X = 2, 10 is X * 5.
+% Expect: X = 2
+
+?- 11 is 2 * 5.
+% Expect: fail
@@ -0,0 +1,50 @@
+%
+% Type tests and term comparisons in compiled clauses (inlined as WAM
+% instructions.) A failed test selects the next clause.
+%
+
+kind(X, var) :- var(X), !.
+kind(X, int) :- integer(X), !.
+kind(X, atom) :- atom(X), !.
+kind(X, compound) :- compound(X), !.
+kind(_, other).
+
+?- kind(_, A), kind(42, B), kind(foo, C), kind(f(x), D), kind([], E).
+% Expect: A = var, B = int, C = atom, D = compound, E = atom
+
+tests(X, [V,N,A,T,I,U,C,L]) :-
+    (var(X) -> V = t ; V = f),
+    (nonvar(X) -> N = t ; N = f),
+    (atom(X) -> A = t ; A = f),
+    (atomic(X) -> T = t ; T = f),
+    (integer(X) -> I = t ; I = f),
+    (number(X) -> U = t ; U = f),
+    (compound(X) -> C = t ; C = f),
+    (callable(X) -> L = t ; L = f).
+
+?- tests(_, A), tests(1, B), tests(foo, C), tests(g(1,2), D).
+% Expect: A = [t,f,f,f,f,f,f,f], B = [f,t,f,f,t,t,f,f], C = [f,t,t,t,f,f,f,t], D = [f,t,f,f,f,f,t,t]
+
+same(X, Y, R) :- X == Y, !, R = same.
+same(X, Y, R) :- X \== Y, R = different.
+
+?- same(f(A,b), f(A,b), R1), same(f(A,b), f(_,b), R2), same(1, 1, R3).
+% Expect: R1 = same, R2 = different, R3 = same
+% Expect: end
+
+shape(T, F, A) :- functor(T, F, A).
+
+?- shape(foo(1,2,3), F, A), shape(bar, G, B), shape(42, H, C).
+% Expect: F = foo, A = 3, G = bar, B = 0, H = 42, C = 0
+
+?- shape(foo(1,2), foo, 3).
+% Expect: fail
+
+%
+% Bindings made by functor/3 wake frozen goals.
+%
+
+woken(W) :- freeze(F, W = F), functor(g(a), F, _).
+
+?- woken(W).
+% Expect: W = g
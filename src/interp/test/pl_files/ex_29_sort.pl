@@ -0,0 +1,64 @@
+%
+% sort/2, msort/2, keysort/2 and sort/4
+%
+
+?- sort([c,a,b,a], X), msort([c,a,b,a], Y).
+% Expect: X = [a,b,c], Y = [a,a,b,c]
+
+?- sort([3,-1,10,-20,3,0], X).
+% Expect: X = [-20,-1,0,3,10]
+
+?- sort([f(b),g(a),f(a),1,foo,_,f(a)], [_|X]).
+% Expect: X = [1,foo,f(a),f(b),g(a)]
+
+?- msort([b-1,a-2,b-0,a-1], X), keysort([b-1,a-2,b-0,a-1], Y).
+% Expect: X = [a-1,a-2,b-0,b-1], Y = [a-2,a-1,b-1,b-0]
+
+?- sort(1, '@<', [f(2,a),f(1,b),f(2,c)], A), sort(1, '@=<', [f(2,a),f(1,b),f(2,c)], B).
+% Expect: A = [f(1,b),f(2,a)], B = [f(1,b),f(2,a),f(2,c)]
+
+?- sort(2, '@>', [f(2,a),f(1,b),f(2,a)], A), sort(0, '@>=', [1,3,2,3], B).
+% Expect: A = [f(1,b),f(2,a)], B = [3,3,2,1]
+
+?- sort(0, '@>', [apple,pineapple,pineapplex,banana,pineapple], X).
+% Expect: X = [pineapplex,pineapple,banana,apple]
+
+?- keysort([a-1,b], X).
+% Expect: keysort/2: Element is not a pair Key-Value; found b
+
+?- sort(2, '@<', [f(1),f(2)], X).
+% Expect: sort/4: Element has no argument 2; found f(1)
+
+?- sort(1, foo, [], X).
+% Expect: sort/4: Second argument must be one of @<, @=<, @> or @>=; found foo
+
+%
+% Large lists (radix sort for integers, and merge sort on several
+% threads for other terms.)
+%
+
+ints(0, L, L) :- !.
+ints(N, L0, L) :- K is (N * 7919) mod 100003 - 50000, N1 is N - 1, ints(N1, [K|L0], L).
+
+pairs(0, L, L) :- !.
+pairs(N, L0, L) :- K is (N * 7919) mod 1009, N1 is N - 1, pairs(N1, [f(K,N)|L0], L).
+
+first_last([X], X, X) :- !.
+first_last([X|Xs], X, Y) :- first_last0(Xs, Y).
+first_last0([Y], Y) :- !.
+first_last0([_|Xs], Y) :- first_last0(Xs, Y).
+
+big_ints(A, B) :- ints(70000, [], L), msort(L, S), first_last(S, A, B).
+
+big_pairs(A, B, C, D) :-
+    pairs(70000, [], L),
+    msort(L, S), first_last(S, A, B),
+    sort(1, '@>', L, T), first_last(T, C, D).
+
+?- big_ints(A, B).
+% Expect: A = -49999, B = 50002
+% Expect: end
+
+?- big_pairs(A, B, C, D).
+% Expect: A = f(0,1009), B = f(1008,69377), C = f(1008,765), D = f(0,1009)
+% Expect: end
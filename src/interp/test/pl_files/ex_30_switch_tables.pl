@@ -0,0 +1,383 @@
+%
+% Indexing tables of different sizes: up to 4 keys are compared one by
+% one, up to 8 are binary searched and more are hashed.
+%
+
+small(a, 1).
+small(b, 2).
+small(c, 3).
+
+?- small(b, X), small(c, Y).
+% Expect: X = 2, Y = 3
+% Expect: end
+
+?- small(d, X).
+% Expect: fail
+
+six(1, a).
+six(10, b).
+six(-5, c).
+six(foo, d).
+six(bar, e).
+six(1000, f).
+
+?- six(-5, X), six(bar, Y), six(1000, Z).
+% Expect: X = c, Y = e, Z = f
+% Expect: end
+
+?- six(2, X).
+% Expect: fail
+
+medium(alpha, 1).
+medium(bravo, 2).
+medium(charlie, 3).
+medium(delta, 4).
+medium(echo, 5).
+medium(foxtrot, 6).
+medium(golf, 7).
+medium(hotel, 8).
+medium(india, 9).
+medium(juliet, 10).
+medium(kilo, 11).
+medium(lima, 12).
+medium(mike, 13).
+medium(november, 14).
+medium(oscar, 15).
+medium(papa, 16).
+medium(quebec, 17).
+medium(romeo, 18).
+medium(sierra, 19).
+medium(tango, 20).
+medium(hotel, 88).
+
+?- medium(alpha, A), medium(sierra, S), medium(tango, T).
+% Expect: A = 1, S = 19, T = 20
+% Expect: end
+
+?- medium(hotel, H).
+% Expect: H = 8
+% Expect: H = 88
+% Expect: end
+
+?- medium(zulu, Z).
+% Expect: fail
+
+%
+% Integers and atoms
+%
+
+large(37, k1).
+large(74, k2).
+large(111, k3).
+large(148, k4).
+large(185, k5).
+large(222, k6).
+large(259, k7).
+large(296, k8).
+large(333, k9).
+large(370, k10).
+large(407, k11).
+large(444, k12).
+large(481, k13).
+large(518, k14).
+large(555, k15).
+large(592, k16).
+large(629, k17).
+large(666, k18).
+large(703, k19).
+large(740, k20).
+large(777, k21).
+large(814, k22).
+large(851, k23).
+large(888, k24).
+large(925, k25).
+large(962, k26).
+large(999, k27).
+large(1036, k28).
+large(1073, k29).
+large(1110, k30).
+large(1147, k31).
+large(1184, k32).
+large(1221, k33).
+large(1258, k34).
+large(1295, k35).
+large(1332, k36).
+large(1369, k37).
+large(1406, k38).
+large(1443, k39).
+large(1480, k40).
+large(1517, k41).
+large(1554, k42).
+large(1591, k43).
+large(1628, k44).
+large(1665, k45).
+large(1702, k46).
+large(1739, k47).
+large(1776, k48).
+large(1813, k49).
+large(1850, k50).
+large(1887, k51).
+large(1924, k52).
+large(1961, k53).
+large(1998, k54).
+large(2035, k55).
+large(2072, k56).
+large(2109, k57).
+large(2146, k58).
+large(2183, k59).
+large(2220, k60).
+large(2257, k61).
+large(2294, k62).
+large(2331, k63).
+large(2368, k64).
+large(2405, k65).
+large(2442, k66).
+large(2479, k67).
+large(2516, k68).
+large(2553, k69).
+large(2590, k70).
+large(2627, k71).
+large(2664, k72).
+large(2701, k73).
+large(2738, k74).
+large(2775, k75).
+large(2812, k76).
+large(2849, k77).
+large(2886, k78).
+large(2923, k79).
+large(2960, k80).
+large(2997, k81).
+large(3034, k82).
+large(3071, k83).
+large(3108, k84).
+large(3145, k85).
+large(3182, k86).
+large(3219, k87).
+large(3256, k88).
+large(3293, k89).
+large(3330, k90).
+large(3367, k91).
+large(3404, k92).
+large(3441, k93).
+large(3478, k94).
+large(3515, k95).
+large(3552, k96).
+large(3589, k97).
+large(3626, k98).
+large(3663, k99).
+large(3700, k100).
+large(alpha, w).
+large(bravo, w).
+large(charlie, w).
+large(delta, w).
+large(echo, w).
+large(foxtrot, w).
+large(golf, w).
+large(hotel, w).
+large(india, w).
+large(juliet, w).
+large(kilo, w).
+large(lima, w).
+large(mike, w).
+large(november, w).
+large(oscar, w).
+large(papa, w).
+large(quebec, w).
+large(romeo, w).
+large(sierra, w).
+large(tango, w).
+
+?- large(37, A), large(3700, B), large(1221, C), large(tango, D).
+% Expect: A = k1, B = k100, C = k33, D = w
+% Expect: end
+
+?- large(38, X).
+% Expect: fail
+
+?- large(X, k77).
+% Expect: X = 2849
+% Expect: end
+
+%
+% Structures (switch_on_structure)
+%
+
+shape(f1(X), X, 1).
+shape(f2(X), X, 2).
+shape(f3(X), X, 3).
+shape(f4(X), X, 4).
+shape(f5(X), X, 5).
+shape(f6(X), X, 6).
+shape(f7(X), X, 7).
+shape(f8(X), X, 8).
+shape(f9(X), X, 9).
+shape(f10(X), X, 10).
+shape(f11(X), X, 11).
+shape(f12(X), X, 12).
+shape(f13(X), X, 13).
+shape(f14(X), X, 14).
+shape(f15(X), X, 15).
+shape(f16(X), X, 16).
+shape(f17(X), X, 17).
+shape(f18(X), X, 18).
+shape(f19(X), X, 19).
+shape(f20(X), X, 20).
+shape(f21(X), X, 21).
+shape(f22(X), X, 22).
+shape(f23(X), X, 23).
+shape(f24(X), X, 24).
+shape(f25(X), X, 25).
+shape(f26(X), X, 26).
+shape(f27(X), X, 27).
+shape(f28(X), X, 28).
+shape(f29(X), X, 29).
+shape(f30(X), X, 30).
+shape(f31(X), X, 31).
+shape(f32(X), X, 32).
+shape(f33(X), X, 33).
+shape(f34(X), X, 34).
+shape(f35(X), X, 35).
+shape(f36(X), X, 36).
+shape(f37(X), X, 37).
+shape(f38(X), X, 38).
+shape(f39(X), X, 39).
+shape(f40(X), X, 40).
+shape(f41(X), X, 41).
+shape(f42(X), X, 42).
+shape(f43(X), X, 43).
+shape(f44(X), X, 44).
+shape(f45(X), X, 45).
+shape(f46(X), X, 46).
+shape(f47(X), X, 47).
+shape(f48(X), X, 48).
+shape(f49(X), X, 49).
+shape(f50(X), X, 50).
+shape(f51(X), X, 51).
+shape(f52(X), X, 52).
+shape(f53(X), X, 53).
+shape(f54(X), X, 54).
+shape(f55(X), X, 55).
+shape(f56(X), X, 56).
+shape(f57(X), X, 57).
+shape(f58(X), X, 58).
+shape(f59(X), X, 59).
+shape(f60(X), X, 60).
+shape(f61(X), X, 61).
+shape(f62(X), X, 62).
+shape(f63(X), X, 63).
+shape(f64(X), X, 64).
+shape(f65(X), X, 65).
+shape(f66(X), X, 66).
+shape(f67(X), X, 67).
+shape(f68(X), X, 68).
+shape(f69(X), X, 69).
+shape(f70(X), X, 70).
+shape(f71(X), X, 71).
+shape(f72(X), X, 72).
+shape(f73(X), X, 73).
+shape(f74(X), X, 74).
+shape(f75(X), X, 75).
+shape(f76(X), X, 76).
+shape(f77(X), X, 77).
+shape(f78(X), X, 78).
+shape(f79(X), X, 79).
+shape(f80(X), X, 80).
+
+?- shape(f1(a), X, N), shape(f80(b), Y, M), shape(f40(c), Z, K).
+% Expect: X = a, N = 1, Y = b, M = 80, Z = c, K = 40
+% Expect: end
+
+?- shape(g(a), X, N).
+% Expect: fail
+
+%
+% On the second argument (switch_on_arg)
+%
+
+second(1, v1).
+second(2, v2).
+second(3, v3).
+second(4, v4).
+second(5, v5).
+second(6, v6).
+second(7, v7).
+second(8, v8).
+second(9, v9).
+second(10, v10).
+second(11, v11).
+second(12, v12).
+second(13, v13).
+second(14, v14).
+second(15, v15).
+second(16, v16).
+second(17, v17).
+second(18, v18).
+second(19, v19).
+second(20, v20).
+second(21, v21).
+second(22, v22).
+second(23, v23).
+second(24, v24).
+second(25, v25).
+second(26, v26).
+second(27, v27).
+second(28, v28).
+second(29, v29).
+second(30, v30).
+second(31, v31).
+second(32, v32).
+second(33, v33).
+second(34, v34).
+second(35, v35).
+second(36, v36).
+second(37, v37).
+second(38, v38).
+second(39, v39).
+second(40, v40).
+second(41, v41).
+second(42, v42).
+second(43, v43).
+second(44, v44).
+second(45, v45).
+second(46, v46).
+second(47, v47).
+second(48, v48).
+second(49, v49).
+second(50, v50).
+second(51, v51).
+second(52, v52).
+second(53, v53).
+second(54, v54).
+second(55, v55).
+second(56, v56).
+second(57, v57).
+second(58, v58).
+second(59, v59).
+second(60, v60).
+second(61, v61).
+second(62, v62).
+second(63, v63).
+second(64, v64).
+second(65, v65).
+second(66, v66).
+second(67, v67).
+second(68, v68).
+second(69, v69).
+second(70, v70).
+second(71, v71).
+second(72, v72).
+second(73, v73).
+second(74, v74).
+second(75, v75).
+second(76, v76).
+second(77, v77).
+second(78, v78).
+second(79, v79).
+second(80, v80).
+
+?- second(X, v1), second(Y, v80), second(Z, v33).
+% Expect: X = 1, Y = 80, Z = 33
+% Expect: end
+
+?- second(X, v81).
+% Expect: fail
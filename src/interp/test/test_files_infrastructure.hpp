@@ -11,6 +11,8 @@ using namespace prologcoin::common;
 using namespace prologcoin::interp;
 
 static bool do_compile = true;
+static bool auto_compile = false;
+static bool do_jit = true;
 static bool full_mode = false;
 
 static std::vector<std::string> parse_x(const std::string &key, std::string &comments)
@@ -81,6 +83,23 @@ static void process_meta(interpreter &interp, std::string &comments,
             interp.current_locale().set_decimal_point(con_cell(",",0));
             interp.current_locale().set_thousands_sep(con_cell(" ",0));
             interp.current_locale().set_grouping(std::vector<int>{-3});
+	} else if (cmd == "hash consing on") {
+	    interp.set_hash_consing(true);
+	} else if (boost::algorithm::starts_with(cmd, "gc threshold ")) {
+	    interp.set_gc_threshold(boost::lexical_cast<size_t>(cmd.substr(13)));
+	} else if (boost::algorithm::starts_with(cmd, "quota ")) {
+	    // quota <heap|trail|stack|files> <N> (0 = unlimited)
+	    std::vector<std::string> words;
+	    boost::split(words, cmd, boost::is_any_of(" "));
+	    size_t n = boost::lexical_cast<size_t>(words[2]);
+	    auto q = interp.get_quotas();
+	    if (words[1] == "heap") q.heap_cells = n;
+	    else if (words[1] == "trail") q.trail_entries = n;
+	    else if (words[1] == "stack") q.stack_words = n;
+	    else if (words[1] == "files") q.open_files = n;
+	    interp.set_quotas(q);
+	} else if (boost::algorithm::starts_with(cmd, "auto compile ")) {
+	    interp.set_auto_compile_threshold(boost::lexical_cast<size_t>(cmd.substr(13)));
 	} else if (boost::algorithm::starts_with(cmd, "dont-compile ")) {
 	    opt[cmd] = 1;
 	} else {
@@ -192,6 +211,19 @@ static bool test_run_once(interpreter &interp,
     return r;
 }
 
+static void set_jit_all(interpreter &interp, bool on)
+{
+    const con_cell freeze_module("$freeze",0);
+
+    std::cout << (on ? "[JIT on]" : "[JIT off]") << "\n";
+    for (auto &qn : interp.get_predicates()) {
+	interp.set_jit(qn, on);
+    }
+    for (auto &qn : interp.get_module(freeze_module)) {
+	interp.set_jit(qn, on);
+    }
+}
+
 static bool test_interpreter_file(const std::string &filepath,
 				  interpreter &interp)
 {
@@ -206,6 +238,13 @@ static bool test_interpreter_file(const std::string &filepath,
     
     interp.set_current_directory(dir);
 
+    // Predicates are compiled explicitly before the WAM run, unless
+    // asked for (see "auto compile" below.) With 'auto_compile' they're
+    // compiled as the interpreter does by default, in the middle of the
+    // WAM run.
+    interp.set_auto_compile_threshold(
+	      auto_compile ? interpreter::DEFAULT_AUTO_COMPILE_THRESHOLD : 0);
+
     // interp.set_debug(true);
 
     std::ifstream *infile = new std::ifstream(filepath);
@@ -353,8 +392,18 @@ static bool test_interpreter_file(const std::string &filepath,
 		// the same, when we compile using WAM the recent predicates.
 		interp.set_wam_enabled(true);
 
-		// Compile recent predicates
-		if (do_compile) {
+		std::vector<ref_cell> query_vars;
+		std::for_each(interp.begin(query), interp.end(query),
+			      [&](const term &v) {
+				  if (v.tag() == tag_t::REF) {
+				      query_vars.push_back(static_cast<const ref_cell &>(v));
+				  }
+			      });
+
+		// Compile recent predicates (the queries that only the WAM
+		// can run are compiled up front also with 'auto_compile')
+		if (do_compile &&
+		    (!auto_compile || opt.count("WAM-only") > 0)) {
 		    std::unordered_set<std::string> dont_compile_set;
 		    for (auto &p : predicates) {
 			auto p_name = interp.to_string(p) + "/"
@@ -392,6 +441,27 @@ static bool test_interpreter_file(const std::string &filepath,
 		}
 		interp.unwind(tr_mark);
 		interp.reset_files();
+
+		// And once more with native code for the compiled
+		// predicates, which must give the same results. Compiled
+		// code doesn't trail bindings that no choice point needs
+		// undone, so the query variables (and frozen closures) are
+		// reset first.
+		if (do_compile && do_jit && interp.is_jit_supported()) {
+		    for (auto v : query_vars) {
+			interp.heap_set(v.index(), v);
+		    }
+		    interp.clear_all_frozen_closures();
+		    set_jit_all(interp, true);
+		    interp.set_register_hb(interp.heap_size());
+		    for (size_t i = 0; i < expected.size(); i++) {
+			test_run_once(interp, i, query, expected, expected_files);
+		    }
+		    interp.unwind(tr_mark);
+		    interp.reset_files();
+		    set_jit_all(interp, false);
+		}
+
 		interp.set_register_hb(interp.heap_size());
 		interp.clear_all_frozen_closures();
 	    }
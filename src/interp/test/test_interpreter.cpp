@@ -335,6 +335,222 @@ static void test_interpreter_freeze_preprocess()
     */
 }
 
+static void test_interpreter_auto_compile()
+{
+    header("test_interpreter_auto_compile()");
+
+    interpreter interp;
+    interp.set_auto_compile_threshold(10);
+    interp.load_program(interp.parse(
+	      "[append([], Zs, Zs),"
+	      "   (append([X|Xs],Ys,[X|Zs]) :- append(Xs,Ys,Zs)),"
+	      "nrev([],[]),"
+	      "   (nrev([X|Xs],Ys) :- nrev(Xs,Rs), append(Rs,[X],Ys)),"
+	      "cold(X)].") );
+
+    con_cell nrev("nrev", 2), append("append", 3), cold("cold", 1);
+    con_cell top = interpreter_base::EMPTY_LIST;
+
+    term qr = interp.parse("nrev([1,2,3,4,5,6,7,8,9,10,11,12,13,14,15],Q), cold(Q).");
+    assert(interp.execute(qr));
+    assert(check_terms(interp.get_result(false),
+		       "Q = [15,14,13,12,11,10,9,8,7,6,5,4,3,2,1]"));
+
+    // Hot predicates got compiled as we went; cold ones didn't
+    assert(interp.is_compiled(top, nrev));
+    assert(interp.is_compiled(top, append));
+    assert(!interp.is_compiled(top, cold));
+
+    // And the compiled code gives the same answer
+    qr = interp.parse("nrev([a,b,c],Q).");
+    assert(interp.execute(qr));
+    assert(check_terms(interp.get_result(false), "Q = [c,b,a]"));
+}
+
+static void test_interpreter_indexing()
+{
+    header("test_interpreter_indexing()");
+
+    const std::string prog =
+	"[addr(wallet, alice, 100), addr(wallet, bob, 200),"
+	" addr(wallet, carol, 300), addr(contract, dave, 400),"
+	" coin(c(1, alice), 10), coin(c(2, bob), 20), coin(c(3, carol), 30)].";
+
+    for (bool wam : {false, true}) {
+	interpreter interp;
+	interp.set_auto_compile_threshold(0);
+	interp.load_program(interp.parse(prog));
+	if (wam) {
+	    interp.compile();
+	    interp.print_code(std::cout);
+	}
+	interp.set_wam_enabled(wam);
+
+	// Only one clause matches, so no choice point is left behind
+	term qr = interp.parse("addr(T, bob, V).");
+	assert(interp.execute(qr));
+	assert(check_terms(interp.get_result(false), "T = wallet, V = 200"));
+	assert(!interp.has_more());
+
+	qr = interp.parse("addr(T, N, 300).");
+	assert(interp.execute(qr));
+	assert(check_terms(interp.get_result(false), "T = wallet, N = carol"));
+	assert(!interp.has_more());
+
+	qr = interp.parse("coin(C, 20).");
+	assert(interp.execute(qr));
+	assert(check_terms(interp.get_result(false), "C = c(2, bob)"));
+	assert(!interp.has_more());
+
+	if (!wam) {
+	    // Inside a compound argument (only on the term interpreter)
+	    qr = interp.parse("coin(c(I, carol), A).");
+	    assert(interp.execute(qr));
+	    assert(check_terms(interp.get_result(false), "I = 3, A = 30"));
+	    assert(!interp.has_more());
+	}
+    }
+}
+
+static void test_interpreter_indexing_consult()
+{
+    header("test_interpreter_indexing_consult()");
+
+    interpreter interp;
+    interp.set_auto_compile_threshold(0);
+    interp.set_wam_enabled(false);
+    interp.load_program(interp.parse("[p(a, 1), p(b, 2), q(_, x)]."));
+
+    // Index p/2 and q/2 first
+    term qr = interp.parse("findall(X, p(b, X), L1), findall(Y, q(c, Y), L2).");
+    assert(interp.execute(qr));
+    assert(check_terms(interp.get_result(false), "L1 = [2], L2 = [x]"));
+
+    // Clauses of a later consult are seen by the indexed calls
+    interp.load_clause(interp.parse("p(b, 3)."));
+    interp.load_clause(interp.parse("q(c, y)."));
+    qr = interp.parse("findall(X, p(b, X), L1), findall(Y, q(c, Y), L2).");
+    assert(interp.execute(qr));
+    assert(check_terms(interp.get_result(false),
+		       "L1 = [2,3], L2 = [x,y]"));
+}
+
+static void test_interpreter_predsort()
+{
+    header("test_interpreter_predsort()");
+
+    for (bool wam : {false, true}) {
+	interpreter interp;
+	interp.setup_standard_lib();
+	interp.load_program(interp.parse(
+	      "[(by_value(O, _-A, _-B) :- compare(O, A, B))]."));
+	if (wam) {
+	    interp.compile();
+	}
+	interp.set_wam_enabled(wam);
+
+	// Elements that compare = to an earlier one are dropped
+	term qr = interp.parse("predsort(by_value, [a-3, b-1, c-2, d-1], L),"
+			       "predsort(by_value, [], E).");
+	assert(interp.execute(qr));
+	assert(check_terms(interp.get_result(false),
+			   "L = [b-1,c-2,a-3], E = []"));
+    }
+}
+
+static void test_interpreter_retry_atom()
+{
+    header("test_interpreter_retry_atom()");
+
+    // The clauses of 'a' are retried after a call with arguments
+    interpreter interp;
+    interp.set_auto_compile_threshold(0);
+    interp.load_program(interp.parse("[a, a]."));
+    term qr = interp.parse("findall(X, (a, X = 1), L).");
+    assert(interp.execute(qr));
+    assert(check_terms(interp.get_result(false), "L = [1,1]"));
+}
+
+static void test_interpreter_compile_atom()
+{
+    header("test_interpreter_compile_atom()");
+
+    // There's no first argument to switch on
+    interpreter interp;
+    interp.set_auto_compile_threshold(0);
+    interp.load_program(interp.parse("[a, (a :- true)]."));
+    interp.compile();
+    interp.set_wam_enabled(true);
+    term qr = interp.parse("findall(X, (a, X = 1), L).");
+    assert(interp.execute(qr));
+    assert(check_terms(interp.get_result(false), "L = [1,1]"));
+}
+
+static void test_interpreter_fork_program()
+{
+    header("test_interpreter_fork_program()");
+
+    interpreter tmpl;
+    tmpl.setup_standard_lib();
+    tmpl.load_program(tmpl.parse("[counter(0)]."));
+    assert(tmpl.execute(tmpl.parse("dynamic(counter/1).")));
+
+    for (size_t i = 0; i < 2; i++) {
+	interpreter interp;
+	interp.fork_program(tmpl);
+	assert(interp.get_heap().num_shared_blocks() > 0);
+
+	term qr = interp.parse("append(X, [c], [a,b,c]), retract(counter(N)),"
+			       "N1 is N + 1, assertz(counter(N1)).");
+	assert(interp.execute(qr));
+	assert(check_terms(interp.get_result(false),
+			   "X = [a,b], N = 0, N1 = 1"));
+    }
+
+    // Neither fork changed the template
+    assert(tmpl.execute(tmpl.parse("counter(N).")));
+    assert(check_terms(tmpl.get_result(false), "N = 0"));
+}
+
+static void test_interpreter_assert_retract_loop()
+{
+    header("test_interpreter_assert_retract_loop()");
+
+    const size_t N = 10000;
+
+    interpreter interp;
+    interp.setup_standard_lib();
+    interp.load_program(interp.parse(
+	"[rep, (rep :- rep),"
+	" (count(Max) :- rep, retract(counter(N)), N1 is N + 1,"
+	"                assertz(counter(N1)), N1 >= Max, !),"
+	" (churn(0) :- !),"
+	" (churn(N) :- assertz(g(N)), retract(g(N)), N1 is N - 1,"
+	"              churn(N1))]."));
+    assert(interp.execute(interp.parse("assertz(counter(0)).")));
+
+    size_t heap_before = interp.heap_size();
+    term qr = interp.parse("count(" + std::to_string(N) + "), counter(C).");
+    assert(interp.execute(qr));
+    assert(check_terms(interp.get_result(false), "C = " + std::to_string(N)));
+
+    // Neither the heap of the query nor the clause heap keep the
+    // retracted clauses.
+    size_t clause_heap = interp.clauses_env().heap_size();
+    std::cout << "Heap grew by " << (interp.heap_size() - heap_before)
+	      << " cells; clause heap is " << clause_heap << " cells\n";
+    assert(interp.heap_size() - heap_before < N);
+    assert(clause_heap < 2*interpreter_base::MIN_CLAUSE_HEAP);
+
+    // Clauses are moved while a call is iterating over them
+    qr = interp.parse("assertz(f(1)), assertz(f(2)), assertz(f(3)),"
+		      "findall(X, (f(X), churn(" + std::to_string(N) + ")), L),"
+		      "retract(f(2)), findall(X, f(X), L2).");
+    assert(interp.execute(qr));
+    assert(check_terms(interp.get_result(false),
+		       "L = [1,2,3], L2 = [1,3]"));
+}
+
 int main( int argc, char *argv[] )
 {
     test_up_and_down();
@@ -343,6 +559,14 @@ int main( int argc, char *argv[] )
     test_interpreter_serialize();
     test_interpreter_multi_instance();
     test_interpreter_freeze_preprocess();
+    test_interpreter_auto_compile();
+    test_interpreter_indexing();
+    test_interpreter_indexing_consult();
+    test_interpreter_predsort();
+    test_interpreter_retry_atom();
+    test_interpreter_compile_atom();
+    test_interpreter_fork_program();
+    test_interpreter_assert_retract_loop();
 
     return 0;
 }
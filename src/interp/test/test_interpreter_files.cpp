@@ -38,11 +38,14 @@ int main( int argc, char *argv[] )
 
     const std::string dir = "/src/interp/test/pl_files";
 
-    if (argc >= 2) {
-	test_interpreter_files(dir, [](interpreter &){}, name);
-    } else {
-	test_interpreter_files(dir, [](interpreter &){});
-    }
+    test_interpreter_files(dir, [](interpreter &){}, name);
+
+    // Once more without compiling up front, so the hot predicates get
+    // compiled while the queries run (the default.)
+    header( "test_interpreter_files (auto compile)" );
+    auto_compile = true;
+    do_jit = false;
+    test_interpreter_files(dir, [](interpreter &){}, name);
 
     return 0;
 }
@@ -1,8 +1,13 @@
 #include <boost/algorithm/string.hpp>
+#include <chrono>
+#include <fstream>
+#include <iterator>
 #include "../../common/term_tools.hpp"
 #include "../interpreter.hpp"
 #include "../wam_interpreter.hpp"
 #include "../wam_compiler.hpp"
+#include "../wam_code_cache.hpp"
+#include <boost/filesystem.hpp>
 
 using namespace prologcoin::common;
 using namespace prologcoin::interp;
@@ -49,6 +54,7 @@ public:
     void test_compile2();
     void test_varset();
     void test_unsafe_set_unify();
+    void test_code_chunks();
 
 private:
     interpreter interp_;
@@ -330,19 +336,21 @@ static void test_instruction_sequence()
 					       code_point::fail(),
 					       int_cell(8)));
 
-    auto *hm1 = interp.new_hash_map();
-    hm1->insert(std::make_pair(con_cell("f", 2), int_cell(126)));
-    hm1->insert(std::make_pair(int_cell(1234), int_cell(207)));
-    interp.add(wam_instruction<SWITCH_ON_CONSTANT>(hm1));
+    wam_instruction_switch_table::entries_t t1;
+    t1.push_back(std::make_pair(con_cell("f", 2), int_cell(126)));
+    t1.push_back(std::make_pair(int_cell(1234), int_cell(207)));
+    interp.add(*wam_instruction_switch_table::new_switch<wam_instruction<SWITCH_ON_CONSTANT> >(t1));
 
-    auto *hm2 = interp.new_hash_map();
-    hm2->insert(std::make_pair(con_cell("f", 2), int_cell(221)));
-    hm2->insert(std::make_pair(con_cell("g", 3), int_cell(235)));
-    interp.add(wam_instruction<SWITCH_ON_STRUCTURE>(hm2));
+    wam_instruction_switch_table::entries_t t2;
+    t2.push_back(std::make_pair(con_cell("f", 2), int_cell(221)));
+    t2.push_back(std::make_pair(con_cell("g", 3), int_cell(235)));
+    interp.add(*wam_instruction_switch_table::new_switch<wam_instruction<SWITCH_ON_STRUCTURE> >(t2));
 
     interp.add(wam_instruction<NECK_CUT>());
     interp.add(wam_instruction<GET_LEVEL>(111));
     interp.add(wam_instruction<CUT>(112));
+    interp.add(wam_instruction<GET_LIST_A_UV2>(1, 2, 3));
+    interp.add(wam_instruction<PUT_VALUE_X2>(4, 0, 5, 1));
 
     interp.print_code(std::cout);
 }
@@ -454,6 +462,366 @@ static void test_unsafe_set_unify()
     test.test_unsafe_set_unify();
 }
 
+void test_wam_compiler::test_code_chunks()
+{
+    static const size_t N = 3000;
+
+    std::string prog = "p(a). p(b).\n";
+    for (size_t i = 0; i < N; i++) {
+	auto n = boost::lexical_cast<std::string>(i);
+	prog += "q" + n + "(X) :- p(X), q" + n + "(f(X)).\n";
+    }
+    interp_.load_program(prog);
+
+    auto p = std::make_pair(con_cell("[]",0), con_cell("p",1));
+    interp_.compile(p);
+    auto *p_code = interp_.to_code(interp_.get_wam_predicate_meta_data(p).code_offset);
+
+    // Existing code stays where it is when more chunks are needed
+    for (size_t i = 0; i < N; i++) {
+	interp_.compile(con_cell("[]",0),
+			con_cell("q" + boost::lexical_cast<std::string>(i),1));
+    }
+    std::cout << "Chunks: " << interp_.num_code_chunks() << std::endl;
+    assert(interp_.num_code_chunks() > 1);
+    assert(interp_.to_code(interp_.get_wam_predicate_meta_data(p).code_offset) == p_code);
+    for (size_t i = 0; i < N; i++) {
+	auto q = std::make_pair(con_cell("[]",0),
+			con_cell("q" + boost::lexical_cast<std::string>(i),1));
+	auto &meta_data = interp_.get_wam_predicate_meta_data(q);
+	auto *instr = interp_.to_code(meta_data.code_offset);
+	assert(interp_.to_code_addr(instr) == meta_data.code_offset);
+    }
+
+    // The chunks with only removed code are freed (but not the
+    // current one, and the first one still has p/1.)
+    for (size_t i = 0; i < N; i++) {
+	interp_.remove_compiled(std::make_pair(con_cell("[]",0),
+		       con_cell("q" + boost::lexical_cast<std::string>(i),1)));
+    }
+    interp_.reclaim_code();
+    std::cout << "Chunks after reclaim: " << interp_.num_code_chunks() << std::endl;
+    assert(interp_.num_code_chunks() == 2);
+    assert(interp_.is_compiled(p));
+
+    // r/1 is removed (by assertz) while it runs, and a nested execute
+    // (format's ~@) follows. Its chunk is only freed once the query
+    // is done.
+    interp_.enable_file_io();
+    prog = "r(X) :- assertz(r(z)), format(\"~@~n\", [true]), X = ok.\n"
+	"go(X) :- r(X).\n";
+    for (size_t i = 0; i < N; i++) {
+	auto n = boost::lexical_cast<std::string>(i);
+	prog += "s" + n + "(X) :- p(X), s" + n + "(f(X)).\n";
+    }
+    interp_.load_program(prog);
+    auto r = std::make_pair(con_cell("[]",0), con_cell("r",1));
+    interp_.compile(r);
+    for (size_t i = 0; i < N; i++) {
+	auto s = std::make_pair(con_cell("[]",0),
+			con_cell("s" + boost::lexical_cast<std::string>(i),1));
+	interp_.compile(s);
+	interp_.remove_compiled(s);
+    }
+    interp_.execute(interp_.parse("true."));
+    size_t num_chunks = interp_.num_code_chunks();
+    std::cout << "Chunks before nested execute: " << num_chunks << std::endl;
+    assert(interp_.execute(interp_.parse("go(X).")));
+    assert(interp_.get_result(false) == "X = ok");
+    assert(!interp_.is_compiled(r));
+    assert(interp_.num_code_chunks() == num_chunks);
+    interp_.execute(interp_.parse("true."));
+    std::cout << "Chunks after the query: " << interp_.num_code_chunks() << std::endl;
+    assert(interp_.num_code_chunks() == num_chunks - 1);
+}
+
+static void test_code_chunks()
+{
+    header("test_code_chunks");
+
+    test_wam_compiler test;
+    test.test_code_chunks();
+}
+
+//
+// Dispatch cost of the switch tables (and a compiled fact table) for
+// different numbers of keys.
+//
+static void test_switch_tables()
+{
+    header("test_switch_tables");
+
+    using clock = std::chrono::steady_clock;
+    static const size_t LOOKUPS = 1000000;
+
+    for (size_t n : {3, 6, 10, 1000, 100000}) {
+	wam_instruction_switch_table::entries_t entries;
+	std::unordered_map<term, code_point> map;
+	for (size_t i = 0; i < n; i++) {
+	    auto e = std::make_pair(term(int_cell(i * 7919)), code_point(int_cell(i)));
+	    entries.push_back(e);
+	    map.insert(e);
+	}
+	auto *table = wam_instruction_switch_table::new_switch<wam_instruction<SWITCH_ON_CONSTANT> >(entries);
+	assert(table->layout() == (n <= wam_instruction_switch_table::MAX_LINEAR ? wam_instruction_switch_table::LINEAR : (n <= wam_instruction_switch_table::MAX_SORTED ? wam_instruction_switch_table::SORTED : wam_instruction_switch_table::HASHED)));
+
+	for (size_t i = 0; i < n; i++) {
+	    auto *cp = table->lookup(int_cell(i * 7919));
+	    assert(cp != nullptr && cp->term_code() == int_cell(i));
+	}
+	assert(table->lookup(int_cell(1)) == nullptr);
+	assert(table->lookup(con_cell("foo",0)) == nullptr);
+
+	// Keys in a scrambled order
+	std::vector<term> keys(1 << 16);
+	for (size_t i = 0; i < keys.size(); i++) {
+	    keys[i] = int_cell(((i * 2654435761u) % n) * 7919);
+	}
+
+	size_t found = 0;
+	auto t0 = clock::now();
+	for (size_t i = 0; i < LOOKUPS; i++) {
+	    found += table->lookup(keys[i % keys.size()]) != nullptr;
+	}
+	auto t1 = clock::now();
+	for (size_t i = 0; i < LOOKUPS; i++) {
+	    found += map.find(keys[i % keys.size()]) != map.end();
+	}
+	auto t2 = clock::now();
+	assert(found == 2*LOOKUPS);
+
+	auto ns = [&](clock::duration d) {
+	    return static_cast<double>(std::chrono::duration_cast<std::chrono::nanoseconds>(d).count()) / LOOKUPS; };
+	std::cout << n << " keys: table " << ns(t1 - t0) << " ns, "
+		  << "unordered_map " << ns(t2 - t1) << " ns per lookup"
+		  << std::endl;
+	delete [] reinterpret_cast<char *>(table);
+    }
+
+    // Calls to compiled fact tables
+    for (size_t n : {10, 1000, 100000}) {
+	interpreter interp;
+	std::string prog;
+	for (size_t i = 0; i < n; i++) {
+	    auto k = boost::lexical_cast<std::string>(i * 7919);
+	    prog += "fact(" + k + ", " + k + ").\n";
+	}
+	prog += "loop(0, _) :- !.\n"
+	    "loop(N, M) :- K is (N mod M) * 7919, fact(K, K), N1 is N - 1, loop(N1, M).\n";
+	interp.load_program(prog);
+	interp.compile();
+
+	auto n_str = boost::lexical_cast<std::string>(n);
+	auto t0 = clock::now();
+	bool r = interp.execute(interp.parse("loop(100000, " + n_str + ")."));
+	auto t1 = clock::now();
+	assert(r);
+	std::cout << n << " facts: "
+		  << std::chrono::duration_cast<std::chrono::milliseconds>(t1 - t0).count()
+		  << " ms for 100000 calls" << std::endl;
+    }
+}
+
+//
+// Native code (per predicate) must give the same results as cont_wam,
+// and handler exceptions must get out of it.
+//
+static void test_jit()
+{
+    header("test_jit");
+
+    if (!interpreter::is_jit_supported()) {
+	std::cout << "No JIT on this platform" << std::endl;
+	return;
+    }
+
+    using clock = std::chrono::steady_clock;
+
+    interpreter interp;
+    interp.load_program(
+	"app([], Zs, Zs).\n"
+	"app([X|Xs], Ys, [X|Zs]) :- app(Xs, Ys, Zs).\n"
+	"nrev([], []).\n"
+	"nrev([X|Xs], Ys) :- nrev(Xs, Rs), app(Rs, [X], Ys).\n"
+	"range(N, N, [N]) :- !.\n"
+	"range(M, N, [M|Ns]) :- M < N, M1 is M + 1, range(M1, N, Ns).\n"
+	"loop(0, L, L) :- !.\n"
+	"loop(N, _, R) :- range(1, 30, L), nrev(L, R0), N1 is N - 1, loop(N1, R0, R).\n"
+	"bad(X, Y) :- Y is X + foo.\n");
+    interp.compile();
+
+    auto run = [&](const std::string &query) {
+	auto t0 = clock::now();
+	bool r = interp.execute(interp.parse(query));
+	auto t1 = clock::now();
+	assert(r);
+	std::cout << query << " " << interp.get_result() << " ("
+		  << std::chrono::duration_cast<std::chrono::milliseconds>(t1 - t0).count()
+		  << " ms)" << std::endl;
+	return interp.get_result();
+    };
+
+    const std::string query = "loop(2000, [], R).";
+    auto expect = run(query);
+
+    for (auto &qn : interp.get_predicates()) {
+	interp.set_jit(qn, true);
+    }
+    assert(run(query) == expect);
+
+    // Switched off for one predicate, and kept over a recompile for
+    // another.
+    auto app = std::make_pair(con_cell("[]",0), con_cell("app",3));
+    auto nrev = std::make_pair(con_cell("[]",0), con_cell("nrev",2));
+    interp.set_jit(app, false);
+    assert(!interp.is_jit(app) && interp.is_jit(nrev));
+    interp.remove_compiled(nrev);
+    interp.compile(nrev);
+    assert(interp.is_jit(nrev));
+    assert(run(query) == expect);
+
+    bool thrown = false;
+    try {
+	interp.execute(interp.parse("bad(1, Y)."));
+    } catch (interpreter_exception &ex) {
+	std::cout << "Exception: " << ex.what() << std::endl;
+	thrown = true;
+    }
+    assert(thrown);
+    interp.reset();
+    assert(run(query) == expect);
+
+    // r/1 is removed (by assertz) while its native code runs, and
+    // format's ~@ runs a nested query before it returns to it.
+    interpreter interp2;
+    interp2.enable_file_io();
+    interp2.load_program(
+	"r(X) :- assertz(r(z)), format(\"~@~n\", [true]), X = ok.\n"
+	"go(X) :- r(X).\n");
+    auto r = std::make_pair(con_cell("[]",0), con_cell("r",1));
+    interp2.set_jit(r, true);
+    interp2.compile(r);
+    assert(interp2.execute(interp2.parse("go(X).")));
+    assert(interp2.get_result(false) == "X = ok");
+    assert(!interp2.is_compiled(r));
+}
+
+//
+// Compiled code saved to a file and loaded into another interpreter
+// (whose atoms are elsewhere) must run as if it had been compiled
+// there.
+//
+static void test_code_cache()
+{
+    header("test_code_cache");
+
+    const std::string prog =
+	"app([], Zs, Zs).\n"
+	"app([X|Xs], Ys, [X|Zs]) :- app(Xs, Ys, Zs).\n"
+	"nrev([], []).\n"
+	"nrev([X|Xs], Ys) :- nrev(Xs, Rs), app(Rs, [X], Ys).\n"
+	"colour(crimson_red, 1). colour(cobalt_blue, 2). colour(forest_green, 3).\n"
+	"colour(sunflower_yellow, 4). colour(tangerine, 5). colour(lavender, 6).\n"
+	"colour(charcoal_grey, 7). colour(ivory_white, 8). colour(turquoise, 9).\n"
+	"colour(magenta_pink, 10).\n"
+	"shape(circle(R), A) :- !, A is 3 * R * R.\n"
+	"shape(rectangle_shape(W, H), A) :- A is W * H.\n"
+	"shape(big, 123456789012345678901234567890).\n"
+	"sum([], S, S).\n"
+	"sum([C|Cs], S0, S) :- colour(C, N), ( N > 5 -> S1 is S0 + N ; S1 = S0 ), sum(Cs, S1, S).\n"
+	"test(R) :- nrev([tangerine, lavender, magenta_pink, turquoise], L), sum(L, 0, S), shape(rectangle_shape(S, 2), A), shape(circle(2), C), shape(big, B), R = f(L, S, A, C, B).\n";
+
+    const std::string path = (boost::filesystem::temp_directory_path()
+			      / boost::filesystem::unique_path("test_code_cache_%%%%%%%%.wam")).string();
+
+    interpreter interp1;
+    interp1.load_program(prog);
+    interp1.compile();
+    wam_code_cache cache1(interp1);
+    auto key = cache1.source_key(interp1.get_predicates());
+    assert(cache1.save(path, key, interp1.get_predicates()));
+    assert(interp1.execute(interp1.parse("test(R).")));
+    auto expect = interp1.get_result();
+    std::cout << "Expect: " << expect << std::endl;
+
+    // Other atoms first, so they get other indices
+    interpreter interp2;
+    interp2.load_program("other(some_long_atom, another_long_atom, forest_green).\n");
+    interp2.load_program(prog);
+    wam_code_cache cache2(interp2);
+    auto key2 = cache2.source_key(interp2.get_predicates());
+    assert(key2 != key);
+    assert(!cache2.load(path, key2));
+
+    std::vector<qname> preds;
+    for (auto &qn : interp2.get_predicates()) {
+	if (qn.second != con_cell("other",3)) {
+	    preds.push_back(qn);
+	}
+    }
+    assert(cache2.source_key(preds) == key);
+    assert(cache2.load(path, key));
+
+    // The bignum constant isn't saved, so shape/2 is compiled here
+    auto shape = std::make_pair(con_cell("[]",0), con_cell("shape",2));
+    auto colour = std::make_pair(con_cell("[]",0), con_cell("colour",2));
+    assert(!interp2.is_compiled(shape) && interp2.is_compiled(colour));
+    interp2.compile();
+    assert(interp2.execute(interp2.parse("test(R).")));
+    std::cout << "Actual: " << interp2.get_result() << std::endl;
+    assert(interp2.get_result() == expect);
+
+    // The loaded predicates are linked, and they can be recompiled
+    interp2.remove_compiled(colour);
+    interp2.compile(colour);
+    assert(interp2.execute(interp2.parse("test(R).")));
+    assert(interp2.get_result() == expect);
+
+    // Code from another layout (fingerprint) isn't loaded, and
+    // damaged code is caught before it's installed.
+    std::string data;
+    {
+	std::ifstream in(path, std::ios::binary);
+	data.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+    }
+    auto write_file = [&](const std::string &d) {
+	std::ofstream out(path, std::ios::binary);
+	out.write(d.data(), d.size());
+    };
+    std::string bad = data;
+    bad[8] ^= 1;
+    write_file(bad);
+    interpreter interp4;
+    interp4.load_program(prog);
+    wam_code_cache cache4(interp4);
+    assert(!cache4.load(path, key));
+    size_t num_loaded = 0;
+    for (size_t i = 24; i < data.size(); i += 3) {
+	bad = data;
+	bad[i] ^= 0x5a;
+	write_file(bad);
+	num_loaded += cache4.load(path, key);
+    }
+    std::cout << "Damaged files loaded: " << num_loaded << " of "
+	      << (data.size() - 24 + 2) / 3 << std::endl;
+    write_file(data);
+    assert(cache4.load(path, key));
+
+    // The standard library through the cache (saved and then loaded)
+    boost::filesystem::remove(path);
+    for (size_t i = 0; i < 2; i++) {
+	interpreter interp3;
+	interp3.set_code_cache(path);
+	interp3.setup_standard_lib();
+	assert(boost::filesystem::exists(path));
+	assert(interp3.execute(interp3.parse("append(X, [c], [a,b,c]), member(Y, [x]).")));
+	std::cout << "Standard library (" << (i == 0 ? "saved" : "loaded") << "): "
+		  << interp3.get_result(false) << std::endl;
+	assert(interp3.get_result(false) == "X = [a,b], Y = x");
+    }
+    boost::filesystem::remove(path);
+}
+
 int main( int argc, char *argv[] )
 {
     test_flatten();
@@ -463,6 +831,10 @@ int main( int argc, char *argv[] )
     test_compile2();
     test_varset();
     test_unsafe_set_unify();
+    test_code_chunks();
+    test_switch_tables();
+    test_jit();
+    test_code_cache();
 
     return 0;
 }
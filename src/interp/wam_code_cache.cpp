@@ -0,0 +1,852 @@
+#include "wam_code_cache.hpp"
+#include "wam_compiler.hpp"
+#include <fstream>
+#include <iterator>
+#include <unordered_set>
+#include <boost/filesystem.hpp>
+
+namespace prologcoin { namespace interp {
+
+namespace {
+
+// 64-bit FNV-1a (it must be the same in every process.)
+class key_hash {
+public:
+    key_hash() : h_(0xcbf29ce484222325ULL) { }
+
+    void add(const uint8_t *bytes, size_t n)
+    {
+	for (size_t i = 0; i < n; i++) {
+	    h_ = (h_ ^ bytes[i]) * 0x100000001b3ULL;
+	}
+    }
+
+    void add(uint64_t v)
+    {
+	uint8_t bytes[8];
+	for (size_t i = 0; i < 8; i++) {
+	    bytes[i] = static_cast<uint8_t>(v >> (8*i));
+	}
+	add(bytes, 8);
+    }
+
+    void add(const std::string &s)
+    {
+	add(static_cast<uint64_t>(s.size()));
+	add(reinterpret_cast<const uint8_t *>(s.data()), s.size());
+    }
+
+    uint64_t value() const { return h_; }
+
+private:
+    uint64_t h_;
+};
+
+class file_reader {
+public:
+    file_reader(const std::string &data) : data_(data), pos_(0) { }
+
+    template<typename T> bool read(T &v)
+    {
+	if (data_.size() - pos_ < sizeof(T)) {
+	    return false;
+	}
+	memcpy(&v, data_.data() + pos_, sizeof(T));
+	pos_ += sizeof(T);
+	return true;
+    }
+
+    bool read(common::term &t)
+    {
+	uint64_t raw;
+	if (!read(raw)) {
+	    return false;
+	}
+	t = common::cell(raw);
+	return true;
+    }
+
+    bool read(std::string &s, size_t n)
+    {
+	if (data_.size() - pos_ < n) {
+	    return false;
+	}
+	s.assign(data_, pos_, n);
+	pos_ += n;
+	return true;
+    }
+
+    bool read(std::vector<code_t> &code, size_t n)
+    {
+	if ((data_.size() - pos_) / sizeof(code_t) < n) {
+	    return false;
+	}
+	code.resize(n);
+	memcpy(code.data(), data_.data() + pos_, n * sizeof(code_t));
+	pos_ += n * sizeof(code_t);
+	return true;
+    }
+
+    bool at_end() const { return pos_ == data_.size(); }
+
+private:
+    const std::string &data_;
+    size_t pos_;
+};
+
+template<typename T> void write(std::ostream &out, const T &v)
+{
+    out.write(reinterpret_cast<const char *>(&v), sizeof(T));
+}
+
+//
+// Calls term_fn on the terms and cp_fn on the code points of an
+// instruction (except for calls and built-ins, see symbols.) The
+// switch tables are laid out again afterwards.
+//
+template<typename TermFn, typename CpFn>
+bool visit(wam_instruction_base *instr, TermFn term_fn, CpFn cp_fn)
+{
+    auto table_fn = [&](wam_instruction_switch_table *table) {
+	auto entries = table->entries();
+	for (auto &e : entries) {
+	    if (!term_fn(e.first) || !cp_fn(e.second)) {
+		return false;
+	    }
+	}
+	table->set_entries(entries);
+	return true;
+    };
+
+    switch (instr->type()) {
+    case PUT_STRUCTURE_A:
+    case PUT_STRUCTURE_X:
+    case PUT_STRUCTURE_Y:
+    case GET_STRUCTURE_A:
+    case GET_STRUCTURE_X:
+    case GET_STRUCTURE_Y: {
+	auto *i = static_cast<wam_instruction_con_reg *>(instr);
+	common::term t = i->con();
+	if (!term_fn(t)) {
+	    return false;
+	}
+	i->set_con(static_cast<const common::con_cell &>(t));
+	return true;
+	}
+    case PUT_CONSTANT:
+    case GET_CONSTANT:
+    case SET_CONSTANT:
+    case UNIFY_CONSTANT:
+    case COST: {
+	auto *i = static_cast<wam_instruction_term *>(instr);
+	common::term t = i->get_term();
+	if (!term_fn(t)) {
+	    return false;
+	}
+	i->set_term(t);
+	return true;
+	}
+    case TRY_ME_ELSE:
+    case RETRY_ME_ELSE:
+    case TRY:
+    case RETRY:
+    case TRUST:
+    case GOTO:
+    case RESET_LEVEL:
+	return cp_fn(static_cast<wam_instruction_code_point *>(instr)->cp());
+    case SWITCH_ON_TERM: {
+	auto *i = reinterpret_cast<wam_instruction<SWITCH_ON_TERM> *>(instr);
+	return cp_fn(i->pv()) && cp_fn(i->pc()) && cp_fn(i->pl()) && cp_fn(i->ps());
+	}
+    case SWITCH_ON_ARG:
+	if (!cp_fn(reinterpret_cast<wam_instruction<SWITCH_ON_ARG> *>(instr)->pv())) {
+	    return false;
+	}
+	// Fall through for the table
+    case SWITCH_ON_CONSTANT:
+    case SWITCH_ON_STRUCTURE:
+	return table_fn(static_cast<wam_instruction_switch_table *>(instr));
+    default:
+	return true;
+    }
+}
+
+inline bool is_symbol_instruction(wam_instruction_type t)
+{
+    return t == CALL || t == EXECUTE || t == BUILTIN || t == BUILTIN_R;
+}
+
+typedef void (*invoke_fn)(wam_interpreter &interp, wam_instruction_base *self);
+
+// The handlers by instruction type
+const invoke_fn * instruction_fns()
+{
+#define WAM_CACHE_FN(I, K) (wam_instruction<I>::init(), &wam_instruction<I>::invoke),
+    static const invoke_fn fns[] = {
+	WAM_INSTRUCTION_TYPES(WAM_CACHE_FN)
+    };
+#undef WAM_CACHE_FN
+    return fns;
+}
+
+// The size (in code_t) of each instruction type. Switch tables are
+// larger (see wam_instruction_switch_table::is_well_formed.)
+const size_t * instruction_sizes()
+{
+#define WAM_CACHE_SIZE(I, K) (sizeof(wam_instruction<I>) + sizeof(code_t) - 1) / sizeof(code_t),
+    static const size_t sizes[] = {
+	WAM_INSTRUCTION_TYPES(WAM_CACHE_SIZE)
+    };
+#undef WAM_CACHE_SIZE
+    return sizes;
+}
+
+template<wam_instruction_type I> inline wam_instruction<I> * as(wam_instruction_base *instr)
+{
+    return reinterpret_cast<wam_instruction<I> *>(instr);
+}
+
+//
+// Whether the size and the registers of an instruction are valid: A
+// and X registers within the register files and Y registers (and
+// the environment sizes of calls) within the environment.
+//
+bool check_instruction(wam_instruction_base *instr, size_t num_y)
+{
+    auto a = [](size_t r) { return r < interpreter_base::MAX_ARGS; };
+    auto x = [](size_t r) { return r < wam_interpreter::MAX_X_REGISTERS; };
+    auto y = [&](size_t r) { return r < num_y; };
+
+    switch (instr->type()) {
+    case SWITCH_ON_CONSTANT:
+	return as<SWITCH_ON_CONSTANT>(instr)->is_well_formed<wam_instruction<SWITCH_ON_CONSTANT> >();
+    case SWITCH_ON_STRUCTURE:
+	return as<SWITCH_ON_STRUCTURE>(instr)->is_well_formed<wam_instruction<SWITCH_ON_STRUCTURE> >();
+    case SWITCH_ON_ARG:
+	return as<SWITCH_ON_ARG>(instr)->is_well_formed<wam_instruction<SWITCH_ON_ARG> >() &&
+	    a(as<SWITCH_ON_ARG>(instr)->ai());
+    default:
+	if (instr->size() != instruction_sizes()[instr->type()]) {
+	    return false;
+	}
+	break;
+    }
+
+    switch (instr->type()) {
+    case PUT_VARIABLE_X:
+    case PUT_VALUE_X:
+    case GET_VARIABLE_X:
+    case GET_VALUE_X: {
+	auto *i = static_cast<wam_instruction_binary_reg *>(instr);
+	return x(i->reg_1()) && a(i->reg_2());
+	}
+    case PUT_VARIABLE_Y:
+    case PUT_VALUE_Y:
+    case PUT_UNSAFE_VALUE_Y:
+    case GET_VARIABLE_Y:
+    case GET_VALUE_Y: {
+	auto *i = static_cast<wam_instruction_binary_reg *>(instr);
+	return y(i->reg_1()) && a(i->reg_2());
+	}
+    case ARITH_ADD:
+    case ARITH_SUB:
+    case ARITH_MUL:
+    case ARITH_IDIV:
+    case ARITH_MOD:
+    case ARITH_SHL:
+    case ARITH_SHR:
+    case ARITH_LT:
+    case ARITH_LE:
+    case ARITH_EQ:
+    case ARITH_NE:
+    case TEST_EQ:
+    case TEST_NE: {
+	auto *i = static_cast<wam_instruction_binary_reg *>(instr);
+	return a(i->reg_1()) && a(i->reg_2());
+	}
+    case PUT_STRUCTURE_A:
+    case GET_STRUCTURE_A:
+	return a(static_cast<wam_instruction_con_reg *>(instr)->reg());
+    case PUT_STRUCTURE_X:
+    case GET_STRUCTURE_X:
+	return x(static_cast<wam_instruction_con_reg *>(instr)->reg());
+    case PUT_STRUCTURE_Y:
+    case GET_STRUCTURE_Y:
+	return y(static_cast<wam_instruction_con_reg *>(instr)->reg());
+    case PUT_LIST_A:
+    case GET_LIST_A:
+    case SET_VARIABLE_A:
+    case SET_VALUE_A:
+    case UNIFY_VARIABLE_A:
+    case UNIFY_VALUE_A:
+    case TEST_VAR:
+    case TEST_NONVAR:
+    case TEST_ATOM:
+    case TEST_ATOMIC:
+    case TEST_INTEGER:
+    case TEST_NUMBER:
+    case TEST_COMPOUND:
+    case TEST_CALLABLE:
+	return a(static_cast<wam_instruction_unary_reg *>(instr)->reg());
+    case PUT_LIST_X:
+    case GET_LIST_X:
+    case SET_VARIABLE_X:
+    case SET_VALUE_X:
+    case SET_LOCAL_VALUE_X:
+    case UNIFY_VARIABLE_X:
+    case UNIFY_VALUE_X:
+    case UNIFY_LOCAL_VALUE_X:
+	return x(static_cast<wam_instruction_unary_reg *>(instr)->reg());
+    case PUT_LIST_Y:
+    case GET_LIST_Y:
+    case SET_VARIABLE_Y:
+    case SET_VALUE_Y:
+    case SET_LOCAL_VALUE_Y:
+    case UNIFY_VARIABLE_Y:
+    case UNIFY_VALUE_Y:
+    case UNIFY_LOCAL_VALUE_Y:
+    case GET_LEVEL:
+    case CUT:
+	return y(static_cast<wam_instruction_unary_reg *>(instr)->reg());
+    case PUT_CONSTANT:
+    case GET_CONSTANT:
+	return a(static_cast<wam_instruction_term_reg *>(instr)->reg());
+    case CALL:
+    case BUILTIN_R:
+    case RESET_LEVEL:
+	return static_cast<wam_instruction_code_point_reg *>(instr)->reg() <= num_y;
+    case GET_LIST_A_UV2: {
+	auto *i = as<GET_LIST_A_UV2>(instr);
+	return a(i->ai()) && x(i->xn1()) && x(i->xn2());
+	}
+    case PUT_VALUE_X2: {
+	auto *i = as<PUT_VALUE_X2>(instr);
+	return x(i->xn1()) && a(i->ai1()) && x(i->xn2()) && a(i->ai2());
+	}
+    default:
+	return true;
+    }
+}
+
+}
+
+uint64_t wam_code_cache::code_fingerprint()
+{
+    key_hash h;
+#define WAM_CACHE_LAYOUT(I, K) \
+    h.add(std::string(#I)); h.add(static_cast<uint64_t>(sizeof(wam_instruction<I>)));
+    WAM_INSTRUCTION_TYPES(WAM_CACHE_LAYOUT)
+#undef WAM_CACHE_LAYOUT
+    h.add(static_cast<uint64_t>(LAST));
+    h.add(static_cast<uint64_t>(sizeof(code_point)));
+    h.add(static_cast<uint64_t>(sizeof(common::term)));
+    h.add(static_cast<uint64_t>(wam_instruction_switch_table::MAX_LINEAR));
+    h.add(static_cast<uint64_t>(wam_instruction_switch_table::MAX_SORTED));
+    h.add(static_cast<uint64_t>(wam_compiler::CODEGEN_VERSION));
+    return h.value();
+}
+
+const uint32_t wam_code_cache::MAGIC;
+const uint32_t wam_code_cache::VERSION;
+
+wam_code_cache::wam_code_cache(wam_interpreter &interp) : interp_(interp)
+{
+}
+
+uint64_t wam_code_cache::source_key(const std::vector<qname> &preds)
+{
+    enum { VAR, ATOM, INT, STR, OTHER };
+
+    key_hash h;
+    auto add_atom = [&](key_hash &h, common::con_cell c) {
+	h.add(interp_.atom_name(c));
+	h.add(static_cast<uint64_t>(c.arity()));
+    };
+
+    for (auto &qn : preds) {
+	add_atom(h, qn.first);
+	add_atom(h, qn.second);
+	for (auto &cl : interp_.get_predicate(qn)) {
+	    if (cl.is_erased()) {
+		continue;
+	    }
+	    std::unordered_map<term, uint64_t> vars;
+	    auto &env = interp_.clause_env(cl);
+	    std::vector<term> stack(1, cl.clause());
+	    while (!stack.empty()) {
+		term t = env.deref(stack.back());
+		stack.pop_back();
+		switch (t.tag()) {
+		case common::tag_t::REF: {
+		    auto it = vars.find(t);
+		    uint64_t n = vars.size();
+		    if (it == vars.end()) {
+			vars[t] = n;
+		    } else {
+			n = it->second;
+		    }
+		    h.add(VAR);
+		    h.add(n);
+		    break;
+		    }
+		case common::tag_t::CON:
+		    h.add(ATOM);
+		    add_atom(h, static_cast<const common::con_cell &>(t));
+		    break;
+		case common::tag_t::INT:
+		    h.add(INT);
+		    h.add(static_cast<uint64_t>(static_cast<const common::int_cell &>(t).value()));
+		    break;
+		case common::tag_t::STR: {
+		    auto f = env.functor(t);
+		    h.add(STR);
+		    add_atom(h, f);
+		    for (size_t i = f.arity(); i > 0; i--) {
+			stack.push_back(env.arg(t, i - 1));
+		    }
+		    break;
+		    }
+		default:
+		    h.add(OTHER);
+		    h.add(env.to_string(t));
+		    break;
+		}
+	    }
+	}
+    }
+
+    // Which goals are built-ins (in any order)
+    uint64_t bns = 0;
+    for (auto &bn : interp_.get_builtins()) {
+	key_hash hb;
+	add_atom(hb, bn.first.first);
+	add_atom(hb, bn.first.second);
+	hb.add(static_cast<uint64_t>(bn.second.is_recursive()));
+	bns += hb.value();
+    }
+    h.add(bns);
+
+    return h.value();
+}
+
+bool wam_code_cache::to_file(term &t)
+{
+    switch (t.tag()) {
+    case common::tag_t::INT:
+	return true;
+    case common::tag_t::CON: {
+	auto c = static_cast<const common::con_cell &>(t);
+	if (c.is_direct()) {
+	    return true;
+	}
+	auto it = atoms_.find(c.atom_index());
+	uint32_t index;
+	if (it == atoms_.end()) {
+	    index = static_cast<uint32_t>(atom_names_.size());
+	    atoms_[c.atom_index()] = index;
+	    atom_names_.push_back(interp_.atom_name(c));
+	} else {
+	    index = it->second;
+	}
+	t = common::con_cell(index, c.arity());
+	return true;
+	}
+    default:
+	// Refers to the heap
+	return false;
+    }
+}
+
+bool wam_code_cache::from_file(term &t)
+{
+    switch (t.tag()) {
+    case common::tag_t::INT:
+	return true;
+    case common::tag_t::CON: {
+	auto c = static_cast<const common::con_cell &>(t);
+	if (c.is_direct()) {
+	    return true;
+	}
+	if (c.atom_index() >= atom_names_.size()) {
+	    return false;
+	}
+	t = interp_.functor(atom_names_[c.atom_index()], c.arity());
+	return true;
+	}
+    default:
+	return false;
+    }
+}
+
+bool wam_code_cache::to_file(qname &qn)
+{
+    term m = qn.first, f = qn.second;
+    if (!to_file(m) || !to_file(f)) {
+	return false;
+    }
+    qn = qname(static_cast<const common::con_cell &>(m),
+	       static_cast<const common::con_cell &>(f));
+    return true;
+}
+
+bool wam_code_cache::from_file(qname &qn)
+{
+    term m = qn.first, f = qn.second;
+    if (m.tag() != common::tag_t::CON || f.tag() != common::tag_t::CON ||
+	!from_file(m) || !from_file(f)) {
+	return false;
+    }
+    qn = qname(static_cast<const common::con_cell &>(m),
+	       static_cast<const common::con_cell &>(f));
+    return true;
+}
+
+bool wam_code_cache::find_builtin(common::con_cell f, builtin_fn fn, qname &qn)
+{
+    // The instruction only has the name (usually in the default module)
+    auto &bn = interp_.get_builtin(interp_.EMPTY_LIST, f);
+    if (bn.fn() == fn) {
+	qn = qname(interp_.EMPTY_LIST, f);
+	return true;
+    }
+    for (auto &b : interp_.get_builtins()) {
+	if (b.first.second == f && b.second.fn() == fn) {
+	    qn = b.first;
+	    return true;
+	}
+    }
+    return false;
+}
+
+bool wam_code_cache::save_image(const qname &qn, predicate_image &img)
+{
+    auto &meta = interp_.get_wam_predicate_meta_data(qn);
+    auto *first = reinterpret_cast<code_t *>(interp_.to_code(meta.code_offset));
+    size_t size = meta.code_size;
+
+    img.qn = qn;
+    img.num_x = static_cast<uint32_t>(meta.num_x_registers);
+    img.num_y = static_cast<uint32_t>(meta.num_y_registers);
+    img.code.assign(first, first + size);
+    if (!to_file(img.qn)) {
+	return false;
+    }
+
+    // The callee of each call in the code (by offset)
+    std::unordered_map<size_t, qname> callees;
+    auto it = interp_.callees_.find(qn);
+    if (it != interp_.callees_.end()) {
+	for (auto &callee : it->second) {
+	    for (auto offset : interp_.calls_[callee]) {
+		if (offset >= meta.code_offset && offset < meta.code_offset + size) {
+		    callees[offset - meta.code_offset] = callee;
+		}
+	    }
+	}
+    }
+
+    auto cp_fn = [&](code_point &cp) {
+	if (cp.has_wam_code()) {
+	    auto *to = reinterpret_cast<code_t *>(cp.wam_code());
+	    // The label stays (switch_on_term tells fail by it)
+	    auto label = cp.term_code();
+	    if (to < first || to >= first + size ||
+		label.tag() != common::tag_t::INT) {
+		return false;
+	    }
+	    cp = code_point(reinterpret_cast<wam_instruction_base *>(
+				static_cast<uintptr_t>(to - first)));
+	    cp.set_term_code(label);
+	    return true;
+	}
+	return cp.is_fail() && cp.wam_code() == nullptr;
+    };
+    auto term_fn = [&](term &t) { return to_file(t); };
+
+    code_t *base = img.code.data();
+    for (size_t offset = 0; offset < size;) {
+	auto *instr = reinterpret_cast<wam_instruction_base *>(base + offset);
+	auto type = instr->type();
+	instr->set_type(nullptr, type);
+	if (is_symbol_instruction(type)) {
+	    auto &cp = static_cast<wam_instruction_code_point *>(instr)->cp();
+	    symbol sym;
+	    sym.offset = static_cast<uint32_t>(offset);
+	    if (type == CALL || type == EXECUTE) {
+		auto it = callees.find(offset);
+		if (it == callees.end()) {
+		    return false;
+		}
+		sym.qn = it->second;
+	    } else if (!find_builtin(cp.name(), cp.bn(), sym.qn)) {
+		return false;
+	    }
+	    if (!to_file(sym.qn)) {
+		return false;
+	    }
+	    img.symbols.push_back(sym);
+	    cp = code_point();
+	} else if (!visit(instr, term_fn, cp_fn)) {
+	    return false;
+	}
+	offset += instr->size();
+    }
+    return true;
+}
+
+bool wam_code_cache::save(const std::string &path, uint64_t key,
+			  const std::vector<qname> &preds)
+{
+    atoms_.clear();
+    atom_names_.clear();
+
+    std::vector<predicate_image> images;
+    for (auto &qn : preds) {
+	predicate_image img;
+	if (interp_.is_compiled(qn) && save_image(qn, img)) {
+	    images.push_back(std::move(img));
+	}
+    }
+
+    // Written to a file of its own and then renamed, so a load (from
+    // another interpreter) never sees half of it.
+    boost::system::error_code ec;
+    auto tmp = boost::filesystem::unique_path(path + ".%%%%%%%%", ec);
+    if (ec) {
+	return false;
+    }
+    {
+	std::ofstream out(tmp.string(), std::ios::binary);
+	write(out, MAGIC);
+	write(out, VERSION);
+	write(out, code_fingerprint());
+	write(out, key);
+
+	write(out, static_cast<uint32_t>(atom_names_.size()));
+	for (auto &name : atom_names_) {
+	    write(out, static_cast<uint32_t>(name.size()));
+	    out.write(name.data(), name.size());
+	}
+
+	write(out, static_cast<uint32_t>(images.size()));
+	for (auto &img : images) {
+	    write(out, img.qn.first);
+	    write(out, img.qn.second);
+	    write(out, img.num_x);
+	    write(out, img.num_y);
+	    write(out, static_cast<uint32_t>(img.code.size()));
+	    write(out, static_cast<uint32_t>(img.symbols.size()));
+	    for (auto &sym : img.symbols) {
+		write(out, sym.offset);
+		write(out, sym.qn.first);
+		write(out, sym.qn.second);
+	    }
+	    out.write(reinterpret_cast<const char *>(img.code.data()),
+		      img.code.size() * sizeof(code_t));
+	}
+	if (!out.flush()) {
+	    boost::filesystem::remove(tmp, ec);
+	    return false;
+	}
+    }
+    boost::filesystem::rename(tmp, path, ec);
+    if (ec) {
+	boost::filesystem::remove(tmp, ec);
+	return false;
+    }
+    return true;
+}
+
+//
+// Everything but the code points within the predicate (which need the
+// address it's loaded at, see install.)
+//
+bool wam_code_cache::load_image(predicate_image &img)
+{
+    if (!from_file(img.qn) || img.num_x > wam_interpreter::MAX_X_REGISTERS) {
+	return false;
+    }
+
+    std::unordered_map<size_t, qname> symbols;
+    for (auto &sym : img.symbols) {
+	if (!from_file(sym.qn) ||
+	    sym.qn.second.arity() > interpreter_base::MAX_ARGS) {
+	    return false;
+	}
+	symbols[sym.offset] = sym.qn;
+    }
+
+    // Check every instruction before anything in it is used
+    size_t size = img.code.size();
+    code_t *base = img.code.data();
+    std::unordered_set<size_t> offsets;
+    for (size_t offset = 0; offset < size;) {
+	auto *instr = reinterpret_cast<wam_instruction_base *>(base + offset);
+	if (static_cast<uint32_t>(instr->type()) >= LAST ||
+	    instr->size() == 0 || instr->size() > size - offset ||
+	    !check_instruction(instr, img.num_y)) {
+	    return false;
+	}
+	offsets.insert(offset);
+	offset += instr->size();
+    }
+
+    auto cp_fn = [&](code_point &cp) {
+	if (cp.has_wam_code()) {
+	    return offsets.count(reinterpret_cast<uintptr_t>(cp.wam_code())) != 0 &&
+		cp.term_code().tag() == common::tag_t::INT;
+	}
+	if (!cp.is_fail()) {
+	    return false;
+	}
+	cp = code_point::fail();
+	return true;
+    };
+    auto term_fn = [&](term &t) { return from_file(t); };
+
+    auto *fns = instruction_fns();
+    size_t num_symbols = 0;
+    for (size_t offset = 0; offset < size;) {
+	auto *instr = reinterpret_cast<wam_instruction_base *>(base + offset);
+	auto type = instr->type();
+	instr->set_type(fns[type], type);
+	if (is_symbol_instruction(type)) {
+	    auto it = symbols.find(offset);
+	    if (it == symbols.end()) {
+		return false;
+	    }
+	    auto &qn = it->second;
+	    auto &cp = static_cast<wam_instruction_code_point *>(instr)->cp();
+	    if (type == CALL || type == EXECUTE) {
+		cp = code_point(qn.first, qn.second);
+	    } else {
+		auto &bn = interp_.get_builtin(qn);
+		if (bn.is_empty() || bn.is_recursive() != (type == BUILTIN_R)) {
+		    return false;
+		}
+		cp = code_point(qn.second, bn.fn(), bn.is_recursive());
+	    }
+	    num_symbols++;
+	} else if (!visit(instr, term_fn, cp_fn)) {
+	    return false;
+	}
+	offset += instr->size();
+    }
+    return num_symbols == img.symbols.size();
+}
+
+void wam_code_cache::install(predicate_image &img)
+{
+    size_t size = img.code.size();
+    interp_.reserve(size);
+    size_t first_offset = interp_.next_offset();
+    auto *first = reinterpret_cast<code_t *>(interp_.to_code(first_offset));
+
+    auto cp_fn = [&](code_point &cp) {
+	if (cp.has_wam_code()) {
+	    auto offset = reinterpret_cast<uintptr_t>(cp.wam_code());
+	    cp.set_wam_code(reinterpret_cast<wam_instruction_base *>(first + offset));
+	}
+	return true;
+    };
+    auto term_fn = [](term &) { return true; };
+
+    code_t *base = img.code.data();
+    for (size_t offset = 0; offset < size;) {
+	auto *instr = reinterpret_cast<wam_instruction_base *>(base + offset);
+	visit(instr, term_fn, cp_fn);
+	interp_.add(*instr);
+	offset += instr->size();
+    }
+
+    // Link the calls (as load_code does)
+    std::unordered_map<size_t, size_t> no_labels;
+    for (auto &sym : img.symbols) {
+	auto *instr = interp_.to_code(first_offset + sym.offset);
+	if (instr->type() == CALL || instr->type() == EXECUTE) {
+	    auto &cp = static_cast<wam_instruction_code_point *>(instr)->cp();
+	    interp_.bind_code_point(no_labels, cp);
+	}
+    }
+
+    interp_.install_code(img.qn, first_offset, img.num_x, img.num_y);
+    interp_.clear_updated_predicate(img.qn);
+}
+
+bool wam_code_cache::load(const std::string &path, uint64_t key)
+{
+    std::ifstream in(path, std::ios::binary);
+    if (!in) {
+	return false;
+    }
+    std::string data((std::istreambuf_iterator<char>(in)),
+		     std::istreambuf_iterator<char>());
+    file_reader r(data);
+
+    uint32_t magic, version;
+    uint64_t fingerprint, file_key;
+    if (!r.read(magic) || !r.read(version) || !r.read(fingerprint) ||
+	!r.read(file_key) || magic != MAGIC || version != VERSION ||
+	fingerprint != code_fingerprint() || file_key != key) {
+	return false;
+    }
+
+    atoms_.clear();
+    atom_names_.clear();
+    uint32_t num_atoms;
+    if (!r.read(num_atoms)) {
+	return false;
+    }
+    for (uint32_t i = 0; i < num_atoms; i++) {
+	uint32_t n;
+	std::string name;
+	if (!r.read(n) || !r.read(name, n)) {
+	    return false;
+	}
+	atom_names_.push_back(name);
+    }
+
+    uint32_t num_preds;
+    if (!r.read(num_preds)) {
+	return false;
+    }
+    // (The counts aren't trusted for allocating, so what is read is
+    // added one by one.)
+    std::vector<predicate_image> images;
+    for (uint32_t i = 0; i < num_preds; i++) {
+	predicate_image img;
+	term m, f;
+	uint32_t size, num_symbols;
+	if (!r.read(m) || !r.read(f) || !r.read(img.num_x) ||
+	    !r.read(img.num_y) || !r.read(size) || !r.read(num_symbols)) {
+	    return false;
+	}
+	img.qn = qname(static_cast<const common::con_cell &>(m),
+		       static_cast<const common::con_cell &>(f));
+	for (uint32_t j = 0; j < num_symbols; j++) {
+	    symbol sym;
+	    if (!r.read(sym.offset) || !r.read(m) || !r.read(f)) {
+		return false;
+	    }
+	    sym.qn = qname(static_cast<const common::con_cell &>(m),
+			   static_cast<const common::con_cell &>(f));
+	    img.symbols.push_back(sym);
+	}
+	if (!r.read(img.code, size) || !load_image(img)) {
+	    return false;
+	}
+	images.push_back(std::move(img));
+    }
+    if (!r.at_end()) {
+	return false;
+    }
+
+    for (auto &img : images) {
+	if (!interp_.is_compiled(img.qn) && !interp_.is_tabled(img.qn)) {
+	    install(img);
+	}
+    }
+    return true;
+}
+
+}}
@@ -0,0 +1,111 @@
+#pragma once
+
+#ifndef _interp_wam_code_cache_hpp
+#define _interp_wam_code_cache_hpp
+
+#include <string>
+#include <vector>
+#include "wam_interpreter.hpp"
+
+namespace prologcoin { namespace interp {
+
+//
+// Compiled predicates saved to a file (a .wam object file) and loaded
+// back, so an interpreter can skip compiling code that hasn't changed
+// (e.g. the standard library, see interpreter::setup_standard_lib.)
+//
+// The code of a predicate is saved as it is in the code area, except
+// for what depends on the process or the interpreter (load undoes it):
+//
+//   - The handler of an instruction (it's given by the type.)
+//   - Atoms that aren't stored in the cell itself (see
+//     con_cell::is_direct) have an index into the atoms of the file.
+//   - Code points within the predicate are offsets from its start.
+//   - Calls and built-ins get an empty code point. They are listed
+//     by name (as symbols) instead.
+//
+// The switch tables are laid out again when loaded, as the order of
+// their keys depends on the atoms.
+//
+// A file is only loaded if its version, the code fingerprint and the
+// key match (see code_fingerprint and source_key.) The code is then
+// checked before anything is installed: instruction types and sizes,
+// registers, switch tables, and code points (which must be
+// instructions of the same predicate.) Predicates whose code refers
+// to the heap (e.g. bignum constants) aren't saved, so they are
+// compiled as usual.
+//
+// Format (in native byte order):
+//
+//   magic, version                                 2 x uint32
+//   fingerprint, key                               2 x uint64
+//   number of atoms, then their names              uint32, (uint32, bytes)*
+//   number of predicates, then for each:
+//     module, name                                 2 x cell
+//     num_x, num_y, code size, number of symbols   4 x uint32
+//     symbols (offset of instruction, qname)       (uint32, 2 x cell)*
+//     code                                         code size x code_t
+//
+class wam_code_cache {
+    using term = common::term;
+
+public:
+    static const uint32_t MAGIC = 0x434d4157; // "WAMC"
+    static const uint32_t VERSION = 2;
+
+    wam_code_cache(wam_interpreter &interp);
+
+    // A hash of the instruction layout (the type and size of every
+    // instruction, code points and cells) and the code generator
+    // version (wam_compiler::CODEGEN_VERSION.)
+    static uint64_t code_fingerprint();
+
+    // A hash of the clauses of the predicates and of the built-ins
+    // (as they decide what code we get.) Atoms are hashed by name and
+    // variables by their order, so it's the same in every interpreter.
+    uint64_t source_key(const std::vector<qname> &preds);
+
+    // Save the compiled predicates among preds. Returns false if the
+    // file couldn't be written.
+    bool save(const std::string &path, uint64_t key,
+	      const std::vector<qname> &preds);
+
+    // Install the predicates of the file (unless they are already
+    // compiled.) Returns false, and installs nothing, if there's no
+    // file or if it doesn't match.
+    bool load(const std::string &path, uint64_t key);
+
+private:
+    struct symbol {
+	uint32_t offset;
+	qname qn;
+    };
+
+    struct predicate_image {
+	qname qn;
+	uint32_t num_x;
+	uint32_t num_y;
+	std::vector<symbol> symbols;
+	std::vector<code_t> code;
+    };
+
+    bool save_image(const qname &qn, predicate_image &img);
+    bool load_image(predicate_image &img);
+    void install(predicate_image &img);
+
+    bool find_builtin(common::con_cell f, builtin_fn fn, qname &qn);
+
+    // Atoms in the code to and from the atoms of the file
+    bool to_file(term &t);
+    bool from_file(term &t);
+    bool to_file(qname &qn);
+    bool from_file(qname &qn);
+
+    wam_interpreter &interp_;
+    std::unordered_map<size_t, uint32_t> atoms_;
+    std::vector<std::string> atom_names_;
+};
+
+}}
+
+#endif
@@ -1,5 +1,6 @@
 #include <queue>
 #include <algorithm>
+#include <numeric>
 #include "wam_compiler.hpp"
 #include "wam_interpreter.hpp"
 
@@ -1294,13 +1295,45 @@ void wam_compiler::compile_builtin(common::con_cell module,
 		} else {
 		    seq.push_back(wam_instruction<CUT>(0));
 		}
-	    } else {
+	    } else if (!compile_inline_builtin(bn.fn(), seq)) {
 		seq.push_back(wam_instruction<BUILTIN>(module, f, bn.fn()));
 	    }
 	}
     }
 }
 
+// The common type tests and comparisons have their own instructions
+// (the arguments are already in the A registers.)
+bool wam_compiler::compile_inline_builtin(builtin_fn fn, wam_interim_code &seq)
+{
+    if (fn == builtins::var_1) {
+	seq.push_back(wam_instruction<TEST_VAR>(0));
+    } else if (fn == builtins::nonvar_1) {
+	seq.push_back(wam_instruction<TEST_NONVAR>(0));
+    } else if (fn == builtins::atom_1) {
+	seq.push_back(wam_instruction<TEST_ATOM>(0));
+    } else if (fn == builtins::atomic_1) {
+	seq.push_back(wam_instruction<TEST_ATOMIC>(0));
+    } else if (fn == builtins::integer_1) {
+	seq.push_back(wam_instruction<TEST_INTEGER>(0));
+    } else if (fn == builtins::number_1) {
+	seq.push_back(wam_instruction<TEST_NUMBER>(0));
+    } else if (fn == builtins::compound_1) {
+	seq.push_back(wam_instruction<TEST_COMPOUND>(0));
+    } else if (fn == builtins::callable_1) {
+	seq.push_back(wam_instruction<TEST_CALLABLE>(0));
+    } else if (fn == builtins::operator_equals) {
+	seq.push_back(wam_instruction<TEST_EQ>(0, 1));
+    } else if (fn == builtins::operator_not_equals) {
+	seq.push_back(wam_instruction<TEST_NE>(0, 1));
+    } else if (fn == builtins::functor_3) {
+	seq.push_back(wam_instruction<FUNCTOR>());
+    } else {
+	return false;
+    }
+    return true;
+}
+
 bool wam_compiler::is_if_then_else(const term goal)
 {
     static const common::con_cell bn_impl = common::con_cell("->",2);
@@ -1495,6 +1528,9 @@ void wam_compiler::compile_goal(const term goal, bool first_goal,
 	f = env_.functor(env_.arg(goal, 1));
     }
     bool isbn = is_builtin(module, f);
+    if (isbn && f != colon && compile_arith(module, f, goal, seq)) {
+	return;
+    }
     compile_query_or_program(goal, COMPILE_QUERY, seq);
     if (isbn) {
 	compile_builtin(module, f, first_goal, seq);
@@ -1503,6 +1539,144 @@ void wam_compiler::compile_goal(const term goal, bool first_goal,
     }
 }
 
+//
+// Arithmetics is compiled when the expressions are made of integers,
+// variables and the functions below. Expressions are evaluated in A
+// registers: k, k+1, ... (they are free as the goal is a builtin.)
+//
+wam_instruction_type wam_compiler::arith_op(common::con_cell f)
+{
+    static const common::con_cell op_add("+",2), op_sub("-",2),
+	op_mul("*",2), op_idiv("//",2), op_mod("mod",2), op_shl("<<",2),
+	op_shr(">>",2);
+
+    if (f == op_add) return ARITH_ADD;
+    if (f == op_sub) return ARITH_SUB;
+    if (f == op_mul) return ARITH_MUL;
+    if (f == op_idiv) return ARITH_IDIV;
+    if (f == op_mod) return ARITH_MOD;
+    if (f == op_shl) return ARITH_SHL;
+    if (f == op_shr) return ARITH_SHR;
+    return LAST;
+}
+
+bool wam_compiler::is_arith_expr(const term expr, size_t k)
+{
+    if (k + 1 >= interpreter_base::MAX_ARGS) {
+	return false;
+    }
+    switch (expr.tag()) {
+    case common::tag_t::REF:
+    case common::tag_t::INT:
+    case common::tag_t::BIG:
+	return true;
+    case common::tag_t::STR: {
+	auto f = env_.functor(expr);
+	if (arith_op(f) == LAST) {
+	    return false;
+	}
+	return is_arith_expr(env_.arg(expr, 0), k) &&
+	       is_arith_expr(env_.arg(expr, 1), k + 1);
+    }
+    default:
+	return false;
+    }
+}
+
+void wam_compiler::compile_arith_expr(const term expr, size_t k,
+				      wam_interim_code &seq)
+{
+    switch (expr.tag()) {
+    case common::tag_t::REF:
+	compile_query_ref(reg(k, A_REG),
+			  static_cast<const common::ref_cell &>(expr), seq);
+	break;
+    case common::tag_t::INT:
+    case common::tag_t::BIG:
+	seq.push_back(wam_instruction<PUT_CONSTANT>(expr, k));
+	break;
+    default: {
+	compile_arith_expr(env_.arg(expr, 0), k, seq);
+	compile_arith_expr(env_.arg(expr, 1), k + 1, seq);
+	switch (arith_op(env_.functor(expr))) {
+	case ARITH_ADD: seq.push_back(wam_instruction<ARITH_ADD>(k, k+1)); break;
+	case ARITH_SUB: seq.push_back(wam_instruction<ARITH_SUB>(k, k+1)); break;
+	case ARITH_MUL: seq.push_back(wam_instruction<ARITH_MUL>(k, k+1)); break;
+	case ARITH_IDIV: seq.push_back(wam_instruction<ARITH_IDIV>(k, k+1)); break;
+	case ARITH_MOD: seq.push_back(wam_instruction<ARITH_MOD>(k, k+1)); break;
+	case ARITH_SHL: seq.push_back(wam_instruction<ARITH_SHL>(k, k+1)); break;
+	case ARITH_SHR: seq.push_back(wam_instruction<ARITH_SHR>(k, k+1)); break;
+	default: assert(false); break;
+	}
+	break;
+        }
+    }
+}
+
+bool wam_compiler::compile_arith(common::con_cell module, common::con_cell f,
+				 const term goal, wam_interim_code &seq)
+{
+    if (f.arity() != 2) {
+	return false;
+    }
+    auto fn = get_builtin(module, f).fn();
+    term lhs = env_.arg(goal, 0);
+    term rhs = env_.arg(goal, 1);
+
+    if (fn == builtins::is_2) {
+	// X is Y is left to the builtin (Y can be any expression)
+	if (rhs.tag() != common::tag_t::STR || !is_arith_expr(rhs, 0)) {
+	    return false;
+	}
+	switch (lhs.tag()) {
+	case common::tag_t::REF:
+	    compile_arith_expr(rhs, 0, seq);
+	    compile_program_ref(reg(0, A_REG),
+				static_cast<const common::ref_cell &>(lhs), seq);
+	    return true;
+	case common::tag_t::INT:
+	case common::tag_t::BIG:
+	    compile_arith_expr(rhs, 0, seq);
+	    seq.push_back(wam_instruction<GET_CONSTANT>(lhs, 0));
+	    return true;
+	default:
+	    return false;
+	}
+    }
+
+    // A > B is B < A, and A >= B is B =< A
+    wam_instruction_type op;
+    if (fn == builtins::operator_less_than) {
+	op = ARITH_LT;
+    } else if (fn == builtins::operator_greater_than) {
+	op = ARITH_LT;
+	std::swap(lhs, rhs);
+    } else if (fn == builtins::operator_equals_less_than) {
+	op = ARITH_LE;
+    } else if (fn == builtins::operator_greater_than_equals) {
+	op = ARITH_LE;
+	std::swap(lhs, rhs);
+    } else if (fn == builtins::operator_arith_equals) {
+	op = ARITH_EQ;
+    } else if (fn == builtins::operator_arith_not_equals) {
+	op = ARITH_NE;
+    } else {
+	return false;
+    }
+    if (!is_arith_expr(lhs, 0) || !is_arith_expr(rhs, 1)) {
+	return false;
+    }
+    compile_arith_expr(lhs, 0, seq);
+    compile_arith_expr(rhs, 1, seq);
+    switch (op) {
+    case ARITH_LT: seq.push_back(wam_instruction<ARITH_LT>(0, 1)); break;
+    case ARITH_LE: seq.push_back(wam_instruction<ARITH_LE>(0, 1)); break;
+    case ARITH_EQ: seq.push_back(wam_instruction<ARITH_EQ>(0, 1)); break;
+    default: seq.push_back(wam_instruction<ARITH_NE>(0, 1)); break;
+    }
+    return true;
+}
+
 void wam_compiler::peephole_opt_execute(wam_interim_code &seq)
 {
     auto it = seq.begin();
@@ -1554,6 +1728,53 @@ void wam_compiler::peephole_opt_execute(wam_interim_code &seq)
     }
 }
 
+//
+// Superinstructions for the sequences that dominate list recursion
+// (e.g. in nrev and queens):
+//
+//   get_list ai + unify_variable xn1 + unify_variable xn2
+//   put_value xn1, ai1 + put_value xn2, ai2
+//
+// This is the last pass, so the other passes only see the basic
+// instructions.
+//
+void wam_compiler::fuse_instructions(wam_interim_code &seq)
+{
+    auto it = seq.begin();
+
+    while (it != seq.end()) {
+	auto it_0 = it; ++it_0;
+	auto it_1 = it_0; if (it_1 != seq.end()) ++it_1;
+	auto it_2 = it_1; if (it_2 != seq.end()) ++it_2;
+
+	if (seq.is_at_type(it_0, GET_LIST_A) &&
+	    seq.is_at_type(it_1, UNIFY_VARIABLE_X) &&
+	    seq.is_at_type(it_2, UNIFY_VARIABLE_X)) {
+	    auto it_3 = it_2; ++it_3;
+	    auto ai = reinterpret_cast<wam_instruction<GET_LIST_A> *>(*it_0)->ai();
+	    auto xn1 = reinterpret_cast<wam_instruction<UNIFY_VARIABLE_X> *>(*it_1)->xn();
+	    auto xn2 = reinterpret_cast<wam_instruction<UNIFY_VARIABLE_X> *>(*it_2)->xn();
+	    delete *it_0;
+	    delete *it_1;
+	    delete *it_2;
+	    seq.erase_after(it, it_3);
+	    it = seq.insert_after(it, wam_instruction<GET_LIST_A_UV2>(ai, xn1, xn2));
+	} else if (seq.is_at_type(it_0, PUT_VALUE_X) &&
+		   seq.is_at_type(it_1, PUT_VALUE_X)) {
+	    auto *put1 = reinterpret_cast<wam_instruction<PUT_VALUE_X> *>(*it_0);
+	    auto *put2 = reinterpret_cast<wam_instruction<PUT_VALUE_X> *>(*it_1);
+	    wam_instruction<PUT_VALUE_X2> fused(put1->xn(), put1->ai(),
+						put2->xn(), put2->ai());
+	    delete *it_0;
+	    delete *it_1;
+	    seq.erase_after(it, it_2);
+	    it = seq.insert_after(it, fused);
+	} else {
+	    ++it;
+	}
+    }
+}
+
 void wam_compiler::peephole_opt_void(wam_interim_code &instrs)
 {
     // Find singleton occurrences
@@ -1748,7 +1969,26 @@ void wam_compiler::compile_clause(const managed_clause &m_clause,
     // (inside compile_query_or_program) touches the vars as it
     // unfolds the inner terms.
 
-    term clause = interp_.copy(clause0);
+    // BIG constants go into the code as they are. Share them with the
+    // stored clause, so the code doesn't refer to heap cells that
+    // backtracking may discard (we can get compiled in the middle
+    // of a query.)
+    std::unordered_map<term, term> bigs;
+    std::vector<term> todo{clause0};
+    while (!todo.empty()) {
+	term t = env_.deref(todo.back());
+	todo.pop_back();
+	if (t.tag() == common::tag_t::BIG) {
+	    bigs[t] = t;
+	} else if (t.tag() == common::tag_t::STR) {
+	    size_t n = env_.functor(t).arity();
+	    for (size_t i = 0; i < n; i++) {
+		todo.push_back(env_.arg(t, i));
+	    }
+	}
+    }
+
+    term clause = interp_.copy(clause0, bigs);
 
     seq.push_back(wam_instruction<COST>(m_clause.cost()));
 
@@ -1848,7 +2088,11 @@ void wam_compiler::emit_switch_on_term(const managed_clauses &subsection,
 	       const std::vector<common::int_cell> &labels,
 	       wam_interim_code &instrs)
 {
-    auto on_var_cp = code_point(labels[0]);
+    std::vector<size_t> all(subsection.size());
+    std::iota(all.begin(), all.end(), 0);
+    bool index_var = find_index_arg(subsection, all, {0}) != 0;
+    auto on_var_cp = index_var ? code_point(new_label())
+	                       : code_point(labels[0]);
 
     auto on_con = find_clauses_on_cat(subsection, FIRST_CON);
     auto on_con_cp = on_con.empty() ? code_point::fail() 
@@ -1870,6 +2114,13 @@ void wam_compiler::emit_switch_on_term(const managed_clauses &subsection,
     emit_second_level_indexing(FIRST_CON,subsection,labels,on_con,on_con_cp,instrs);
     emit_second_level_indexing(FIRST_LST,subsection,labels,on_lst,on_lst_cp,instrs);
     emit_second_level_indexing(FIRST_STR,subsection,labels,on_str,on_str_cp,instrs);
+
+    // First argument is unbound, but maybe some other isn't
+    if (index_var) {
+	const common::int_cell &lbl = static_cast<const common::int_cell &>(on_var_cp.term_code());
+	instrs.push_back(wam_interim_instruction<INTERIM_LABEL>(lbl));
+	emit_arg_indexing(subsection, all, labels, {0}, code_point(labels[0]), instrs);
+    }
 }
 
 void wam_compiler::emit_third_level_indexing(
@@ -1886,6 +2137,126 @@ void wam_compiler::emit_third_level_indexing(
     }
 }
 
+common::cell wam_compiler::arg_index_key(const term clause, size_t pos)
+{
+    auto arg = env_.deref(env_.arg(clause_head(clause), pos));
+    switch (arg.tag()) {
+    case common::tag_t::CON: return arg;
+    case common::tag_t::INT: return arg;
+    case common::tag_t::STR: return env_.functor(arg);
+    default: return term(); // We don't index on variables or BIGs
+    }
+}
+
+//
+// Find the argument (other than those already used) that best splits
+// up the clauses. All clauses must have it instantiated, so there's no
+// clause order to preserve between the groups. Returns 0 if there's
+// none.
+//
+size_t wam_compiler::find_index_arg(const managed_clauses &subsection,
+				    const std::vector<size_t> &clause_indices,
+				    const std::vector<size_t> &used)
+{
+    size_t arity = env_.functor(clause_head(subsection[0].clause())).arity();
+    size_t best = 0, best_num_keys = 1;
+    for (size_t pos = 1; pos < arity; pos++) {
+	if (std::find(used.begin(), used.end(), pos) != used.end()) {
+	    continue;
+	}
+	std::unordered_set<term> keys;
+	for (auto ci : clause_indices) {
+	    auto key = arg_index_key(subsection[ci].clause(), pos);
+	    if (key == term()) {
+		keys.clear();
+		break;
+	    }
+	    keys.insert(key);
+	}
+	if (keys.size() > best_num_keys) {
+	    best = pos;
+	    best_num_keys = keys.size();
+	}
+    }
+    return best;
+}
+
+//
+// Emit switch_on_arg for the best argument and recursively do the same
+// for clauses that share the key. If the argument is unbound we try the
+// next best argument and eventually go to 'on_var' or, if that's a
+// failure, a try-chain of all the clauses.
+// Returns false if there was no argument to index on.
+//
+bool wam_compiler::emit_arg_indexing(const managed_clauses &subsection,
+				     const std::vector<size_t> &clause_indices,
+				     const std::vector<common::int_cell> &labels,
+				     std::vector<size_t> used,
+				     code_point on_var,
+				     wam_interim_code &instrs)
+{
+    size_t pos = find_index_arg(subsection, clause_indices, used);
+    if (pos == 0) {
+	return false;
+    }
+    used.push_back(pos);
+
+    // If unbound, there might be yet another argument to try
+    code_point on_var_next = on_var;
+    bool var_index = find_index_arg(subsection, clause_indices, used) != 0;
+    bool var_chain = !var_index && on_var.is_fail();
+    if (var_index || var_chain) {
+	on_var = code_point(new_label());
+    }
+
+    wam_hash_map map;
+    std::vector<term> order;
+    std::unordered_map<term, std::vector<size_t> > groups;
+    for (auto ci : clause_indices) {
+	auto key = arg_index_key(subsection[ci].clause(), pos);
+	auto &group = groups[key];
+	if (group.empty()) {
+	    order.push_back(key);
+	}
+	group.push_back(ci);
+    }
+    wam_instruction_switch_table::entries_t entries;
+    for (auto key : order) {
+	auto &group = groups[key];
+	if (group.size() == 1) {
+	    entries.push_back(std::make_pair(key, code_point(labels[2*group[0]+1])));
+	} else {
+	    entries.push_back(std::make_pair(key, code_point(new_label())));
+	}
+	map.insert(entries.back());
+    }
+    instrs.push_back(wam_instruction_switch_table::new_switch<wam_instruction<SWITCH_ON_ARG> >(entries, pos, on_var));
+
+    if (var_index || var_chain) {
+	const common::int_cell &lbl = static_cast<const common::int_cell &>(on_var.term_code());
+	instrs.push_back(wam_interim_instruction<INTERIM_LABEL>(lbl));
+	if (var_index) {
+	    emit_arg_indexing(subsection, clause_indices, labels, used,
+			      on_var_next, instrs);
+	} else {
+	    emit_third_level_indexing(clause_indices, labels, instrs);
+	}
+    }
+    for (auto key : order) {
+	auto &group = groups[key];
+	if (group.size() > 1) {
+	    auto &cp = map[key];
+	    const common::int_cell &lbl = static_cast<const common::int_cell &>(cp.term_code());
+	    instrs.push_back(wam_interim_instruction<INTERIM_LABEL>(lbl));
+	    if (!emit_arg_indexing(subsection, group, labels, used,
+				   code_point::fail(), instrs)) {
+		emit_third_level_indexing(group, labels, instrs);
+	    }
+	}
+    }
+    return true;
+}
+
 void wam_compiler::emit_second_level_indexing(
 	      wam_compiler::first_arg_cat_t cat,
 	      const managed_clauses &subsection,
@@ -1901,53 +2272,51 @@ void wam_compiler::emit_second_level_indexing(
     const common::int_cell &ic = static_cast<const common::int_cell &>(cp.term_code());
     instrs.push_back(wam_interim_instruction<INTERIM_LABEL>(ic));
 
-    auto *map = interp_.new_hash_map();
-    std::vector<term> for_third_arg;
-    std::vector<std::vector<size_t> > for_third_indices;
+    // Group the clauses on their first argument (in order of appearance)
+    std::vector<term> order;
+    std::unordered_map<term, std::vector<size_t> > groups;
     for (auto clause_index : clause_indices) {
-	common::int_cell new_lbl(0);
-	auto &m_clause = subsection[clause_index];
-
-	auto arg0 = first_arg(m_clause.clause());
-
-	// Already managed?
-	if (map->count(arg0)) {
-	    continue;
+	auto arg0 = first_arg(subsection[clause_index].clause());
+	auto &group = groups[arg0];
+	if (group.empty()) {
+	    order.push_back(arg0);
 	}
+	group.push_back(clause_index);
+    }
 
-	// Get all clauses with the same arg
-	std::vector<size_t> same_arg0;
-	for (auto ci : clause_indices) {
-	    auto &other_m_clause = subsection[ci];
-	    auto other_arg0 = first_arg(other_m_clause.clause());
-	    if (arg0 == other_arg0) {
-		same_arg0.push_back(ci);
-	    }
-	}
+    wam_hash_map map;
+    wam_instruction_switch_table::entries_t entries;
+    std::vector<term> for_third_arg;
+    std::vector<std::vector<size_t> > for_third_indices;
+    for (auto arg0 : order) {
+	auto &same_arg0 = groups[arg0];
 	if (same_arg0.size() == 1) {
 	    // Unique? Then direct jump
-	    map->insert(std::make_pair(arg0, code_point(labels[2*same_arg0[0]+1])));
+	    entries.push_back(std::make_pair(arg0, code_point(labels[2*same_arg0[0]+1])));
 	} else {
 	    // Multiple, so create third level indexing
-	    new_lbl = new_label();
-	    map->insert(std::make_pair(arg0, code_point(new_lbl)));
+	    entries.push_back(std::make_pair(arg0, code_point(new_label())));
 	    for_third_arg.push_back(arg0);
 	    for_third_indices.push_back(same_arg0);
 	}
+	map.insert(entries.back());
     }
     switch (cat) {
-    case FIRST_CON: instrs.push_back(wam_instruction<SWITCH_ON_CONSTANT>(map)); break;
-    case FIRST_STR: instrs.push_back(wam_instruction<SWITCH_ON_STRUCTURE>(map)); break;
+    case FIRST_CON: instrs.push_back(wam_instruction_switch_table::new_switch<wam_instruction<SWITCH_ON_CONSTANT> >(entries)); break;
+    case FIRST_STR: instrs.push_back(wam_instruction_switch_table::new_switch<wam_instruction<SWITCH_ON_STRUCTURE> >(entries)); break;
     default: break;
     }
     size_t n = for_third_arg.size();
     for (size_t i = 0; i < n; i++) {
 	auto arg = for_third_arg[i];
 	auto &clause_indices = for_third_indices[i];
-	auto &cp = (*map)[arg];
+	auto &cp = map[arg];
 	const common::int_cell &lbl = static_cast<const common::int_cell &>(cp.term_code());
 	instrs.push_back(wam_interim_instruction<INTERIM_LABEL>(lbl));
-	emit_third_level_indexing(clause_indices, labels, instrs);
+	if (!emit_arg_indexing(subsection, clause_indices, labels, {0},
+			       code_point::fail(), instrs)) {
+	    emit_third_level_indexing(clause_indices, labels, instrs);
+	}
     }
 }
 
@@ -1957,7 +2326,11 @@ void wam_compiler::compile_subsection(const managed_clauses &subsection,
     auto n = subsection.size();
     if (n > 1) {
         std::vector<common::int_cell> labels = new_labels(2*n);
-	emit_switch_on_term(subsection, labels, instrs);
+	// There's no first argument to switch on for atoms
+	auto head = clause_head(subsection[0].clause());
+	if (env_.functor(head).arity() > 0) {
+	    emit_switch_on_term(subsection, labels, instrs);
+	}
 	for (size_t i = 0; i < n; i++) {
 	    emit_cp(labels, i, n, instrs);
 	    auto &m_clause = subsection[i];
@@ -1975,12 +2348,25 @@ void wam_compiler::compile_subsection(const managed_clauses &subsection,
 
 void wam_compiler::compile_predicate(const qname &qn, wam_interim_code &instrs)
 {
-    auto &clauses = interp_.get_predicate(qn);
+    auto &stored = interp_.get_predicate(qn);
 
-    if (clauses.empty()) {
+    if (stored.empty()) {
 	return;
     }
 
+    // Asserted clauses are on the clause heap, so copies of them are
+    // compiled (see wam_interpreter::compile.)
+    managed_clauses clauses;
+    for (auto &m_clause : stored) {
+	if (m_clause.is_asserted()) {
+	    term cl = interp_.copy(m_clause.clause(),
+				   interp_.clause_env(m_clause));
+	    clauses.push_back(managed_clause(cl, m_clause.cost()));
+	} else {
+	    clauses.push_back(m_clause);
+	}
+    }
+
     auto sections = partition_clauses_nonvar(clauses);
     auto n = sections.size();
     if (n > 1) {
@@ -1992,6 +2378,7 @@ void wam_compiler::compile_predicate(const qname &qn, wam_interim_code &instrs)
     } else {
         compile_subsection(sections[0], instrs);
     }
+    fuse_instructions(instrs);
 }
 
 term wam_compiler::clause_head(const term clause)
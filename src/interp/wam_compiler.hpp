@@ -89,18 +89,10 @@ public:
     static inline void init() {
 	static bool init = [] {
 	    register_printer(&invoke, &print);
-	    register_updater(&invoke, &updater);
 	    return true; } ();
 	static_cast<void>(init);
     }
 
-    inline void update(code_t *old_base, code_t *new_base)
-    {
-	for (auto &p : *from_) {
-	    update_ptr(p, old_base, new_base);
-	}
-    }
-
     static void invoke(wam_interpreter &interp, wam_instruction_base *self)
     {
         assert("this instruction should never be executed." == nullptr);
@@ -120,12 +112,6 @@ public:
 	out << "]";
     }
 
-    static void updater(wam_instruction_base *self, code_t *old_base, code_t *new_base)
-    {
-	auto self1 = reinterpret_cast<wam_interim_instruction<INTERIM_MERGE> *>(self);
-	self1->update(old_base, new_base);
-    }
-
     const std::vector<code_point> & sources() const {
 	return *from_;
     }
@@ -259,9 +245,11 @@ public:
         return size_;
     }
 
-private:
+    // Takes an instruction allocated with new char[] (see
+    // wam_instruction_switch_table::new_switch)
     void push_back(wam_instruction_base *instr);
 
+private:
     wam_interpreter &interp_;
     std::forward_list<wam_instruction_base *>::iterator end_;
     size_t size_;
@@ -309,6 +297,11 @@ class wam_compiler {
 public:
     typedef common::term term;
 
+    // Bump this whenever the generated code changes (e.g. peephole
+    // rules, fused instructions or switch tables), so code compiled
+    // by an older version isn't loaded (see wam_code_cache.)
+    static const uint32_t CODEGEN_VERSION = 1;
+
     wam_compiler(wam_interpreter &interp)
         : interp_(interp), env_(interp), regs_a_(A_REG), regs_x_(X_REG), regs_y_(Y_REG), label_count_(1), goal_count_(0), level_count_(0), current_module_(common::con_cell("[]",0)) { }
 
@@ -460,6 +453,7 @@ private:
 			 common::con_cell f,
 			 bool first_goal,
 			 wam_interim_code &seq);
+    bool compile_inline_builtin(builtin_fn fn, wam_interim_code &seq);
 
 
     void compile_query_or_program(term t, compile_type c,
@@ -492,8 +486,14 @@ private:
     void compile_if_then_else(const term disj, wam_interim_code &code);
     void compile_disjunction(const term disj, wam_interim_code &code);
     void compile_goal(const term goal, bool first_goal, wam_interim_code &seq);
+    wam_instruction_type arith_op(common::con_cell f);
+    bool is_arith_expr(const term expr, size_t k);
+    void compile_arith_expr(const term expr, size_t k, wam_interim_code &seq);
+    bool compile_arith(common::con_cell module, common::con_cell f,
+		       const term goal, wam_interim_code &seq);
     void peephole_opt_execute(wam_interim_code &seq);
     void peephole_opt_void(wam_interim_code &instr);
+    void fuse_instructions(wam_interim_code &seq);
     void reset_clause_temps();
     bool is_relevant_varset_op(const term t);
     void compute_var_indices(const term t);
@@ -573,6 +573,16 @@ private:
 	     const std::vector<size_t> &clause_indices,
 	     const std::vector<common::int_cell> &labels,
 	     wam_interim_code &instrs);
+    common::cell arg_index_key(const term clause, size_t pos);
+    size_t find_index_arg(const managed_clauses &subsection,
+			  const std::vector<size_t> &clause_indices,
+			  const std::vector<size_t> &used);
+    bool emit_arg_indexing(const managed_clauses &subsection,
+			   const std::vector<size_t> &clause_indices,
+			   const std::vector<common::int_cell> &labels,
+			   std::vector<size_t> used,
+			   code_point on_var,
+			   wam_interim_code &instrs);
 
     void print_partition(std::ostream &out,
 			 const std::vector<managed_clauses> &partition);
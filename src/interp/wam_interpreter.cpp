@@ -1,62 +1,209 @@
 #include "wam_interpreter.hpp"
 #include "wam_compiler.hpp"
+#include "wam_jit.hpp"
+#include <algorithm>
 
 namespace prologcoin { namespace interp {
 
 std::unordered_map<wam_instruction_base::fn_type, wam_instruction_base::print_fn_type> wam_instruction_base::print_fns_;
-std::unordered_map<wam_instruction_base::fn_type, wam_instruction_base::updater_fn_type> wam_instruction_base::updater_fns_;
+
+const common::ref_cell wam_instruction_switch_table::EMPTY_KEY(0);
+
+void wam_instruction_switch_table::fill(size_t offset, size_t slots,
+					const entries_t &entries)
+{
+    size_t n = entries.size();
+    layout_ = n <= MAX_LINEAR ? LINEAR : (n <= MAX_SORTED ? SORTED : HASHED);
+    num_keys_ = static_cast<uint32_t>(n);
+    num_slots_ = static_cast<uint32_t>(slots);
+    table_offset_ = static_cast<uint32_t>(offset);
+    hash_shift_ = 64;
+    for (size_t s = slots; s > 1; s /= 2) {
+	hash_shift_--;
+    }
+
+    auto *ks = const_cast<common::term *>(keys());
+    auto *vs = values();
+    for (size_t i = 0; i < slots; i++) {
+	new (&ks[i]) common::term(EMPTY_KEY);
+	new (&vs[i]) code_point();
+    }
+
+    switch (layout()) {
+    case LINEAR:
+	for (size_t i = 0; i < n; i++) {
+	    ks[i] = entries[i].first;
+	    vs[i] = entries[i].second;
+	}
+	break;
+    case SORTED: {
+	std::vector<size_t> order(n);
+	for (size_t i = 0; i < n; i++) {
+	    order[i] = i;
+	}
+	std::sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+		return entries[a].first.raw_value() < entries[b].first.raw_value(); });
+	for (size_t i = 0; i < n; i++) {
+	    ks[i] = entries[order[i]].first;
+	    vs[i] = entries[order[i]].second;
+	}
+	break;
+	}
+    case HASHED:
+	for (auto &e : entries) {
+	    size_t i = hash_slot(e.first);
+	    while (ks[i] != EMPTY_KEY) {
+		i = (i + 1) & (slots - 1);
+	    }
+	    ks[i] = e.first;
+	    vs[i] = e.second;
+	}
+	break;
+    }
+}
+
+wam_instruction_switch_table::entries_t wam_instruction_switch_table::entries() const
+{
+    entries_t es;
+    for (size_t i = 0; i < num_slots(); i++) {
+	if (!is_empty_slot(i)) {
+	    es.push_back(std::make_pair(keys()[i], values()[i]));
+	}
+    }
+    return es;
+}
+
+wam_code::wam_code(wam_interpreter &interp, size_t chunk_size)
+    : interp_(interp), chunk_size_(chunk_size), current_(nullptr)
+{
+    new_chunk(chunk_size_);
+}
+
+wam_code::~wam_code()
+{
+    for (auto &entry : chunks_) {
+	delete [] entry.second->instrs;
+	delete entry.second;
+    }
+}
+
+void wam_code::new_chunk(size_t capacity)
+{
+    size_t base = current_ == nullptr ? 0 : current_->base + current_->capacity;
+    auto *ch = new code_chunk();
+    ch->base = base;
+    ch->size = 0;
+    ch->capacity = capacity;
+    ch->removed = 0;
+    ch->instrs = new code_t[capacity];
+    chunks_[base] = ch;
+    chunk_ptrs_[ch->instrs] = ch;
+    current_ = ch;
+}
+
+void wam_code::reserve(size_t sz)
+{
+    if (current_->size + sz > current_->capacity) {
+	new_chunk(std::max(sz, chunk_size_));
+    }
+}
 
 size_t wam_code::add(const wam_instruction_base &i)
 {
-    size_t offset = next_offset();
     size_t sz = i.size();
-    code_t *old_base = instrs_;
     code_t *data = ensure_fit(sz);
-    code_t *new_base = instrs_;
+    size_t offset = to_code_addr(data);
     auto p = reinterpret_cast<wam_instruction_base *>(data);
     memcpy(p, &i, sz*sizeof(code_t));
 
-    if (old_base != new_base) {
-	p->update(old_base, new_base);
-    }
-
     if (i.type() == EXECUTE || i.type() == CALL) {
 	auto *cp_instr = reinterpret_cast<wam_instruction_code_point *>(p);
 	auto module = cp_instr->cp().module();
 	auto f = cp_instr->cp().name();
-	calls_[std::make_pair(module,f)].push_back(offset);
+	auto callee = std::make_pair(module, f);
+	calls_[callee].push_back(offset);
+	loaded_calls_.push_back(callee);
     }
     
     return sz;
 }
 
+void wam_code::remove_compiled(const qname &pn)
+{
+    auto it = predicate_map_.find(pn);
+    if (it == predicate_map_.end()) {
+	return;
+    }
+    auto meta_data = it->second;
+    predicate_map_.erase(pn);
+    predicate_rev_map_.erase(meta_data.code_offset);
+
+    auto &offsets = calls_[pn];
+    for (auto offset : offsets) {
+	auto *cp_instr = reinterpret_cast<wam_instruction_code_point *>(to_code(offset));
+	cp_instr->cp().set_wam_code(nullptr);
+    }
+
+    // Forget the calls made from the removed code
+    size_t from = meta_data.code_offset;
+    size_t to = from + meta_data.code_size;
+    for (auto &callee : callees_[pn]) {
+	auto &offs = calls_[callee];
+	offs.erase(std::remove_if(offs.begin(), offs.end(),
+				  [&](size_t off) {
+				      return off >= from && off < to; }),
+		   offs.end());
+    }
+    callees_.erase(pn);
+
+    find_chunk(from)->removed += meta_data.code_size;
+}
+
+void wam_code::reclaim_code()
+{
+    for (auto it = chunks_.begin(); it != chunks_.end();) {
+	auto *ch = it->second;
+	if (ch != current_ && ch->removed == ch->size) {
+	    chunk_ptrs_.erase(ch->instrs);
+	    delete [] ch->instrs;
+	    delete ch;
+	    it = chunks_.erase(it);
+	} else {
+	    ++it;
+	}
+    }
+}
+
 void wam_code::print_code(std::ostream &out)
 {
     static const common::con_cell default_module("[]",0);
-    for (size_t i = 0; i < instrs_size_;) {
-	if (predicate_rev_map_.count(i)) {
-	    auto name = predicate_rev_map_[i];
-	    if (name.first == default_module) {
-		out << interp_.to_string(name.second);
-	    } else {
-		out << interp_.to_string(name.first) << ":"
-		    << interp_.to_string(name.second);
-	    }
-	    out << "/" << name.second.arity() << ": ";
-	    if (predicate_map_.count(name)) {
-	      auto meta_data = predicate_map_[name];
-	      out << "(num_x=" << meta_data.num_x_registers << ")";
+    for (auto &entry : chunks_) {
+	auto *ch = entry.second;
+	for (size_t i = ch->base; i < ch->base + ch->size;) {
+	    if (predicate_rev_map_.count(i)) {
+		auto name = predicate_rev_map_[i];
+		if (name.first == default_module) {
+		    out << interp_.to_string(name.second);
+		} else {
+		    out << interp_.to_string(name.first) << ":"
+			<< interp_.to_string(name.second);
+		}
+		out << "/" << name.second.arity() << ": ";
+		if (predicate_map_.count(name)) {
+		    auto meta_data = predicate_map_[name];
+		    out << "(num_x=" << meta_data.num_x_registers << ")";
+		}
+		out << std::endl;
 	    }
+
+	    wam_instruction_base *instr
+		= reinterpret_cast<wam_instruction_base *>(&ch->instrs[i - ch->base]);
+	    out << "[" << std::setw(5) << i << "]: ";
+	    instr->print(out, interp_);
 	    out << std::endl;
-	}
 
-	wam_instruction_base *instr
-	  = reinterpret_cast<wam_instruction_base *>(&instrs_[i]);
-	out << "[" << std::setw(5) << i << "]: ";
-	instr->print(out, interp_);
-	out << std::endl;
-	
-	i += instr->size();
+	    i += instr->size();
+	}
     }
 }
 
@@ -69,64 +216,243 @@ wam_interpreter::wam_interpreter() : wam_code(*this)
     register_s_ = 0;
     memset(register_xn_, 0, sizeof(register_xn_));
     compiler_ = new wam_compiler(*this);
+    jit_ = new wam_jit(*this);
 }
 
 wam_interpreter::~wam_interpreter()
 {
+    delete jit_;
     delete compiler_;
-    for (auto m : hash_maps_) {
-	delete m;
+}
+
+void wam_interpreter::remove_compiled(const qname &pn)
+{
+    jit_->remove(pn);
+    wam_code::remove_compiled(pn);
+}
+
+void wam_interpreter::reclaim_code()
+{
+    wam_code::reclaim_code();
+    jit_->reclaim();
+}
+
+bool wam_interpreter::is_jit_supported()
+{
+    return wam_jit::is_supported();
+}
+
+void wam_interpreter::set_jit(const qname &qn, bool on)
+{
+    if (on) {
+	pin_name(qn);
+	jit_predicates_.insert(qn);
+	if (is_compiled(qn)) {
+	    jit_->compile(qn);
+	}
+    } else {
+	jit_predicates_.erase(qn);
+	jit_->remove(qn);
     }
 }
 
+#define WAM_TYPE(I, K) I,
+static constexpr wam_instruction_type wam_instruction_types[] = {
+    WAM_INSTRUCTION_TYPES(WAM_TYPE)
+};
+#undef WAM_TYPE
+
+static constexpr bool wam_instruction_types_in_order(size_t i)
+{
+    return i == LAST || (wam_instruction_types[i] == i &&
+			 wam_instruction_types_in_order(i + 1));
+}
+
+static_assert(sizeof(wam_instruction_types) / sizeof(wam_instruction_types[0]) == LAST &&
+	      wam_instruction_types_in_order(0),
+	      "WAM_INSTRUCTION_TYPES must list all wam_instruction_types in order");
+
 bool wam_interpreter::cont_wam()
 {
     fail_ = false;
+    if (is_debug()) {
+	cont_wam_debug();
+    } else {
+	cont_wam_threaded();
+    }
+    return !fail_;
+}
+
+//
+// The handlers are inlined into one function, and each one dispatches
+// directly to the next (with computed gotos if the compiler has them;
+// otherwise it's a switch.) After a jump we first run native code if
+// there's any for the new code point (see wam_jit.hpp.)
+//
+void wam_interpreter::cont_wam_threaded()
+{
+    wam_instruction_base *instr;
+
+#define WAM_DISPATCH_JUMP() \
+    if (jit_->has_code()) jit_->run(); \
+    if (!p().has_wam_code() || is_top_fail()) return; \
+    WAM_DISPATCH_NEXT()
+
+#if defined(__GNUC__)
+
+#define WAM_LABEL(I, K) &&L_##I,
+    static void * const labels[] = { WAM_INSTRUCTION_TYPES(WAM_LABEL) };
+#undef WAM_LABEL
+
+#define WAM_DISPATCH_NEXT() \
+    instr = p().wam_code(); \
+    goto *labels[instr->type()];
+
+#define WAM_HANDLER(I, K) \
+    L_##I: \
+        wam_instruction<I>::invoke(*this, instr); \
+	WAM_DISPATCH_##K()
+
+    WAM_DISPATCH_JUMP()
+    WAM_INSTRUCTION_TYPES(WAM_HANDLER)
+
+#else
+
+#define WAM_DISPATCH_NEXT() continue;
+
+#define WAM_HANDLER(I, K) \
+    case I: \
+        wam_instruction<I>::invoke(*this, instr); \
+	WAM_DISPATCH_##K()
+
     while (p().has_wam_code() && !is_top_fail()) {
-	if (auto instr = p().wam_code()) {
-	    if (is_debug()) {
-		std::cout << "[WAM debug]: tr=" << trail_size() << " [" << std::setw(5)
-			  << to_code_addr(instr) << "]: e=" << e0() << " ";
-		instr->print(std::cout, *this);
-		std::cout << "\n";
-	    }
-	    instr->invoke(*this);
-	    cnt++;
+	instr = p().wam_code();
+	switch (instr->type()) {
+	WAM_INSTRUCTION_TYPES(WAM_HANDLER)
+	default:
+	    return;
 	}
     }
-    if (is_debug()) {
-	if (fail_) {
-	    std::cout << "[WAM debug]: fail\n";
-	} else {
-	    std::cout << "[WAM debug]: exit\n";
-	}
+
+#endif
+
+#undef WAM_HANDLER
+#undef WAM_DISPATCH_NEXT
+#undef WAM_DISPATCH_JUMP
+}
+
+void wam_interpreter::cont_wam_debug()
+{
+    while (p().has_wam_code() && !is_top_fail()) {
+	auto instr = p().wam_code();
+	std::cout << "[WAM debug]: tr=" << trail_size() << " [" << std::setw(5)
+		  << to_code_addr(instr) << "]: e=" << e0() << " ";
+	instr->print(std::cout, *this);
+	std::cout << "\n";
+	instr->invoke(*this);
+    }
+    if (fail_) {
+	std::cout << "[WAM debug]: fail\n";
+    } else {
+	std::cout << "[WAM debug]: exit\n";
     }
-    return !fail_;
 }
 
 void wam_interpreter::compile(const qname &qn)
 {
+    // BIG constants go into the code as they are (and the copies of
+    // asserted clauses that get compiled don't stay on the heap.)
+    if (is_tabled(qn) || has_asserted_big(qn)) {
+	return;
+    }
     wam_interim_code instrs(*this);
     compiler_->compile_predicate(qn, instrs);
-    size_t xn_size = compiler_->get_num_x_registers(instrs);
-    size_t yn_size = compiler_->get_environment_size_of(instrs);    
-    size_t first_offset = next_offset();
-    load_code(instrs);
-
-    // Update WAM code points if there was reallocation.
-    if (reallocation_occurred()) {
-	for (auto &entry : code_db_) {
-	    auto &qn = entry.first;
-	    auto &cp = entry.second;
-	    if (cp.has_wam_code()) {
-		cp.set_wam_code(resolve_wam_predicate(qn.first, qn.second));
-	    }
+    install_code(qn, instrs);
+}
+
+//
+// A stack for the profiler (innermost first.) Naive environments know
+// their predicate, for compiled code we use the continuation points
+// (i.e. the callers.)
+//
+void wam_interpreter::profile_samples()
+{
+    static const size_t MAX_DEPTH = 256;
+
+    std::vector<common::con_cell> stack;
+    auto add = [&](common::con_cell f) {
+	if (f != EMPTY_LIST && (stack.empty() || stack.back() != f)) {
+	    stack.push_back(f);
 	}
+    };
+
+    add(profile_predicate(p()));
+    add(profile_predicate(cp()));
+
+    auto *e = e0();
+    auto k = e_kind();
+    for (size_t depth = 0; e != nullptr && depth < MAX_DEPTH; depth++) {
+	if (k != ENV_WAM) {
+	    add(reinterpret_cast<environment_naive_t *>(e)->pe);
+	}
+	add(profile_predicate(e->cp));
+	auto ce = e->ce;
+	e = ce.ce0();
+	k = ce.kind();
     }
 
+    get_profiler().add_samples(stack);
+}
+
+//
+// Slow paths for compiled arithmetics. A register may hold an
+// unevaluated expression (e.g. X = 1+2, Y is X*3), so the operands
+// are evaluated first.
+//
+void wam_interpreter::arith_apply(wam_instruction_type op, uint32_t ai, uint32_t aj)
+{
+    static const common::con_cell fns[] = {
+	common::con_cell("+",2),
+	common::con_cell("-",2),
+	common::con_cell("*",2),
+	common::con_cell("//",2),
+	common::con_cell("mod",2),
+	common::con_cell("<<",2),
+	common::con_cell(">>",2)
+    };
+
+    term args[2] = { deref(a(ai)), deref(a(aj)) };
+    args[0] = arith().eval(args[0], "arithmetics");
+    args[1] = arith().eval(args[1], "arithmetics");
+    a(ai) = arith().apply(fns[op - ARITH_ADD], args, "arithmetics");
+}
+
+int wam_interpreter::arith_compare_big(uint32_t ai, uint32_t aj)
+{
+    term lhs = deref(a(ai)), rhs = deref(a(aj));
+    return arith().compare(lhs, rhs, "arithmetics");
+}
+
+void wam_interpreter::install_code(const qname &qn, wam_interim_code &instrs)
+{
+    size_t xn_size = compiler_->get_num_x_registers(instrs);
+    size_t yn_size = compiler_->get_environment_size_of(instrs);    
+    size_t first_offset = load_code(instrs);
+    install_code(qn, first_offset, xn_size, yn_size);
+}
+
+void wam_interpreter::install_code(const qname &qn, size_t first_offset,
+				   size_t num_x, size_t num_y)
+{
+    size_t code_size = next_offset() - first_offset;
+
     auto *next_instr = to_code(first_offset);
-    set_wam_predicate(qn, next_instr, xn_size, yn_size);
+    set_wam_predicate(qn, next_instr, code_size, num_x, num_y);
     set_code(qn, code_point(next_instr));
+
+    if (is_jit(qn)) {
+	jit_->compile(qn);
+    }
 }
 
 void wam_interpreter::compile(common::con_cell module, common::con_cell name)
@@ -178,10 +504,19 @@ void wam_interpreter::bind_code_point(std::unordered_map<size_t, size_t> &label_
     }
 }
 
-void wam_interpreter::load_code(wam_interim_code &instrs)
+size_t wam_interpreter::load_code(wam_interim_code &instrs)
 {
     // instrs.print(std::cout);
 
+    // The code is loaded into a single chunk
+    size_t sz = 0;
+    for (auto *instr : instrs) {
+	if (!wam_compiler::is_label_instruction(instr)) {
+	    sz += instr->size();
+	}
+    }
+    reserve(sz);
+
     std::unordered_map<size_t, size_t> label_map;
     size_t first_offset = next_offset();
     size_t offset = first_offset;
@@ -224,12 +559,17 @@ void wam_interpreter::load_code(wam_interim_code &instrs)
 	    bind_code_point(label_map, cp_instr->ps());
 	    }
 	    break;
+        case SWITCH_ON_ARG:
+	    bind_code_point(label_map, static_cast<wam_instruction<SWITCH_ON_ARG> *>(instr)->pv());
+	    // Fall through for the table
         case SWITCH_ON_CONSTANT:
         case SWITCH_ON_STRUCTURE:
 	    {
-	    auto cp_instr = static_cast<wam_instruction_hash_map *>(instr);
-	    for (auto &e : cp_instr->map()) {
-		bind_code_point(label_map, e.second);
+	    auto table = static_cast<wam_instruction_switch_table *>(instr);
+	    for (size_t i = 0; i < table->num_slots(); i++) {
+		if (!table->is_empty_slot(i)) {
+		    bind_code_point(label_map, table->value(i));
+		}
 	    }
 	    }
 	    break;
@@ -239,6 +579,7 @@ void wam_interpreter::load_code(wam_interim_code &instrs)
 	i += instr->size();
 	instr = next_instruction(instr);
     }
+    return first_offset;
 }
 
 }}
@@ -86,6 +86,7 @@ enum wam_instruction_type {
   SWITCH_ON_TERM,
   SWITCH_ON_CONSTANT,
   SWITCH_ON_STRUCTURE,
+  SWITCH_ON_ARG, // Non-standard WAM; hash on some other argument
  
   NECK_CUT,
   GET_LEVEL,
@@ -94,14 +95,87 @@ enum wam_instruction_type {
   GOTO,        // Non-standard WAM, but so we can compile (A ; B) efficiently
   RESET_LEVEL, // --- "" ---
 
+  ARITH_ADD,   // Non-standard WAM; compiled arithmetics (ai := ai op aj)
+  ARITH_SUB,
+  ARITH_MUL,
+  ARITH_IDIV,
+  ARITH_MOD,
+  ARITH_SHL,
+  ARITH_SHR,
+  ARITH_LT,    // --- "" --- (fail unless ai op aj)
+  ARITH_LE,
+  ARITH_EQ,
+  ARITH_NE,
+
+  TEST_VAR,      // Non-standard WAM; inlined builtins (fail unless ai is ...)
+  TEST_NONVAR,
+  TEST_ATOM,
+  TEST_ATOMIC,
+  TEST_INTEGER,
+  TEST_NUMBER,
+  TEST_COMPOUND,
+  TEST_CALLABLE,
+  TEST_EQ,       // --- "" --- (ai == aj)
+  TEST_NE,       // --- "" --- (ai \== aj)
+  FUNCTOR,       // --- "" --- (functor(a0, a1, a2))
+
+  GET_LIST_A_UV2, // Non-standard WAM; superinstructions (see
+  PUT_VALUE_X2,   // wam_compiler::fuse_instructions)
+
   COST, // Non-standard WAM; for accumulated cost
 
   LAST
 };
 
+//
+// All instruction types (in the order of wam_instruction_type.) NEXT
+// instructions always continue with the one that follows, so we can
+// dispatch on it without checking if the code point is still WAM code
+// or if we have failed. The others (JUMP) may go anywhere.
+//
+#define WAM_INSTRUCTION_TYPES(X) \
+    X(PUT_VARIABLE_X, NEXT) X(PUT_VARIABLE_Y, NEXT) \
+    X(PUT_VALUE_X, NEXT) X(PUT_VALUE_Y, NEXT) X(PUT_UNSAFE_VALUE_Y, NEXT) \
+    X(PUT_STRUCTURE_A, NEXT) X(PUT_STRUCTURE_X, NEXT) \
+    X(PUT_STRUCTURE_Y, NEXT) X(PUT_LIST_A, NEXT) X(PUT_LIST_X, NEXT) \
+    X(PUT_LIST_Y, NEXT) X(PUT_CONSTANT, NEXT) \
+    X(GET_VARIABLE_X, NEXT) X(GET_VARIABLE_Y, NEXT) \
+    X(GET_VALUE_X, JUMP) X(GET_VALUE_Y, JUMP) \
+    X(GET_STRUCTURE_A, JUMP) X(GET_STRUCTURE_X, JUMP) \
+    X(GET_STRUCTURE_Y, JUMP) X(GET_LIST_A, JUMP) X(GET_LIST_X, JUMP) \
+    X(GET_LIST_Y, JUMP) X(GET_CONSTANT, JUMP) \
+    X(SET_VARIABLE_A, NEXT) X(SET_VARIABLE_X, NEXT) \
+    X(SET_VARIABLE_Y, NEXT) X(SET_VALUE_A, NEXT) X(SET_VALUE_X, NEXT) \
+    X(SET_VALUE_Y, NEXT) X(SET_LOCAL_VALUE_X, NEXT) \
+    X(SET_LOCAL_VALUE_Y, NEXT) X(SET_CONSTANT, NEXT) X(SET_VOID, NEXT) \
+    X(UNIFY_VARIABLE_A, NEXT) X(UNIFY_VARIABLE_X, NEXT) \
+    X(UNIFY_VARIABLE_Y, NEXT) X(UNIFY_VALUE_A, JUMP) \
+    X(UNIFY_VALUE_X, JUMP) X(UNIFY_VALUE_Y, JUMP) \
+    X(UNIFY_LOCAL_VALUE_X, JUMP) X(UNIFY_LOCAL_VALUE_Y, JUMP) \
+    X(UNIFY_CONSTANT, JUMP) X(UNIFY_VOID, NEXT) \
+    X(ALLOCATE, NEXT) X(DEALLOCATE, JUMP) X(CALL, JUMP) X(EXECUTE, JUMP) \
+    X(PROCEED, JUMP) X(BUILTIN, JUMP) X(BUILTIN_R, JUMP) \
+    X(TRY_ME_ELSE, JUMP) X(RETRY_ME_ELSE, JUMP) X(TRUST_ME, JUMP) \
+    X(TRY, JUMP) X(RETRY, JUMP) X(TRUST, JUMP) \
+    X(SWITCH_ON_TERM, JUMP) X(SWITCH_ON_CONSTANT, JUMP) \
+    X(SWITCH_ON_STRUCTURE, JUMP) X(SWITCH_ON_ARG, JUMP) \
+    X(NECK_CUT, JUMP) X(GET_LEVEL, NEXT) X(CUT, JUMP) \
+    X(GOTO, JUMP) X(RESET_LEVEL, JUMP) \
+    X(ARITH_ADD, JUMP) X(ARITH_SUB, JUMP) X(ARITH_MUL, JUMP) \
+    X(ARITH_IDIV, JUMP) X(ARITH_MOD, JUMP) X(ARITH_SHL, JUMP) \
+    X(ARITH_SHR, JUMP) X(ARITH_LT, JUMP) X(ARITH_LE, JUMP) \
+    X(ARITH_EQ, JUMP) X(ARITH_NE, JUMP) \
+    X(TEST_VAR, JUMP) X(TEST_NONVAR, JUMP) X(TEST_ATOM, JUMP) \
+    X(TEST_ATOMIC, JUMP) X(TEST_INTEGER, JUMP) X(TEST_NUMBER, JUMP) \
+    X(TEST_COMPOUND, JUMP) X(TEST_CALLABLE, JUMP) X(TEST_EQ, JUMP) \
+    X(TEST_NE, JUMP) X(FUNCTOR, JUMP) \
+    X(GET_LIST_A_UV2, JUMP) X(PUT_VALUE_X2, NEXT) \
+    X(COST, NEXT)
+
 class wam_interpreter;
 class wam_compiler;
 class wam_interim_code;
+class wam_jit;
 
 typedef uint64_t code_t;
 
@@ -132,24 +206,6 @@ public:
 
     template<wam_instruction_type I> inline void set_type();
 
-protected:
-    inline void update_ptr(code_point &p, code_t *old_base, code_t *new_base)
-    {
-	if (!p.has_wam_code()) {
-	    return;
-	}
-	p.set_wam_code(reinterpret_cast<wam_instruction_base *>(reinterpret_cast<code_t *>(p.wam_code()) - old_base + new_base));
-    }
-
-    inline void update(code_t *old_base, code_t *new_base)
-    {
-	auto it = updater_fns_.find(fn());
-	if (it != updater_fns_.end()) {
-	    auto updater_fn = it->second;
-	    updater_fn(this, old_base, new_base);
-	}
-    }
-
 private:
     fn_type fn_;
     wam_instruction_type type_;
@@ -157,19 +213,12 @@ private:
 
     typedef void (*print_fn_type)(std::ostream &out, wam_interpreter &interp, wam_instruction_base *self);
 
-    typedef void (*updater_fn_type)(wam_instruction_base *self, code_t *old_base, code_t *new_base);
-
 public:
     static void register_printer(fn_type fn, print_fn_type print_fn)
     {
         print_fns_[fn] = print_fn;
     }
 
-    static void register_updater(fn_type fn, updater_fn_type updater_fn)
-    {
-	updater_fns_[fn] = updater_fn;
-    }
-
     void print(std::ostream &out, wam_interpreter &interp)
     {
         print_fn_type pfn = print_fns_[fn_];
@@ -182,9 +231,6 @@ public:
 
 private:
     static std::unordered_map<fn_type, print_fn_type> print_fns_;
-    static std::unordered_map<fn_type, updater_fn_type> updater_fns_;
-
-    friend class wam_code;
 };
 
 template<wam_instruction_type I> class wam_instruction : protected wam_instruction_base
@@ -339,13 +385,6 @@ public:
 	cp_ = cp;
     }
 
-protected:
-    static void updater(wam_instruction_base *self, code_t *old_base, code_t *new_base)
-    {
-	auto self1 = reinterpret_cast<wam_instruction_code_point *>(self);
-	self1->update(old_base, new_base);
-    }
-
 private:
     code_point cp_;
 };
@@ -363,58 +402,204 @@ private:
     uint32_t reg_;
 };
 
-class wam_instruction_hash_map : public wam_instruction_base
+//
+// switch_on_constant, switch_on_structure and switch_on_arg have their
+// key -> code point table inline, right after the instruction (so the
+// instruction is larger than its class): the keys and then the code
+// points. The layout depends on the number of keys: up to MAX_LINEAR
+// keys are compared one by one, up to MAX_SORTED are sorted (binary
+// search) and more than that go into an open addressing hash table
+// that is at most half full. (Binary search is only kept for a few
+// keys where it keeps the table small; a hash probe is faster beyond
+// that.)
+//
+class wam_instruction_switch_table : public wam_instruction_base
 {
 public:
-    inline wam_instruction_hash_map(fn_type fn, uint64_t sz_bytes, wam_instruction_type t, wam_hash_map *map)
-	: wam_instruction_base(fn, sz_bytes, t), map_(map) { }
+    enum layout_t { LINEAR, SORTED, HASHED };
+
+    static const size_t MAX_LINEAR = 4;
+    static const size_t MAX_SORTED = 8;
+
+    typedef std::vector<std::pair<common::term, code_point> > entries_t;
+
+    inline layout_t layout() const { return static_cast<layout_t>(layout_); }
+    inline size_t num_keys() const { return num_keys_; }
+    inline size_t num_slots() const { return num_slots_; }
+
+    inline bool is_empty_slot(size_t i) const
+    { return keys()[i] == EMPTY_KEY; }
+    inline common::term key(size_t i) const { return keys()[i]; }
+    inline code_point & value(size_t i) { return values()[i]; }
+
+    // The code point for the key (or nullptr if there's none)
+    inline const code_point * lookup(common::term key) const
+    {
+	const common::term *ks = keys();
+	switch (layout()) {
+	case LINEAR:
+	    for (size_t i = 0; i < num_keys_; i++) {
+		if (ks[i] == key) {
+		    return &values()[i];
+		}
+	    }
+	    return nullptr;
+	case SORTED: {
+	    // Branch free binary search
+	    auto k = key.raw_value();
+	    const common::term *base = ks;
+	    for (size_t n = num_keys_; n > 1;) {
+		size_t half = n / 2;
+		base = base[half - 1].raw_value() < k ? base + half : base;
+		n -= half;
+	    }
+	    return *base == key ? &values()[base - ks] : nullptr;
+	    }
+	case HASHED: {
+	    size_t mask = num_slots_ - 1;
+	    for (size_t i = hash_slot(key); ; i = (i + 1) & mask) {
+		if (ks[i] == key) {
+		    return &values()[i];
+		}
+		if (ks[i] == EMPTY_KEY) {
+		    return nullptr;
+		}
+	    }
+	    }
+	}
+	return nullptr;
+    }
 
-    inline wam_hash_map & map() const { return *map_; }
+    // The entries in table order
+    entries_t entries() const;
+
+    // Lay out the table again for new entries (as many as it has),
+    // e.g. when the keys are other cells.
+    inline void set_entries(const entries_t &entries)
+    {
+	fill(table_offset_, num_slots_, entries);
+    }
 
-    inline void update(code_t *old_base, code_t *new_base)
+    // Whether the table is laid out as new_switch (of T) and fill
+    // would lay it out, e.g. for code read from a file.
+    template<typename T> inline bool is_well_formed() const
     {
-	for (auto &v : map()) {
-	    update_ptr(v.second, old_base, new_base);
+	size_t n = num_keys_;
+	size_t slots = n <= MAX_SORTED ? n : 2*next_pow2(n);
+	size_t offset = (sizeof(T) + sizeof(code_t) - 1) / sizeof(code_t);
+	size_t sz_bytes = offset * sizeof(code_t)
+	    + slots * (sizeof(common::term) + sizeof(code_point));
+	layout_t layout = n <= MAX_LINEAR ? LINEAR : (n <= MAX_SORTED ? SORTED : HASHED);
+	if (layout_ != layout || num_slots_ != slots || table_offset_ != offset ||
+	    size() != (sz_bytes + sizeof(code_t) - 1) / sizeof(code_t)) {
+	    return false;
+	}
+	size_t num_keys = 0;
+	for (size_t i = 0; i < num_slots_; i++) {
+	    num_keys += !is_empty_slot(i);
 	}
+	return num_keys == n;
     }
 
-protected:
-    static void updater(wam_instruction_base *self, code_t *old_base, code_t *new_base)
+    // Allocate an instruction T (with new char[], like interim
+    // instructions) with room for the table of the entries.
+    template<typename T, typename... Args>
+    static T * new_switch(const entries_t &entries, Args... args)
     {
-	auto self1 = reinterpret_cast<wam_instruction_hash_map *>(self);
-	self1->update(old_base, new_base);
+	size_t n = entries.size();
+	size_t slots = n <= MAX_SORTED ? n : 2*next_pow2(n);
+	size_t offset = (sizeof(T) + sizeof(code_t) - 1) / sizeof(code_t);
+	size_t sz_bytes = offset * sizeof(code_t)
+	    + slots * (sizeof(common::term) + sizeof(code_point));
+	auto *self = new (new char[sz_bytes]) T(sz_bytes, args...);
+	self->fill(offset, slots, entries);
+	return self;
     }
 
+protected:
+    inline wam_instruction_switch_table(fn_type fn, uint64_t sz_bytes, wam_instruction_type t)
+	: wam_instruction_base(fn, sz_bytes, t),
+	  layout_(LINEAR), num_keys_(0), num_slots_(0), table_offset_(0),
+	  hash_shift_(0) { }
+
+    static const common::ref_cell EMPTY_KEY;
+
 private:
-    wam_hash_map *map_;
+    inline const common::term * keys() const
+    {
+	return reinterpret_cast<const common::term *>(
+		  reinterpret_cast<const code_t *>(this) + table_offset_);
+    }
+
+    inline code_point * values() const
+    {
+	return const_cast<code_point *>(reinterpret_cast<const code_point *>(keys() + num_slots_));
+    }
+
+    inline size_t hash_slot(common::term key) const
+    {
+	return static_cast<size_t>((key.raw_value() * 0x9e3779b97f4a7c15ULL) >> hash_shift_);
+    }
+
+    static inline size_t next_pow2(size_t n)
+    {
+	size_t p = 1;
+	while (p < n) p *= 2;
+	return p;
+    }
+
+    void fill(size_t offset, size_t slots, const entries_t &entries);
+
+    uint32_t layout_;
+    uint32_t num_keys_;
+    uint32_t num_slots_;
+    uint32_t table_offset_;
+    uint32_t hash_shift_;
 };
 
+//
+// The code area is a list of chunks that never move, so code points
+// (in registers, environments, choice points and other code) stay
+// valid when more code is added. A predicate is always loaded into a
+// single chunk; a new chunk is started when it doesn't fit in the
+// current one.
+//
+// Code addresses are offsets into a (virtual) address space where
+// each chunk has its own range. Ranges are never reused, so a chunk
+// whose predicates have all been removed can be freed (see
+// reclaim_code) without confusing it with newer code.
+//
 class wam_code
 {
 public:
-    wam_code(wam_interpreter &interp,
-  			     size_t initial_capacity = 1024)
-	: interp_(interp), instrs_size_(0), instrs_capacity_(initial_capacity)
-    { instrs_ = new code_t[instrs_capacity_]; }
+    static const size_t CHUNK_SIZE = 16384;
+
+    wam_code(wam_interpreter &interp, size_t chunk_size = CHUNK_SIZE);
+    ~wam_code();
 
     inline size_t next_offset() const
     {
-	return instrs_size_;
+	return current_->base + current_->size;
     }
-    
+
+    // Make sure the next 'sz' words go into the same chunk
+    void reserve(size_t sz);
+
     inline size_t to_code_addr(code_t *p) const
     {
-	return static_cast<size_t>(p - instrs_);
+	auto *ch = find_chunk(p);
+	return ch->base + static_cast<size_t>(p - ch->instrs);
     }
 
     inline size_t to_code_addr(wam_instruction_base *p) const
     {
-	return static_cast<size_t>(reinterpret_cast<code_t *>(p) - instrs_);
+	return to_code_addr(reinterpret_cast<code_t *>(p));
     }
 
     inline wam_instruction_base * to_code(size_t addr) const
     {
-	return reinterpret_cast<wam_instruction_base *>(&instrs_[addr]);
+	auto *ch = find_chunk(addr);
+	return reinterpret_cast<wam_instruction_base *>(&ch->instrs[addr - ch->base]);
     }
 
     size_t add(const wam_instruction_base &i);
@@ -432,30 +617,28 @@ public:
 	return is_compiled(std::make_pair(module,p));
     }
 
-    inline void remove_compiled(const qname &pn)
-    {
-	auto it = predicate_map_.find(pn);
-	if (it != predicate_map_.end()) {
-	    auto meta_data = it->second;
-	    predicate_map_.erase(pn);
-	    predicate_rev_map_.erase(meta_data.code_offset);
+    void remove_compiled(const qname &pn);
 
-	    auto &offsets = calls_[pn];
-	    for (auto offset : offsets) {
-		auto *cp_instr = reinterpret_cast<wam_instruction_code_point *>(to_code(offset));
-		cp_instr->cp().set_wam_code(nullptr);
-	    }
-	}
+    // Free the chunks that only have removed code. Must only be called
+    // when no code is running (i.e. not from within a query, nested
+    // ones included.)
+    void reclaim_code();
+
+    inline size_t num_code_chunks() const
+    {
+	return chunks_.size();
     }
 
     struct predicate_meta_data {
-        inline predicate_meta_data(size_t off, size_t num_x, size_t num_y)
+        inline predicate_meta_data(size_t off, size_t sz, size_t num_x, size_t num_y)
 	  : code_offset(off),
+	    code_size(sz),
 	    num_x_registers(num_x),
             num_y_registers(num_y) { }
         predicate_meta_data() = default;
 
         size_t code_offset;
+        size_t code_size;
         size_t num_x_registers;
         size_t num_y_registers;
     };
@@ -465,6 +648,21 @@ public:
         return predicate_map_[qn];
     }
 
+    // The predicate whose code contains code_addr (if any)
+    inline bool find_wam_predicate(size_t code_addr, qname &qn) const
+    {
+	if (code_addr >= next_offset()) {
+	    return false;
+	}
+	auto it = predicate_rev_map_.upper_bound(code_addr);
+	if (it == predicate_rev_map_.begin()) {
+	    return false;
+	}
+	--it;
+	qn = it->second;
+	return true;
+    }
+
     const qname get_wam_predicate(size_t code_addr)
     {
         auto it = predicate_rev_map_.find(code_addr);
@@ -479,13 +677,16 @@ public:
 protected:
     void set_wam_predicate(const qname &qn,
 			   wam_instruction_base *instr,
+			   size_t code_size,
 			   size_t num_x_registers,
 			   size_t num_y_registers)
 
     {
 	size_t predicate_offset = to_code_addr(instr);
-	predicate_map_[qn] = predicate_meta_data(predicate_offset, num_x_registers, num_y_registers);
+	predicate_map_[qn] = predicate_meta_data(predicate_offset, code_size, num_x_registers, num_y_registers);
 	predicate_rev_map_[predicate_offset] = qn;
+	callees_[qn].swap(loaded_calls_);
+	loaded_calls_.clear();
 
 	auto &offsets = calls_[qn];
 	for (auto offset : offsets) {
@@ -504,51 +705,61 @@ protected:
 	}
     }
 
-protected:
-    bool reallocation_occurred() {
-	bool r = reallocation_count_ != last_reallocation_count_;
-	last_reallocation_count_ = reallocation_count_;
-	return r;
-    }
-
 private:
-    code_t * ensure_fit(size_t sz)
+    struct code_chunk {
+	size_t base;     // Code address of the first word
+	size_t size;
+	size_t capacity;
+	size_t removed;  // Words of removed predicates
+	code_t *instrs;
+    };
+
+    void new_chunk(size_t capacity);
+
+    inline code_chunk * find_chunk(size_t addr) const
     {
-        ensure_capacity(instrs_size_ + sz);
-	code_t *data = &instrs_[instrs_size_];
-	instrs_size_ += sz;
-	return data;
+	if (addr >= current_->base) {
+	    return current_;
+	}
+	auto it = chunks_.upper_bound(addr);
+	--it;
+	return it->second;
     }
 
-    void ensure_capacity(size_t cap)
+    inline code_chunk * find_chunk(code_t *p) const
     {
-        if (cap > instrs_capacity_) {
-   	    size_t new_cap = 2*std::max(cap, instrs_size_);
-	    code_t *new_instrs = new code_t[new_cap];
-	    memcpy(new_instrs, instrs_, sizeof(code_t)*instrs_size_);
-	    instrs_capacity_ = new_cap;
-
-	    update(instrs_, new_instrs);
-
-	    delete instrs_;
-	    instrs_ = new_instrs;
-
-	    reallocation_count_++;
-        }
+	if (p >= current_->instrs && p < current_->instrs + current_->capacity) {
+	    return current_;
+	}
+	auto it = chunk_ptrs_.upper_bound(p);
+	--it;
+	return it->second;
     }
 
-    inline void update(code_t *old_base, code_t *new_base);
+    code_t * ensure_fit(size_t sz)
+    {
+        reserve(sz);
+	code_t *data = &current_->instrs[current_->size];
+	current_->size += sz;
+	return data;
+    }
 
     wam_interpreter &interp_;
-    size_t instrs_size_;
-    size_t instrs_capacity_;
-    code_t *instrs_;
-    size_t reallocation_count_;
-    size_t last_reallocation_count_;
+    size_t chunk_size_;
+    code_chunk *current_;
+    std::map<size_t, code_chunk *> chunks_;
+    std::map<code_t *, code_chunk *> chunk_ptrs_;
 
     std::unordered_map<qname, predicate_meta_data> predicate_map_;
     std::map<size_t, qname> predicate_rev_map_;
     std::unordered_map<qname, std::vector<size_t> > calls_;
+
+    // The predicates called from a predicate (to find its entries in
+    // calls_ when it's removed) and from the code being loaded.
+    std::unordered_map<qname, std::vector<qname> > callees_;
+    std::vector<qname> loaded_calls_;
+
+    friend class wam_code_cache;
 };
 
 template<> class wam_instruction<CALL> : public wam_instruction_code_point_reg {
@@ -562,16 +773,10 @@ public:
     inline static void init() {
 	static bool init_ = [] {
 	    register_printer(&invoke, &print);
-	    register_updater(&invoke, &updater);
 	    return true; } ();
 	static_cast<void>(init_);
     }
 
-    inline void update(code_t *old_base, code_t *new_base)
-    {
-	update_ptr(p(), old_base, new_base);
-    }
-
     inline const code_point & p() const { return cp(); }
     inline code_point & p() { return cp(); }
 
@@ -590,7 +795,6 @@ public:
 
     static void print(std::ostream &out, wam_interpreter &interp, wam_instruction_base *self);
 
-    static void updater(wam_instruction_base *self, code_t *old_base, code_t *new_base);
 };
 
 template<> class wam_instruction<BUILTIN> : public wam_instruction_code_point {
@@ -659,17 +863,10 @@ public:
 
     typedef common::term term;
 
-    inline wam_hash_map * new_hash_map()
-    {
-	auto *map = new wam_hash_map();
-	hash_maps_.push_back(map);
-	return map;
-    }
+    static const size_t MAX_X_REGISTERS = 1024;
 
-    inline void remove_compiled(const qname &pn)
-    {
-	wam_code::remove_compiled(pn);
-    }
+    void remove_compiled(const qname &pn);
+    void reclaim_code();
 
     inline std::string to_string(const term t) const
     {
@@ -703,8 +900,22 @@ public:
     void compile(const qname &pred);
     void compile(common::con_cell module, common::con_cell name);
 
+    // Native code for compiled predicates (see wam_jit.hpp.) A
+    // predicate with JIT on gets native code whenever it's compiled.
+    static bool is_jit_supported();
+    void set_jit(const qname &pred, bool on);
+    inline bool is_jit(const qname &pred) const
+    {
+	return jit_predicates_.count(pred) != 0;
+    }
+
 protected:
-    void load_code(wam_interim_code &code);
+    void install_code(const qname &pred, wam_interim_code &code);
+    // Install the code loaded from first_offset and onwards
+    void install_code(const qname &pred, size_t first_offset,
+		      size_t num_x, size_t num_y);
+    // Returns the code address of the first instruction
+    size_t load_code(wam_interim_code &code);
     void bind_code_point(std::unordered_map<size_t, size_t> &label_map,
 			 code_point &cp);
 
@@ -714,15 +925,71 @@ protected:
 	return !fail_;
     }
 
-    int cnt = 0;
+    //
+    // Profiling. The ports of compiled code are counted by the
+    // instructions: call/execute (call), proceed/execute (exit) and
+    // retry/trust (redo.) The predicate is looked up from the address
+    // of the instruction. With last call optimization the caller
+    // exits at its execute instruction.
+    //
+
+    inline common::con_cell profile_predicate(const code_point &p1) const
+    {
+	qname qn;
+	if (p1.has_wam_code() &&
+	    find_wam_predicate(to_code_addr(p1.wam_code()), qn)) {
+	    return qn.second;
+	}
+	return EMPTY_LIST;
+    }
+
+    inline void profile_call(const code_point &p1)
+    {
+	// The code point of a call instruction has the name.
+	auto f = p1.term_code().tag() == common::tag_t::CON
+	    ? p1.name() : profile_predicate(p1);
+	if (f != EMPTY_LIST) {
+	    get_profiler().call(f);
+	}
+	if (get_profiler().has_pending_samples()) {
+	    profile_samples();
+	}
+    }
+
+    inline void profile_exit()
+    {
+	auto f = profile_predicate(p());
+	if (f != EMPTY_LIST) {
+	    get_profiler().exit(f);
+	}
+    }
+
+    inline void profile_redo()
+    {
+	auto f = profile_predicate(p());
+	if (f != EMPTY_LIST) {
+	    get_profiler().redo(f, b()->exits);
+	}
+    }
+
+    // Walk the environments and record the pending samples
+    void profile_samples();
 
     bool cont_wam();
 
 private:
+    // The dispatch loops of cont_wam (see wam_interpreter.cpp)
+    void cont_wam_threaded();
+    void cont_wam_debug();
+
     bool fail_;
     wam_compiler *compiler_;
+    wam_jit *jit_;
+    std::unordered_set<qname> jit_predicates_;
 
     template<wam_instruction_type I> friend class wam_instruction;
+    friend class wam_jit;
+    friend class wam_code_cache;
 
     static inline size_t num_y(interpreter_base *interp, bool use_previous)
     {
@@ -739,13 +1006,41 @@ private:
 	if (!wami->cp().has_wam_code()) {
 	    return interpreter_base::num_y(interp, use_previous);
 	}
-        auto after_call = wami->cp().wam_code();
+	return num_y_at_continuation(wami->cp());
+    }
+
+protected:
+    // The environment size (number of Y variables still in use) is
+    // given by the call instruction right before the continuation point.
+    static inline size_t num_y_at_continuation(const code_point &cont)
+    {
+        auto after_call = cont.wam_code();
 	auto at_call = reinterpret_cast<wam_instruction_code_point_reg *>(
 		  reinterpret_cast<code_t *>(after_call) -
 		  sizeof(wam_instruction_code_point_reg)/sizeof(code_t));
 	return at_call->reg();
     }
 
+    inline void tidy_trail()
+    {
+        size_t i = (b() != nullptr) ? b()->tr: 0;
+	size_t tr = trail_size();
+	size_t bb = to_stack_addr(base(b()));
+
+	while (i < tr) {
+	    if (trail_get(i) < get_register_hb() ||
+		(heap_size() < trail_get(i) && trail_get(i) < bb)) {
+		i++;
+	    } else {
+		trail_set(i, trail_get(tr-1));
+		tr--;
+	    }
+	}
+	trim_trail(tr);
+    }
+
+private:
+
     static inline void save_state(interpreter_base *interp)
     {
         // First check if we're in WAM (or not)
@@ -820,24 +1115,6 @@ private:
 	}
     }
 
-    inline void tidy_trail()
-    {
-        size_t i = (b() != nullptr) ? b()->tr: 0;
-	size_t tr = trail_size();
-	size_t bb = to_stack_addr(base(b()));
-
-	while (i < tr) {
-	    if (trail_get(i) < get_register_hb() ||
-		(heap_size() < trail_get(i) && trail_get(i) < bb)) {
-		i++;
-	    } else {
-		trail_set(i, trail_get(tr-1));
-		tr--;
-	    }
-	}
-	trim_trail(tr);
-    }
-
     inline void unwind_trail(size_t a1, size_t a2)
     {
         unwind_frozen_closures(a1, a2);
@@ -865,9 +1142,7 @@ private:
 
     size_t register_s_;
 
-    std::vector<wam_hash_map *> hash_maps_;
-
-    term register_xn_[1024];
+    term register_xn_[MAX_X_REGISTERS];
 
   public:
     inline void next_instruction(code_point &p)
@@ -1454,18 +1729,39 @@ private:
 	    set_cp(EMPTY_LIST);
 	    return; // Go back to simple interpreter
 	}
+
+	count_inference();
+	if (get_profiler().is_enabled()) {
+	    profile_call(p1);
+	}
+
+	check_gc();
     }
 
     inline void execute(code_point &p1, size_t arity)
     {
+	if (get_profiler().is_enabled()) {
+	    // Last call: the caller is done (if the callee succeeds.)
+	    profile_exit();
+	    if (p1.has_wam_code()) {
+		profile_call(p1);
+	    }
+	}
         set_num_of_args(arity);
 	set_b0(b());
 	set_p(p1);
+	if (p1.has_wam_code()) {
+	    count_inference();
+	    check_gc();
+	}
     }
 
 protected:
     inline void proceed()
     {
+	if (get_profiler().is_enabled()) {
+	    profile_exit();
+	}
         set_p(cp());
 
 	// After a call is done we check for frozen closures
@@ -1476,6 +1772,7 @@ private:
     inline bool builtin_r(wam_instruction_base *p0)
     {
         auto bn = reinterpret_cast<wam_instruction<BUILTIN_R> *>(p0);
+	count_inference();
 	size_t num_args = bn->arity();
 	set_num_of_args(num_args);
 	goto_next_instruction();
@@ -1502,6 +1799,7 @@ private:
     inline bool builtin(wam_instruction_base *p0)
     {
         auto bn = reinterpret_cast<wam_instruction<BUILTIN> *>(p0);
+	count_inference();
 	size_t num_args = bn->arity();
 	set_num_of_args(num_args);
 	goto_next_instruction();
@@ -1561,12 +1859,18 @@ private:
 
     inline void retry_me_else(code_point &L)
     {
+	if (get_profiler().is_enabled()) {
+	    profile_redo();
+	}
 	retry_choice_point(L);
 	goto_next_instruction();
     }
 
     inline void trust_me()
     {
+	if (get_profiler().is_enabled()) {
+	    profile_redo();
+	}
 	trust_choice_point();
 	goto_next_instruction();
     }
@@ -1581,6 +1885,9 @@ private:
 
     inline void retry(code_point &L)
     {
+	if (get_profiler().is_enabled()) {
+	    profile_redo();
+	}
         auto p1 = p();
 	next_instruction(p1);
 	retry_choice_point(p1);
@@ -1589,6 +1896,9 @@ private:
 
     inline void trust(code_point &L)
     {
+	if (get_profiler().is_enabled()) {
+	    profile_redo();
+	}
 	trust_choice_point();
 	set_p(L);
     }
@@ -1636,26 +1946,53 @@ private:
 	}
     }
 
-    inline void switch_on_constant(wam_hash_map &map)
+    inline void switch_on_constant(const wam_instruction_switch_table &table)
     {
 	term t = deref(a(0));
-	auto it = map.find(t);
-	if (it == map.end()) {
+	auto *cp = table.lookup(t);
+	if (cp == nullptr) {
 	    backtrack();
 	} else {
-	    set_p(it->second);
+	    set_p(*cp);
 	}
     }
 
-    inline void switch_on_structure(wam_hash_map &map)
+    inline void switch_on_structure(const wam_instruction_switch_table &table)
     {
 	term t = functor(deref(a(0)));
+	auto *cp = table.lookup(t);
+	if (cp == nullptr) {
+	    backtrack();
+	} else {
+	    set_p(*cp);
+	}
+    }
+
+    inline void switch_on_arg(uint32_t ai, const code_point &pv,
+			      const wam_instruction_switch_table &table)
+    {
+	term t = deref(a(ai));
+
+	switch (t.tag()) {
+	case common::tag_t::REF:
+	    set_p(pv);
+	    return;
+	case common::tag_t::STR:
+	    t = functor(t);
+	    break;
+	case common::tag_t::CON: case common::tag_t::INT:
+	    break;
+	default:
+	    // No clause has a BIG here
+	    backtrack();
+	    return;
+	}
 
-	auto it = map.find(t);
-	if (it == map.end()) {
+	auto *cp = table.lookup(t);
+	if (cp == nullptr) {
 	    backtrack();
 	} else {
-	    set_p(it->second);
+	    set_p(*cp);
 	}
     }
 
@@ -1699,66 +2036,321 @@ private:
 	             // instruction to get the current size of the environment
     }
 
-    inline void cost(uint64_t c)
+    //
+    // Compiled arithmetics (see wam_compiler::compile_arith.) The
+    // expression is evaluated in A registers. Small integers are
+    // computed here; BIGs, overflows and registers that hold an
+    // unevaluated expression are left to arithmetics.
+    //
+    inline bool arith_small(uint32_t ai, uint32_t aj, int64_t &x, int64_t &y)
     {
-	add_accumulated_cost(c);
-	goto_next_instruction();
+	term s = deref(a(ai)), t = deref(a(aj));
+	if (s.tag() != common::tag_t::INT || t.tag() != common::tag_t::INT) {
+	    return false;
+	}
+	x = static_cast<common::int_cell &>(s).value();
+	y = static_cast<common::int_cell &>(t).value();
+	return true;
     }
 
-    friend class test_wam_interpreter;
-};
-
-inline void wam_code::update(code_t *old_base, code_t *new_base)
-{
-    wam_instruction_base *instr = reinterpret_cast<wam_instruction_base *>(new_base);
-    for (size_t i = 0; i < instrs_size_;) {
-	instr->update(old_base, new_base);
-	instr = interp_.next_instruction(instr);
-	i = static_cast<size_t>(reinterpret_cast<code_t *>(instr) - new_base);
+    static inline bool arith_fits(int64_t v)
+    {
+	return v >= common::int_cell::min().value() &&
+	       v <= common::int_cell::max().value();
     }
-}
 
-template<> class wam_instruction<PUT_VARIABLE_X> : public wam_instruction_binary_reg {
-public:
-    inline wam_instruction(uint32_t xn, uint32_t ai) :
-	wam_instruction_binary_reg(&invoke, sizeof(*this), PUT_VARIABLE_X,
-				   xn, ai) {
-        init();
+    inline void arith_add(uint32_t ai, uint32_t aj)
+    {
+	int64_t x, y;
+	// Small integers have 61 bits, so the sum can't overflow
+	if (arith_small(ai, aj, x, y) && arith_fits(x + y)) {
+	    a(ai) = common::int_cell(x + y);
+	} else {
+	    arith_apply(ARITH_ADD, ai, aj);
+	}
+	goto_next_instruction();
     }
 
-    inline uint32_t xn() const { return reg_1(); }
-    inline uint32_t ai() const { return reg_2(); }
-    inline void set_xn(size_t n) { set_reg_1(n); }
+    inline void arith_sub(uint32_t ai, uint32_t aj)
+    {
+	int64_t x, y;
+	if (arith_small(ai, aj, x, y) && arith_fits(x - y)) {
+	    a(ai) = common::int_cell(x - y);
+	} else {
+	    arith_apply(ARITH_SUB, ai, aj);
+	}
+	goto_next_instruction();
+    }
 
-    inline static void init() {
-	static bool init_ = [] {
-	    register_printer(&invoke, &print);
-	    return true; } ();
-	static_cast<void>(init_);
+    inline void arith_mul(uint32_t ai, uint32_t aj)
+    {
+	int64_t x, y, r;
+	if (arith_small(ai, aj, x, y) && !__builtin_mul_overflow(x, y, &r) &&
+	    arith_fits(r)) {
+	    a(ai) = common::int_cell(r);
+	} else {
+	    arith_apply(ARITH_MUL, ai, aj);
+	}
+	goto_next_instruction();
     }
 
-    static void invoke(wam_interpreter &interp, wam_instruction_base *self)
+    inline void arith_idiv(uint32_t ai, uint32_t aj)
     {
-        auto self1 = reinterpret_cast<wam_instruction<PUT_VARIABLE_X> *>(self);
-        interp.put_variable_x(self1->xn(), self1->ai());
+	int64_t x, y;
+	if (arith_small(ai, aj, x, y) && y != 0 && arith_fits(x / y)) {
+	    a(ai) = common::int_cell(x / y);
+	} else {
+	    arith_apply(ARITH_IDIV, ai, aj);
+	}
+	goto_next_instruction();
     }
 
-    static void print(std::ostream &out, wam_interpreter &interp, wam_instruction_base *self)
+    inline void arith_mod(uint32_t ai, uint32_t aj)
     {
-        auto self1 = reinterpret_cast<wam_instruction<PUT_VARIABLE_X> *>(self);
-        out << "put_variable x" << self1->xn() << ", a" << self1->ai();
+	int64_t x, y;
+	if (arith_small(ai, aj, x, y) && y != 0) {
+	    // The result has the sign of the divisor
+	    int64_t r = x % y;
+	    if (r != 0 && (r < 0) != (y < 0)) {
+		r += y;
+	    }
+	    a(ai) = common::int_cell(r);
+	} else {
+	    arith_apply(ARITH_MOD, ai, aj);
+	}
+	goto_next_instruction();
     }
-};
 
-template<> class wam_instruction<PUT_VARIABLE_Y> : public wam_instruction_binary_reg {
-public:
-    inline wam_instruction(uint32_t yn, uint32_t ai) :
-	wam_instruction_binary_reg(&invoke, sizeof(*this), PUT_VARIABLE_Y,
-				   yn, ai) {
-        init();
+    inline void arith_shl(uint32_t ai, uint32_t aj)
+    {
+	int64_t x, y;
+	if (arith_small(ai, aj, x, y) && y >= 0 && y < 64) {
+	    __int128 v = static_cast<__int128>(x) << y;
+	    if (v >= common::int_cell::min().value() &&
+		v <= common::int_cell::max().value()) {
+		a(ai) = common::int_cell(static_cast<int64_t>(v));
+		goto_next_instruction();
+		return;
+	    }
+	}
+	arith_apply(ARITH_SHL, ai, aj);
+	goto_next_instruction();
     }
 
-    static inline void init() {
+    inline void arith_shr(uint32_t ai, uint32_t aj)
+    {
+	int64_t x, y;
+	if (arith_small(ai, aj, x, y) && y >= 0) {
+	    a(ai) = common::int_cell(x >> (y < 63 ? y : 63));
+	} else {
+	    arith_apply(ARITH_SHR, ai, aj);
+	}
+	goto_next_instruction();
+    }
+
+    // -1, 0 or 1
+    inline int arith_compare(uint32_t ai, uint32_t aj)
+    {
+	int64_t x, y;
+	if (arith_small(ai, aj, x, y)) {
+	    return x < y ? -1 : (x > y ? 1 : 0);
+	}
+	return arith_compare_big(ai, aj);
+    }
+
+    // Continue if ok, otherwise backtrack
+    inline void guard(bool ok)
+    {
+	if (ok) {
+	    goto_next_instruction();
+	} else {
+	    backtrack();
+	}
+    }
+
+    void arith_apply(wam_instruction_type op, uint32_t ai, uint32_t aj);
+    int arith_compare_big(uint32_t ai, uint32_t aj);
+
+    //
+    // Inlined type tests and term comparisons (the same tests as the
+    // builtins, but without marshalling the arguments.) A failed test
+    // backtracks, i.e. it takes the next clause or else branch.
+    //
+    inline bool is_compound(term t)
+    {
+	return t.tag() == common::tag_t::STR && functor(t).arity() > 0;
+    }
+
+    inline void test_var(uint32_t ai)
+    {
+	guard(deref(a(ai)).tag() == common::tag_t::REF);
+    }
+
+    inline void test_nonvar(uint32_t ai)
+    {
+	guard(deref(a(ai)).tag() != common::tag_t::REF);
+    }
+
+    inline void test_atom(uint32_t ai)
+    {
+	guard(is_atom(deref(a(ai))));
+    }
+
+    inline void test_integer(uint32_t ai)
+    {
+	guard(deref(a(ai)).tag() == common::tag_t::INT);
+    }
+
+    inline void test_compound(uint32_t ai)
+    {
+	guard(is_compound(deref(a(ai))));
+    }
+
+    inline void test_callable(uint32_t ai)
+    {
+	term t = deref(a(ai));
+	guard(is_atom(t) || is_compound(t));
+    }
+
+    inline void test_eq(uint32_t ai, uint32_t aj)
+    {
+	guard(standard_order(deref(a(ai)), deref(a(aj))) == 0);
+    }
+
+    inline void test_ne(uint32_t ai, uint32_t aj)
+    {
+	guard(standard_order(deref(a(ai)), deref(a(aj))) != 0);
+    }
+
+    // As builtins::functor_3 (and, as it unifies, the frozen closures
+    // are checked like for any builtin.)
+    inline void functor_()
+    {
+	goto_next_instruction();
+	term t = deref(a(0));
+	bool ok;
+	switch (t.tag()) {
+	case common::tag_t::INT:
+	case common::tag_t::BIG:
+	    ok = unify(a(1), t) && unify(a(2), common::int_cell(0));
+	    break;
+	case common::tag_t::STR:
+	case common::tag_t::CON: {
+	    common::con_cell f = functor(t);
+	    ok = unify(a(1), to_atom(f)) &&
+		 unify(a(2), common::int_cell(f.arity()));
+	    break;
+	    }
+	default: {
+	    term args[3] = { t, deref(a(1)), deref(a(2)) };
+	    ok = builtins::functor_3(*this, 3, args);
+	    break;
+	    }
+	}
+	if (!ok) {
+	    backtrack();
+	} else {
+	    check_frozen();
+	}
+    }
+
+    inline void cost(uint64_t c)
+    {
+	add_accumulated_cost(c);
+	goto_next_instruction();
+    }
+
+    //
+    // Superinstructions
+    //
+
+    // get_list ai + unify_variable xn1 + unify_variable xn2
+    inline void get_list_a_uv2(uint32_t ai, uint32_t xn1, uint32_t xn2)
+    {
+	term t = deref(a(ai));
+	switch (t.tag()) {
+	case common::tag_t::REF: {
+	    term s = new_term_str(DOTTED_PAIR);
+	    auto ref = static_cast<common::ref_cell &>(t);
+	    bind(ref, s);
+	    mode_ = WRITE;
+	    x(xn1) = new_ref();
+	    x(xn2) = new_ref();
+	    register_s_ += 2;
+	    break;
+	    }
+	case common::tag_t::STR: {
+	    auto str = static_cast<common::str_cell &>(t);
+	    if (functor(str) != DOTTED_PAIR) {
+		backtrack();
+		return;
+	    }
+	    mode_ = READ;
+	    x(xn1) = heap_get(str.index() + 1);
+	    x(xn2) = heap_get(str.index() + 2);
+	    register_s_ = str.index() + 3;
+	    break;
+	    }
+	default:
+	    backtrack();
+	    return;
+	}
+	goto_next_instruction();
+    }
+
+    // put_value xn1, ai1 + put_value xn2, ai2
+    inline void put_value_x2(uint32_t xn1, uint32_t ai1,
+			     uint32_t xn2, uint32_t ai2)
+    {
+	a(ai1) = x(xn1);
+	a(ai2) = x(xn2);
+	goto_next_instruction();
+    }
+
+    friend class test_wam_interpreter;
+};
+
+template<> class wam_instruction<PUT_VARIABLE_X> : public wam_instruction_binary_reg {
+public:
+    inline wam_instruction(uint32_t xn, uint32_t ai) :
+	wam_instruction_binary_reg(&invoke, sizeof(*this), PUT_VARIABLE_X,
+				   xn, ai) {
+        init();
+    }
+
+    inline uint32_t xn() const { return reg_1(); }
+    inline uint32_t ai() const { return reg_2(); }
+    inline void set_xn(size_t n) { set_reg_1(n); }
+
+    inline static void init() {
+	static bool init_ = [] {
+	    register_printer(&invoke, &print);
+	    return true; } ();
+	static_cast<void>(init_);
+    }
+
+    static void invoke(wam_interpreter &interp, wam_instruction_base *self)
+    {
+        auto self1 = reinterpret_cast<wam_instruction<PUT_VARIABLE_X> *>(self);
+        interp.put_variable_x(self1->xn(), self1->ai());
+    }
+
+    static void print(std::ostream &out, wam_interpreter &interp, wam_instruction_base *self)
+    {
+        auto self1 = reinterpret_cast<wam_instruction<PUT_VARIABLE_X> *>(self);
+        out << "put_variable x" << self1->xn() << ", a" << self1->ai();
+    }
+};
+
+template<> class wam_instruction<PUT_VARIABLE_Y> : public wam_instruction_binary_reg {
+public:
+    inline wam_instruction(uint32_t yn, uint32_t ai) :
+	wam_instruction_binary_reg(&invoke, sizeof(*this), PUT_VARIABLE_Y,
+				   yn, ai) {
+        init();
+    }
+
+    static inline void init() {
 	static bool init_ = [] {
 	    register_printer(&invoke, &print);
 	    return true; } ();
@@ -3078,12 +3670,6 @@ inline void wam_instruction<CALL>::print(std::ostream &out, wam_interpreter &int
     out << ", " << self1->num_y();
 }
 
-inline void wam_instruction<CALL>::updater(wam_instruction_base *self, code_t *old_base, code_t *new_base)
-{
-    auto self1 = reinterpret_cast<wam_instruction<CALL> *>(self);
-    self1->update(old_base, new_base);
-}
-
 template<> class wam_instruction<EXECUTE> : public wam_instruction_code_point {
 public:
     inline wam_instruction(common::con_cell l) :
@@ -3094,16 +3680,10 @@ public:
     static inline void init() {
 	static bool init_ = [] {
 	    register_printer(&invoke, &print);
-	    register_updater(&invoke, &updater);
 	    return true; } ();
 	static_cast<void>(init_);
     }
 
-    inline void update(code_t *old_base, code_t *new_base)
-    {
-	update_ptr(p(), old_base, new_base);
-    }
-
     inline const code_point & p() const { return cp(); }
     inline code_point & p() { return cp(); }
 
@@ -3121,12 +3701,6 @@ public:
 	interp.execute(self1->p(), self1->arity());
     }
 
-    static void updater(wam_instruction_base *self, code_t *old_base, code_t *new_base)
-    {
-	auto self1 = reinterpret_cast<wam_instruction<EXECUTE> *>(self);
-	self1->update(old_base, new_base);	
-    }
-
     static void print(std::ostream &out, wam_interpreter &interp, wam_instruction_base *self)
     {
 	auto self1 = reinterpret_cast<wam_instruction<EXECUTE> *>(self);
@@ -3199,7 +3773,6 @@ public:
     static inline void init() {
 	static bool init = [] {
  	    register_printer(&invoke, &print);
- 	    register_updater(&invoke, &updater);
 	    return true; } ();
 	static_cast<void>(init);
     }
@@ -3207,11 +3780,6 @@ public:
     inline const code_point & p() const { return cp(); }
     inline code_point & p() { return cp(); }
 
-    inline void update(code_t *old_base, code_t *new_base)
-    {
-	update_ptr(p(), old_base, new_base);
-    }
-
     static void invoke(wam_interpreter &interp, wam_instruction_base *self)
     {
 	auto self1 = reinterpret_cast<wam_instruction<TRY_ME_ELSE> *>(self);
@@ -3224,11 +3792,6 @@ public:
 	out << "try_me_else " << interp.to_string(self1->p());
     }
 
-    static void updater(wam_instruction_base *self, code_t *old_base, code_t *new_base)
-    {
-	auto self1 = reinterpret_cast<wam_instruction<TRY_ME_ELSE> *>(self);
-	self1->update(old_base, new_base);
-    }
 };
 
 template<> class wam_instruction<RETRY_ME_ELSE> : public wam_instruction_code_point {
@@ -3241,7 +3804,6 @@ public:
     static inline void init() {
 	static bool init = [] {
  	    register_printer(&invoke, &print);
- 	    register_updater(&invoke, &updater);
 	    return true; } ();
 	static_cast<void>(init);
     }
@@ -3249,11 +3811,6 @@ public:
     inline const code_point & p() const { return cp(); }
     inline code_point & p() { return cp(); }
 
-    inline void update(code_t *old_base, code_t *new_base)
-    {
-        update_ptr(p(), old_base, new_base);
-    }
-
     static void invoke(wam_interpreter &interp, wam_instruction_base *self)
     {
 	auto self1 = reinterpret_cast<wam_instruction<RETRY_ME_ELSE> *>(self);
@@ -3266,11 +3823,6 @@ public:
 	out << "retry_me_else " << interp.to_string(self1->p());
     }
 
-    static void updater(wam_instruction_base *self, code_t *old_base, code_t *new_base)
-    {
-	auto self1 = reinterpret_cast<wam_instruction<RETRY_ME_ELSE> *>(self);
-	self1->update(old_base, new_base);
-    }
 };
 
 template<> class wam_instruction<TRUST_ME> : public wam_instruction_base {
@@ -3311,7 +3863,6 @@ public:
     static inline void init() {
 	static bool init = [] {
  	    register_printer(&invoke, &print);
- 	    register_updater(&invoke, &updater);
 	    return true; } ();
 	static_cast<void>(init);
     }
@@ -3319,11 +3870,6 @@ public:
     inline const code_point & p() const { return cp(); }
     inline code_point & p() { return cp(); }
 
-    inline void update(code_t *old_base, code_t *new_base)
-    {
-	update_ptr(p(), old_base, new_base);
-    }
-
     static void invoke(wam_interpreter &interp, wam_instruction_base *self)
     {
 	auto self1 = reinterpret_cast<wam_instruction<TRY> *>(self);
@@ -3336,11 +3882,6 @@ public:
 	out << "try " << interp.to_string(self1->p());
     }
 
-    static void updater(wam_instruction_base *self, code_t *old_base, code_t *new_base)
-    {
-	auto self1 = reinterpret_cast<wam_instruction<TRY> *>(self);
-	self1->update(old_base, new_base);
-    }
 };
 
 template<> class wam_instruction<RETRY> : public wam_instruction_code_point {
@@ -3353,7 +3894,6 @@ public:
     static inline void init() {
 	static bool init = [] {
  	    register_printer(&invoke, &print);
- 	    register_updater(&invoke, &updater);
 	    return true; } ();
 	static_cast<void>(init);
     }
@@ -3361,11 +3901,6 @@ public:
     inline const code_point & p() const { return cp(); }
     inline code_point & p() { return cp(); }
 
-    inline void update(code_t *old_base, code_t *new_base)
-    {
-	update_ptr(p(), old_base, new_base);
-    }
-
     static void invoke(wam_interpreter &interp, wam_instruction_base *self)
     {
 	auto self1 = reinterpret_cast<wam_instruction<RETRY> *>(self);
@@ -3378,11 +3913,6 @@ public:
 	out << "retry " << interp.to_string(self1->p());
     }
 
-    static void updater(wam_instruction_base *self, code_t *old_base, code_t *new_base)
-    {
-	auto self1 = reinterpret_cast<wam_instruction<RETRY> *>(self);
-	self1->update(old_base, new_base);
-    }
 };
 
 template<> class wam_instruction<TRUST> : public wam_instruction_code_point {
@@ -3395,7 +3925,6 @@ public:
     static inline void init() {
 	static bool init = [] {
  	    register_printer(&invoke, &print);
- 	    register_updater(&invoke, &updater);
 	    return true; } ();
 	static_cast<void>(init);
     }
@@ -3403,11 +3932,6 @@ public:
     inline const code_point & p() const { return cp(); }
     inline code_point & p() { return cp(); }
 
-    inline void update(code_t *old_base, code_t *new_base)
-    {
-	update_ptr(p(), old_base, new_base);
-    }
-
     static void invoke(wam_interpreter &interp, wam_instruction_base *self)
     {
 	auto self1 = reinterpret_cast<wam_instruction<TRUST> *>(self);
@@ -3420,11 +3944,6 @@ public:
 	out << "trust " << interp.to_string(self1->p());
     }
 
-    static void updater(wam_instruction_base *self, code_t *old_base, code_t *new_base)
-    {
-	auto self1 = reinterpret_cast<wam_instruction<TRUST> *>(self);
-	self1->update(old_base, new_base);
-    }
 };
 
 template<> class wam_instruction<SWITCH_ON_TERM> : public wam_instruction_base {
@@ -3441,7 +3960,6 @@ public:
     static inline void init() {
 	static bool init = [] {
  	    register_printer(&invoke, &print);
- 	    register_updater(&invoke, &updater);
 	    return true; } ();
 	static_cast<void>(init);
     }
@@ -3451,14 +3969,6 @@ public:
     inline code_point & pl() { return pl_; }
     inline code_point & ps() { return ps_; }
 
-    inline void update(code_t *old_base, code_t *new_base)
-    {
-        update_ptr(pv_, old_base, new_base);
-	update_ptr(pc_, old_base, new_base);
-	update_ptr(pl_, old_base, new_base);
-	update_ptr(ps_, old_base, new_base);
-    }
-
     static void invoke(wam_interpreter &interp, wam_instruction_base *self)
     {
 	auto self1 = reinterpret_cast<wam_instruction<SWITCH_ON_TERM> *>(self);
@@ -3494,29 +4004,23 @@ public:
 	}
     }
 
-    static void updater(wam_instruction_base *self, code_t *old_base, code_t *new_base)
-    {
-	auto self1 = reinterpret_cast<wam_instruction<SWITCH_ON_TERM> *>(self);
-	self1->update(old_base, new_base);
-    }
-
     code_point pv_;
     code_point pc_;
     code_point pl_;
     code_point ps_;
 };
 
-template<> class wam_instruction<SWITCH_ON_CONSTANT> : public wam_instruction_hash_map {
+template<> class wam_instruction<SWITCH_ON_CONSTANT> : public wam_instruction_switch_table {
 public:
-    inline wam_instruction(wam_hash_map *map) :
-      wam_instruction_hash_map(&invoke, sizeof(*this), SWITCH_ON_CONSTANT,map){
+    // Use new_switch (the table follows the instruction)
+    inline wam_instruction(uint64_t sz_bytes) :
+      wam_instruction_switch_table(&invoke, sz_bytes, SWITCH_ON_CONSTANT) {
         init();
     }
 
     static inline void init() {
 	static bool init = [] {
  	    register_printer(&invoke, &print);
- 	    register_updater(&invoke, &updater);
 	    return true; } ();
 	static_cast<void>(init);
     }
@@ -3524,7 +4028,7 @@ public:
     static void invoke(wam_interpreter &interp, wam_instruction_base *self)
     {
 	auto self1 = reinterpret_cast<wam_instruction<SWITCH_ON_CONSTANT> *>(self);
-	interp.switch_on_constant(self1->map());
+	interp.switch_on_constant(*self1);
     }
 
     static void print(std::ostream &out, wam_interpreter &interp, wam_instruction_base *self)
@@ -3532,28 +4036,26 @@ public:
 	auto self1 = reinterpret_cast<wam_instruction<SWITCH_ON_CONSTANT> *>(self);
 	out << "switch_on_constant ";
 	bool first = true;
-	for (auto &v : self1->map()) {
+	for (size_t i = 0; i < self1->num_slots(); i++) {
+	    if (self1->is_empty_slot(i)) continue;
 	    if (!first) out << ", ";
-	    out << interp.to_string(v.first) << "->" << interp.to_string(v.second);
+	    out << interp.to_string(self1->key(i)) << "->" << interp.to_string(self1->value(i));
 	    first = false;
 	}
     }
-
-    wam_hash_map *map_;
 };
 
-template<> class wam_instruction<SWITCH_ON_STRUCTURE> : public wam_instruction_hash_map {
+template<> class wam_instruction<SWITCH_ON_STRUCTURE> : public wam_instruction_switch_table {
 public:
-    inline wam_instruction(wam_hash_map *map) :
-        wam_instruction_hash_map(&invoke, sizeof(*this), SWITCH_ON_STRUCTURE,
-				 map) {
+    // Use new_switch (the table follows the instruction)
+    inline wam_instruction(uint64_t sz_bytes) :
+        wam_instruction_switch_table(&invoke, sz_bytes, SWITCH_ON_STRUCTURE) {
         init();
     }
 
     static inline void init() {
 	static bool init = [] {
  	    register_printer(&invoke, &print);
- 	    register_updater(&invoke, &updater);
 	    return true; } ();
 	static_cast<void>(init);
     }
@@ -3561,7 +4063,7 @@ public:
     static void invoke(wam_interpreter &interp, wam_instruction_base *self)
     {
 	auto self1 = reinterpret_cast<wam_instruction<SWITCH_ON_STRUCTURE> *>(self);
-	interp.switch_on_structure(self1->map());
+	interp.switch_on_structure(*self1);
     }
 
     static void print(std::ostream &out, wam_interpreter &interp, wam_instruction_base *self)
@@ -3569,20 +4071,64 @@ public:
 	auto self1 = reinterpret_cast<wam_instruction<SWITCH_ON_STRUCTURE> *>(self);
 	out << "switch_on_structure ";
 	bool first = true;
-	for (auto &v : self1->map()) {
+	for (size_t i = 0; i < self1->num_slots(); i++) {
+	    if (self1->is_empty_slot(i)) continue;
 	    if (!first) out << ", ";
-	    auto str = static_cast<const common::str_cell &>(v.first);
-	    auto f = interp.functor(str);
-	    out << interp.to_string(v.first) << "/" << f.arity() << "->" << interp.to_string(v.second);
+	    auto k = self1->key(i);
+	    auto f = static_cast<const common::con_cell &>(k);
+	    out << interp.to_string(f) << "/" << f.arity() << "->" << interp.to_string(self1->value(i));
 	    first = false;
 	}
     }
+};
+
+template<> class wam_instruction<SWITCH_ON_ARG> : public wam_instruction_switch_table {
+public:
+    // Use new_switch (the table follows the instruction)
+    inline wam_instruction(uint64_t sz_bytes, uint32_t ai, code_point pv) :
+        wam_instruction_switch_table(&invoke, sz_bytes, SWITCH_ON_ARG),
+	pv_(pv), ai_(ai) {
+        init();
+    }
 
-    static void updater(wam_instruction_base *self, code_t *old_base, code_t *new_base)
+    static inline void init() {
+	static bool init = [] {
+ 	    register_printer(&invoke, &print);
+	    return true; } ();
+	static_cast<void>(init);
+    }
+
+    inline uint32_t ai() const { return ai_; }
+    inline code_point & pv() { return pv_; }
+
+    static void invoke(wam_interpreter &interp, wam_instruction_base *self)
     {
-	auto self1 = reinterpret_cast<wam_instruction<SWITCH_ON_STRUCTURE> *>(self);
-	self1->update(old_base, new_base);
+	auto self1 = reinterpret_cast<wam_instruction<SWITCH_ON_ARG> *>(self);
+	interp.switch_on_arg(self1->ai(), self1->pv(), *self1);
+    }
+
+    static void print(std::ostream &out, wam_interpreter &interp, wam_instruction_base *self)
+    {
+	auto self1 = reinterpret_cast<wam_instruction<SWITCH_ON_ARG> *>(self);
+	out << "switch_on_arg a" << self1->ai() << ", V->"
+	    << interp.to_string(self1->pv());
+	for (size_t i = 0; i < self1->num_slots(); i++) {
+	    if (self1->is_empty_slot(i)) continue;
+	    auto k = self1->key(i);
+	    out << ", " << interp.to_string(k);
+	    if (k.tag() == common::tag_t::CON) {
+		auto f = static_cast<const common::con_cell &>(k);
+		if (f.arity() > 0) {
+		    out << "/" << f.arity();
+		}
+	    }
+	    out << "->" << interp.to_string(self1->value(i));
+	}
     }
+
+private:
+    code_point pv_;
+    uint32_t ai_;
 };
 
 template<> class wam_instruction<NECK_CUT> : public wam_instruction_base {
@@ -3681,7 +4227,6 @@ public:
     static inline void init() {
 	static bool init = [] {
  	    register_printer(&invoke, &print);
- 	    register_updater(&invoke, &updater);
 	    return true; } ();
 	static_cast<void>(init);
     }
@@ -3689,11 +4234,6 @@ public:
     inline const code_point & p() const { return cp(); }
     inline code_point & p() { return cp(); }
 
-    inline void update(code_t *old_base, code_t *new_base)
-    {
-	update_ptr(p(), old_base, new_base);
-    }
-
     static void invoke(wam_interpreter &interp, wam_instruction_base *self)
     {
 	auto self1 = reinterpret_cast<wam_instruction<GOTO> *>(self);
@@ -3706,11 +4246,6 @@ public:
 	out << "goto " << interp.to_string(self1->p());
     }
 
-    static void updater(wam_instruction_base *self, code_t *old_base, code_t *new_base)
-    {
-	auto self1 = reinterpret_cast<wam_instruction<GOTO> *>(self);
-	self1->update(old_base, new_base);
-    }
 };
 
 template<> class wam_instruction<RESET_LEVEL> : public wam_instruction_code_point_reg {
@@ -3745,6 +4280,731 @@ public:
     }
 };
 
+template<> class wam_instruction<ARITH_ADD> : public wam_instruction_binary_reg {
+public:
+    inline wam_instruction(uint32_t ai, uint32_t aj) :
+	wam_instruction_binary_reg(&invoke, sizeof(*this), ARITH_ADD, ai, aj) {
+        init();
+    }
+
+    static inline void init() {
+	static bool init_ = [] {
+	    register_printer(&invoke, &print);
+	    return true; } ();
+	static_cast<void>(init_);
+    }
+
+    inline uint32_t ai() const { return reg_1(); }
+    inline uint32_t aj() const { return reg_2(); }
+
+    static void invoke(wam_interpreter &interp, wam_instruction_base *self)
+    {
+        auto self1 = reinterpret_cast<wam_instruction<ARITH_ADD> *>(self);
+        interp.arith_add(self1->ai(), self1->aj());
+    }
+
+    static void print(std::ostream &out, wam_interpreter &interp, wam_instruction_base *self)
+    {
+        auto self1 = reinterpret_cast<wam_instruction<ARITH_ADD> *>(self);
+        out << "add a" << self1->ai() << ", a" << self1->aj();
+    }
+};
+
+template<> class wam_instruction<ARITH_SUB> : public wam_instruction_binary_reg {
+public:
+    inline wam_instruction(uint32_t ai, uint32_t aj) :
+	wam_instruction_binary_reg(&invoke, sizeof(*this), ARITH_SUB, ai, aj) {
+        init();
+    }
+
+    static inline void init() {
+	static bool init_ = [] {
+	    register_printer(&invoke, &print);
+	    return true; } ();
+	static_cast<void>(init_);
+    }
+
+    inline uint32_t ai() const { return reg_1(); }
+    inline uint32_t aj() const { return reg_2(); }
+
+    static void invoke(wam_interpreter &interp, wam_instruction_base *self)
+    {
+        auto self1 = reinterpret_cast<wam_instruction<ARITH_SUB> *>(self);
+        interp.arith_sub(self1->ai(), self1->aj());
+    }
+
+    static void print(std::ostream &out, wam_interpreter &interp, wam_instruction_base *self)
+    {
+        auto self1 = reinterpret_cast<wam_instruction<ARITH_SUB> *>(self);
+        out << "sub a" << self1->ai() << ", a" << self1->aj();
+    }
+};
+
+template<> class wam_instruction<ARITH_MUL> : public wam_instruction_binary_reg {
+public:
+    inline wam_instruction(uint32_t ai, uint32_t aj) :
+	wam_instruction_binary_reg(&invoke, sizeof(*this), ARITH_MUL, ai, aj) {
+        init();
+    }
+
+    static inline void init() {
+	static bool init_ = [] {
+	    register_printer(&invoke, &print);
+	    return true; } ();
+	static_cast<void>(init_);
+    }
+
+    inline uint32_t ai() const { return reg_1(); }
+    inline uint32_t aj() const { return reg_2(); }
+
+    static void invoke(wam_interpreter &interp, wam_instruction_base *self)
+    {
+        auto self1 = reinterpret_cast<wam_instruction<ARITH_MUL> *>(self);
+        interp.arith_mul(self1->ai(), self1->aj());
+    }
+
+    static void print(std::ostream &out, wam_interpreter &interp, wam_instruction_base *self)
+    {
+        auto self1 = reinterpret_cast<wam_instruction<ARITH_MUL> *>(self);
+        out << "mul a" << self1->ai() << ", a" << self1->aj();
+    }
+};
+
+template<> class wam_instruction<ARITH_IDIV> : public wam_instruction_binary_reg {
+public:
+    inline wam_instruction(uint32_t ai, uint32_t aj) :
+	wam_instruction_binary_reg(&invoke, sizeof(*this), ARITH_IDIV, ai, aj) {
+        init();
+    }
+
+    static inline void init() {
+	static bool init_ = [] {
+	    register_printer(&invoke, &print);
+	    return true; } ();
+	static_cast<void>(init_);
+    }
+
+    inline uint32_t ai() const { return reg_1(); }
+    inline uint32_t aj() const { return reg_2(); }
+
+    static void invoke(wam_interpreter &interp, wam_instruction_base *self)
+    {
+        auto self1 = reinterpret_cast<wam_instruction<ARITH_IDIV> *>(self);
+        interp.arith_idiv(self1->ai(), self1->aj());
+    }
+
+    static void print(std::ostream &out, wam_interpreter &interp, wam_instruction_base *self)
+    {
+        auto self1 = reinterpret_cast<wam_instruction<ARITH_IDIV> *>(self);
+        out << "idiv a" << self1->ai() << ", a" << self1->aj();
+    }
+};
+
+template<> class wam_instruction<ARITH_MOD> : public wam_instruction_binary_reg {
+public:
+    inline wam_instruction(uint32_t ai, uint32_t aj) :
+	wam_instruction_binary_reg(&invoke, sizeof(*this), ARITH_MOD, ai, aj) {
+        init();
+    }
+
+    static inline void init() {
+	static bool init_ = [] {
+	    register_printer(&invoke, &print);
+	    return true; } ();
+	static_cast<void>(init_);
+    }
+
+    inline uint32_t ai() const { return reg_1(); }
+    inline uint32_t aj() const { return reg_2(); }
+
+    static void invoke(wam_interpreter &interp, wam_instruction_base *self)
+    {
+        auto self1 = reinterpret_cast<wam_instruction<ARITH_MOD> *>(self);
+        interp.arith_mod(self1->ai(), self1->aj());
+    }
+
+    static void print(std::ostream &out, wam_interpreter &interp, wam_instruction_base *self)
+    {
+        auto self1 = reinterpret_cast<wam_instruction<ARITH_MOD> *>(self);
+        out << "mod a" << self1->ai() << ", a" << self1->aj();
+    }
+};
+
+template<> class wam_instruction<ARITH_SHL> : public wam_instruction_binary_reg {
+public:
+    inline wam_instruction(uint32_t ai, uint32_t aj) :
+	wam_instruction_binary_reg(&invoke, sizeof(*this), ARITH_SHL, ai, aj) {
+        init();
+    }
+
+    static inline void init() {
+	static bool init_ = [] {
+	    register_printer(&invoke, &print);
+	    return true; } ();
+	static_cast<void>(init_);
+    }
+
+    inline uint32_t ai() const { return reg_1(); }
+    inline uint32_t aj() const { return reg_2(); }
+
+    static void invoke(wam_interpreter &interp, wam_instruction_base *self)
+    {
+        auto self1 = reinterpret_cast<wam_instruction<ARITH_SHL> *>(self);
+        interp.arith_shl(self1->ai(), self1->aj());
+    }
+
+    static void print(std::ostream &out, wam_interpreter &interp, wam_instruction_base *self)
+    {
+        auto self1 = reinterpret_cast<wam_instruction<ARITH_SHL> *>(self);
+        out << "shl a" << self1->ai() << ", a" << self1->aj();
+    }
+};
+
+template<> class wam_instruction<ARITH_SHR> : public wam_instruction_binary_reg {
+public:
+    inline wam_instruction(uint32_t ai, uint32_t aj) :
+	wam_instruction_binary_reg(&invoke, sizeof(*this), ARITH_SHR, ai, aj) {
+        init();
+    }
+
+    static inline void init() {
+	static bool init_ = [] {
+	    register_printer(&invoke, &print);
+	    return true; } ();
+	static_cast<void>(init_);
+    }
+
+    inline uint32_t ai() const { return reg_1(); }
+    inline uint32_t aj() const { return reg_2(); }
+
+    static void invoke(wam_interpreter &interp, wam_instruction_base *self)
+    {
+        auto self1 = reinterpret_cast<wam_instruction<ARITH_SHR> *>(self);
+        interp.arith_shr(self1->ai(), self1->aj());
+    }
+
+    static void print(std::ostream &out, wam_interpreter &interp, wam_instruction_base *self)
+    {
+        auto self1 = reinterpret_cast<wam_instruction<ARITH_SHR> *>(self);
+        out << "shr a" << self1->ai() << ", a" << self1->aj();
+    }
+};
+
+template<> class wam_instruction<ARITH_LT> : public wam_instruction_binary_reg {
+public:
+    inline wam_instruction(uint32_t ai, uint32_t aj) :
+	wam_instruction_binary_reg(&invoke, sizeof(*this), ARITH_LT, ai, aj) {
+        init();
+    }
+
+    static inline void init() {
+	static bool init_ = [] {
+	    register_printer(&invoke, &print);
+	    return true; } ();
+	static_cast<void>(init_);
+    }
+
+    inline uint32_t ai() const { return reg_1(); }
+    inline uint32_t aj() const { return reg_2(); }
+
+    static void invoke(wam_interpreter &interp, wam_instruction_base *self)
+    {
+        auto self1 = reinterpret_cast<wam_instruction<ARITH_LT> *>(self);
+        interp.guard(interp.arith_compare(self1->ai(), self1->aj()) < 0);
+    }
+
+    static void print(std::ostream &out, wam_interpreter &interp, wam_instruction_base *self)
+    {
+        auto self1 = reinterpret_cast<wam_instruction<ARITH_LT> *>(self);
+        out << "lt a" << self1->ai() << ", a" << self1->aj();
+    }
+};
+
+template<> class wam_instruction<ARITH_LE> : public wam_instruction_binary_reg {
+public:
+    inline wam_instruction(uint32_t ai, uint32_t aj) :
+	wam_instruction_binary_reg(&invoke, sizeof(*this), ARITH_LE, ai, aj) {
+        init();
+    }
+
+    static inline void init() {
+	static bool init_ = [] {
+	    register_printer(&invoke, &print);
+	    return true; } ();
+	static_cast<void>(init_);
+    }
+
+    inline uint32_t ai() const { return reg_1(); }
+    inline uint32_t aj() const { return reg_2(); }
+
+    static void invoke(wam_interpreter &interp, wam_instruction_base *self)
+    {
+        auto self1 = reinterpret_cast<wam_instruction<ARITH_LE> *>(self);
+        interp.guard(interp.arith_compare(self1->ai(), self1->aj()) <= 0);
+    }
+
+    static void print(std::ostream &out, wam_interpreter &interp, wam_instruction_base *self)
+    {
+        auto self1 = reinterpret_cast<wam_instruction<ARITH_LE> *>(self);
+        out << "le a" << self1->ai() << ", a" << self1->aj();
+    }
+};
+
+template<> class wam_instruction<ARITH_EQ> : public wam_instruction_binary_reg {
+public:
+    inline wam_instruction(uint32_t ai, uint32_t aj) :
+	wam_instruction_binary_reg(&invoke, sizeof(*this), ARITH_EQ, ai, aj) {
+        init();
+    }
+
+    static inline void init() {
+	static bool init_ = [] {
+	    register_printer(&invoke, &print);
+	    return true; } ();
+	static_cast<void>(init_);
+    }
+
+    inline uint32_t ai() const { return reg_1(); }
+    inline uint32_t aj() const { return reg_2(); }
+
+    static void invoke(wam_interpreter &interp, wam_instruction_base *self)
+    {
+        auto self1 = reinterpret_cast<wam_instruction<ARITH_EQ> *>(self);
+        interp.guard(interp.arith_compare(self1->ai(), self1->aj()) == 0);
+    }
+
+    static void print(std::ostream &out, wam_interpreter &interp, wam_instruction_base *self)
+    {
+        auto self1 = reinterpret_cast<wam_instruction<ARITH_EQ> *>(self);
+        out << "eq a" << self1->ai() << ", a" << self1->aj();
+    }
+};
+
+template<> class wam_instruction<ARITH_NE> : public wam_instruction_binary_reg {
+public:
+    inline wam_instruction(uint32_t ai, uint32_t aj) :
+	wam_instruction_binary_reg(&invoke, sizeof(*this), ARITH_NE, ai, aj) {
+        init();
+    }
+
+    static inline void init() {
+	static bool init_ = [] {
+	    register_printer(&invoke, &print);
+	    return true; } ();
+	static_cast<void>(init_);
+    }
+
+    inline uint32_t ai() const { return reg_1(); }
+    inline uint32_t aj() const { return reg_2(); }
+
+    static void invoke(wam_interpreter &interp, wam_instruction_base *self)
+    {
+        auto self1 = reinterpret_cast<wam_instruction<ARITH_NE> *>(self);
+        interp.guard(interp.arith_compare(self1->ai(), self1->aj()) != 0);
+    }
+
+    static void print(std::ostream &out, wam_interpreter &interp, wam_instruction_base *self)
+    {
+        auto self1 = reinterpret_cast<wam_instruction<ARITH_NE> *>(self);
+        out << "ne a" << self1->ai() << ", a" << self1->aj();
+    }
+};
+
+template<> class wam_instruction<TEST_VAR> : public wam_instruction_unary_reg {
+public:
+    inline wam_instruction(uint32_t ai) :
+	wam_instruction_unary_reg(&invoke, sizeof(*this), TEST_VAR, ai) {
+        init();
+    }
+
+    static inline void init() {
+	static bool init_ = [] {
+	    register_printer(&invoke, &print);
+	    return true; } ();
+	static_cast<void>(init_);
+    }
+
+    inline uint32_t ai() const { return reg(); }
+
+    static void invoke(wam_interpreter &interp, wam_instruction_base *self)
+    {
+        auto self1 = reinterpret_cast<wam_instruction<TEST_VAR> *>(self);
+        interp.test_var(self1->ai());
+    }
+
+    static void print(std::ostream &out, wam_interpreter &interp, wam_instruction_base *self)
+    {
+        auto self1 = reinterpret_cast<wam_instruction<TEST_VAR> *>(self);
+        out << "var a" << self1->ai();
+    }
+};
+
+template<> class wam_instruction<TEST_NONVAR> : public wam_instruction_unary_reg {
+public:
+    inline wam_instruction(uint32_t ai) :
+	wam_instruction_unary_reg(&invoke, sizeof(*this), TEST_NONVAR, ai) {
+        init();
+    }
+
+    static inline void init() {
+	static bool init_ = [] {
+	    register_printer(&invoke, &print);
+	    return true; } ();
+	static_cast<void>(init_);
+    }
+
+    inline uint32_t ai() const { return reg(); }
+
+    static void invoke(wam_interpreter &interp, wam_instruction_base *self)
+    {
+        auto self1 = reinterpret_cast<wam_instruction<TEST_NONVAR> *>(self);
+        interp.test_nonvar(self1->ai());
+    }
+
+    static void print(std::ostream &out, wam_interpreter &interp, wam_instruction_base *self)
+    {
+        auto self1 = reinterpret_cast<wam_instruction<TEST_NONVAR> *>(self);
+        out << "nonvar a" << self1->ai();
+    }
+};
+
+template<> class wam_instruction<TEST_ATOM> : public wam_instruction_unary_reg {
+public:
+    inline wam_instruction(uint32_t ai) :
+	wam_instruction_unary_reg(&invoke, sizeof(*this), TEST_ATOM, ai) {
+        init();
+    }
+
+    static inline void init() {
+	static bool init_ = [] {
+	    register_printer(&invoke, &print);
+	    return true; } ();
+	static_cast<void>(init_);
+    }
+
+    inline uint32_t ai() const { return reg(); }
+
+    static void invoke(wam_interpreter &interp, wam_instruction_base *self)
+    {
+        auto self1 = reinterpret_cast<wam_instruction<TEST_ATOM> *>(self);
+        interp.test_atom(self1->ai());
+    }
+
+    static void print(std::ostream &out, wam_interpreter &interp, wam_instruction_base *self)
+    {
+        auto self1 = reinterpret_cast<wam_instruction<TEST_ATOM> *>(self);
+        out << "atom a" << self1->ai();
+    }
+};
+
+template<> class wam_instruction<TEST_ATOMIC> : public wam_instruction_unary_reg {
+public:
+    inline wam_instruction(uint32_t ai) :
+	wam_instruction_unary_reg(&invoke, sizeof(*this), TEST_ATOMIC, ai) {
+        init();
+    }
+
+    static inline void init() {
+	static bool init_ = [] {
+	    register_printer(&invoke, &print);
+	    return true; } ();
+	static_cast<void>(init_);
+    }
+
+    inline uint32_t ai() const { return reg(); }
+
+    static void invoke(wam_interpreter &interp, wam_instruction_base *self)
+    {
+        auto self1 = reinterpret_cast<wam_instruction<TEST_ATOMIC> *>(self);
+        interp.test_atom(self1->ai());
+    }
+
+    static void print(std::ostream &out, wam_interpreter &interp, wam_instruction_base *self)
+    {
+        auto self1 = reinterpret_cast<wam_instruction<TEST_ATOMIC> *>(self);
+        out << "atomic a" << self1->ai();
+    }
+};
+
+template<> class wam_instruction<TEST_INTEGER> : public wam_instruction_unary_reg {
+public:
+    inline wam_instruction(uint32_t ai) :
+	wam_instruction_unary_reg(&invoke, sizeof(*this), TEST_INTEGER, ai) {
+        init();
+    }
+
+    static inline void init() {
+	static bool init_ = [] {
+	    register_printer(&invoke, &print);
+	    return true; } ();
+	static_cast<void>(init_);
+    }
+
+    inline uint32_t ai() const { return reg(); }
+
+    static void invoke(wam_interpreter &interp, wam_instruction_base *self)
+    {
+        auto self1 = reinterpret_cast<wam_instruction<TEST_INTEGER> *>(self);
+        interp.test_integer(self1->ai());
+    }
+
+    static void print(std::ostream &out, wam_interpreter &interp, wam_instruction_base *self)
+    {
+        auto self1 = reinterpret_cast<wam_instruction<TEST_INTEGER> *>(self);
+        out << "integer a" << self1->ai();
+    }
+};
+
+template<> class wam_instruction<TEST_NUMBER> : public wam_instruction_unary_reg {
+public:
+    inline wam_instruction(uint32_t ai) :
+	wam_instruction_unary_reg(&invoke, sizeof(*this), TEST_NUMBER, ai) {
+        init();
+    }
+
+    static inline void init() {
+	static bool init_ = [] {
+	    register_printer(&invoke, &print);
+	    return true; } ();
+	static_cast<void>(init_);
+    }
+
+    inline uint32_t ai() const { return reg(); }
+
+    static void invoke(wam_interpreter &interp, wam_instruction_base *self)
+    {
+        auto self1 = reinterpret_cast<wam_instruction<TEST_NUMBER> *>(self);
+        interp.test_integer(self1->ai());
+    }
+
+    static void print(std::ostream &out, wam_interpreter &interp, wam_instruction_base *self)
+    {
+        auto self1 = reinterpret_cast<wam_instruction<TEST_NUMBER> *>(self);
+        out << "number a" << self1->ai();
+    }
+};
+
+template<> class wam_instruction<TEST_COMPOUND> : public wam_instruction_unary_reg {
+public:
+    inline wam_instruction(uint32_t ai) :
+	wam_instruction_unary_reg(&invoke, sizeof(*this), TEST_COMPOUND, ai) {
+        init();
+    }
+
+    static inline void init() {
+	static bool init_ = [] {
+	    register_printer(&invoke, &print);
+	    return true; } ();
+	static_cast<void>(init_);
+    }
+
+    inline uint32_t ai() const { return reg(); }
+
+    static void invoke(wam_interpreter &interp, wam_instruction_base *self)
+    {
+        auto self1 = reinterpret_cast<wam_instruction<TEST_COMPOUND> *>(self);
+        interp.test_compound(self1->ai());
+    }
+
+    static void print(std::ostream &out, wam_interpreter &interp, wam_instruction_base *self)
+    {
+        auto self1 = reinterpret_cast<wam_instruction<TEST_COMPOUND> *>(self);
+        out << "compound a" << self1->ai();
+    }
+};
+
+template<> class wam_instruction<TEST_CALLABLE> : public wam_instruction_unary_reg {
+public:
+    inline wam_instruction(uint32_t ai) :
+	wam_instruction_unary_reg(&invoke, sizeof(*this), TEST_CALLABLE, ai) {
+        init();
+    }
+
+    static inline void init() {
+	static bool init_ = [] {
+	    register_printer(&invoke, &print);
+	    return true; } ();
+	static_cast<void>(init_);
+    }
+
+    inline uint32_t ai() const { return reg(); }
+
+    static void invoke(wam_interpreter &interp, wam_instruction_base *self)
+    {
+        auto self1 = reinterpret_cast<wam_instruction<TEST_CALLABLE> *>(self);
+        interp.test_callable(self1->ai());
+    }
+
+    static void print(std::ostream &out, wam_interpreter &interp, wam_instruction_base *self)
+    {
+        auto self1 = reinterpret_cast<wam_instruction<TEST_CALLABLE> *>(self);
+        out << "callable a" << self1->ai();
+    }
+};
+
+template<> class wam_instruction<TEST_EQ> : public wam_instruction_binary_reg {
+public:
+    inline wam_instruction(uint32_t ai, uint32_t aj) :
+	wam_instruction_binary_reg(&invoke, sizeof(*this), TEST_EQ, ai, aj) {
+        init();
+    }
+
+    static inline void init() {
+	static bool init_ = [] {
+	    register_printer(&invoke, &print);
+	    return true; } ();
+	static_cast<void>(init_);
+    }
+
+    inline uint32_t ai() const { return reg_1(); }
+    inline uint32_t aj() const { return reg_2(); }
+
+    static void invoke(wam_interpreter &interp, wam_instruction_base *self)
+    {
+        auto self1 = reinterpret_cast<wam_instruction<TEST_EQ> *>(self);
+        interp.test_eq(self1->ai(), self1->aj());
+    }
+
+    static void print(std::ostream &out, wam_interpreter &interp, wam_instruction_base *self)
+    {
+        auto self1 = reinterpret_cast<wam_instruction<TEST_EQ> *>(self);
+        out << "equals a" << self1->ai() << ", a" << self1->aj();
+    }
+};
+
+template<> class wam_instruction<TEST_NE> : public wam_instruction_binary_reg {
+public:
+    inline wam_instruction(uint32_t ai, uint32_t aj) :
+	wam_instruction_binary_reg(&invoke, sizeof(*this), TEST_NE, ai, aj) {
+        init();
+    }
+
+    static inline void init() {
+	static bool init_ = [] {
+	    register_printer(&invoke, &print);
+	    return true; } ();
+	static_cast<void>(init_);
+    }
+
+    inline uint32_t ai() const { return reg_1(); }
+    inline uint32_t aj() const { return reg_2(); }
+
+    static void invoke(wam_interpreter &interp, wam_instruction_base *self)
+    {
+        auto self1 = reinterpret_cast<wam_instruction<TEST_NE> *>(self);
+        interp.test_ne(self1->ai(), self1->aj());
+    }
+
+    static void print(std::ostream &out, wam_interpreter &interp, wam_instruction_base *self)
+    {
+        auto self1 = reinterpret_cast<wam_instruction<TEST_NE> *>(self);
+        out << "not_equals a" << self1->ai() << ", a" << self1->aj();
+    }
+};
+
+template<> class wam_instruction<FUNCTOR> : public wam_instruction_base {
+public:
+    inline wam_instruction() :
+      wam_instruction_base(&invoke, sizeof(*this), FUNCTOR) {
+      init();
+    }
+
+    static inline void init() {
+	static bool init = [] {
+ 	    register_printer(&invoke, &print);
+	    return true; } ();
+	static_cast<void>(init);
+    }
+
+    static void invoke(wam_interpreter &interp, wam_instruction_base *self)
+    {
+	static_cast<void>(self);
+        interp.functor_();
+    }
+
+    static void print(std::ostream &out, wam_interpreter &interp, wam_instruction_base *self)
+    {
+	static_cast<void>(interp);
+	static_cast<void>(self);
+        out << "functor";
+    }
+};
+
+template<> class wam_instruction<GET_LIST_A_UV2> : public wam_instruction_base {
+public:
+    inline wam_instruction(uint32_t ai, uint32_t xn1, uint32_t xn2) :
+      wam_instruction_base(&invoke, sizeof(*this), GET_LIST_A_UV2),
+      ai_(ai), xn1_(xn1), xn2_(xn2) {
+      init();
+    }
+
+    static inline void init() {
+	static bool init = [] {
+ 	    register_printer(&invoke, &print);
+	    return true; } ();
+	static_cast<void>(init);
+    }
+
+    inline uint32_t ai() const { return ai_; }
+    inline uint32_t xn1() const { return xn1_; }
+    inline uint32_t xn2() const { return xn2_; }
+
+    static void invoke(wam_interpreter &interp, wam_instruction_base *self)
+    {
+	auto self1 = reinterpret_cast<wam_instruction<GET_LIST_A_UV2> *>(self);
+        interp.get_list_a_uv2(self1->ai(), self1->xn1(), self1->xn2());
+    }
+
+    static void print(std::ostream &out, wam_interpreter &interp, wam_instruction_base *self)
+    {
+	auto self1 = reinterpret_cast<wam_instruction<GET_LIST_A_UV2> *>(self);
+        out << "get_list_uv2 a" << self1->ai() << ", x" << self1->xn1()
+	    << ", x" << self1->xn2();
+    }
+
+private:
+    uint32_t ai_, xn1_, xn2_;
+};
+
+template<> class wam_instruction<PUT_VALUE_X2> : public wam_instruction_base {
+public:
+    inline wam_instruction(uint32_t xn1, uint32_t ai1,
+			   uint32_t xn2, uint32_t ai2) :
+      wam_instruction_base(&invoke, sizeof(*this), PUT_VALUE_X2),
+      xn1_(xn1), ai1_(ai1), xn2_(xn2), ai2_(ai2) {
+      init();
+    }
+
+    static inline void init() {
+	static bool init = [] {
+ 	    register_printer(&invoke, &print);
+	    return true; } ();
+	static_cast<void>(init);
+    }
+
+    inline uint32_t xn1() const { return xn1_; }
+    inline uint32_t ai1() const { return ai1_; }
+    inline uint32_t xn2() const { return xn2_; }
+    inline uint32_t ai2() const { return ai2_; }
+
+    static void invoke(wam_interpreter &interp, wam_instruction_base *self)
+    {
+	auto self1 = reinterpret_cast<wam_instruction<PUT_VALUE_X2> *>(self);
+        interp.put_value_x2(self1->xn1(), self1->ai1(),
+			    self1->xn2(), self1->ai2());
+    }
+
+    static void print(std::ostream &out, wam_interpreter &interp, wam_instruction_base *self)
+    {
+	auto self1 = reinterpret_cast<wam_instruction<PUT_VALUE_X2> *>(self);
+        out << "put_value2 x" << self1->xn1() << ", a" << self1->ai1()
+	    << ", x" << self1->xn2() << ", a" << self1->ai2();
+    }
+
+private:
+    uint32_t xn1_, ai1_, xn2_, ai2_;
+};
+
 template<> class wam_instruction<COST> : public wam_instruction_term {
 public:
     inline wam_instruction(int64_t cost) :
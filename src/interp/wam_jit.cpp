@@ -0,0 +1,390 @@
+#include "wam_jit.hpp"
+#include <algorithm>
+
+#if WAM_JIT
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+namespace prologcoin { namespace interp {
+
+#if WAM_JIT
+
+namespace {
+
+//
+// The few x86-64 instructions we need. rbx holds the interpreter, r12
+// the X registers and r13 the A registers (all callee saved.)
+//
+class x64_emitter {
+public:
+    x64_emitter(std::vector<uint8_t> &buf) : buf_(buf) { }
+
+    inline size_t pos() const { return buf_.size(); }
+
+    void bytes(std::initializer_list<uint8_t> bs)
+    {
+	buf_.insert(buf_.end(), bs);
+    }
+
+    void imm32(uint32_t v)
+    {
+	for (size_t i = 0; i < 4; i++) {
+	    buf_.push_back(static_cast<uint8_t>(v >> (8*i)));
+	}
+    }
+
+    void imm64(uint64_t v)
+    {
+	for (size_t i = 0; i < 8; i++) {
+	    buf_.push_back(static_cast<uint8_t>(v >> (8*i)));
+	}
+    }
+
+    // mov rax, [r12 + 8*xn]
+    void load_x(uint32_t xn) { bytes({0x49, 0x8b, 0x84, 0x24}); imm32(8*xn); }
+    // mov [r12 + 8*xn], rax
+    void store_x(uint32_t xn) { bytes({0x49, 0x89, 0x84, 0x24}); imm32(8*xn); }
+    // mov rax, [r13 + 8*ai]
+    void load_a(uint32_t ai) { bytes({0x49, 0x8b, 0x85}); imm32(8*ai); }
+    // mov [r13 + 8*ai], rax
+    void store_a(uint32_t ai) { bytes({0x49, 0x89, 0x85}); imm32(8*ai); }
+    // mov rax, imm64
+    void load_imm(uint64_t v) { bytes({0x48, 0xb8}); imm64(v); }
+
+    // rax = step(rbx, instr, cont); returns the position of the
+    // displacement to cont (see patch)
+    size_t call_step(const void *fn, const void *instr)
+    {
+	bytes({0x48, 0x89, 0xdf});                                  // mov rdi, rbx
+	bytes({0x48, 0xbe}); imm64(reinterpret_cast<uint64_t>(instr)); // mov rsi, instr
+	bytes({0x48, 0x8d, 0x15}); imm32(0);                        // lea rdx, [rip + cont]
+	size_t cont = pos() - 4;
+	load_imm(reinterpret_cast<uint64_t>(fn));
+	bytes({0xff, 0xd0});                                        // call rax
+	bytes({0x48, 0x85, 0xc0});                                  // test rax, rax
+	return cont;
+    }
+
+    // jmp rax
+    void jmp_rax() { bytes({0xff, 0xe0}); }
+
+    // jz/jmp rel32; returns the position of rel32 (see patch)
+    size_t jz() { bytes({0x0f, 0x84}); imm32(0); return pos() - 4; }
+    size_t jmp() { bytes({0xe9}); imm32(0); return pos() - 4; }
+
+    void patch(size_t at, size_t target)
+    {
+	uint32_t rel = static_cast<uint32_t>(static_cast<int64_t>(target) - static_cast<int64_t>(at + 4));
+	for (size_t i = 0; i < 4; i++) {
+	    buf_[at + i] = static_cast<uint8_t>(rel >> (8*i));
+	}
+    }
+
+    // enter(interp, entry, xs, as)
+    void prologue()
+    {
+	bytes({0x53, 0x41, 0x54, 0x41, 0x55}); // push rbx, r12, r13
+	bytes({0x48, 0x89, 0xfb});             // mov rbx, rdi
+	bytes({0x49, 0x89, 0xd4});             // mov r12, rdx
+	bytes({0x49, 0x89, 0xcd});             // mov r13, rcx
+	bytes({0xff, 0xe6});                   // jmp rsi
+    }
+
+    void epilogue()
+    {
+	bytes({0x41, 0x5d, 0x41, 0x5c, 0x5b}); // pop r13, r12, rbx
+	bytes({0xc3});                         // ret
+    }
+
+private:
+    std::vector<uint8_t> &buf_;
+};
+
+}
+
+static_assert(sizeof(common::term) == sizeof(uint64_t),
+	      "The JIT moves terms as 64-bit words");
+
+wam_jit::wam_jit(wam_interpreter &interp)
+    : interp_(interp), cache_(), depth_(0)
+{
+    std::vector<uint8_t> buf;
+    x64_emitter(buf).prologue();
+    enter_ = reinterpret_cast<enter_fn>(alloc_exec(buf, enter_size_));
+}
+
+wam_jit::~wam_jit()
+{
+    for (auto &c : code_) {
+	free_exec(c.second.mem, c.second.size);
+    }
+    reclaim();
+    free_exec(reinterpret_cast<uint8_t *>(enter_), enter_size_);
+}
+
+bool wam_jit::is_supported()
+{
+    return true;
+}
+
+uint8_t * wam_jit::alloc_exec(const std::vector<uint8_t> &buf, size_t &size)
+{
+    size_t page = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+    size = (buf.size() + page - 1) / page * page;
+    void *mem = mmap(nullptr, size, PROT_READ | PROT_WRITE,
+		     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mem == MAP_FAILED) {
+	throw std::bad_alloc();
+    }
+    std::copy(buf.begin(), buf.end(), static_cast<uint8_t *>(mem));
+    if (mprotect(mem, size, PROT_READ | PROT_EXEC) != 0) {
+	munmap(mem, size);
+	throw std::bad_alloc();
+    }
+    return static_cast<uint8_t *>(mem);
+}
+
+void wam_jit::free_exec(uint8_t *mem, size_t size)
+{
+    munmap(mem, size);
+}
+
+bool wam_jit::compile(const qname &qn)
+{
+    if (!interp_.is_compiled(qn)) {
+	return false;
+    }
+    remove(qn);
+
+    std::vector<uint8_t> buf;
+    std::vector<std::pair<wam_instruction_base *, size_t> > entries;
+    emit_code(qn, buf, entries);
+
+    native_code c;
+    c.mem = alloc_exec(buf, c.size);
+    for (auto &e : entries) {
+	c.instrs.push_back(e.first);
+	entries_[e.first] = c.mem + e.second;
+    }
+    code_[qn] = c;
+    return true;
+}
+
+void wam_jit::emit_code(const qname &qn, std::vector<uint8_t> &buf,
+			std::vector<std::pair<wam_instruction_base *, size_t> > &entries)
+{
+    auto &meta = interp_.get_wam_predicate_meta_data(qn);
+    auto *first = interp_.to_code(meta.code_offset);
+    auto *last = reinterpret_cast<wam_instruction_base *>(
+	      reinterpret_cast<code_t *>(first) + meta.code_size);
+
+    x64_emitter em(buf);
+    std::unordered_map<wam_instruction_base *, size_t> labels;
+    std::vector<std::pair<size_t, wam_instruction_base *> > gotos;
+    std::vector<size_t> exits;
+
+    for (auto *instr = first; instr < last;) {
+	auto *next = interp_.next_instruction(instr);
+	labels[instr] = em.pos();
+	entries.push_back(std::make_pair(instr, em.pos()));
+
+	switch (instr->type()) {
+	case PUT_VALUE_X: {
+	    auto *i = reinterpret_cast<wam_instruction<PUT_VALUE_X> *>(instr);
+	    em.load_x(i->xn());
+	    em.store_a(i->ai());
+	    break;
+	    }
+	case PUT_VALUE_X2: {
+	    auto *i = reinterpret_cast<wam_instruction<PUT_VALUE_X2> *>(instr);
+	    em.load_x(i->xn1());
+	    em.store_a(i->ai1());
+	    em.load_x(i->xn2());
+	    em.store_a(i->ai2());
+	    break;
+	    }
+	case GET_VARIABLE_X: {
+	    auto *i = reinterpret_cast<wam_instruction<GET_VARIABLE_X> *>(instr);
+	    em.load_a(i->ai());
+	    em.store_x(i->xn());
+	    break;
+	    }
+	case PUT_CONSTANT: {
+	    auto *i = reinterpret_cast<wam_instruction<PUT_CONSTANT> *>(instr);
+	    em.load_imm(i->c().raw_value());
+	    em.store_a(static_cast<uint32_t>(i->ai()));
+	    break;
+	    }
+	case GOTO: {
+	    auto *i = reinterpret_cast<wam_instruction<GOTO> *>(instr);
+	    auto *target = i->p().has_wam_code() ? i->p().wam_code() : nullptr;
+	    if (target >= first && target < last) {
+		gotos.push_back(std::make_pair(em.jmp(), target));
+		break;
+	    }
+	    }
+	    // Fall through
+	default: {
+	    size_t cont = em.call_step(step_fn(instr->type()), instr);
+	    exits.push_back(em.jz());
+	    if (is_jump(instr->type())) {
+		em.jmp_rax();
+	    }
+	    em.patch(cont, em.pos());
+	    break;
+	    }
+	}
+	instr = next;
+    }
+
+    // A predicate ends with a jump, so we only get here from the
+    // handlers.
+    size_t exit = em.pos();
+    em.epilogue();
+
+    for (auto at : exits) {
+	em.patch(at, exit);
+    }
+    for (auto &g : gotos) {
+	em.patch(g.first, labels[g.second]);
+    }
+}
+
+void wam_jit::remove(const qname &qn)
+{
+    auto it = code_.find(qn);
+    if (it == code_.end()) {
+	return;
+    }
+    for (auto *instr : it->second.instrs) {
+	entries_.erase(instr);
+    }
+    std::fill(std::begin(cache_), std::end(cache_),
+	      std::make_pair(nullptr, nullptr));
+    removed_.push_back(it->second);
+    code_.erase(it);
+}
+
+void wam_jit::reclaim()
+{
+    // Native code is still running further up the C stack (a handler
+    // runs a nested query), so it's left for a later reclaim.
+    if (depth_ != 0) {
+	return;
+    }
+    for (auto &c : removed_) {
+	free_exec(c.mem, c.size);
+    }
+    removed_.clear();
+}
+
+void wam_jit::run()
+{
+    auto &p = interp_.p();
+    if (!p.has_wam_code() || interp_.is_top_fail()) {
+	return;
+    }
+    auto *entry = lookup(p.wam_code());
+    if (entry == nullptr) {
+	return;
+    }
+    depth_++;
+    enter_(&interp_, entry, interp_.register_xn_, interp_.args());
+    depth_--;
+    if (pending_) {
+	auto ex = pending_;
+	pending_ = nullptr;
+	std::rethrow_exception(ex);
+    }
+}
+
+//
+// Exceptions can't unwind through the native code, so they're kept
+// until we're back in run.
+//
+template<wam_instruction_type I, bool Jump>
+const uint8_t * wam_jit::step(wam_interpreter *interp,
+			      wam_instruction_base *instr,
+			      const uint8_t *cont)
+{
+    auto &p = interp->p();
+    try {
+	p.set_wam_code(instr);
+	wam_instruction<I>::invoke(*interp, instr);
+    } catch (...) {
+	interp->jit_->pending_ = std::current_exception();
+	return nullptr;
+    }
+    if (!Jump) {
+	return cont;
+    }
+    if (!p.has_wam_code() || interp->is_top_fail()) {
+	return nullptr;
+    }
+    auto *to = p.wam_code();
+    if (to == interp->next_instruction(instr)) {
+	return cont;
+    }
+    return interp->jit_->lookup(to);
+}
+
+// NEXT or JUMP (see WAM_INSTRUCTION_TYPES)
+#define WAM_JIT_JUMP_NEXT false
+#define WAM_JIT_JUMP_JUMP true
+
+bool wam_jit::is_jump(wam_instruction_type t)
+{
+#define WAM_JIT_IS_JUMP(I, K) WAM_JIT_JUMP_##K,
+    static const bool jumps[] = { WAM_INSTRUCTION_TYPES(WAM_JIT_IS_JUMP) };
+#undef WAM_JIT_IS_JUMP
+    return jumps[t];
+}
+
+const void * wam_jit::step_fn(wam_instruction_type t)
+{
+#define WAM_JIT_STEP(I, K) reinterpret_cast<const void *>(&step<I, WAM_JIT_JUMP_##K>),
+    static const void * const steps[] = { WAM_INSTRUCTION_TYPES(WAM_JIT_STEP) };
+#undef WAM_JIT_STEP
+    return steps[t];
+}
+
+#undef WAM_JIT_JUMP_JUMP
+#undef WAM_JIT_JUMP_NEXT
+
+#else
+
+wam_jit::wam_jit(wam_interpreter &interp)
+    : interp_(interp), enter_(nullptr), enter_size_(0), depth_(0)
+{
+}
+
+wam_jit::~wam_jit()
+{
+}
+
+bool wam_jit::is_supported()
+{
+    return false;
+}
+
+bool wam_jit::compile(const qname &)
+{
+    return false;
+}
+
+void wam_jit::remove(const qname &)
+{
+}
+
+void wam_jit::reclaim()
+{
+}
+
+void wam_jit::run()
+{
+}
+
+#endif
+
+}}
@@ -0,0 +1,129 @@
+#pragma once
+
+#ifndef _interp_wam_jit_hpp
+#define _interp_wam_jit_hpp
+
+#include <exception>
+#include <vector>
+#include "wam_interpreter.hpp"
+
+#if defined(__x86_64__) && defined(__unix__)
+#define WAM_JIT 1
+#else
+#define WAM_JIT 0
+#endif
+
+namespace prologcoin { namespace interp {
+
+//
+// A template JIT for compiled predicates (x86-64 only.) Every WAM
+// instruction of the predicate gets a piece of native code:
+//
+//   put_value x/a, get_variable x/a and put_constant are register
+//   moves, with the bases of the X and A registers pinned in r12 and
+//   r13. goto jumps within the native code.
+//
+//   Other instructions call their handler (see step.) The native
+//   code falls through if the handler went on to the next
+//   instruction, jumps to the native code of wherever it went
+//   otherwise, or returns to cont_wam if there's none.
+//
+// The code point (p) is only updated before a handler is called, as
+// nothing else looks at it.
+//
+// Native code of a removed predicate is kept until reclaim (as the
+// WAM code is), since it may still be running. Nothing is freed while
+// run is active (e.g. when a handler runs a nested query.)
+//
+class wam_jit {
+    using term = common::term;
+
+public:
+    wam_jit(wam_interpreter &interp);
+    ~wam_jit();
+
+    static bool is_supported();
+
+    // Returns false if there's no WAM code (or no JIT)
+    bool compile(const qname &qn);
+    void remove(const qname &qn);
+
+    // Free the native code of removed predicates. Must only be called
+    // when no code is running.
+    void reclaim();
+
+    inline bool has_code() const
+    {
+	return !entries_.empty();
+    }
+
+    inline bool is_compiled(const qname &qn) const
+    {
+	return code_.count(qn) != 0;
+    }
+
+    // Run native code if the code point has any
+    void run();
+
+private:
+    typedef void (*enter_fn)(wam_interpreter *interp, const uint8_t *entry,
+			     term *xs, term *as);
+
+    struct native_code {
+	uint8_t *mem;
+	size_t size;
+	std::vector<wam_instruction_base *> instrs;
+    };
+
+    // Runs the handler of instr. Returns the native code to continue
+    // with (cont if it's the next instruction), or null to return.
+    template<wam_instruction_type I, bool Jump>
+    static const uint8_t * step(wam_interpreter *interp,
+				wam_instruction_base *instr,
+				const uint8_t *cont);
+
+    static bool is_jump(wam_instruction_type t);
+    static const void * step_fn(wam_instruction_type t);
+
+    // The native code of a WAM instruction (if any)
+    inline const uint8_t * lookup(wam_instruction_base *instr)
+    {
+	auto &e = cache_[(reinterpret_cast<uintptr_t>(instr) * 0x9e3779b97f4a7c15ULL) >> (64 - CACHE_BITS)];
+	if (e.first == instr) {
+	    return e.second;
+	}
+	auto it = entries_.find(instr);
+	if (it == entries_.end()) {
+	    return nullptr;
+	}
+	e = *it;
+	return e.second;
+    }
+
+    void emit_code(const qname &qn, std::vector<uint8_t> &buf,
+		   std::vector<std::pair<wam_instruction_base *, size_t> > &entries);
+
+    static uint8_t * alloc_exec(const std::vector<uint8_t> &buf, size_t &size);
+    static void free_exec(uint8_t *mem, size_t size);
+
+    static const size_t CACHE_BITS = 10;
+
+    wam_interpreter &interp_;
+    enter_fn enter_;
+    size_t enter_size_;
+    std::unordered_map<wam_instruction_base *, const uint8_t *> entries_;
+    std::pair<wam_instruction_base *, const uint8_t *> cache_[1 << CACHE_BITS];
+    std::unordered_map<qname, native_code> code_;
+    std::vector<native_code> removed_;
+
+    // An exception thrown by a handler, to be rethrown once we're out
+    // of the native code.
+    std::exception_ptr pending_;
+
+    // How many runs are active (on the C stack)
+    size_t depth_;
+};
+
+}}
+
+#endif
@@ -1,6 +1,7 @@
 #include <boost/filesystem.hpp>
 #include <boost/algorithm/string/predicate.hpp>
 #include "../node/self_node.hpp"
+#include "../interp/interpreter.hpp"
 #include "interactive_terminal.hpp"
 
 using namespace prologcoin::node;
@@ -17,6 +18,7 @@ static void help()
     std::cout << "  --interactive (non-interactive currently unavailable)" << std::endl;
     std::cout << "  --port <number> (start service on this port, default is " << self_node::DEFAULT_PORT << ")" << std::endl;
     std::cout << "  --name <string> (set friendly name on node, default is noname)" << std::endl;
+    std::cout << "  --codecache <file> (compiled standard library, saved on first use)" << std::endl;
     // std::cout << "  --homedir <dir> (location of home directory, default userdir/" << program_name << ")" << std::endl;
 
     std::cout << std::endl;
@@ -110,6 +112,11 @@ int main(int argc, char *argv[])
     if (!name_opt.empty()) {
 	name = name_opt;
     }
+
+    std::string codecache_opt = get_option(args, "--codecache");
+    if (!codecache_opt.empty()) {
+	prologcoin::interp::interpreter::set_default_code_cache(codecache_opt);
+    }
     // std::cout << "Dir     : " << home_dir << std::endl;
 
     start();
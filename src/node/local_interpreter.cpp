@@ -444,6 +444,53 @@ bool me_builtins::funds_1(interpreter_base &interp0, size_t arity, term args[] )
 }
 
 
+static size_t * quota_resource(interpreter_base::quotas &q, term resource)
+{
+    if (resource == con_cell("heap",0)) return &q.heap_cells;
+    if (resource == con_cell("trail",0)) return &q.trail_entries;
+    if (resource == con_cell("stack",0)) return &q.stack_words;
+    if (resource == con_cell("files",0)) return &q.open_files;
+    return nullptr;
+}
+
+bool me_builtins::quota_2(interpreter_base &interp0, size_t arity, term args[] )
+{
+    auto &interp = to_local(interp0);
+    auto q = interp.get_quotas();
+    term resource = interp0.deref(args[0]);
+    size_t *limit = quota_resource(q, resource);
+    if (limit == nullptr) {
+	interp.abort(interpreter_exception_wrong_arg_type("quota/2: First argument must be one of heap, trail, stack or files; was " + interp.to_string(resource)));
+    }
+    term arg = interp0.deref(args[1]);
+    if (arg.tag() == tag_t::INT) {
+	interp.root_check("quota", arity);
+	auto val = reinterpret_cast<int_cell &>(arg).value();
+	if (val < 0) {
+	    return false;
+	}
+	*limit = static_cast<size_t>(val);
+	interp.set_quotas(q);
+	return true;
+    } else if (arg.tag() == tag_t::REF) {
+	return interp.unify(arg, int_cell(static_cast<int64_t>(*limit)));
+    } else {
+	return false;
+    }
+}
+
+bool me_builtins::usage_2(interpreter_base &interp0, size_t arity, term args[] )
+{
+    auto &interp = to_local(interp0);
+    auto u = interp.get_usage();
+    term resource = interp0.deref(args[0]);
+    size_t *used = quota_resource(u, resource);
+    if (used == nullptr) {
+	interp.abort(interpreter_exception_wrong_arg_type("usage/2: First argument must be one of heap, trail, stack or files; was " + interp.to_string(resource)));
+    }
+    return interp.unify(args[1], int_cell(static_cast<int64_t>(*used)));
+}
+
 bool me_builtins::commit(local_interpreter &interp, term_serializer::buffer_t &buf, term t, bool naming)
 {
     global::global &g = interp.self().global();
@@ -521,19 +568,28 @@ void local_interpreter::root_check(const char *name, size_t arity)
 void local_interpreter::ensure_initialized()
 {
     if (!initialized_) {
-	initialized_ = true;
+	initialize(&self().session_template());
+    }
+}
+
+void local_interpreter::initialize(const local_interpreter *tmpl)
+{
+    initialized_ = true;
+    if (tmpl != nullptr) {
+	fork_program(*tmpl);
+    } else {
 	setup_standard_lib();
+    }
 
-	// TODO: Only do this for authorized clients.
-	load_builtins_file_io();
+    // TODO: Only do this for authorized clients.
+    load_builtins_file_io();
 
-	ec::builtins::load(*this);
-	common::con_cell top(EMPTY_LIST);
-	ec::builtins::load(*this, &top);
-        coin::builtins::load(*this);
+    ec::builtins::load(*this);
+    common::con_cell top(EMPTY_LIST);
+    ec::builtins::load(*this, &top);
+    coin::builtins::load(*this);
 
-	setup_local_builtins();
-    }
+    setup_local_builtins();
 }
 
 void local_interpreter::setup_local_builtins()
@@ -565,6 +621,10 @@ void local_interpreter::setup_local_builtins()
     load_builtin(ME, functor("new_funds_per_second",1), &me_builtins::new_funds_per_second_1);
     load_builtin(ME, con_cell("funds",1), &me_builtins::funds_1);
 
+    // Resource quotas
+    load_builtin(ME, con_cell("quota",2), &me_builtins::quota_2);
+    load_builtin(ME, con_cell("usage",2), &me_builtins::usage_2);
+
     // Commit
     load_builtin(ME, con_cell("commit", 1), &me_builtins::commit_2);    
     load_builtin(ME, con_cell("commit", 2), &me_builtins::commit_2);
@@ -53,6 +53,10 @@ public:
     static bool new_funds_per_second_1(interpreter_base &interp, size_t arity, term args[]);
     static bool funds_1(interpreter_base &interp, size_t arity, term args[]);
 
+    // Resource quotas
+    static bool quota_2(interpreter_base &interp, size_t arity, term args[]);
+    static bool usage_2(interpreter_base &interp, size_t arity, term args[]);
+
     // Commit to global state
     static bool commit(local_interpreter &interp, buffer_t &buf, term t, bool naming);
     static bool commit_2(interpreter_base &interp, size_t arity, term args[]);
@@ -97,6 +101,11 @@ public:
 
     void ensure_initialized();
 
+    // Load the standard library and builtins. With a template the
+    // program is forked from it (sharing its heap) instead of being
+    // set up from scratch.
+    void initialize(const local_interpreter *tmpl);
+
     bool reset();
     void local_reset();
 
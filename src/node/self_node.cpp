@@ -25,6 +25,7 @@ self_node::self_node(unsigned short port)
       timer_(ioservice_),
       comment_(env_.EMPTY_LIST),
       recent_in_connection_(nullptr),
+      session_template_(nullptr),
       preferred_num_standard_out_connections_(DEFAULT_NUM_STANDARD_OUT_CONNECTIONS),
       preferred_num_verifier_connections_(DEFAULT_NUM_VERIFIER_CONNECTIONS),
       num_standard_out_connections_(0),
@@ -41,6 +42,11 @@ self_node::self_node(unsigned short port)
     id_ = random::next();
 }
 
+self_node::~self_node()
+{
+    delete session_template_;
+}
+
 void self_node::start()
 {
     stopped_ = false;
@@ -373,6 +379,17 @@ out_connection * self_node::new_verifier_connection(const ip_service &ip)
     return out;
 }
 
+const local_interpreter & self_node::session_template()
+{
+    boost::lock_guard<boost::recursive_mutex> guard(lock_);
+
+    if (session_template_ == nullptr) {
+	session_template_ = new in_session_state(this, nullptr, false);
+	session_template_->local_interp().initialize(nullptr);
+    }
+    return session_template_->local_interp();
+}
+
 void self_node::kill_in_session(in_session_state *sess)
 {
     boost::lock_guard<boost::recursive_mutex> guard(lock_);
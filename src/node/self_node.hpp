@@ -23,6 +23,7 @@
 namespace prologcoin { namespace node {
 
 class task_execute_query;
+class local_interpreter;
 
 class self_node_exception : public std::runtime_error {
 public:
@@ -74,6 +75,7 @@ public:
     static const uint64_t DEFAULT_NEW_FUNDS_PER_SECOND = 100;
 
     self_node(unsigned short port = DEFAULT_PORT);
+    ~self_node();
 
     inline term_env & env() { return env_; }
 
@@ -205,6 +207,11 @@ public:
     void kill_in_session(in_session_state *sess);
     void in_session_connect(in_session_state *sess, in_connection *conn);
 
+    // A fully initialized interpreter (standard library and builtins)
+    // that new sessions fork their program from. It is never executed,
+    // so its heap blocks can be shared read-only by every session.
+    const local_interpreter & session_template();
+
     out_connection * new_standard_out_connection(const ip_service &ip);
     out_connection * new_verifier_connection(const ip_service &ip);
 
@@ -297,6 +304,7 @@ private:
 
     boost::recursive_mutex lock_;
     std::unordered_map<std::string, in_session_state *> in_states_;
+    in_session_state *session_template_;
     std::vector<connection *> closed_;
 
     address_book address_book_;